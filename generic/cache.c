@@ -0,0 +1,1384 @@
+/*
+ * cache.c --
+ *
+ * Implementation of the part of the TclCurl extension that keeps the
+ * responses to GET requests in a directory, '-cachedir'.
+ *
+ * Every URL has two files in the directory, named after a hash of the
+ * URL: '.body' with the body of the response and '.meta' with a dict
+ * with the URL, the validators, when it expires and the headers.
+ * Fresh responses are served from the files without a transfer, stale
+ * ones are revalidated with 'If-None-Match' and 'If-Modified-Since'.
+ *
+ * A handle can also use a memory cache, '-memcache', created with
+ * 'curl::memcache create' and shared by all the handles in the process.
+ * It only keeps fresh responses, evicting the least recently used ones
+ * when it is full, and is checked before the directory.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#include "cache.h"
+
+static void curlCacheClear(struct curlCacheData *cachePtr);
+static Tcl_Obj *curlCacheReadEntry(const char *path,Tcl_Obj *urlName);
+static int curlCacheWriteEntry(struct curlCacheData *cachePtr,Tcl_Obj *entry);
+static int curlCacheDeliver(struct curlObjData *curlData,const char *path);
+static void curlCacheRemove(struct curlCacheData *cachePtr,const char *suffix);
+static int curlCacheRename(struct curlCacheData *cachePtr,const char *from,
+        const char *suffix);
+static Tcl_WideInt curlCacheNow(void);
+static Tcl_Obj *curlCacheGet(Tcl_Obj *entry,const char *key);
+static struct curlCacheData *curlCacheAlloc(struct curlObjData *curlData);
+static void curlMemCacheKey(struct curlObjData *curlData,const char *vary,
+        Tcl_DString *keyPtr);
+static struct curlMemEntry *curlMemCacheLookup(struct curlMemCache *memCachePtr,
+        struct curlObjData *curlData);
+static void curlMemCacheStore(struct curlMemCache *memCachePtr,
+        struct curlObjData *curlData,Tcl_WideInt expires);
+static void curlMemCacheUnlink(struct curlMemCache *memCachePtr,
+        struct curlMemEntry *entryPtr);
+static void curlMemCacheEntryRelease(struct curlMemCache *memCachePtr,
+        struct curlMemEntry *entryPtr);
+
+/*
+ * The memory caches by name, for any thread to find them.
+ */
+TCL_DECLARE_MUTEX(memCacheLock)
+static Tcl_HashTable memCachesByName;
+static int memCachesInitialized=0;
+static int memCacheCounter=0;
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Tclcurl_CacheInit --
+ *
+ *  This procedure creates the 'curl::memcache' command.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Tclcurl_CacheInit (Tcl_Interp *interp) {
+
+    Tcl_CreateObjCommand (interp,"::curl::memcache",curlMemCacheObjCmd,
+            (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlCacheAlloc --
+ *
+ *  Returns the cache block of a handle, creating it the first time.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static struct curlCacheData *
+curlCacheAlloc(struct curlObjData *curlData) {
+    struct curlCacheData   *cachePtr=curlData->cache;
+
+    if (cachePtr==NULL) {
+        cachePtr=(struct curlCacheData *)Tcl_Alloc(sizeof(struct curlCacheData));
+        memset(cachePtr,0,sizeof(struct curlCacheData));
+        curlData->cache=cachePtr;
+    }
+    return cachePtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlCacheSetDir --
+ *
+ *  Sets the directory of the cache of a handle, '-cachedir', an empty
+ *  string stops using it. The directory is created if it isn't there.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlCacheSetDir(Tcl_Interp *interp,struct curlObjData *curlData,Tcl_Obj *dirObj) {
+    struct curlCacheData   *cachePtr=curlData->cache;
+    Tcl_StatBuf            *statPtr;
+    int                     exists;
+
+    if (*Tcl_GetString(dirObj)=='\0') {
+        if (cachePtr!=NULL) {
+            curlSetObj(&cachePtr->dir,NULL);
+        }
+        return TCL_OK;
+    }
+
+    statPtr=Tcl_AllocStatBuf();
+    exists=(Tcl_FSStat(dirObj,statPtr)==0);
+    Tcl_Free((char *)statPtr);
+    if (!exists&&(Tcl_FSCreateDirectory(dirObj)!=TCL_OK)) {
+        Tcl_SetObjResult(interp,Tcl_ObjPrintf(
+                "couldn't create cache directory \"%s\": %s",
+                Tcl_GetString(dirObj),Tcl_PosixError(interp)));
+        return TCL_ERROR;
+    }
+
+    cachePtr=curlCacheAlloc(curlData);
+    curlSetObj(&cachePtr->dir,dirObj);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlCacheSetMem --
+ *
+ *  Sets the memory cache of a handle, '-memcache', an empty string
+ *  stops using it.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlCacheSetMem(Tcl_Interp *interp,struct curlObjData *curlData,Tcl_Obj *nameObj) {
+    struct curlCacheData   *cachePtr;
+    struct curlMemCache    *memCachePtr=NULL;
+
+    if (*Tcl_GetString(nameObj)!='\0') {
+        memCachePtr=curlMemCacheGet(interp,nameObj);
+        if (memCachePtr==NULL) {
+            return TCL_ERROR;
+        }
+    } else if (curlData->cache==NULL) {
+        return TCL_OK;
+    }
+
+    cachePtr=curlCacheAlloc(curlData);
+    if (cachePtr->memCache!=NULL) {
+        curlMemCacheRelease(cachePtr->memCache);
+    }
+    cachePtr->memCache=memCachePtr;
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlCachePrepare --
+ *
+ *  Called before a transfer of a handle with a cache. If the cache has
+ *  a fresh copy of the response it says so, otherwise it sets the
+ *  handle up so the response goes through the cache, with the headers
+ *  to revalidate the copy there is, if there is one.
+ *
+ * Results:
+ *  1 if the response can be served from the cache, 0 if there has to
+ *  be a transfer.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlCachePrepare(Tcl_Interp *interp,struct curlObjData *curlData) {
+    struct curlCacheData   *cachePtr=curlData->cache;
+    struct curl_slist      *slistPtr;
+    Tcl_Obj                *valueObj;
+    Tcl_DString             header;
+    Tcl_WideUInt            hash=(Tcl_WideUInt)14695981039346656037ULL;
+    Tcl_WideInt             expires=0;
+    const char             *url;
+    const unsigned char    *bytes;
+    char                    key[24];
+    int                     length,i;
+
+    cachePtr->status=CACHE_NONE;
+    if ((cachePtr->dir==NULL)&&(cachePtr->memCache==NULL)) {
+        return 0;
+    }
+    cachePtr->status=CACHE_BYPASS;
+    if ((curlData->methodFlags!=0)||(curlData->urlName==NULL)) {
+        return 0;
+    }
+    /* Credentials, cookies or a certificate may get a response of their own. */
+    if ((curlData->identityFlags&~IDENTITY_USERAGENT)!=0) {
+        return 0;
+    }
+    url=Tcl_GetStringFromObj(curlData->urlName,&length);
+    if (!Tcl_StringCaseMatch(url,"http://*",1)
+            &&!Tcl_StringCaseMatch(url,"https://*",1)) {
+        return 0;
+    }
+
+    Tcl_DStringInit(&cachePtr->path);
+    Tcl_DStringInit(&cachePtr->headers);
+    Tcl_DStringInit(&cachePtr->bodyName);
+
+    if (cachePtr->memCache!=NULL) {
+        cachePtr->memEntry=curlMemCacheLookup(cachePtr->memCache,curlData);
+        if (cachePtr->memEntry!=NULL) {
+            cachePtr->status=CACHE_HIT;
+            cachePtr->hits++;
+            return 1;
+        }
+    }
+
+    if (cachePtr->dir!=NULL) {
+        /* FNV-1a, the URL is in the entry too, in case two of them collide. */
+        for (bytes=(const unsigned char *)url,i=0;i<length;i++) {
+            hash^=bytes[i];
+            hash*=(Tcl_WideUInt)1099511628211ULL;
+        }
+        sprintf(key,"%016" TCL_LL_MODIFIER "x",hash);
+
+        Tcl_DStringAppend(&cachePtr->path,Tcl_GetString(cachePtr->dir),-1);
+        Tcl_DStringAppend(&cachePtr->path,"/",1);
+        Tcl_DStringAppend(&cachePtr->path,key,-1);
+
+        cachePtr->entry=curlCacheReadEntry(Tcl_DStringValue(&cachePtr->path),
+                curlData->urlName);
+    }
+    if (cachePtr->entry!=NULL) {
+        if ((valueObj=curlCacheGet(cachePtr->entry,"expires"))!=NULL) {
+            Tcl_GetWideIntFromObj(NULL,valueObj,&expires);
+        }
+        if (curlCacheNow()<expires) {
+            cachePtr->status=CACHE_HIT;
+            cachePtr->hits++;
+            return 1;
+        }
+
+        /* The user's headers, plus the ones to revalidate our copy. */
+        for (slistPtr=curlData->headerList;slistPtr!=NULL;slistPtr=slistPtr->next) {
+            cachePtr->headerList=curl_slist_append(cachePtr->headerList,slistPtr->data);
+        }
+        Tcl_DStringInit(&header);
+        if (((valueObj=curlCacheGet(cachePtr->entry,"etag"))!=NULL)
+                &&(*Tcl_GetString(valueObj))) {
+            Tcl_DStringAppend(&header,"If-None-Match: ",-1);
+            Tcl_DStringAppend(&header,Tcl_GetString(valueObj),-1);
+            cachePtr->headerList=curl_slist_append(cachePtr->headerList,
+                    Tcl_DStringValue(&header));
+        }
+        if (((valueObj=curlCacheGet(cachePtr->entry,"lastmodified"))!=NULL)
+                &&(*Tcl_GetString(valueObj))) {
+            Tcl_DStringSetLength(&header,0);
+            Tcl_DStringAppend(&header,"If-Modified-Since: ",-1);
+            Tcl_DStringAppend(&header,Tcl_GetString(valueObj),-1);
+            cachePtr->headerList=curl_slist_append(cachePtr->headerList,
+                    Tcl_DStringValue(&header));
+        }
+        Tcl_DStringFree(&header);
+        curl_easy_setopt(curlData->curl,CURLOPT_HTTPHEADER,cachePtr->headerList);
+    }
+
+    cachePtr->active=1;
+    cachePtr->responseCode=0;
+    cachePtr->maxAge=-1;
+    cachePtr->expires=-1;
+    cachePtr->noStore=0;
+    cachePtr->noCache=0;
+    cachePtr->failed=0;
+    cachePtr->memLength=0;
+    cachePtr->memFailed=0;
+    curl_easy_setopt(curlData->curl,CURLOPT_WRITEFUNCTION,curlCacheWrite);
+    curl_easy_setopt(curlData->curl,CURLOPT_WRITEDATA,curlData);
+    curl_easy_setopt(curlData->curl,CURLOPT_HEADERFUNCTION,curlCacheHeader);
+    curl_easy_setopt(curlData->curl,CURLOPT_HEADERDATA,curlData);
+
+    return 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlCacheServe --
+ *
+ *  Gives the headers and the body of a fresh copy to the handle, as if
+ *  they had come from a transfer.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlCacheServe(struct curlObjData *curlData) {
+    struct curlCacheData   *cachePtr=curlData->cache;
+    struct curlMemEntry    *entryPtr=cachePtr->memEntry;
+    Tcl_Obj                *headersObj;
+    char                   *headers;
+    int                     length;
+
+    if (entryPtr!=NULL) {
+        curlWriteResponse(curlData,entryPtr->headers,entryPtr->headersLength,
+                entryPtr->body,entryPtr->bodyLength);
+    } else {
+        if ((headersObj=curlCacheGet(cachePtr->entry,"headers"))!=NULL) {
+            headers=Tcl_GetStringFromObj(headersObj,&length);
+            curlWriteResponse(curlData,headers,length,NULL,0);
+        }
+        curlCacheDeliver(curlData,Tcl_DStringValue(&cachePtr->path));
+    }
+    curlCacheClear(cachePtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlCacheHeader --
+ *
+ *  The header function of transfers through the cache, it picks the
+ *  validators and the expiration time from the headers before giving
+ *  them to the handle.
+ *
+ *----------------------------------------------------------------------
+ */
+
+size_t
+curlCacheHeader(char *ptr,size_t size,size_t nmemb,void *curlDataPtr) {
+    struct curlObjData     *curlData=(struct curlObjData *)curlDataPtr;
+    struct curlCacheData   *cachePtr=curlData->cache;
+    size_t                  length=size*nmemb;
+    size_t                  nameLength,i;
+    Tcl_DString             value;
+    char                   *valuePtr,*maxAge;
+
+    if ((length>5)&&(!strncmp(ptr,"HTTP/",5))) {
+        /* A new response, after a redirection or a '100 Continue'. */
+        Tcl_DStringSetLength(&cachePtr->headers,0);
+        cachePtr->responseCode=0;
+        for (i=5;(i<length)&&(ptr[i]!=' ');i++) {
+        }
+        for (;(i<length)&&(ptr[i]==' ');i++) {
+        }
+        for (;(i<length)&&(ptr[i]>='0')&&(ptr[i]<='9');i++) {
+            cachePtr->responseCode=cachePtr->responseCode*10+(ptr[i]-'0');
+        }
+        curlSetObj(&cachePtr->etag,NULL);
+        curlSetObj(&cachePtr->lastModified,NULL);
+        curlSetObj(&cachePtr->vary,NULL);
+        cachePtr->maxAge=-1;
+        cachePtr->expires=-1;
+        cachePtr->noStore=0;
+        cachePtr->noCache=0;
+    }
+    Tcl_DStringAppend(&cachePtr->headers,ptr,(int)length);
+
+    for (nameLength=0;(nameLength<length)&&(ptr[nameLength]!=':');nameLength++) {
+    }
+    if (nameLength<length) {
+        Tcl_DStringInit(&value);
+        for (i=nameLength+1;(i<length)&&((ptr[i]==' ')||(ptr[i]=='\t'));i++) {
+        }
+        Tcl_DStringAppend(&value,ptr+i,(int)(length-i));
+        while ((Tcl_DStringLength(&value)>0)&&((Tcl_DStringValue(&value)
+                [Tcl_DStringLength(&value)-1]=='\n')||(Tcl_DStringValue(&value)
+                [Tcl_DStringLength(&value)-1]=='\r'))) {
+            Tcl_DStringSetLength(&value,Tcl_DStringLength(&value)-1);
+        }
+        valuePtr=Tcl_DStringValue(&value);
+
+        if ((nameLength==4)&&(!Tcl_UtfNcasecmp(ptr,"etag",4))) {
+            curlSetObj(&cachePtr->etag,Tcl_NewStringObj(valuePtr,-1));
+        } else if ((nameLength==13)&&(!Tcl_UtfNcasecmp(ptr,"last-modified",13))) {
+            curlSetObj(&cachePtr->lastModified,Tcl_NewStringObj(valuePtr,-1));
+        } else if ((nameLength==4)&&(!Tcl_UtfNcasecmp(ptr,"vary",4))) {
+            curlSetObj(&cachePtr->vary,Tcl_NewStringObj(valuePtr,-1));
+        } else if ((nameLength==7)&&(!Tcl_UtfNcasecmp(ptr,"expires",7))) {
+            cachePtr->expires=(Tcl_WideInt)curl_getdate(valuePtr,NULL);
+        } else if ((nameLength==13)&&(!Tcl_UtfNcasecmp(ptr,"cache-control",13))) {
+            Tcl_UtfToLower(valuePtr);
+            if (strstr(valuePtr,"no-store")!=NULL) {
+                cachePtr->noStore=1;
+            }
+            if (strstr(valuePtr,"no-cache")!=NULL) {
+                cachePtr->noCache=1;
+            }
+            if ((maxAge=strstr(valuePtr,"max-age="))!=NULL) {
+                cachePtr->maxAge=0;
+                for (maxAge+=8;(*maxAge>='0')&&(*maxAge<='9');maxAge++) {
+                    cachePtr->maxAge=cachePtr->maxAge*10+(*maxAge-'0');
+                }
+            }
+        }
+        Tcl_DStringFree(&value);
+    }
+
+    return curlWriteHeader(curlData,ptr,length);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlCacheWrite --
+ *
+ *  The write function of transfers through the cache, the body of a
+ *  '200' response is written to a temporary file before giving it to
+ *  the handle.
+ *
+ *----------------------------------------------------------------------
+ */
+
+size_t
+curlCacheWrite(char *ptr,size_t size,size_t nmemb,void *curlDataPtr) {
+    struct curlObjData     *curlData=(struct curlObjData *)curlDataPtr;
+    struct curlCacheData   *cachePtr=curlData->cache;
+    size_t                  length=size*nmemb;
+    Tcl_Time                now;
+    char                    suffix[64];
+
+    if ((cachePtr->responseCode==200)&&!cachePtr->noStore&&!cachePtr->failed
+            &&(Tcl_DStringLength(&cachePtr->path)>0)) {
+        if (cachePtr->bodyFile==NULL) {
+            Tcl_GetTime(&now);
+            sprintf(suffix,".%p.%ld%06ld.tmp",(void *)curlData,
+                    (long)now.sec,(long)now.usec);
+            Tcl_DStringSetLength(&cachePtr->bodyName,0);
+            Tcl_DStringAppend(&cachePtr->bodyName,
+                    Tcl_DStringValue(&cachePtr->path),-1);
+            Tcl_DStringAppend(&cachePtr->bodyName,suffix,-1);
+            cachePtr->bodyFile=fopen(Tcl_DStringValue(&cachePtr->bodyName),"wb");
+        }
+        if ((cachePtr->bodyFile==NULL)
+                ||(fwrite(ptr,1,length,cachePtr->bodyFile)!=length)) {
+            cachePtr->failed=1;
+        }
+    }
+    if ((cachePtr->responseCode==200)&&!cachePtr->noStore&&!cachePtr->memFailed
+            &&(cachePtr->memCache!=NULL)) {
+        if (cachePtr->memLength+length>(size_t)cachePtr->memCache->maxBytes) {
+            /* It wouldn't fit anyway. */
+            cachePtr->memFailed=1;
+        } else {
+            if (cachePtr->memLength+length>cachePtr->memSize) {
+                cachePtr->memSize=(cachePtr->memLength+length)*2;
+                cachePtr->memBody=Tcl_Realloc(cachePtr->memBody,cachePtr->memSize);
+            }
+            memcpy(cachePtr->memBody+cachePtr->memLength,ptr,length);
+            cachePtr->memLength+=length;
+        }
+    }
+
+    return curlWriteBody(curlData,ptr,length);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlCacheFinish --
+ *
+ *  Called after a transfer through the cache. It gives the handle its
+ *  functions back and, depending on the response, gives the handle the
+ *  body of the copy we have, keeps the new one or leaves it alone.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlCacheFinish(struct curlObjData *curlData,CURLcode exitCode) {
+    struct curlCacheData   *cachePtr=curlData->cache;
+    Tcl_Obj                *entry;
+    Tcl_WideInt             now=curlCacheNow();
+    Tcl_WideInt             expires=0;
+    int                     stored=0;
+
+    if (!cachePtr->active) {
+        return;
+    }
+    cachePtr->active=0;
+    curlSetWriter(curlData,curlData->writeFunction,curlData->writeData);
+    curlSetHeaderWriter(curlData,curlData->headerFunction,curlData->headerData);
+    if (cachePtr->headerList!=NULL) {
+        curl_easy_setopt(curlData->curl,CURLOPT_HTTPHEADER,curlData->headerList);
+    }
+    if (cachePtr->bodyFile!=NULL) {
+        if (fclose(cachePtr->bodyFile)) {
+            cachePtr->failed=1;
+        }
+        cachePtr->bodyFile=NULL;
+    }
+
+    if (!cachePtr->noCache) {
+        if (cachePtr->maxAge>=0) {
+            expires=now+cachePtr->maxAge;
+        } else if (cachePtr->expires>0) {
+            expires=cachePtr->expires;
+        }
+    }
+
+    if ((exitCode==CURLE_OK)&&(cachePtr->responseCode==304)
+            &&(cachePtr->entry!=NULL)) {
+        /* Our copy is still good, it gets the new expiration time, unless
+           it varies, then it is only good for this request. */
+        if (cachePtr->vary!=NULL) {
+            expires=0;
+        }
+        cachePtr->status=CACHE_REVALIDATED;
+        cachePtr->revalidated++;
+        curlCacheDeliver(curlData,Tcl_DStringValue(&cachePtr->path));
+        entry=Tcl_DuplicateObj(cachePtr->entry);
+        Tcl_IncrRefCount(entry);
+        Tcl_DictObjPut(NULL,entry,Tcl_NewStringObj("expires",-1),
+                Tcl_NewWideIntObj(expires));
+        if (cachePtr->etag!=NULL) {
+            Tcl_DictObjPut(NULL,entry,Tcl_NewStringObj("etag",-1),cachePtr->etag);
+        }
+        if (cachePtr->lastModified!=NULL) {
+            Tcl_DictObjPut(NULL,entry,Tcl_NewStringObj("lastmodified",-1),
+                    cachePtr->lastModified);
+        }
+        curlCacheWriteEntry(cachePtr,entry);
+        Tcl_DecrRefCount(entry);
+        curlCacheClear(cachePtr);
+        return;
+    }
+
+    cachePtr->status=CACHE_MISS;
+    cachePtr->misses++;
+    if ((exitCode==CURLE_OK)&&(cachePtr->responseCode==200)
+            &&(cachePtr->memCache!=NULL)&&!cachePtr->noStore
+            &&!cachePtr->memFailed&&(expires>now)) {
+        curlMemCacheStore(cachePtr->memCache,curlData,expires);
+    }
+    if ((exitCode==CURLE_OK)&&(cachePtr->responseCode==200)
+            &&(Tcl_DStringLength(&cachePtr->path)>0)) {
+        if (cachePtr->noStore||(cachePtr->vary!=NULL)) {
+            /* The entries are by URL, one that varies can't be kept. */
+            curlCacheRemove(cachePtr,".meta");
+            curlCacheRemove(cachePtr,".body");
+        } else if (!cachePtr->failed&&((expires>now)||(cachePtr->etag!=NULL)
+                ||(cachePtr->lastModified!=NULL))) {
+            if (Tcl_DStringLength(&cachePtr->bodyName)==0) {
+                /* An empty body, there is no file yet. */
+                Tcl_DStringAppend(&cachePtr->bodyName,
+                        Tcl_DStringValue(&cachePtr->path),-1);
+                Tcl_DStringAppend(&cachePtr->bodyName,".empty.tmp",-1);
+                cachePtr->bodyFile=fopen(Tcl_DStringValue(&cachePtr->bodyName),"wb");
+                if (cachePtr->bodyFile!=NULL) {
+                    fclose(cachePtr->bodyFile);
+                    cachePtr->bodyFile=NULL;
+                }
+            }
+            if (curlCacheRename(cachePtr,Tcl_DStringValue(&cachePtr->bodyName),
+                    ".body")==0) {
+                entry=Tcl_NewDictObj();
+                Tcl_IncrRefCount(entry);
+                Tcl_DictObjPut(NULL,entry,Tcl_NewStringObj("url",-1),
+                        curlData->urlName);
+                Tcl_DictObjPut(NULL,entry,Tcl_NewStringObj("etag",-1),
+                        (cachePtr->etag!=NULL)?cachePtr->etag:Tcl_NewObj());
+                Tcl_DictObjPut(NULL,entry,Tcl_NewStringObj("lastmodified",-1),
+                        (cachePtr->lastModified!=NULL)?cachePtr->lastModified:Tcl_NewObj());
+                Tcl_DictObjPut(NULL,entry,Tcl_NewStringObj("expires",-1),
+                        Tcl_NewWideIntObj(expires));
+                Tcl_DictObjPut(NULL,entry,Tcl_NewStringObj("headers",-1),
+                        Tcl_NewStringObj(Tcl_DStringValue(&cachePtr->headers),
+                        Tcl_DStringLength(&cachePtr->headers)));
+                curlCacheWriteEntry(cachePtr,entry);
+                Tcl_DecrRefCount(entry);
+                stored=1;
+            }
+        }
+    }
+    if (!stored&&(Tcl_DStringLength(&cachePtr->bodyName)!=0)) {
+        remove(Tcl_DStringValue(&cachePtr->bodyName));
+    }
+    curlCacheClear(cachePtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlCacheClear --
+ *
+ *  Frees what the cache keeps during a transfer.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+curlCacheClear(struct curlCacheData *cachePtr) {
+
+    Tcl_DStringFree(&cachePtr->path);
+    Tcl_DStringFree(&cachePtr->headers);
+    Tcl_DStringFree(&cachePtr->bodyName);
+    curlSetObj(&cachePtr->entry,NULL);
+    curlSetObj(&cachePtr->etag,NULL);
+    curlSetObj(&cachePtr->lastModified,NULL);
+    curlSetObj(&cachePtr->vary,NULL);
+    curl_slist_free_all(cachePtr->headerList);
+    cachePtr->headerList=NULL;
+    if (cachePtr->memEntry!=NULL) {
+        curlMemCacheEntryRelease(cachePtr->memCache,cachePtr->memEntry);
+        cachePtr->memEntry=NULL;
+    }
+    if (cachePtr->memBody!=NULL) {
+        Tcl_Free(cachePtr->memBody);
+        cachePtr->memBody=NULL;
+        cachePtr->memSize=0;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlCacheReadEntry --
+ *
+ *  Reads the '.meta' file of an entry.
+ *
+ * Results:
+ *  The dict in the file, with a reference for the caller, NULL if
+ *  there is no entry for the URL or its body is missing.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tcl_Obj *
+curlCacheReadEntry(const char *path,Tcl_Obj *urlName) {
+    Tcl_DString             name,contents;
+    Tcl_Obj                *entry,*urlObj;
+    FILE                   *metaFile;
+    char                    buffer[4096];
+    size_t                  length;
+    int                     size;
+
+    Tcl_DStringInit(&name);
+    Tcl_DStringAppend(&name,path,-1);
+    Tcl_DStringAppend(&name,".meta",-1);
+    metaFile=fopen(Tcl_DStringValue(&name),"rb");
+    if (metaFile==NULL) {
+        Tcl_DStringFree(&name);
+        return NULL;
+    }
+    Tcl_DStringInit(&contents);
+    while ((length=fread(buffer,1,sizeof(buffer),metaFile))>0) {
+        Tcl_DStringAppend(&contents,buffer,(int)length);
+    }
+    fclose(metaFile);
+
+    entry=Tcl_NewStringObj(Tcl_DStringValue(&contents),Tcl_DStringLength(&contents));
+    Tcl_IncrRefCount(entry);
+    Tcl_DStringFree(&contents);
+
+    if ((Tcl_DictObjSize(NULL,entry,&size)!=TCL_OK)
+            ||((urlObj=curlCacheGet(entry,"url"))==NULL)
+            ||strcmp(Tcl_GetString(urlObj),Tcl_GetString(urlName))) {
+        Tcl_DecrRefCount(entry);
+        Tcl_DStringFree(&name);
+        return NULL;
+    }
+
+    Tcl_DStringSetLength(&name,(int)strlen(path));
+    Tcl_DStringAppend(&name,".body",-1);
+    metaFile=fopen(Tcl_DStringValue(&name),"rb");
+    Tcl_DStringFree(&name);
+    if (metaFile==NULL) {
+        Tcl_DecrRefCount(entry);
+        return NULL;
+    }
+    fclose(metaFile);
+
+    return entry;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlCacheWriteEntry --
+ *
+ *  Writes the '.meta' file of an entry, through a temporary file so the
+ *  other handles using the directory never see half of it.
+ *
+ * Results:
+ *  0 if all went well.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+curlCacheWriteEntry(struct curlCacheData *cachePtr,Tcl_Obj *entry) {
+    Tcl_DString             name;
+    FILE                   *metaFile;
+    const char             *contents;
+    Tcl_Time                now;
+    char                    suffix[64];
+    int                     length,result;
+
+    Tcl_GetTime(&now);
+    sprintf(suffix,".%p.%ld%06ld.meta.tmp",(void *)cachePtr,
+            (long)now.sec,(long)now.usec);
+    Tcl_DStringInit(&name);
+    Tcl_DStringAppend(&name,Tcl_DStringValue(&cachePtr->path),-1);
+    Tcl_DStringAppend(&name,suffix,-1);
+
+    metaFile=fopen(Tcl_DStringValue(&name),"wb");
+    if (metaFile==NULL) {
+        Tcl_DStringFree(&name);
+        return 1;
+    }
+    contents=Tcl_GetStringFromObj(entry,&length);
+    result=(fwrite(contents,1,length,metaFile)!=(size_t)length);
+    result|=fclose(metaFile);
+    if (!result) {
+        result=curlCacheRename(cachePtr,Tcl_DStringValue(&name),".meta");
+    }
+    if (result) {
+        remove(Tcl_DStringValue(&name));
+    }
+    Tcl_DStringFree(&name);
+
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlCacheDeliver --
+ *
+ *  Gives the handle the body of an entry.
+ *
+ * Results:
+ *  0 if all went well.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+curlCacheDeliver(struct curlObjData *curlData,const char *path) {
+    Tcl_DString             name;
+    FILE                   *bodyFile;
+    char                    buffer[CACHE_CHUNK];
+    size_t                  length;
+    int                     result=0;
+
+    Tcl_DStringInit(&name);
+    Tcl_DStringAppend(&name,path,-1);
+    Tcl_DStringAppend(&name,".body",-1);
+    bodyFile=fopen(Tcl_DStringValue(&name),"rb");
+    Tcl_DStringFree(&name);
+    if (bodyFile==NULL) {
+        return 1;
+    }
+    while ((length=fread(buffer,1,sizeof(buffer),bodyFile))>0) {
+        if (curlWriteBody(curlData,buffer,length)!=length) {
+            result=1;
+            break;
+        }
+    }
+    fclose(bodyFile);
+
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlCacheRemove, curlCacheRename, curlCacheNow, curlCacheGet --
+ *
+ *  Remove a file of the entry of the transfer or put a file in its
+ *  place, the time in seconds and a field of an entry.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+curlCacheRemove(struct curlCacheData *cachePtr,const char *suffix) {
+    Tcl_DString             name;
+
+    Tcl_DStringInit(&name);
+    Tcl_DStringAppend(&name,Tcl_DStringValue(&cachePtr->path),-1);
+    Tcl_DStringAppend(&name,suffix,-1);
+    remove(Tcl_DStringValue(&name));
+    Tcl_DStringFree(&name);
+}
+
+static int
+curlCacheRename(struct curlCacheData *cachePtr,const char *from,
+        const char *suffix) {
+    Tcl_DString             name;
+    int                     result;
+
+    Tcl_DStringInit(&name);
+    Tcl_DStringAppend(&name,Tcl_DStringValue(&cachePtr->path),-1);
+    Tcl_DStringAppend(&name,suffix,-1);
+#ifdef _WIN32
+    remove(Tcl_DStringValue(&name));
+#endif
+    result=rename(from,Tcl_DStringValue(&name));
+    Tcl_DStringFree(&name);
+
+    return result;
+}
+
+static Tcl_WideInt
+curlCacheNow(void) {
+    Tcl_Time                now;
+
+    Tcl_GetTime(&now);
+    return (Tcl_WideInt)now.sec;
+}
+
+static Tcl_Obj *
+curlCacheGet(Tcl_Obj *entry,const char *key) {
+    Tcl_Obj                *keyObj=Tcl_NewStringObj(key,-1);
+    Tcl_Obj                *valueObj=NULL;
+
+    Tcl_IncrRefCount(keyObj);
+    if (Tcl_DictObjGet(NULL,entry,keyObj,&valueObj)!=TCL_OK) {
+        valueObj=NULL;
+    }
+    Tcl_DecrRefCount(keyObj);
+
+    return valueObj;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlCacheInfo --
+ *
+ *  Returns what 'getinfo cache' returns, a dict with what the cache did
+ *  with the last transfer and how many hits, revalidations and misses
+ *  there have been.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Tcl_Obj *
+curlCacheInfo(struct curlObjData *curlData) {
+    struct curlCacheData   *cachePtr=(curlData!=NULL)?curlData->cache:NULL;
+    Tcl_Obj                *resultObj=Tcl_NewDictObj();
+
+    Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("status",-1),
+            Tcl_NewStringObj(cacheStatusTable[cachePtr?cachePtr->status:0],-1));
+    Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("hits",-1),
+            Tcl_NewWideIntObj(cachePtr?cachePtr->hits:0));
+    Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("revalidated",-1),
+            Tcl_NewWideIntObj(cachePtr?cachePtr->revalidated:0));
+    Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("misses",-1),
+            Tcl_NewWideIntObj(cachePtr?cachePtr->misses:0));
+
+    return resultObj;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlCacheCopy, curlCacheFree --
+ *
+ *  A duplicated handle uses the same directory and memory cache, with
+ *  counters of its own.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlCacheCopy(struct curlObjData *curlDataOld,struct curlObjData *curlDataNew) {
+    struct curlCacheData   *cachePtr;
+
+    curlDataNew->cache=NULL;
+    if (curlDataOld->cache==NULL) {
+        return;
+    }
+    cachePtr=(struct curlCacheData *)Tcl_Alloc(sizeof(struct curlCacheData));
+    memset(cachePtr,0,sizeof(struct curlCacheData));
+    curlSetObj(&cachePtr->dir,curlDataOld->cache->dir);
+    cachePtr->memCache=curlDataOld->cache->memCache;
+    if (cachePtr->memCache!=NULL) {
+        curlMemCacheHold(cachePtr->memCache);
+    }
+    curlDataNew->cache=cachePtr;
+}
+
+void
+curlCacheFree(struct curlObjData *curlData) {
+    struct curlCacheData   *cachePtr=curlData->cache;
+
+    if (cachePtr==NULL) {
+        return;
+    }
+    curlSetObj(&cachePtr->dir,NULL);
+    if (cachePtr->memCache!=NULL) {
+        curlMemCacheRelease(cachePtr->memCache);
+    }
+    Tcl_Free((char *)cachePtr);
+    curlData->cache=NULL;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMemCacheObjCmd --
+ *
+ *  This procedure is invoked to process the "curl::memcache" Tcl command.
+ *  See the user documentation for details on what it does.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlMemCacheObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]) {
+    struct curlMemCache    *memCachePtr;
+    Tcl_HashEntry          *hashPtr;
+    Tcl_Obj                *resultObj;
+    Tcl_WideInt             maxBytes=MEMCACHE_MAXBYTES;
+    int                     tableIndex,optionIndex,newEntry,destroyed=0;
+
+    if (objc<2) {
+        Tcl_WrongNumArgs(interp,1,objv,"subcommand ?arg ...?");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(interp, objv[1], memCacheCommandTable, "subcommand",
+            TCL_EXACT,&tableIndex)==TCL_ERROR) {
+        return TCL_ERROR;
+    }
+
+    if (tableIndex==0) {
+        if ((objc!=2)&&(objc!=4)) {
+            Tcl_WrongNumArgs(interp,2,objv,"?-maxbytes bytes?");
+            return TCL_ERROR;
+        }
+        if (objc==4) {
+            if (Tcl_GetIndexFromObj(interp,objv[2],memCacheOptionTable,"option",
+                    TCL_EXACT,&optionIndex)==TCL_ERROR) {
+                return TCL_ERROR;
+            }
+            if (Tcl_GetWideIntFromObj(interp,objv[3],&maxBytes)==TCL_ERROR) {
+                return TCL_ERROR;
+            }
+            if (maxBytes<=0) {
+                Tcl_SetObjResult(interp,Tcl_ObjPrintf(
+                        "bad size \"%s\": must be a positive number",
+                        Tcl_GetString(objv[3])));
+                return TCL_ERROR;
+            }
+        }
+        memCachePtr=(struct curlMemCache *)Tcl_Alloc(sizeof(struct curlMemCache));
+        memset(memCachePtr,0,sizeof(struct curlMemCache));
+        Tcl_InitHashTable(&memCachePtr->entries,TCL_STRING_KEYS);
+        Tcl_InitHashTable(&memCachePtr->varies,TCL_STRING_KEYS);
+        memCachePtr->maxBytes=maxBytes;
+        memCachePtr->refCount=1;
+
+        Tcl_MutexLock(&memCacheLock);
+        if (!memCachesInitialized) {
+            Tcl_InitHashTable(&memCachesByName,TCL_STRING_KEYS);
+            memCachesInitialized=1;
+        }
+        snprintf(memCachePtr->name,sizeof(memCachePtr->name),"memcache%d",
+                ++memCacheCounter);
+        hashPtr=Tcl_CreateHashEntry(&memCachesByName,memCachePtr->name,&newEntry);
+        Tcl_SetHashValue(hashPtr,memCachePtr);
+        Tcl_MutexUnlock(&memCacheLock);
+
+        Tcl_SetObjResult(interp,Tcl_NewStringObj(memCachePtr->name,-1));
+        return TCL_OK;
+    }
+
+    if (objc!=3) {
+        Tcl_WrongNumArgs(interp,2,objv,"cache");
+        return TCL_ERROR;
+    }
+    memCachePtr=curlMemCacheGet(interp,objv[2]);
+    if (memCachePtr==NULL) {
+        return TCL_ERROR;
+    }
+
+    switch(tableIndex) {
+        case 1:
+            resultObj=Tcl_NewDictObj();
+            Tcl_MutexLock(&memCachePtr->mutex);
+            Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("entries",-1),
+                    Tcl_NewIntObj(memCachePtr->entries.numEntries));
+            Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("bytes",-1),
+                    Tcl_NewWideIntObj(memCachePtr->bytes));
+            Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("maxbytes",-1),
+                    Tcl_NewWideIntObj(memCachePtr->maxBytes));
+            Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("hits",-1),
+                    Tcl_NewWideIntObj(memCachePtr->hits));
+            Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("misses",-1),
+                    Tcl_NewWideIntObj(memCachePtr->misses));
+            Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("evictions",-1),
+                    Tcl_NewWideIntObj(memCachePtr->evictions));
+            Tcl_MutexUnlock(&memCachePtr->mutex);
+            Tcl_SetObjResult(interp,resultObj);
+            break;
+        case 2:
+            Tcl_MutexLock(&memCachePtr->mutex);
+            while (memCachePtr->first!=NULL) {
+                curlMemCacheUnlink(memCachePtr,memCachePtr->first);
+            }
+            Tcl_MutexUnlock(&memCachePtr->mutex);
+            break;
+        case 3:
+            /* The handles using it can go on doing so. */
+            Tcl_MutexLock(&memCacheLock);
+            hashPtr=Tcl_FindHashEntry(&memCachesByName,memCachePtr->name);
+            if (hashPtr!=NULL) {
+                Tcl_DeleteHashEntry(hashPtr);
+                destroyed=1;
+            }
+            Tcl_MutexUnlock(&memCacheLock);
+            if (destroyed) {
+                curlMemCacheRelease(memCachePtr);
+            }
+            break;
+    }
+    curlMemCacheRelease(memCachePtr);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMemCacheGet --
+ *
+ *  Finds a memory cache from its name.
+ *
+ * Results:
+ *  The cache, with a reference the caller has to let go of with
+ *  curlMemCacheRelease, NULL if there is no such cache, with an error
+ *  message in the interpreter.
+ *
+ *----------------------------------------------------------------------
+ */
+
+struct curlMemCache *
+curlMemCacheGet(Tcl_Interp *interp,Tcl_Obj *nameObj) {
+    struct curlMemCache    *memCachePtr=NULL;
+    Tcl_HashEntry          *hashPtr;
+
+    Tcl_MutexLock(&memCacheLock);
+    if (memCachesInitialized) {
+        hashPtr=Tcl_FindHashEntry(&memCachesByName,Tcl_GetString(nameObj));
+        if (hashPtr!=NULL) {
+            memCachePtr=(struct curlMemCache *)Tcl_GetHashValue(hashPtr);
+            memCachePtr->refCount++;
+        }
+    }
+    Tcl_MutexUnlock(&memCacheLock);
+
+    if (memCachePtr==NULL) {
+        Tcl_SetObjResult(interp,Tcl_ObjPrintf(
+                "\"%s\" is not a memory cache",Tcl_GetString(nameObj)));
+    }
+    return memCachePtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMemCacheHold, curlMemCacheRelease --
+ *
+ *  Keep track of the name and the handles using a memory cache, it is
+ *  freed when the last of them lets go.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlMemCacheHold(struct curlMemCache *memCachePtr) {
+    Tcl_MutexLock(&memCacheLock);
+    memCachePtr->refCount++;
+    Tcl_MutexUnlock(&memCacheLock);
+}
+
+void
+curlMemCacheRelease(struct curlMemCache *memCachePtr) {
+
+    Tcl_MutexLock(&memCacheLock);
+    if (--memCachePtr->refCount>0) {
+        Tcl_MutexUnlock(&memCacheLock);
+        return;
+    }
+    Tcl_MutexUnlock(&memCacheLock);
+
+    /* The last entry for a URL takes its 'varies' along. */
+    while (memCachePtr->first!=NULL) {
+        curlMemCacheUnlink(memCachePtr,memCachePtr->first);
+    }
+    Tcl_DeleteHashTable(&memCachePtr->varies);
+    Tcl_DeleteHashTable(&memCachePtr->entries);
+    Tcl_MutexFinalize(&memCachePtr->mutex);
+    Tcl_Free((char *)memCachePtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMemCacheKey --
+ *
+ *  Puts together the key of the response to the request of a handle:
+ *  the method, the URL and, for every header in 'vary', the value the
+ *  handle sends.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+curlMemCacheKey(struct curlObjData *curlData,const char *vary,
+        Tcl_DString *keyPtr) {
+    struct curl_slist      *slistPtr;
+    const char             *name,*end,*value;
+    int                     length,start,i;
+
+    Tcl_DStringInit(keyPtr);
+    Tcl_DStringAppend(keyPtr,"GET ",4);
+    Tcl_DStringAppend(keyPtr,Tcl_GetString(curlData->urlName),-1);
+    for (name=vary;*name!='\0';name=end) {
+        while ((*name==' ')||(*name=='\t')||(*name==',')) {
+            name++;
+        }
+        for (end=name;(*end!='\0')&&(*end!=',');end++) {
+        }
+        for (length=(int)(end-name);(length>0)
+                &&((name[length-1]==' ')||(name[length-1]=='\t'));length--) {
+        }
+        if (length==0) {
+            continue;
+        }
+        Tcl_DStringAppend(keyPtr,"\n",1);
+        start=Tcl_DStringLength(keyPtr);
+        Tcl_DStringAppend(keyPtr,name,length);
+        for (i=start;i<Tcl_DStringLength(keyPtr);i++) {
+            if ((Tcl_DStringValue(keyPtr)[i]>='A')&&(Tcl_DStringValue(keyPtr)[i]<='Z')) {
+                Tcl_DStringValue(keyPtr)[i]+='a'-'A';
+            }
+        }
+        Tcl_DStringAppend(keyPtr,":",1);
+        for (slistPtr=curlData->headerList;slistPtr!=NULL;slistPtr=slistPtr->next) {
+            if (!Tcl_UtfNcasecmp(slistPtr->data,name,length)
+                    &&(slistPtr->data[length]==':')) {
+                for (value=slistPtr->data+length+1;(*value==' ')||(*value=='\t');value++) {
+                }
+                Tcl_DStringAppend(keyPtr,value,-1);
+                break;
+            }
+        }
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMemCacheLookup --
+ *
+ *  Looks for a fresh response to the request of a handle.
+ *
+ * Results:
+ *  The entry, with a reference the caller has to let go of with
+ *  curlMemCacheEntryRelease, or NULL.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static struct curlMemEntry *
+curlMemCacheLookup(struct curlMemCache *memCachePtr,struct curlObjData *curlData) {
+    struct curlMemEntry    *entryPtr=NULL;
+    Tcl_HashEntry          *hashPtr;
+    Tcl_DString             key;
+    const char             *vary="";
+
+    Tcl_MutexLock(&memCachePtr->mutex);
+    hashPtr=Tcl_FindHashEntry(&memCachePtr->varies,Tcl_GetString(curlData->urlName));
+    if (hashPtr!=NULL) {
+        vary=((struct curlMemVary *)Tcl_GetHashValue(hashPtr))->vary;
+    }
+    curlMemCacheKey(curlData,vary,&key);
+    hashPtr=Tcl_FindHashEntry(&memCachePtr->entries,Tcl_DStringValue(&key));
+    Tcl_DStringFree(&key);
+
+    if (hashPtr!=NULL) {
+        entryPtr=(struct curlMemEntry *)Tcl_GetHashValue(hashPtr);
+        if (entryPtr->expires<=curlCacheNow()) {
+            curlMemCacheUnlink(memCachePtr,entryPtr);
+            entryPtr=NULL;
+        } else if (entryPtr!=memCachePtr->first) {
+            /* To the front of the list, it is the most recently used. */
+            entryPtr->prev->next=entryPtr->next;
+            if (entryPtr->next!=NULL) {
+                entryPtr->next->prev=entryPtr->prev;
+            } else {
+                memCachePtr->last=entryPtr->prev;
+            }
+            entryPtr->prev=NULL;
+            entryPtr->next=memCachePtr->first;
+            memCachePtr->first->prev=entryPtr;
+            memCachePtr->first=entryPtr;
+        }
+    }
+    if (entryPtr!=NULL) {
+        entryPtr->refCount++;
+        memCachePtr->hits++;
+    } else {
+        memCachePtr->misses++;
+    }
+    Tcl_MutexUnlock(&memCachePtr->mutex);
+
+    return entryPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMemCacheStore --
+ *
+ *  Keeps the response a handle just got, evicting the least recently
+ *  used entries to make room for it.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+curlMemCacheStore(struct curlMemCache *memCachePtr,struct curlObjData *curlData,
+        Tcl_WideInt expires) {
+    struct curlCacheData   *cachePtr=curlData->cache;
+    struct curlMemEntry    *entryPtr;
+    struct curlMemVary     *varyPtr;
+    Tcl_HashEntry          *hashPtr;
+    Tcl_DString             key;
+    const char             *vary="";
+    size_t                  headersLength=Tcl_DStringLength(&cachePtr->headers);
+    size_t                  size;
+    int                     newEntry;
+
+    if (cachePtr->vary!=NULL) {
+        vary=Tcl_GetString(cachePtr->vary);
+        if (strchr(vary,'*')!=NULL) {
+            return;
+        }
+    }
+    curlMemCacheKey(curlData,vary,&key);
+    /* Every entry counts what 'varies' keeps for its URL too. */
+    size=sizeof(struct curlMemEntry)+Tcl_DStringLength(&key)+headersLength
+            +cachePtr->memLength+sizeof(struct curlMemVary)
+            +strlen(Tcl_GetString(curlData->urlName))+strlen(vary)+2;
+    if (size>(size_t)memCachePtr->maxBytes) {
+        Tcl_DStringFree(&key);
+        return;
+    }
+
+    /* The headers and the body go right after the entry. */
+    entryPtr=(struct curlMemEntry *)Tcl_Alloc(sizeof(struct curlMemEntry)
+            +headersLength+cachePtr->memLength);
+    memset(entryPtr,0,sizeof(struct curlMemEntry));
+    entryPtr->expires=expires;
+    entryPtr->size=size;
+    entryPtr->headers=(char *)(entryPtr+1);
+    entryPtr->headersLength=headersLength;
+    memcpy(entryPtr->headers,Tcl_DStringValue(&cachePtr->headers),headersLength);
+    entryPtr->body=entryPtr->headers+headersLength;
+    entryPtr->bodyLength=cachePtr->memLength;
+    if (cachePtr->memLength>0) {
+        memcpy(entryPtr->body,cachePtr->memBody,cachePtr->memLength);
+    }
+
+    Tcl_MutexLock(&memCachePtr->mutex);
+    hashPtr=Tcl_CreateHashEntry(&memCachePtr->varies,
+            Tcl_GetString(curlData->urlName),&newEntry);
+    if (newEntry) {
+        varyPtr=(struct curlMemVary *)Tcl_Alloc(sizeof(struct curlMemVary));
+        varyPtr->refCount=0;
+        Tcl_SetHashValue(hashPtr,varyPtr);
+    } else {
+        varyPtr=(struct curlMemVary *)Tcl_GetHashValue(hashPtr);
+        Tcl_Free(varyPtr->vary);
+    }
+    varyPtr->vary=curlstrdup((char *)vary);
+    varyPtr->refCount++;
+    entryPtr->varyPtr=hashPtr;
+
+    hashPtr=Tcl_CreateHashEntry(&memCachePtr->entries,Tcl_DStringValue(&key),&newEntry);
+    if (!newEntry) {
+        curlMemCacheUnlink(memCachePtr,(struct curlMemEntry *)Tcl_GetHashValue(hashPtr));
+        hashPtr=Tcl_CreateHashEntry(&memCachePtr->entries,Tcl_DStringValue(&key),
+                &newEntry);
+    }
+    Tcl_SetHashValue(hashPtr,entryPtr);
+    entryPtr->hashPtr=hashPtr;
+    entryPtr->next=memCachePtr->first;
+    if (memCachePtr->first!=NULL) {
+        memCachePtr->first->prev=entryPtr;
+    } else {
+        memCachePtr->last=entryPtr;
+    }
+    memCachePtr->first=entryPtr;
+    memCachePtr->bytes+=size;
+
+    while ((memCachePtr->bytes>memCachePtr->maxBytes)
+            &&(memCachePtr->last!=entryPtr)) {
+        curlMemCacheUnlink(memCachePtr,memCachePtr->last);
+        memCachePtr->evictions++;
+    }
+    Tcl_MutexUnlock(&memCachePtr->mutex);
+    Tcl_DStringFree(&key);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMemCacheUnlink, curlMemCacheEntryRelease --
+ *
+ *  Take an entry out of a memory cache, with its mutex locked, and let
+ *  go of an entry that was served. The entry is freed once it is out
+ *  of the cache and nobody is serving it.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+curlMemCacheUnlink(struct curlMemCache *memCachePtr,struct curlMemEntry *entryPtr) {
+    struct curlMemVary     *varyPtr=(struct curlMemVary *)
+            Tcl_GetHashValue(entryPtr->varyPtr);
+
+    if (--varyPtr->refCount==0) {
+        Tcl_DeleteHashEntry(entryPtr->varyPtr);
+        Tcl_Free(varyPtr->vary);
+        Tcl_Free((char *)varyPtr);
+    }
+    entryPtr->varyPtr=NULL;
+    if (entryPtr->prev!=NULL) {
+        entryPtr->prev->next=entryPtr->next;
+    } else {
+        memCachePtr->first=entryPtr->next;
+    }
+    if (entryPtr->next!=NULL) {
+        entryPtr->next->prev=entryPtr->prev;
+    } else {
+        memCachePtr->last=entryPtr->prev;
+    }
+    Tcl_DeleteHashEntry(entryPtr->hashPtr);
+    entryPtr->hashPtr=NULL;
+    memCachePtr->bytes-=entryPtr->size;
+    if (entryPtr->refCount==0) {
+        Tcl_Free((char *)entryPtr);
+    }
+}
+
+static void
+curlMemCacheEntryRelease(struct curlMemCache *memCachePtr,
+        struct curlMemEntry *entryPtr) {
+
+    Tcl_MutexLock(&memCachePtr->mutex);
+    if ((--entryPtr->refCount==0)&&(entryPtr->hashPtr==NULL)) {
+        Tcl_Free((char *)entryPtr);
+    }
+    Tcl_MutexUnlock(&memCachePtr->mutex);
+}
@@ -0,0 +1,139 @@
+/*
+ * cache.h --
+ *
+ * Header file for the part of the TclCurl extension that keeps the
+ * responses to GET requests in a directory and revalidates them, or in
+ * memory.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#define cache_h
+#include "tclcurl.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * What the cache did with the last transfer of a handle.
+ */
+#define CACHE_NONE          0
+#define CACHE_HIT           1
+#define CACHE_REVALIDATED   2
+#define CACHE_MISS          3
+#define CACHE_BYPASS        4
+
+const static char *cacheStatusTable[] = {
+    "", "hit", "revalidated", "miss", "bypass", (char *)NULL
+};
+
+#define CACHE_CHUNK         16384
+
+const static char *memCacheCommandTable[] = {
+    "create", "stats", "flush", "destroy", (char *)NULL
+};
+
+const static char *memCacheOptionTable[] = {
+    "-maxbytes", (char *)NULL
+};
+
+#define MEMCACHE_MAXBYTES   (64*1024*1024)
+
+/*
+ * A response in a memory cache. Handles serving it hold a reference, so
+ * it can be evicted while they do, it is freed when the last one is done.
+ */
+struct curlMemEntry {
+    Tcl_HashEntry          *hashPtr;
+    Tcl_HashEntry          *varyPtr;
+    int                     refCount;
+    Tcl_WideInt             expires;
+    char                   *headers;
+    size_t                  headersLength;
+    char                   *body;
+    size_t                  bodyLength;
+    size_t                  size;
+    struct curlMemEntry    *prev;
+    struct curlMemEntry    *next;
+};
+
+/*
+ * The headers the last response for a URL said it varies on, it goes
+ * with the last entry for the URL.
+ */
+struct curlMemVary {
+    int                     refCount;
+    char                   *vary;
+};
+
+/*
+ * A memory cache, it belongs to the process, so handles in any thread can
+ * use it. The name and the handles using it hold a reference. The entries
+ * are keyed by method, URL and the request headers the response said it
+ * varies on, kept by URL in 'varies', and listed most recently used first.
+ */
+struct curlMemCache {
+    char                    name[32];
+    int                     refCount;
+    Tcl_Mutex               mutex;
+    Tcl_HashTable           entries;
+    Tcl_HashTable           varies;
+    struct curlMemEntry    *first;
+    struct curlMemEntry    *last;
+    Tcl_WideInt             maxBytes;
+    Tcl_WideInt             bytes;
+    Tcl_WideInt             hits;
+    Tcl_WideInt             misses;
+    Tcl_WideInt             evictions;
+};
+
+/*
+ * The cache of a handle, the fields after 'active' only mean something
+ * during a transfer.
+ */
+struct curlCacheData {
+    Tcl_Obj                *dir;
+    struct curlMemCache    *memCache;
+    int                     status;
+    Tcl_WideInt             hits;
+    Tcl_WideInt             revalidated;
+    Tcl_WideInt             misses;
+
+    int                     active;
+    Tcl_DString             path;
+    Tcl_Obj                *entry;
+    struct curl_slist      *headerList;
+    long                    responseCode;
+    Tcl_DString             headers;
+    Tcl_Obj                *etag;
+    Tcl_Obj                *lastModified;
+    Tcl_WideInt             maxAge;
+    Tcl_WideInt             expires;
+    int                     noStore;
+    int                     noCache;
+    FILE                   *bodyFile;
+    Tcl_DString             bodyName;
+    int                     failed;
+    struct curlMemEntry    *memEntry;
+    Tcl_Obj                *vary;
+    char                   *memBody;
+    size_t                  memLength;
+    size_t                  memSize;
+    int                     memFailed;
+};
+
+int curlMemCacheObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]);
+struct curlMemCache *curlMemCacheGet(Tcl_Interp *interp,Tcl_Obj *nameObj);
+void curlMemCacheHold(struct curlMemCache *memCachePtr);
+void curlMemCacheRelease(struct curlMemCache *memCachePtr);
+
+size_t curlCacheWrite(char *ptr,size_t size,size_t nmemb,void *curlDataPtr);
+size_t curlCacheHeader(char *ptr,size_t size,size_t nmemb,void *curlDataPtr);
+
+#ifdef  __cplusplus
+}
+#endif
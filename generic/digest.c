@@ -0,0 +1,759 @@
+/*
+ * digest.c --
+ *
+ * Implementation of the part of the TclCurl extension that computes the
+ * digests of the bodies as they arrive, '-digest', '-digestvar' and
+ * '-expectdigest'.
+ *
+ * The body goes through curlDigestWrite on its way to whatever the
+ * handle writes it to, a file, '-bodyvar' or '-writeproc', so there is no
+ * need to read it again afterwards. When a download to a file is carried
+ * on with '-resume', what was already in the file is read once to start
+ * the digests with. SHA-256 and MD5 are plain C, CRC32C uses the
+ * instructions for it on x86 processors with SSE 4.2 and ARM ones with
+ * the CRC extension, a table otherwise.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#include "digest.h"
+#include <stdio.h>
+
+#if (defined(__GNUC__)||defined(__clang__))&&(defined(__x86_64__)||defined(__i386__))
+#define DIGEST_CRC32C_SSE42
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#define DIGEST_CRC32C_ARM
+#include <arm_acle.h>
+#endif
+
+static struct curlDigestData *curlDigestAlloc(struct curlObjData *curlData);
+static void curlDigestUpdate(struct curlDigestData *digestPtr,
+        const unsigned char *bytes,size_t length);
+static void curlDigestFile(struct curlDigestData *digestPtr,const char *fileName,
+        Tcl_WideInt length);
+static Tcl_Obj *curlDigestHex(const unsigned char *bytes,int length);
+
+static void curlSha256Init(struct curlSha256 *ctxPtr);
+static void curlSha256Update(struct curlSha256 *ctxPtr,const unsigned char *bytes,
+        size_t length);
+static void curlSha256Final(struct curlSha256 *ctxPtr,unsigned char digest[32]);
+static void curlSha256Transform(unsigned int state[8],const unsigned char *block);
+
+static void curlMd5Init(struct curlMd5 *ctxPtr);
+static void curlMd5Update(struct curlMd5 *ctxPtr,const unsigned char *bytes,
+        size_t length);
+static void curlMd5Final(struct curlMd5 *ctxPtr,unsigned char digest[16]);
+static void curlMd5Transform(unsigned int state[4],const unsigned char *block);
+
+static unsigned int curlCrc32c(unsigned int crc,const unsigned char *bytes,
+        size_t length);
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlDigestSetAlgorithms, curlDigestSetVar, curlDigestSetExpected --
+ *
+ *  Set '-digest', the list of digests to compute, '-digestvar', the
+ *  variable to put them in, and '-expectdigest', a dict with the digests
+ *  the body must have.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlDigestSetAlgorithms(Tcl_Interp *interp,struct curlObjData *curlData,
+        Tcl_Obj *algorithmsObj) {
+    Tcl_Obj               **elements;
+    int                     count,i,index,algorithms=0;
+
+    if (Tcl_ListObjGetElements(interp,algorithmsObj,&count,&elements)!=TCL_OK) {
+        return TCL_ERROR;
+    }
+    for (i=0;i<count;i++) {
+        if (Tcl_GetIndexFromObj(interp,elements[i],digestTable,"digest",
+                TCL_EXACT,&index)==TCL_ERROR) {
+            return TCL_ERROR;
+        }
+        algorithms|=1<<index;
+    }
+    if ((algorithms!=0)||(curlData->digest!=NULL)) {
+        curlDigestAlloc(curlData)->algorithms=algorithms;
+    }
+    return TCL_OK;
+}
+
+int
+curlDigestSetVar(Tcl_Interp *interp,struct curlObjData *curlData,Tcl_Obj *varNameObj) {
+
+    if ((*Tcl_GetString(varNameObj)!='\0')||(curlData->digest!=NULL)) {
+        curlSetObj(&curlDigestAlloc(curlData)->varName,
+                (*Tcl_GetString(varNameObj)!='\0')?varNameObj:NULL);
+    }
+    return TCL_OK;
+}
+
+int
+curlDigestSetExpected(Tcl_Interp *interp,struct curlObjData *curlData,
+        Tcl_Obj *expectedObj) {
+    struct curlDigestData  *digestPtr;
+    Tcl_DictSearch          search;
+    Tcl_Obj                *keyObj,*valueObj,*expected;
+    int                     done,index,algorithms=0;
+
+    if (Tcl_DictObjFirst(interp,expectedObj,&search,&keyObj,&valueObj,&done)!=TCL_OK) {
+        return TCL_ERROR;
+    }
+    expected=Tcl_NewDictObj();
+    for (;!done;Tcl_DictObjNext(&search,&keyObj,&valueObj,&done)) {
+        if (Tcl_GetIndexFromObj(interp,keyObj,digestTable,"digest",
+                TCL_EXACT,&index)==TCL_ERROR) {
+            Tcl_DictObjDone(&search);
+            Tcl_DecrRefCount(expected);
+            return TCL_ERROR;
+        }
+        algorithms|=1<<index;
+        /* The digests are given in lower case. */
+        valueObj=Tcl_DuplicateObj(valueObj);
+        Tcl_SetObjLength(valueObj,Tcl_UtfToLower(Tcl_GetString(valueObj)));
+        Tcl_DictObjPut(NULL,expected,keyObj,valueObj);
+    }
+    if ((algorithms==0)&&(curlData->digest==NULL)) {
+        Tcl_DecrRefCount(expected);
+        return TCL_OK;
+    }
+    digestPtr=curlDigestAlloc(curlData);
+    digestPtr->expectedAlgorithms=algorithms;
+    curlSetObj(&digestPtr->expected,(algorithms!=0)?expected:NULL);
+    if (algorithms==0) {
+        Tcl_DecrRefCount(expected);
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlDigestPrepare --
+ *
+ *  Called before every attempt, it starts the digests over and puts
+ *  curlDigestWrite between libcurl and the handle's write function. If
+ *  the attempt carries on a download, the digests start with what is in
+ *  the file.
+ *
+ *  It has to come after curlResumePrepare and before a cache or
+ *  coalescing stand in between, they give the body to the handle's
+ *  function.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlDigestPrepare(struct curlObjData *curlData) {
+    struct curlDigestData  *digestPtr=curlData->digest;
+    Tcl_WideInt             offset;
+
+    if (digestPtr==NULL) {
+        return;
+    }
+    digestPtr->computing=digestPtr->algorithms|digestPtr->expectedAlgorithms;
+    if (digestPtr->computing==0) {
+        return;
+    }
+    curlSha256Init(&digestPtr->sha256);
+    curlMd5Init(&digestPtr->md5);
+    digestPtr->crc32c=0xffffffff;
+
+    if ((offset=curlResumeOffset(curlData))>0) {
+        curlDigestFile(digestPtr,Tcl_GetString(curlData->files->outFile),offset);
+    }
+
+    if (!digestPtr->watching) {
+        digestPtr->writeFunction=curlData->writeFunction;
+        digestPtr->writeData=curlData->writeData;
+        digestPtr->watching=1;
+        curlSetWriter(curlData,curlDigestWrite,curlData);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlDigestWrite --
+ *
+ *  The write function while watching, the bytes the handle takes go
+ *  into the digests.
+ *
+ * Results:
+ *  What the handle's write function returns.
+ *
+ *----------------------------------------------------------------------
+ */
+
+size_t
+curlDigestWrite(char *ptr,size_t size,size_t nmemb,void *curlDataPtr) {
+    struct curlObjData     *curlData=(struct curlObjData *)curlDataPtr;
+    struct curlDigestData  *digestPtr=curlData->digest;
+    size_t                  length=size*nmemb;
+    size_t                  written;
+
+    if (digestPtr->writeFunction!=NULL) {
+        written=digestPtr->writeFunction(ptr,1,length,digestPtr->writeData);
+    } else {
+        written=fwrite(ptr,1,length,(digestPtr->writeData!=NULL)
+                ?(FILE *)digestPtr->writeData:stdout);
+    }
+    /* Anything else is an error, or a pause and the bytes come again. */
+    if (written==length) {
+        curlDigestUpdate(digestPtr,(const unsigned char *)ptr,length);
+    }
+    return written;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlDigestFinish --
+ *
+ *  Called when the transfer is done, after the last attempt. If it went
+ *  well, the digests are put in '-digestvar' and checked against the
+ *  ones in '-expectdigest'.
+ *
+ * Results:
+ *  The exit code of the transfer, CURLE_WRITE_ERROR if a digest isn't
+ *  the one expected.
+ *
+ *----------------------------------------------------------------------
+ */
+
+CURLcode
+curlDigestFinish(struct curlObjData *curlData,CURLcode exitCode) {
+    struct curlDigestData  *digestPtr=curlData->digest;
+    Tcl_Obj                *digestsObj,*valueObj,*expectedObj;
+    unsigned char           digest[32];
+    unsigned int            crc;
+    int                     i,j;
+
+    if ((digestPtr==NULL)||!digestPtr->watching) {
+        return exitCode;
+    }
+    curlDigestStop(curlData);
+    if (exitCode!=CURLE_OK) {
+        return exitCode;
+    }
+
+    digestsObj=Tcl_NewDictObj();
+    Tcl_IncrRefCount(digestsObj);
+    for (i=0;digestTable[i]!=NULL;i++) {
+        if (!(digestPtr->computing&(1<<i))) {
+            continue;
+        }
+        switch(i) {
+            case DIGEST_SHA256:
+                curlSha256Final(&digestPtr->sha256,digest);
+                valueObj=curlDigestHex(digest,32);
+                break;
+            case DIGEST_MD5:
+                curlMd5Final(&digestPtr->md5,digest);
+                valueObj=curlDigestHex(digest,16);
+                break;
+            default:
+                crc=digestPtr->crc32c^0xffffffff;
+                for (j=0;j<4;j++) {
+                    digest[j]=(unsigned char)(crc>>(24-8*j));
+                }
+                valueObj=curlDigestHex(digest,4);
+                break;
+        }
+        Tcl_DictObjPut(NULL,digestsObj,Tcl_NewStringObj(digestTable[i],-1),valueObj);
+        if ((digestPtr->expectedAlgorithms&(1<<i))
+                &&(Tcl_DictObjGet(NULL,digestPtr->expected,
+                        Tcl_NewStringObj(digestTable[i],-1),&expectedObj)==TCL_OK)
+                &&(expectedObj!=NULL)
+                &&strcmp(Tcl_GetString(expectedObj),Tcl_GetString(valueObj))) {
+            exitCode=CURLE_WRITE_ERROR;
+        }
+    }
+    if (digestPtr->varName!=NULL) {
+        Tcl_ObjSetVar2(curlData->interp,digestPtr->varName,NULL,digestsObj,0);
+    }
+    Tcl_DecrRefCount(digestsObj);
+
+    return exitCode;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlDigestStop --
+ *
+ *  Gives the handle back its write function.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlDigestStop(struct curlObjData *curlData) {
+    struct curlDigestData  *digestPtr=curlData->digest;
+
+    if ((digestPtr==NULL)||!digestPtr->watching) {
+        return;
+    }
+    digestPtr->watching=0;
+    curlSetWriter(curlData,digestPtr->writeFunction,digestPtr->writeData);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlDigestCopy, curlDigestFree --
+ *
+ *  A duplicated handle computes the same digests.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlDigestCopy(struct curlObjData *curlDataOld,struct curlObjData *curlDataNew) {
+    struct curlDigestData  *digestPtr;
+
+    curlDataNew->digest=NULL;
+    if (curlDataOld->digest==NULL) {
+        return;
+    }
+    digestPtr=curlDigestAlloc(curlDataNew);
+    digestPtr->algorithms=curlDataOld->digest->algorithms;
+    digestPtr->expectedAlgorithms=curlDataOld->digest->expectedAlgorithms;
+    curlSetObj(&digestPtr->varName,curlDataOld->digest->varName);
+    curlSetObj(&digestPtr->expected,curlDataOld->digest->expected);
+}
+
+void
+curlDigestFree(struct curlObjData *curlData) {
+    struct curlDigestData  *digestPtr=curlData->digest;
+
+    if (digestPtr==NULL) {
+        return;
+    }
+    curlSetObj(&digestPtr->varName,NULL);
+    curlSetObj(&digestPtr->expected,NULL);
+    Tcl_Free((char *)digestPtr);
+    curlData->digest=NULL;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlDigestAlloc --
+ *
+ *  Returns the digest block of a handle, allocating it the first time
+ *  one of the options needs it.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static struct curlDigestData *
+curlDigestAlloc(struct curlObjData *curlData) {
+
+    if (curlData->digest==NULL) {
+        curlData->digest=(struct curlDigestData *)Tcl_Alloc(sizeof(struct curlDigestData));
+        memset(curlData->digest,0,sizeof(struct curlDigestData));
+    }
+    return curlData->digest;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlDigestUpdate, curlDigestFile --
+ *
+ *  Add bytes to the digests being computed, from memory or from the
+ *  beginning of a file.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+curlDigestUpdate(struct curlDigestData *digestPtr,const unsigned char *bytes,
+        size_t length) {
+
+    if (digestPtr->computing&(1<<DIGEST_SHA256)) {
+        curlSha256Update(&digestPtr->sha256,bytes,length);
+    }
+    if (digestPtr->computing&(1<<DIGEST_MD5)) {
+        curlMd5Update(&digestPtr->md5,bytes,length);
+    }
+    if (digestPtr->computing&(1<<DIGEST_CRC32C)) {
+        digestPtr->crc32c=curlCrc32c(digestPtr->crc32c,bytes,length);
+    }
+}
+
+static void
+curlDigestFile(struct curlDigestData *digestPtr,const char *fileName,
+        Tcl_WideInt length) {
+    FILE                   *filePtr;
+    unsigned char          *buffer;
+    size_t                  count;
+
+    filePtr=fopen(fileName,"rb");
+    if (filePtr==NULL) {
+        return;
+    }
+    buffer=(unsigned char *)Tcl_Alloc(DIGEST_CHUNK);
+    while ((length>0)&&((count=fread(buffer,1,(length<DIGEST_CHUNK)
+            ?(size_t)length:DIGEST_CHUNK,filePtr))>0)) {
+        curlDigestUpdate(digestPtr,buffer,count);
+        length-=count;
+    }
+    Tcl_Free((char *)buffer);
+    fclose(filePtr);
+}
+
+static Tcl_Obj *
+curlDigestHex(const unsigned char *bytes,int length) {
+    static const char       digits[]="0123456789abcdef";
+    char                    hex[65];
+    int                     i;
+
+    for (i=0;i<length;i++) {
+        hex[2*i]=digits[bytes[i]>>4];
+        hex[2*i+1]=digits[bytes[i]&15];
+    }
+    return Tcl_NewStringObj(hex,2*length);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlSha256Init, curlSha256Update, curlSha256Final --
+ *
+ *  SHA-256, as in FIPS 180-4.
+ *
+ *----------------------------------------------------------------------
+ */
+
+#define DIGEST_ROTR(x,n)    (((x)>>(n))|((x)<<(32-(n))))
+#define DIGEST_ROTL(x,n)    (((x)<<(n))|((x)>>(32-(n))))
+
+static const unsigned int sha256Init[8]={
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const unsigned int sha256K[64]={
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void
+curlSha256Init(struct curlSha256 *ctxPtr) {
+
+    memcpy(ctxPtr->state,sha256Init,sizeof(sha256Init));
+    ctxPtr->count=0;
+}
+
+static void
+curlSha256Update(struct curlSha256 *ctxPtr,const unsigned char *bytes,size_t length) {
+    size_t                  used=(size_t)(ctxPtr->count&63),take;
+
+    ctxPtr->count+=length;
+    if (used>0) {
+        take=(64-used<length)?64-used:length;
+        memcpy(ctxPtr->buffer+used,bytes,take);
+        bytes+=take;
+        length-=take;
+        if (used+take<64) {
+            return;
+        }
+        curlSha256Transform(ctxPtr->state,ctxPtr->buffer);
+    }
+    for (;length>=64;bytes+=64,length-=64) {
+        curlSha256Transform(ctxPtr->state,bytes);
+    }
+    memcpy(ctxPtr->buffer,bytes,length);
+}
+
+static void
+curlSha256Final(struct curlSha256 *ctxPtr,unsigned char digest[32]) {
+    unsigned char           pad[72];
+    Tcl_WideUInt            bits=ctxPtr->count*8;
+    size_t                  used=(size_t)(ctxPtr->count&63);
+    size_t                  padLength=(used<56)?56-used:120-used;
+    int                     i;
+
+    memset(pad,0,sizeof(pad));
+    pad[0]=0x80;
+    for (i=0;i<8;i++) {
+        pad[padLength+i]=(unsigned char)(bits>>(56-8*i));
+    }
+    curlSha256Update(ctxPtr,pad,padLength+8);
+    for (i=0;i<32;i++) {
+        digest[i]=(unsigned char)(ctxPtr->state[i/4]>>(24-8*(i%4)));
+    }
+}
+
+static void
+curlSha256Transform(unsigned int state[8],const unsigned char *block) {
+    unsigned int            w[64],a,b,c,d,e,f,g,h,t1,t2;
+    int                     i;
+
+    for (i=0;i<16;i++) {
+        w[i]=((unsigned int)block[4*i]<<24)|((unsigned int)block[4*i+1]<<16)
+                |((unsigned int)block[4*i+2]<<8)|(unsigned int)block[4*i+3];
+    }
+    for (;i<64;i++) {
+        w[i]=w[i-16]+w[i-7]
+                +(DIGEST_ROTR(w[i-15],7)^DIGEST_ROTR(w[i-15],18)^(w[i-15]>>3))
+                +(DIGEST_ROTR(w[i-2],17)^DIGEST_ROTR(w[i-2],19)^(w[i-2]>>10));
+    }
+    a=state[0]; b=state[1]; c=state[2]; d=state[3];
+    e=state[4]; f=state[5]; g=state[6]; h=state[7];
+    for (i=0;i<64;i++) {
+        t1=h+(DIGEST_ROTR(e,6)^DIGEST_ROTR(e,11)^DIGEST_ROTR(e,25))
+                +((e&f)^(~e&g))+sha256K[i]+w[i];
+        t2=(DIGEST_ROTR(a,2)^DIGEST_ROTR(a,13)^DIGEST_ROTR(a,22))
+                +((a&b)^(a&c)^(b&c));
+        h=g; g=f; f=e; e=d+t1;
+        d=c; c=b; b=a; a=t1+t2;
+    }
+    state[0]+=a; state[1]+=b; state[2]+=c; state[3]+=d;
+    state[4]+=e; state[5]+=f; state[6]+=g; state[7]+=h;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMd5Init, curlMd5Update, curlMd5Final --
+ *
+ *  MD5, as in RFC 1321.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static const unsigned int md5K[64]={
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+    0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+    0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+    0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+    0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const int md5Shift[16]={
+    7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21
+};
+
+static void
+curlMd5Init(struct curlMd5 *ctxPtr) {
+
+    ctxPtr->state[0]=0x67452301;
+    ctxPtr->state[1]=0xefcdab89;
+    ctxPtr->state[2]=0x98badcfe;
+    ctxPtr->state[3]=0x10325476;
+    ctxPtr->count=0;
+}
+
+static void
+curlMd5Update(struct curlMd5 *ctxPtr,const unsigned char *bytes,size_t length) {
+    size_t                  used=(size_t)(ctxPtr->count&63),take;
+
+    ctxPtr->count+=length;
+    if (used>0) {
+        take=(64-used<length)?64-used:length;
+        memcpy(ctxPtr->buffer+used,bytes,take);
+        bytes+=take;
+        length-=take;
+        if (used+take<64) {
+            return;
+        }
+        curlMd5Transform(ctxPtr->state,ctxPtr->buffer);
+    }
+    for (;length>=64;bytes+=64,length-=64) {
+        curlMd5Transform(ctxPtr->state,bytes);
+    }
+    memcpy(ctxPtr->buffer,bytes,length);
+}
+
+static void
+curlMd5Final(struct curlMd5 *ctxPtr,unsigned char digest[16]) {
+    unsigned char           pad[72];
+    Tcl_WideUInt            bits=ctxPtr->count*8;
+    size_t                  used=(size_t)(ctxPtr->count&63);
+    size_t                  padLength=(used<56)?56-used:120-used;
+    int                     i;
+
+    memset(pad,0,sizeof(pad));
+    pad[0]=0x80;
+    for (i=0;i<8;i++) {
+        pad[padLength+i]=(unsigned char)(bits>>(8*i));
+    }
+    curlMd5Update(ctxPtr,pad,padLength+8);
+    for (i=0;i<16;i++) {
+        digest[i]=(unsigned char)(ctxPtr->state[i/4]>>(8*(i%4)));
+    }
+}
+
+static void
+curlMd5Transform(unsigned int state[4],const unsigned char *block) {
+    unsigned int            m[16],a,b,c,d,f,t;
+    int                     i,g;
+
+    for (i=0;i<16;i++) {
+        m[i]=(unsigned int)block[4*i]|((unsigned int)block[4*i+1]<<8)
+                |((unsigned int)block[4*i+2]<<16)|((unsigned int)block[4*i+3]<<24);
+    }
+    a=state[0]; b=state[1]; c=state[2]; d=state[3];
+    for (i=0;i<64;i++) {
+        if (i<16) {
+            f=(b&c)|(~b&d);
+            g=i;
+        } else if (i<32) {
+            f=(d&b)|(~d&c);
+            g=(5*i+1)%16;
+        } else if (i<48) {
+            f=b^c^d;
+            g=(3*i+5)%16;
+        } else {
+            f=c^(b|~d);
+            g=(7*i)%16;
+        }
+        t=d;
+        d=c;
+        c=b;
+        f+=a+md5K[i]+m[g];
+        b+=DIGEST_ROTL(f,md5Shift[(i/16)*4+i%4]);
+        a=t;
+    }
+    state[0]+=a; state[1]+=b; state[2]+=c; state[3]+=d;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlCrc32c --
+ *
+ *  CRC32C, the Castagnoli polynomial, with the processor's instructions
+ *  if it has them, or eight bytes at a time with tables otherwise.
+ *
+ * Results:
+ *  The CRC so far, without the final inversion.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static unsigned int crc32cTable[8][256];
+static int crc32cReady=0;
+#ifdef DIGEST_CRC32C_SSE42
+static int crc32cHardware=0;
+#endif
+TCL_DECLARE_MUTEX(crc32cMutex)
+
+#ifdef DIGEST_CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static unsigned int
+curlCrc32cHardware(unsigned int crc,const unsigned char *bytes,size_t length) {
+#ifdef __x86_64__
+    unsigned long long      word;
+
+    for (;length>=8;bytes+=8,length-=8) {
+        memcpy(&word,bytes,8);
+        crc=(unsigned int)_mm_crc32_u64(crc,word);
+    }
+#endif
+    for (;length>0;bytes++,length--) {
+        crc=_mm_crc32_u8(crc,*bytes);
+    }
+    return crc;
+}
+#endif
+
+static unsigned int
+curlCrc32c(unsigned int crc,const unsigned char *bytes,size_t length) {
+    unsigned int            one,two;
+    int                     i,j;
+#ifdef DIGEST_CRC32C_ARM
+    unsigned long long      word;
+
+    for (;length>=8;bytes+=8,length-=8) {
+        memcpy(&word,bytes,8);
+        crc=__crc32cd(crc,word);
+    }
+    for (;length>0;bytes++,length--) {
+        crc=__crc32cb(crc,*bytes);
+    }
+    return crc;
+#endif
+
+    if (!crc32cReady) {
+        Tcl_MutexLock(&crc32cMutex);
+        if (!crc32cReady) {
+            for (i=0;i<256;i++) {
+                crc32cTable[0][i]=i;
+                for (j=0;j<8;j++) {
+                    crc32cTable[0][i]=(crc32cTable[0][i]>>1)
+                            ^((crc32cTable[0][i]&1)?0x82f63b78:0);
+                }
+            }
+            for (i=0;i<256;i++) {
+                for (j=1;j<8;j++) {
+                    crc32cTable[j][i]=(crc32cTable[j-1][i]>>8)
+                            ^crc32cTable[0][crc32cTable[j-1][i]&0xff];
+                }
+            }
+#ifdef DIGEST_CRC32C_SSE42
+            crc32cHardware=__builtin_cpu_supports("sse4.2");
+#endif
+            crc32cReady=1;
+        }
+        Tcl_MutexUnlock(&crc32cMutex);
+    }
+#ifdef DIGEST_CRC32C_SSE42
+    if (crc32cHardware) {
+        return curlCrc32cHardware(crc,bytes,length);
+    }
+#endif
+
+    for (;length>=8;bytes+=8,length-=8) {
+        one=crc^((unsigned int)bytes[0]|((unsigned int)bytes[1]<<8)
+                |((unsigned int)bytes[2]<<16)|((unsigned int)bytes[3]<<24));
+        two=(unsigned int)bytes[4]|((unsigned int)bytes[5]<<8)
+                |((unsigned int)bytes[6]<<16)|((unsigned int)bytes[7]<<24);
+        crc=crc32cTable[7][one&0xff]^crc32cTable[6][(one>>8)&0xff]
+                ^crc32cTable[5][(one>>16)&0xff]^crc32cTable[4][one>>24]
+                ^crc32cTable[3][two&0xff]^crc32cTable[2][(two>>8)&0xff]
+                ^crc32cTable[1][(two>>16)&0xff]^crc32cTable[0][two>>24];
+    }
+    for (;length>0;bytes++,length--) {
+        crc=crc32cTable[0][(crc^*bytes)&0xff]^(crc>>8);
+    }
+    return crc;
+}
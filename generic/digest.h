@@ -0,0 +1,67 @@
+/*
+ * digest.h --
+ *
+ * Header file for the part of the TclCurl extension that computes the
+ * digests of the bodies as they arrive, '-digest'.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#define digest_h
+#include "tclcurl.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define DIGEST_SHA256       0
+#define DIGEST_MD5          1
+#define DIGEST_CRC32C       2
+
+const static char *digestTable[] = {
+    "sha256", "md5", "crc32c", (char *)NULL
+};
+
+#define DIGEST_CHUNK        16384
+
+struct curlSha256 {
+    unsigned int            state[8];
+    Tcl_WideUInt            count;
+    unsigned char           buffer[64];
+};
+
+struct curlMd5 {
+    unsigned int            state[4];
+    Tcl_WideUInt            count;
+    unsigned char           buffer[64];
+};
+
+/*
+ * The digests a handle computes, as bits of 1<<DIGEST_*: the ones in
+ * '-digest' and the ones in '-expectdigest', a dict with the hex digits
+ * expected for some of them. The fields after 'expected' only mean
+ * something during a transfer: while watching, the body goes through
+ * curlDigestWrite before the handle's write function.
+ */
+struct curlDigestData {
+    int                     algorithms;
+    Tcl_Obj                *varName;
+    int                     expectedAlgorithms;
+    Tcl_Obj                *expected;
+
+    int                     watching;
+    curl_write_callback     writeFunction;
+    void                   *writeData;
+    int                     computing;
+    struct curlSha256       sha256;
+    struct curlMd5          md5;
+    unsigned int            crc32c;
+};
+
+size_t curlDigestWrite(char *ptr,size_t size,size_t nmemb,void *curlDataPtr);
+
+#ifdef  __cplusplus
+}
+#endif
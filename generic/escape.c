@@ -0,0 +1,486 @@
+/*
+ * escape.c --
+ *
+ * Implementation of the part of the TclCurl extension that URL encodes
+ * and decodes strings and builds and parses query strings.
+ *
+ * The work is done here instead of in 'curl_easy_escape', which stops
+ * at the first NUL and needs a copy of every string, so a whole list or
+ * query string is done in one pass over its bytes.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#include "escape.h"
+#include <limits.h>
+
+static const Tcl_ObjType   *byteArrayType=NULL;
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Tclcurl_EscapeInit --
+ *
+ *  This procedure creates the commands to encode and decode strings.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Tclcurl_EscapeInit (Tcl_Interp *interp) {
+
+    byteArrayType=Tcl_GetObjType("bytearray");
+
+    Tcl_CreateObjCommand (interp,"::curl::escape",curlEscape,
+            (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
+    Tcl_CreateObjCommand (interp,"::curl::unescape",curlUnescape,
+            (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
+    Tcl_CreateObjCommand (interp,"::curl::buildquery",curlBuildQuery,
+            (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
+    Tcl_CreateObjCommand (interp,"::curl::parsequery",curlParseQuery,
+            (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlEscape --
+ *
+ *  This function is invoked to process the "curl::escape" Tcl command.
+ *  See the user documentation for details on what it does.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+curlEscape(ClientData clientData, Tcl_Interp *interp,
+    int objc,Tcl_Obj *const objv[]) {
+
+    Tcl_Obj                  *resultObj,**elemv;
+    Tcl_DString               bytes,buffer;
+    const unsigned char      *bytesPtr;
+    int                       tableIndex,elemc,length,i;
+
+    if ((objc!=2)&&(objc!=3)) {
+        Tcl_WrongNumArgs(interp,1,objv,"?-list? string");
+        return TCL_ERROR;
+    }
+    if (objc==3) {
+        if (Tcl_GetIndexFromObj(interp,objv[1],escapeOptionTable,"option",
+                TCL_EXACT,&tableIndex)==TCL_ERROR) {
+            return TCL_ERROR;
+        }
+        if (Tcl_ListObjGetElements(interp,objv[2],&elemc,&elemv)==TCL_ERROR) {
+            return TCL_ERROR;
+        }
+    } else {
+        elemc=1;
+        elemv=(Tcl_Obj **)&objv[1];
+    }
+
+    resultObj=Tcl_NewListObj(0,NULL);
+    Tcl_DStringInit(&buffer);
+    for (i=0;i<elemc;i++) {
+        Tcl_DStringInit(&bytes);
+        Tcl_DStringSetLength(&buffer,0);
+        bytesPtr=curlEscapeGetBytes(elemv[i],&length,&bytes);
+        if (curlEscapeAppend(interp,&buffer,bytesPtr,length)==TCL_ERROR) {
+            Tcl_DStringFree(&bytes);
+            Tcl_DStringFree(&buffer);
+            Tcl_DecrRefCount(resultObj);
+            return TCL_ERROR;
+        }
+        Tcl_DStringFree(&bytes);
+        if (objc==2) {
+            Tcl_DecrRefCount(resultObj);
+            Tcl_DStringResult(interp,&buffer);
+            return TCL_OK;
+        }
+        Tcl_ListObjAppendElement(NULL,resultObj,Tcl_NewStringObj(
+                Tcl_DStringValue(&buffer),Tcl_DStringLength(&buffer)));
+    }
+    Tcl_DStringFree(&buffer);
+    Tcl_SetObjResult(interp,resultObj);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlUnescape --
+ *
+ *  This function is invoked to process the "curl::unescape" Tcl command.
+ *  See the user documentation for details on what it does.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+curlUnescape(ClientData clientData, Tcl_Interp *interp,
+    int objc,Tcl_Obj *const objv[]) {
+
+    Tcl_Obj                  *resultObj,**elemv;
+    Tcl_DString               buffer;
+    const char               *string;
+    int                       tableIndex,elemc,length,plain,i;
+
+    if ((objc!=2)&&(objc!=3)) {
+        Tcl_WrongNumArgs(interp,1,objv,"?-list? string");
+        return TCL_ERROR;
+    }
+    if (objc==3) {
+        if (Tcl_GetIndexFromObj(interp,objv[1],escapeOptionTable,"option",
+                TCL_EXACT,&tableIndex)==TCL_ERROR) {
+            return TCL_ERROR;
+        }
+        if (Tcl_ListObjGetElements(interp,objv[2],&elemc,&elemv)==TCL_ERROR) {
+            return TCL_ERROR;
+        }
+    } else {
+        elemc=1;
+        elemv=(Tcl_Obj **)&objv[1];
+    }
+
+    resultObj=(objc==3)?Tcl_NewListObj(0,NULL):NULL;
+    Tcl_DStringInit(&buffer);
+    for (i=0;i<elemc;i++) {
+        Tcl_DStringSetLength(&buffer,0);
+        string=Tcl_GetStringFromObj(elemv[i],&length);
+        plain=curlUnescapeAppend(&buffer,string,length,0);
+        if (resultObj==NULL) {
+            resultObj=curlUnescapeObj(&buffer,plain);
+        } else {
+            Tcl_ListObjAppendElement(NULL,resultObj,curlUnescapeObj(&buffer,plain));
+        }
+    }
+    Tcl_DStringFree(&buffer);
+    Tcl_SetObjResult(interp,resultObj);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlBuildQuery --
+ *
+ *  This function is invoked to process the "curl::buildquery" Tcl
+ *  command, it encodes a list of names and values as a query string.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+curlBuildQuery(ClientData clientData, Tcl_Interp *interp,
+    int objc,Tcl_Obj *const objv[]) {
+
+    Tcl_Obj                 **elemv;
+    Tcl_DString               bytes,buffer;
+    const unsigned char      *bytesPtr;
+    int                       elemc,length,i;
+
+    if (objc!=2) {
+        Tcl_WrongNumArgs(interp,1,objv,"pairs");
+        return TCL_ERROR;
+    }
+    if (Tcl_ListObjGetElements(interp,objv[1],&elemc,&elemv)==TCL_ERROR) {
+        return TCL_ERROR;
+    }
+    if (elemc&1) {
+        Tcl_SetObjResult(interp,Tcl_NewStringObj(
+                "list must have an even number of elements",-1));
+        return TCL_ERROR;
+    }
+
+    Tcl_DStringInit(&buffer);
+    for (i=0;i<elemc;i++) {
+        if (i!=0) {
+            Tcl_DStringAppend(&buffer,(i&1)?"=":"&",1);
+        }
+        Tcl_DStringInit(&bytes);
+        bytesPtr=curlEscapeGetBytes(elemv[i],&length,&bytes);
+        if (curlEscapeAppend(interp,&buffer,bytesPtr,length)==TCL_ERROR) {
+            Tcl_DStringFree(&bytes);
+            Tcl_DStringFree(&buffer);
+            return TCL_ERROR;
+        }
+        Tcl_DStringFree(&bytes);
+    }
+    Tcl_DStringResult(interp,&buffer);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlParseQuery --
+ *
+ *  This function is invoked to process the "curl::parsequery" Tcl
+ *  command, it decodes a query string, or the body of a form, into a
+ *  list of names and values.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+curlParseQuery(ClientData clientData, Tcl_Interp *interp,
+    int objc,Tcl_Obj *const objv[]) {
+
+    Tcl_Obj                  *resultObj;
+    Tcl_DString               buffer;
+    const char               *string,*end,*pairEnd,*equal;
+    int                       length,plain;
+
+    if (objc!=2) {
+        Tcl_WrongNumArgs(interp,1,objv,"query");
+        return TCL_ERROR;
+    }
+    string=Tcl_GetStringFromObj(objv[1],&length);
+    end=string+length;
+    if ((string<end)&&(*string=='?')) {
+        string++;
+    }
+
+    resultObj=Tcl_NewListObj(0,NULL);
+    Tcl_DStringInit(&buffer);
+    for (;string<end;string=pairEnd+1) {
+        pairEnd=memchr(string,'&',end-string);
+        if (pairEnd==NULL) {
+            pairEnd=end;
+        }
+        if (pairEnd==string) {
+            continue;
+        }
+        equal=memchr(string,'=',pairEnd-string);
+        if (equal==NULL) {
+            equal=pairEnd;
+        }
+        Tcl_DStringSetLength(&buffer,0);
+        plain=curlUnescapeAppend(&buffer,string,(int)(equal-string),1);
+        Tcl_ListObjAppendElement(NULL,resultObj,curlUnescapeObj(&buffer,plain));
+
+        Tcl_DStringSetLength(&buffer,0);
+        if (equal<pairEnd) {
+            equal++;
+        }
+        plain=curlUnescapeAppend(&buffer,equal,(int)(pairEnd-equal),1);
+        Tcl_ListObjAppendElement(NULL,resultObj,curlUnescapeObj(&buffer,plain));
+    }
+    Tcl_DStringFree(&buffer);
+    Tcl_SetObjResult(interp,resultObj);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlEscapeGetBytes --
+ *
+ *  Gets the bytes to encode from a Tcl object, a byte array is used as
+ *  it is, a string as UTF-8. Tcl keeps the NUL character as two bytes,
+ *  those are turned back into one, in 'bufferPtr' so the object is left
+ *  alone.
+ *
+ * Parameter:
+ *  objPtr: The object with the data.
+ *  lengthPtr: Where to put the number of bytes.
+ *  bufferPtr: An initialized DString the caller frees afterwards.
+ *
+ * Results:
+ *  A pointer to the bytes.
+ *
+ *----------------------------------------------------------------------
+ */
+const unsigned char *
+curlEscapeGetBytes(Tcl_Obj *objPtr,int *lengthPtr,Tcl_DString *bufferPtr) {
+    const char                *string,*nulPtr;
+    int                        length;
+
+    if ((objPtr->typePtr==byteArrayType)&&(objPtr->bytes==NULL)) {
+        return Tcl_GetByteArrayFromObj(objPtr,lengthPtr);
+    }
+    string=Tcl_GetStringFromObj(objPtr,&length);
+    *lengthPtr=length;
+    if (memchr(string,0xC0,length)==NULL) {
+        return (const unsigned char *)string;
+    }
+    while ((nulPtr=memchr(string,0xC0,length))!=NULL) {
+        if ((nulPtr+1<string+length)&&((unsigned char)nulPtr[1]==0x80)) {
+            Tcl_DStringAppend(bufferPtr,string,(int)(nulPtr-string)+1);
+            Tcl_DStringValue(bufferPtr)[Tcl_DStringLength(bufferPtr)-1]='\0';
+            nulPtr++;
+        } else {
+            Tcl_DStringAppend(bufferPtr,string,(int)(nulPtr-string)+1);
+        }
+        length-=(int)(nulPtr-string)+1;
+        string=nulPtr+1;
+    }
+    Tcl_DStringAppend(bufferPtr,string,length);
+    *lengthPtr=Tcl_DStringLength(bufferPtr);
+
+    return (const unsigned char *)Tcl_DStringValue(bufferPtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlEscapeAppend --
+ *
+ *  URL encodes 'length' bytes, appending them to a DString. Every byte
+ *  that isn't unreserved becomes '%XX'.
+ *
+ * Results:
+ *  A standard Tcl result, it fails only if the result would be too big.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+curlEscapeAppend(Tcl_Interp *interp,Tcl_DString *dsPtr,
+        const unsigned char *bytes,int length) {
+    static const char          hexDigits[]="0123456789ABCDEF";
+    char                      *out;
+    int                        start,used,i;
+
+    start=Tcl_DStringLength(dsPtr);
+    if (length>(INT_MAX-start)/3) {
+        Tcl_SetObjResult(interp,Tcl_NewStringObj("string too long to escape",-1));
+        return TCL_ERROR;
+    }
+    Tcl_DStringSetLength(dsPtr,start+length*3);
+    out=Tcl_DStringValue(dsPtr)+start;
+    for (i=0,used=0;i<length;i++) {
+        if (escapeUnreserved[bytes[i]]) {
+            out[used++]=bytes[i];
+        } else {
+            out[used++]='%';
+            out[used++]=hexDigits[bytes[i]>>4];
+            out[used++]=hexDigits[bytes[i]&0x0F];
+        }
+    }
+    Tcl_DStringSetLength(dsPtr,start+used);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlHexValue --
+ *
+ *  Returns the value of a hexadecimal digit, -1 if it isn't one.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+curlHexValue(unsigned char digit) {
+
+    if ((digit>='0')&&(digit<='9')) {
+        return digit-'0';
+    }
+    digit|=0x20;
+    if ((digit>='a')&&(digit<='f')) {
+        return digit-'a'+10;
+    }
+    return -1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlUnescapeAppend --
+ *
+ *  Decodes 'length' bytes of a URL encoded string, appending them to a
+ *  DString. A '%' not followed by two hexadecimal digits is left as it
+ *  is, with 'form' set a '+' is a space, as in the body of forms.
+ *
+ * Results:
+ *  '1' if all the decoded bytes are ASCII characters other than NUL,
+ *  '0' otherwise.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+curlUnescapeAppend(Tcl_DString *dsPtr,const char *string,int length,
+        int form) {
+    const unsigned char       *in=(const unsigned char *)string;
+    unsigned char             *out;
+    int                        start,used,high,low,plain=1,i;
+
+    start=Tcl_DStringLength(dsPtr);
+    Tcl_DStringSetLength(dsPtr,start+length);
+    out=(unsigned char *)Tcl_DStringValue(dsPtr)+start;
+    for (i=0,used=0;i<length;i++) {
+        if ((in[i]=='%')&&(i+2<length)
+                &&((high=curlHexValue(in[i+1]))>=0)
+                &&((low=curlHexValue(in[i+2]))>=0)) {
+            out[used]=(unsigned char)((high<<4)|low);
+            i+=2;
+        } else if (form&&(in[i]=='+')) {
+            out[used]=' ';
+        } else {
+            out[used]=in[i];
+        }
+        if ((out[used]==0)||(out[used]>=0x80)) {
+            plain=0;
+        }
+        used++;
+    }
+    Tcl_DStringSetLength(dsPtr,start+used);
+
+    return plain;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlUnescapeObj --
+ *
+ *  Makes a Tcl string out of decoded bytes, taken as UTF-8.
+ *
+ * Parameter:
+ *  dsPtr: The decoded bytes.
+ *  plain: What 'curlUnescapeAppend' returned, if set the bytes are
+ *         used as they are.
+ *
+ * Results:
+ *  A new Tcl object.
+ *
+ *----------------------------------------------------------------------
+ */
+Tcl_Obj *
+curlUnescapeObj(Tcl_DString *dsPtr,int plain) {
+    Tcl_Encoding               utf8;
+    Tcl_DString                utfString;
+    Tcl_Obj                   *resultObj;
+
+    if (plain) {
+        return Tcl_NewStringObj(Tcl_DStringValue(dsPtr),Tcl_DStringLength(dsPtr));
+    }
+    utf8=Tcl_GetEncoding(NULL,"utf-8");
+    Tcl_ExternalToUtfDString(utf8,Tcl_DStringValue(dsPtr),
+            Tcl_DStringLength(dsPtr),&utfString);
+    Tcl_FreeEncoding(utf8);
+    resultObj=Tcl_NewStringObj(Tcl_DStringValue(&utfString),
+            Tcl_DStringLength(&utfString));
+    Tcl_DStringFree(&utfString);
+
+    return resultObj;
+}
@@ -0,0 +1,65 @@
+/*
+ * escape.h --
+ *
+ * Header file for the part of the TclCurl extension that URL encodes
+ * and decodes strings and query strings.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#define escape_h
+#include "tclcurl.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The bytes that are left alone when encoding, the unreserved characters
+ * of RFC 3986, the same ones 'curl_easy_escape' leaves alone.
+ */
+const static unsigned char escapeUnreserved[256] = {
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,0,    /* '-' '.'      */
+    1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,0,    /* '0' - '9'    */
+    0,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,    /* 'A' - 'O'    */
+    1,1,1,1,1,1,1,1,1,1,1,0,0,0,0,1,    /* 'P' - 'Z' '_'*/
+    0,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,    /* 'a' - 'o'    */
+    1,1,1,1,1,1,1,1,1,1,1,0,0,0,1,0,    /* 'p' - 'z' '~'*/
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+};
+
+const static char *escapeOptionTable[] = {
+    "-list", (char *)NULL
+};
+
+int curlEscape(ClientData clientData, Tcl_Interp *interp,
+    int objc,Tcl_Obj *const objv[]);
+int curlUnescape(ClientData clientData, Tcl_Interp *interp,
+    int objc,Tcl_Obj *const objv[]);
+int curlBuildQuery(ClientData clientData, Tcl_Interp *interp,
+    int objc,Tcl_Obj *const objv[]);
+int curlParseQuery(ClientData clientData, Tcl_Interp *interp,
+    int objc,Tcl_Obj *const objv[]);
+
+const unsigned char *curlEscapeGetBytes(Tcl_Obj *objPtr,int *lengthPtr,
+        Tcl_DString *bufferPtr);
+int curlEscapeAppend(Tcl_Interp *interp,Tcl_DString *dsPtr,
+        const unsigned char *bytes,int length);
+int curlUnescapeAppend(Tcl_DString *dsPtr,const char *string,int length,
+        int form);
+Tcl_Obj *curlUnescapeObj(Tcl_DString *dsPtr,int plain);
+
+#ifdef  __cplusplus
+}
+#endif
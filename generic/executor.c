@@ -0,0 +1,896 @@
+/*
+ * executor.c --
+ *
+ * Implementation of the part of the TclCurl extension that runs transfers
+ * in a pool of threads.
+ *
+ * Every worker thread of a 'curl::executor' has its own multi handle and
+ * takes the transfers from a queue shared by the workers. Any interpreter,
+ * in any thread, can submit a transfer to an executor by its name, and the
+ * result goes back to the thread that submitted it as an event. The
+ * workers share their DNS cache and TLS sessions through a share handle.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#include "executor.h"
+
+#if defined(TCL_THREADS) && CURL_AT_LEAST_VERSION(7, 68, 0)
+
+TCL_DECLARE_MUTEX(executorLock)
+
+static Tcl_HashTable    executors;
+static int              executorsInitialized=0;
+
+/*
+ * Guards the lists of pending transfers of the submitting threads.
+ */
+TCL_DECLARE_MUTEX(pendingLock)
+
+static Tcl_ThreadDataKey submitterKey;
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Tclcurl_ExecutorInit --
+ *
+ *  This procedure initializes the 'executor' part of the package.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Tclcurl_ExecutorInit (Tcl_Interp *interp) {
+
+    Tcl_MutexLock(&executorLock);
+    if (!executorsInitialized) {
+        Tcl_InitHashTable(&executors,TCL_STRING_KEYS);
+        executorsInitialized=1;
+    }
+    Tcl_MutexUnlock(&executorLock);
+
+    Tcl_CreateObjCommand (interp,"::curl::executor",curlExecutorObjCmd,
+            (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlExecutorObjCmd --
+ *
+ *  This procedure is invoked to process the "curl::executor" Tcl command.
+ *  See the user documentation for details on what it does.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlExecutorObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]) {
+
+    struct curlExecutor     *execPtr;
+    Tcl_HashEntry           *entryPtr;
+    Tcl_HashSearch           search;
+    Tcl_Obj                 *resultObj;
+    int                      tableIndex, code;
+
+    if (objc<2) {
+        Tcl_WrongNumArgs(interp,1,objv,"option ?arg ...?");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(interp,objv[1],executorCommandTable,"option",
+            TCL_EXACT,&tableIndex)==TCL_ERROR) {
+        return TCL_ERROR;
+    }
+    switch(tableIndex) {
+        case 0:
+            return curlExecutorCreate(interp,objc,objv);
+        case 1:
+            if (objc!=5) {
+                Tcl_WrongNumArgs(interp,2,objv,"executor spec command");
+                return TCL_ERROR;
+            }
+            /* The lock keeps the executor from going away meanwhile. */
+            Tcl_MutexLock(&executorLock);
+            entryPtr=Tcl_FindHashEntry(&executors,Tcl_GetString(objv[2]));
+            if (entryPtr==NULL) {
+                Tcl_MutexUnlock(&executorLock);
+                Tcl_SetObjResult(interp,Tcl_ObjPrintf(
+                        "\"%s\" is not an executor",Tcl_GetString(objv[2])));
+                return TCL_ERROR;
+            }
+            execPtr=(struct curlExecutor *)Tcl_GetHashValue(entryPtr);
+            code=curlExecutorSubmit(interp,execPtr,objv[3],objv[4]);
+            Tcl_MutexUnlock(&executorLock);
+            return code;
+        case 2:
+            if (objc!=2) {
+                Tcl_WrongNumArgs(interp,2,objv,"");
+                return TCL_ERROR;
+            }
+            resultObj=Tcl_NewListObj(0,NULL);
+            Tcl_MutexLock(&executorLock);
+            for (entryPtr=Tcl_FirstHashEntry(&executors,&search);entryPtr!=NULL;
+                    entryPtr=Tcl_NextHashEntry(&search)) {
+                Tcl_ListObjAppendElement(NULL,resultObj,Tcl_NewStringObj(
+                        Tcl_GetHashKey(&executors,entryPtr),-1));
+            }
+            Tcl_MutexUnlock(&executorLock);
+            Tcl_SetObjResult(interp,resultObj);
+            return TCL_OK;
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlExecutorCreate --
+ *
+ *  Creates an executor and its worker threads, its name is the first
+ *  free one of curlexec1, curlexec2... in the whole process, and a
+ *  command with that name is created in the interpreter.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlExecutorCreate(Tcl_Interp *interp,int objc,Tcl_Obj *const objv[]) {
+
+    struct curlExecutor     *execPtr;
+    struct curlExecWorker   *workerPtr;
+    Tcl_HashEntry           *entryPtr;
+    Tcl_CmdInfo              info;
+    char                     name[32];
+    int                      threads=4, tableIndex, i, isNew;
+
+    if (objc%2) {
+        Tcl_WrongNumArgs(interp,2,objv,"?-threads count?");
+        return TCL_ERROR;
+    }
+    for (i=2;i<objc;i+=2) {
+        if (Tcl_GetIndexFromObj(interp,objv[i],executorCreateTable,"option",
+                TCL_EXACT,&tableIndex)==TCL_ERROR) {
+            return TCL_ERROR;
+        }
+        if (Tcl_GetIntFromObj(interp,objv[i+1],&threads)!=TCL_OK) {
+            return TCL_ERROR;
+        }
+        if (threads<1) {
+            Tcl_SetObjResult(interp,Tcl_NewStringObj(
+                    "an executor needs at least one thread",-1));
+            return TCL_ERROR;
+        }
+    }
+
+    execPtr=(struct curlExecutor *)Tcl_Alloc(sizeof(struct curlExecutor));
+    memset(execPtr,0,sizeof(struct curlExecutor));
+
+    execPtr->share.shandle=curl_share_init();
+    if (execPtr->share.shandle==NULL) {
+        Tcl_Free((char *)execPtr);
+        Tcl_SetObjResult(interp,Tcl_NewStringObj("Couldn't create share handle",-1));
+        return TCL_ERROR;
+    }
+    curl_share_setopt(execPtr->share.shandle,CURLSHOPT_LOCKFUNC,curlShareLockFunc);
+    curl_share_setopt(execPtr->share.shandle,CURLSHOPT_UNLOCKFUNC,curlShareUnLockFunc);
+    curl_share_setopt(execPtr->share.shandle,CURLSHOPT_USERDATA,&execPtr->share);
+    curl_share_setopt(execPtr->share.shandle,CURLSHOPT_SHARE,CURL_LOCK_DATA_DNS);
+    curl_share_setopt(execPtr->share.shandle,CURLSHOPT_SHARE,CURL_LOCK_DATA_SSL_SESSION);
+
+    Tcl_MutexLock(&executorLock);
+    for (i=1;;i++) {
+        sprintf(name,"curlexec%d",i);
+        if (Tcl_FindHashEntry(&executors,name)==NULL
+                &&!Tcl_GetCommandInfo(interp,name,&info)) {
+            break;
+        }
+    }
+    entryPtr=Tcl_CreateHashEntry(&executors,name,&isNew);
+    Tcl_SetHashValue(entryPtr,execPtr);
+    Tcl_MutexUnlock(&executorLock);
+
+    execPtr->name=curlstrdup(name);
+    execPtr->workerCount=threads;
+    execPtr->workers=(struct curlExecWorker *)Tcl_Alloc(
+            threads*sizeof(struct curlExecWorker));
+    memset(execPtr->workers,0,threads*sizeof(struct curlExecWorker));
+    for (i=0;i<threads;i++) {
+        workerPtr=&execPtr->workers[i];
+        workerPtr->execPtr=execPtr;
+        workerPtr->multi=curl_multi_init();
+        workerPtr->idle=(CURL **)Tcl_Alloc(EXECUTOR_MAX_ACTIVE*sizeof(CURL *));
+    }
+    for (i=0;i<threads;i++) {
+        workerPtr=&execPtr->workers[i];
+        if (Tcl_CreateThread(&workerPtr->threadId,curlExecWorkerProc,
+                (ClientData)workerPtr,TCL_THREAD_STACK_DEFAULT,
+                TCL_THREAD_JOINABLE)!=TCL_OK) {
+            /* The ones already running are told to go away. */
+            curlExecutorDestroy(execPtr);
+            Tcl_SetObjResult(interp,Tcl_NewStringObj("Couldn't create thread",-1));
+            return TCL_ERROR;
+        }
+        workerPtr->started=1;
+    }
+
+    execPtr->token=Tcl_CreateObjCommand(interp,name,curlExecutorInstanceObjCmd,
+            (ClientData)execPtr,(Tcl_CmdDeleteProc *)curlExecutorDeleteCmd);
+    Tcl_SetObjResult(interp,Tcl_NewStringObj(name,-1));
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlExecutorInstanceObjCmd --
+ *
+ *  This procedure is invoked to process the commands of the executors.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlExecutorInstanceObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]) {
+
+    struct curlExecutor     *execPtr=(struct curlExecutor *)clientData;
+    int                      tableIndex;
+
+    if (objc<2) {
+        Tcl_WrongNumArgs(interp,1,objv,"option ?arg ...?");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(interp,objv[1],executorObjCommandTable,"option",
+            TCL_EXACT,&tableIndex)==TCL_ERROR) {
+        return TCL_ERROR;
+    }
+    switch(tableIndex) {
+        case 0:
+            if (objc!=4) {
+                Tcl_WrongNumArgs(interp,2,objv,"spec command");
+                return TCL_ERROR;
+            }
+            return curlExecutorSubmit(interp,execPtr,objv[2],objv[3]);
+        case 1:
+            if (objc!=2) {
+                Tcl_WrongNumArgs(interp,2,objv,"");
+                return TCL_ERROR;
+            }
+            Tcl_DeleteCommandFromToken(interp,execPtr->token);
+            break;
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlExecutorDeleteCmd --
+ *
+ *  Invoked when the command of an executor is deleted, it destroys the
+ *  executor.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlExecutorDeleteCmd(ClientData clientData) {
+    curlExecutorDestroy((struct curlExecutor *)clientData);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlExecutorDestroy --
+ *
+ *  Stops the worker threads and waits for them. The transfers still
+ *  going on or waiting in the queue are reported as aborted.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlExecutorDestroy(struct curlExecutor *execPtr) {
+    struct curlExecWorker   *workerPtr;
+    struct curlExecJob      *jobPtr;
+    Tcl_HashEntry           *entryPtr;
+    int                      i, result;
+
+    Tcl_MutexLock(&executorLock);
+    entryPtr=Tcl_FindHashEntry(&executors,execPtr->name);
+    if (entryPtr!=NULL) {
+        Tcl_DeleteHashEntry(entryPtr);
+    }
+    Tcl_MutexUnlock(&executorLock);
+
+    Tcl_MutexLock(&execPtr->mutex);
+    execPtr->shutdown=1;
+    Tcl_MutexUnlock(&execPtr->mutex);
+
+    /* The workers clean up their own handles before they exit. */
+    for (i=0;i<execPtr->workerCount;i++) {
+        workerPtr=&execPtr->workers[i];
+        if (workerPtr->started) {
+            curl_multi_wakeup(workerPtr->multi);
+            Tcl_JoinThread(workerPtr->threadId,&result);
+        } else {
+            curl_multi_cleanup(workerPtr->multi);
+            Tcl_Free((char *)workerPtr->idle);
+        }
+    }
+    while ((jobPtr=execPtr->queueFirst)!=NULL) {
+        execPtr->queueFirst=jobPtr->next;
+        curlExecJobDeliver(jobPtr,CURLE_ABORTED_BY_CALLBACK);
+    }
+    Tcl_Free((char *)execPtr->workers);
+
+    curl_share_cleanup(execPtr->share.shandle);
+    for (i=0;i<CURL_LOCK_DATA_LAST;i++) {
+        Tcl_ConditionFinalize(&execPtr->share.locks[i].cond);
+        Tcl_MutexFinalize(&execPtr->share.locks[i].mutex);
+    }
+    Tcl_MutexFinalize(&execPtr->mutex);
+    Tcl_Free(execPtr->name);
+    Tcl_Free((char *)execPtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlExecutorSubmit --
+ *
+ *  Queues a transfer in an executor and wakes up its workers.
+ *
+ * Parameters:
+ *  interp: The interpreter that will get the result.
+ *  execPtr: The executor.
+ *  specObj: A dict with the options of the transfer.
+ *  commandObj: The command to invoke with the result.
+ *
+ * Results:
+ *  A standard Tcl result, the id of the transfer.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlExecutorSubmit(Tcl_Interp *interp,struct curlExecutor *execPtr,
+        Tcl_Obj *specObj,Tcl_Obj *commandObj) {
+
+    struct curlExecJob      *jobPtr;
+    int                      i;
+
+    jobPtr=curlExecJobNew(interp,specObj);
+    if (jobPtr==NULL) {
+        return TCL_ERROR;
+    }
+    jobPtr->threadId=Tcl_GetCurrentThread();
+    jobPtr->interp=interp;
+    Tcl_Preserve((ClientData)interp);
+    jobPtr->command=commandObj;
+    Tcl_IncrRefCount(commandObj);
+    curlExecPendingAdd(jobPtr);
+
+    Tcl_MutexLock(&execPtr->mutex);
+    jobPtr->id=++execPtr->nextId;
+    if (execPtr->queueLast==NULL) {
+        execPtr->queueFirst=jobPtr;
+    } else {
+        execPtr->queueLast->next=jobPtr;
+    }
+    execPtr->queueLast=jobPtr;
+    Tcl_MutexUnlock(&execPtr->mutex);
+
+    for (i=0;i<execPtr->workerCount;i++) {
+        curl_multi_wakeup(execPtr->workers[i].multi);
+    }
+
+    Tcl_SetObjResult(interp,Tcl_NewIntObj(jobPtr->id));
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlExecJobNew --
+ *
+ *  Creates a transfer from the dict with its options, the values are
+ *  copied so the worker threads don't need any Tcl object.
+ *
+ * Results:
+ *  The new transfer, NULL in case of error.
+ *
+ *----------------------------------------------------------------------
+ */
+
+struct curlExecJob *
+curlExecJobNew(Tcl_Interp *interp,Tcl_Obj *specObj) {
+
+    struct curlExecJob      *jobPtr;
+    struct curlExecOption   *optionPtr;
+    Tcl_DictSearch           search;
+    Tcl_Obj                 *keyObj, *valueObj, **elements;
+    int                      size, done, tableIndex, count, i;
+    char                    *string;
+
+    if (Tcl_DictObjSize(interp,specObj,&size)!=TCL_OK) {
+        return NULL;
+    }
+    jobPtr=(struct curlExecJob *)Tcl_Alloc(sizeof(struct curlExecJob));
+    memset(jobPtr,0,sizeof(struct curlExecJob));
+    jobPtr->options=(struct curlExecOption *)Tcl_Alloc(
+            (size+1)*sizeof(struct curlExecOption));
+    memset(jobPtr->options,0,(size+1)*sizeof(struct curlExecOption));
+
+    Tcl_DictObjFirst(interp,specObj,&search,&keyObj,&valueObj,&done);
+    for (;!done;Tcl_DictObjNext(&search,&keyObj,&valueObj,&done)) {
+        if (Tcl_GetIndexFromObj(interp,keyObj,executorOptionTable,"option",
+                TCL_EXACT,&tableIndex)==TCL_ERROR) {
+            goto error;
+        }
+        optionPtr=&jobPtr->options[jobPtr->optionCount++];
+        optionPtr->option=executorOptions[tableIndex];
+        optionPtr->type=executorOptionTypes[tableIndex];
+        switch(optionPtr->type) {
+            case EXECUTOR_STRING:
+                string=Tcl_GetStringFromObj(valueObj,&optionPtr->length);
+                optionPtr->string=Tcl_Alloc(optionPtr->length+1);
+                memcpy(optionPtr->string,string,optionPtr->length+1);
+                break;
+            case EXECUTOR_LONG:
+                if (Tcl_GetLongFromObj(interp,valueObj,&optionPtr->number)!=TCL_OK) {
+                    goto error;
+                }
+                break;
+            case EXECUTOR_LIST:
+                if (Tcl_ListObjGetElements(interp,valueObj,&count,&elements)!=TCL_OK) {
+                    goto error;
+                }
+                for (i=0;i<count;i++) {
+                    optionPtr->list=curl_slist_append(optionPtr->list,
+                            Tcl_GetString(elements[i]));
+                }
+                break;
+        }
+    }
+    Tcl_DictObjDone(&search);
+    return jobPtr;
+
+error:
+    Tcl_DictObjDone(&search);
+    curlExecJobFree(jobPtr);
+    return NULL;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlExecJobFree --
+ *
+ *  Frees a transfer, the command and the interpreter are the business
+ *  of the submitting thread.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlExecJobFree(struct curlExecJob *jobPtr) {
+    int          i;
+
+    for (i=0;i<jobPtr->optionCount;i++) {
+        Tcl_Free(jobPtr->options[i].string);
+        curl_slist_free_all(jobPtr->options[i].list);
+    }
+    Tcl_Free((char *)jobPtr->options);
+    Tcl_Free(jobPtr->body);
+    Tcl_Free((char *)jobPtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlExecJobDeliver --
+ *
+ *  Sends a finished transfer back to the thread that submitted it, or
+ *  frees it if that thread is gone.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlExecJobDeliver(struct curlExecJob *jobPtr,CURLcode result) {
+    struct curlExecEvent    *eventPtr;
+
+    jobPtr->result=result;
+    Tcl_MutexLock(&pendingLock);
+    if (jobPtr->submitterPtr==NULL) {
+        /* curlExecThreadExit already let go of the command and interp. */
+        Tcl_MutexUnlock(&pendingLock);
+        curlExecJobFree(jobPtr);
+        return;
+    }
+    jobPtr->delivered=1;
+    eventPtr=(struct curlExecEvent *)Tcl_Alloc(sizeof(struct curlExecEvent));
+    eventPtr->header.proc=curlExecEventProc;
+    eventPtr->jobPtr=jobPtr;
+    Tcl_ThreadQueueEvent(jobPtr->threadId,(Tcl_Event *)eventPtr,TCL_QUEUE_TAIL);
+    Tcl_ThreadAlert(jobPtr->threadId);
+    Tcl_MutexUnlock(&pendingLock);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlExecEventProc --
+ *
+ *  Invoked in the submitting thread when a transfer is done, it invokes
+ *  its command with the result.
+ *
+ * Results:
+ *  1, the event has been taken care of.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlExecEventProc(Tcl_Event *evPtr,int flags) {
+    struct curlExecJob      *jobPtr=((struct curlExecEvent *)evPtr)->jobPtr;
+    Tcl_Interp              *interp=jobPtr->interp;
+    Tcl_Obj                 *resultObj, *cmdObj;
+
+    curlExecPendingRemove(jobPtr);
+    if (!Tcl_InterpDeleted(interp)) {
+        resultObj=Tcl_NewDictObj();
+        Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("id",-1),
+                Tcl_NewIntObj(jobPtr->id));
+        Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("code",-1),
+                Tcl_NewIntObj(jobPtr->result));
+        Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("responsecode",-1),
+                Tcl_NewLongObj(jobPtr->responseCode));
+        Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("body",-1),
+                Tcl_NewByteArrayObj((unsigned char *)jobPtr->body,(int)jobPtr->size));
+        Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("time",-1),
+                Tcl_NewDoubleObj(jobPtr->totalTime));
+
+        cmdObj=Tcl_DuplicateObj(jobPtr->command);
+        Tcl_IncrRefCount(cmdObj);
+        if (Tcl_ListObjAppendElement(interp,cmdObj,resultObj)!=TCL_OK
+                ||Tcl_EvalObjEx(interp,cmdObj,TCL_EVAL_GLOBAL)!=TCL_OK) {
+            Tcl_BackgroundError(interp);
+        }
+        Tcl_DecrRefCount(cmdObj);
+    }
+    Tcl_DecrRefCount(jobPtr->command);
+    Tcl_Release((ClientData)interp);
+    curlExecJobFree(jobPtr);
+
+    return 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlExecPendingAdd, curlExecPendingRemove --
+ *
+ *  Keep the list of the transfers a thread submitted and hasn't got
+ *  back yet, the first time a thread submits one it gets an exit
+ *  handler.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlExecPendingAdd(struct curlExecJob *jobPtr) {
+    struct curlExecSubmitter *submitterPtr;
+
+    submitterPtr=(struct curlExecSubmitter *)Tcl_GetThreadData(&submitterKey,
+            sizeof(struct curlExecSubmitter));
+    if (!submitterPtr->initialized) {
+        Tcl_CreateThreadExitHandler(curlExecThreadExit,(ClientData)submitterPtr);
+        submitterPtr->initialized=1;
+    }
+    Tcl_MutexLock(&pendingLock);
+    jobPtr->submitterPtr=submitterPtr;
+    jobPtr->pendingPrev=NULL;
+    jobPtr->pendingNext=submitterPtr->pendingFirst;
+    if (submitterPtr->pendingFirst!=NULL) {
+        submitterPtr->pendingFirst->pendingPrev=jobPtr;
+    }
+    submitterPtr->pendingFirst=jobPtr;
+    Tcl_MutexUnlock(&pendingLock);
+}
+
+void
+curlExecPendingRemove(struct curlExecJob *jobPtr) {
+
+    Tcl_MutexLock(&pendingLock);
+    if (jobPtr->pendingPrev!=NULL) {
+        jobPtr->pendingPrev->pendingNext=jobPtr->pendingNext;
+    } else {
+        jobPtr->submitterPtr->pendingFirst=jobPtr->pendingNext;
+    }
+    if (jobPtr->pendingNext!=NULL) {
+        jobPtr->pendingNext->pendingPrev=jobPtr->pendingPrev;
+    }
+    jobPtr->pendingPrev=jobPtr->pendingNext=NULL;
+    Tcl_MutexUnlock(&pendingLock);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlExecThreadExit --
+ *
+ *  Invoked when a thread that submitted transfers exits, the ones it
+ *  hasn't got back are dropped: their commands and interpreters are
+ *  let go of here, in their thread. Those still in an executor are
+ *  freed when they are done, those whose event is queued now, as the
+ *  event will never be processed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlExecThreadExit(ClientData clientData) {
+    struct curlExecSubmitter *submitterPtr=(struct curlExecSubmitter *)clientData;
+    struct curlExecJob      *jobPtr, *nextPtr, *deliveredFirst=NULL;
+
+    /* Once the lock is released, a worker may free the ones it has. */
+    Tcl_MutexLock(&pendingLock);
+    for (jobPtr=submitterPtr->pendingFirst;jobPtr!=NULL;jobPtr=nextPtr) {
+        nextPtr=jobPtr->pendingNext;
+        Tcl_DecrRefCount(jobPtr->command);
+        Tcl_Release((ClientData)jobPtr->interp);
+        jobPtr->command=NULL;
+        jobPtr->interp=NULL;
+        jobPtr->submitterPtr=NULL;
+        if (jobPtr->delivered) {
+            jobPtr->pendingNext=deliveredFirst;
+            deliveredFirst=jobPtr;
+        }
+    }
+    submitterPtr->pendingFirst=NULL;
+    Tcl_MutexUnlock(&pendingLock);
+
+    for (jobPtr=deliveredFirst;jobPtr!=NULL;jobPtr=nextPtr) {
+        nextPtr=jobPtr->pendingNext;
+        curlExecJobFree(jobPtr);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlExecWorkerProc --
+ *
+ *  The main loop of the worker threads: they take transfers from the
+ *  queue while they have room for them, and drive their multi handle
+ *  until they are told to stop.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Tcl_ThreadCreateType
+curlExecWorkerProc(ClientData clientData) {
+    struct curlExecWorker   *workerPtr=(struct curlExecWorker *)clientData;
+    struct curlExecutor     *execPtr=workerPtr->execPtr;
+    struct curlExecJob      *jobPtr, *startFirst, *startLast;
+    CURLMsg                 *multiInfo;
+    int                      running, msgLeft, i;
+
+    while (1) {
+        startFirst=startLast=NULL;
+        Tcl_MutexLock(&execPtr->mutex);
+        if (execPtr->shutdown) {
+            Tcl_MutexUnlock(&execPtr->mutex);
+            break;
+        }
+        while (workerPtr->active<EXECUTOR_MAX_ACTIVE&&execPtr->queueFirst!=NULL) {
+            jobPtr=execPtr->queueFirst;
+            execPtr->queueFirst=jobPtr->next;
+            if (execPtr->queueFirst==NULL) {
+                execPtr->queueLast=NULL;
+            }
+            jobPtr->next=NULL;
+            if (startLast==NULL) {
+                startFirst=jobPtr;
+            } else {
+                startLast->next=jobPtr;
+            }
+            startLast=jobPtr;
+            workerPtr->active++;
+        }
+        Tcl_MutexUnlock(&execPtr->mutex);
+
+        while ((jobPtr=startFirst)!=NULL) {
+            startFirst=jobPtr->next;
+            jobPtr->next=NULL;
+            curlExecWorkerStart(workerPtr,jobPtr);
+        }
+
+        curl_multi_perform(workerPtr->multi,&running);
+        while ((multiInfo=curl_multi_info_read(workerPtr->multi,&msgLeft))!=NULL) {
+            if (multiInfo->msg==CURLMSG_DONE) {
+                curlExecWorkerFinish(workerPtr,multiInfo->easy_handle,
+                        multiInfo->data.result);
+            }
+        }
+        curl_multi_poll(workerPtr->multi,NULL,0,1000,NULL);
+    }
+
+    /* The transfers still going on are aborted. */
+    while ((jobPtr=workerPtr->activeFirst)!=NULL) {
+        curlExecWorkerFinish(workerPtr,jobPtr->easy,CURLE_ABORTED_BY_CALLBACK);
+    }
+
+    for (i=0;i<workerPtr->idleCount;i++) {
+        curl_easy_cleanup(workerPtr->idle[i]);
+    }
+    Tcl_Free((char *)workerPtr->idle);
+    curl_multi_cleanup(workerPtr->multi);
+
+    Tcl_ExitThread(0);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlExecWorkerStart --
+ *
+ *  Starts a transfer in a worker, with one of its idle handles if it
+ *  has any.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlExecWorkerStart(struct curlExecWorker *workerPtr,struct curlExecJob *jobPtr) {
+    struct curlExecOption   *optionPtr;
+    CURL                    *easy;
+    int                      i;
+
+    if (workerPtr->idleCount>0) {
+        easy=workerPtr->idle[--workerPtr->idleCount];
+    } else {
+        easy=curl_easy_init();
+        if (easy==NULL) {
+            workerPtr->active--;
+            curlExecJobDeliver(jobPtr,CURLE_OUT_OF_MEMORY);
+            return;
+        }
+    }
+    curl_easy_setopt(easy,CURLOPT_SHARE,workerPtr->execPtr->share.shandle);
+    curl_easy_setopt(easy,CURLOPT_NOSIGNAL,1L);
+    curl_easy_setopt(easy,CURLOPT_WRITEFUNCTION,curlExecWrite);
+    curl_easy_setopt(easy,CURLOPT_WRITEDATA,jobPtr);
+    curl_easy_setopt(easy,CURLOPT_PRIVATE,jobPtr);
+    for (i=0;i<jobPtr->optionCount;i++) {
+        optionPtr=&jobPtr->options[i];
+        switch(optionPtr->type) {
+            case EXECUTOR_STRING:
+                if (optionPtr->option==CURLOPT_COPYPOSTFIELDS) {
+                    curl_easy_setopt(easy,CURLOPT_POSTFIELDSIZE,(long)optionPtr->length);
+                }
+                curl_easy_setopt(easy,optionPtr->option,optionPtr->string);
+                break;
+            case EXECUTOR_LONG:
+                curl_easy_setopt(easy,optionPtr->option,optionPtr->number);
+                break;
+            case EXECUTOR_LIST:
+                curl_easy_setopt(easy,optionPtr->option,optionPtr->list);
+                break;
+        }
+    }
+
+    jobPtr->easy=easy;
+    jobPtr->next=workerPtr->activeFirst;
+    workerPtr->activeFirst=jobPtr;
+    if (curl_multi_add_handle(workerPtr->multi,easy)!=CURLM_OK) {
+        curlExecWorkerFinish(workerPtr,easy,CURLE_FAILED_INIT);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlExecWorkerFinish --
+ *
+ *  Takes a finished transfer out of a worker, keeps its handle for the
+ *  next one and sends the result back.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlExecWorkerFinish(struct curlExecWorker *workerPtr,CURL *easy,CURLcode result) {
+    struct curlExecJob      *jobPtr;
+    struct curlExecJob     **prevPtr;
+
+    curl_easy_getinfo(easy,CURLINFO_PRIVATE,(char **)&jobPtr);
+    curl_easy_getinfo(easy,CURLINFO_RESPONSE_CODE,&jobPtr->responseCode);
+    curl_easy_getinfo(easy,CURLINFO_TOTAL_TIME,&jobPtr->totalTime);
+    if (result!=CURLE_ABORTED_BY_CALLBACK) {
+        curlStatsRecord(easy,result);
+    }
+    curl_multi_remove_handle(workerPtr->multi,easy);
+
+    for (prevPtr=&workerPtr->activeFirst;*prevPtr!=NULL;prevPtr=&(*prevPtr)->next) {
+        if (*prevPtr==jobPtr) {
+            *prevPtr=jobPtr->next;
+            break;
+        }
+    }
+    jobPtr->next=NULL;
+    jobPtr->easy=NULL;
+    workerPtr->active--;
+
+    curl_easy_reset(easy);
+    if (workerPtr->idleCount<EXECUTOR_MAX_ACTIVE) {
+        workerPtr->idle[workerPtr->idleCount++]=easy;
+    } else {
+        curl_easy_cleanup(easy);
+    }
+
+    curlExecJobDeliver(jobPtr,result);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlExecWrite --
+ *
+ *  libcurl calls this function with the body of the transfers.
+ *
+ * Results:
+ *  The number of bytes taken.
+ *
+ *----------------------------------------------------------------------
+ */
+
+size_t
+curlExecWrite(char *ptr,size_t size,size_t nmemb,void *userdata) {
+    struct curlExecJob     *jobPtr=(struct curlExecJob *)userdata;
+    size_t                  realsize=size*nmemb;
+
+    if (jobPtr->size+realsize>jobPtr->capacity) {
+        jobPtr->capacity=2*jobPtr->capacity+realsize;
+        jobPtr->body=Tcl_Realloc(jobPtr->body,jobPtr->capacity);
+    }
+    memcpy(jobPtr->body+jobPtr->size,ptr,realsize);
+    jobPtr->size+=realsize;
+
+    return realsize;
+}
+
+#else
+
+/*
+ * Without threads, or with a libcurl without curl_multi_poll, there are
+ * no executors.
+ */
+
+int
+Tclcurl_ExecutorInit (Tcl_Interp *interp) {
+    return TCL_OK;
+}
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * executor.h --
+ *
+ * Header file for the part of the TclCurl extension that runs transfers
+ * in a pool of threads.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#define executor_h
+#include "tclcurl.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#if defined(TCL_THREADS) && CURL_AT_LEAST_VERSION(7, 68, 0)
+
+/*
+ * How many transfers a worker thread has going on at the same time, the
+ * rest wait in the queue of the executor.
+ */
+#define EXECUTOR_MAX_ACTIVE 64
+
+#define EXECUTOR_STRING     0
+#define EXECUTOR_LONG       1
+#define EXECUTOR_LIST       2
+
+/*
+ * An option of a transfer, parsed in the thread that submits it.
+ */
+struct curlExecOption {
+    CURLoption              option;
+    int                     type;
+    char                   *string;
+    int                     length;
+    long                    number;
+    struct curl_slist      *list;
+};
+
+struct curlExecSubmitter;
+
+/*
+ * A transfer, it goes from the submitting thread to a worker and back,
+ * only the submitting thread touches 'interp' and 'command'. Until its
+ * event is processed it is also in the list of pending transfers of
+ * 'submitterPtr', 'delivered' once the event is queued.
+ */
+struct curlExecJob {
+    int                     id;
+    Tcl_ThreadId            threadId;
+    Tcl_Interp             *interp;
+    Tcl_Obj                *command;
+    struct curlExecSubmitter *submitterPtr;
+    int                     delivered;
+    struct curlExecJob     *pendingPrev;
+    struct curlExecJob     *pendingNext;
+    int                     optionCount;
+    struct curlExecOption  *options;
+    CURLcode                result;
+    long                    responseCode;
+    double                  totalTime;
+    char                   *body;
+    size_t                  size;
+    size_t                  capacity;
+    CURL                   *easy;
+    struct curlExecJob     *next;
+};
+
+/*
+ * The thread specific data of a thread that submits transfers. If it
+ * exits before they come back, they are dropped.
+ */
+struct curlExecSubmitter {
+    int                     initialized;
+    struct curlExecJob     *pendingFirst;
+};
+
+struct curlExecEvent {
+    Tcl_Event               header;
+    struct curlExecJob     *jobPtr;
+};
+
+struct curlExecutor;
+
+struct curlExecWorker {
+    struct curlExecutor    *execPtr;
+    Tcl_ThreadId            threadId;
+    int                     started;
+    CURLM                  *multi;
+    int                     active;
+    struct curlExecJob     *activeFirst;
+    CURL                  **idle;
+    int                     idleCount;
+};
+
+struct curlExecutor {
+    char                   *name;
+    Tcl_Command             token;
+    Tcl_Mutex               mutex;
+    int                     shutdown;
+    int                     nextId;
+    struct curlExecJob     *queueFirst;
+    struct curlExecJob     *queueLast;
+    int                     workerCount;
+    struct curlExecWorker  *workers;
+    struct shcurlObjData    share;
+};
+
+const static char *executorCommandTable[] = {
+    "create", "submit", "names", (char *)NULL
+};
+
+const static char *executorObjCommandTable[] = {
+    "submit", "destroy", (char *)NULL
+};
+
+const static char *executorCreateTable[] = {
+    "-threads", (char *)NULL
+};
+
+/*
+ * The options a transfer can have, with their libcurl option and type.
+ */
+const static char *executorOptionTable[] = {
+    "-url",           "-useragent",     "-referer",       "-customrequest",
+    "-userpwd",       "-cookie",        "-postfields",    "-proxy",
+    "-range",         "-encoding",      "-timeout",       "-connecttimeout",
+    "-followlocation","-maxredirs",     "-nobody",        "-sslverifypeer",
+    "-sslverifyhost", "-failonerror",   "-httpheader",
+    (char *)NULL
+};
+
+const static CURLoption executorOptions[] = {
+    CURLOPT_URL,            CURLOPT_USERAGENT,      CURLOPT_REFERER,
+    CURLOPT_CUSTOMREQUEST,  CURLOPT_USERPWD,        CURLOPT_COOKIE,
+    CURLOPT_COPYPOSTFIELDS, CURLOPT_PROXY,          CURLOPT_RANGE,
+    CURLOPT_ACCEPT_ENCODING,CURLOPT_TIMEOUT,        CURLOPT_CONNECTTIMEOUT,
+    CURLOPT_FOLLOWLOCATION, CURLOPT_MAXREDIRS,      CURLOPT_NOBODY,
+    CURLOPT_SSL_VERIFYPEER, CURLOPT_SSL_VERIFYHOST, CURLOPT_FAILONERROR,
+    CURLOPT_HTTPHEADER
+};
+
+const static int executorOptionTypes[] = {
+    EXECUTOR_STRING, EXECUTOR_STRING, EXECUTOR_STRING, EXECUTOR_STRING,
+    EXECUTOR_STRING, EXECUTOR_STRING, EXECUTOR_STRING, EXECUTOR_STRING,
+    EXECUTOR_STRING, EXECUTOR_STRING, EXECUTOR_LONG,   EXECUTOR_LONG,
+    EXECUTOR_LONG,   EXECUTOR_LONG,   EXECUTOR_LONG,   EXECUTOR_LONG,
+    EXECUTOR_LONG,   EXECUTOR_LONG,   EXECUTOR_LIST
+};
+
+int curlExecutorObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]);
+int curlExecutorInstanceObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]);
+int curlExecutorCreate(Tcl_Interp *interp,int objc,Tcl_Obj *const objv[]);
+void curlExecutorDeleteCmd(ClientData clientData);
+void curlExecutorDestroy(struct curlExecutor *execPtr);
+
+int curlExecutorSubmit(Tcl_Interp *interp,struct curlExecutor *execPtr,
+        Tcl_Obj *specObj,Tcl_Obj *commandObj);
+struct curlExecJob *curlExecJobNew(Tcl_Interp *interp,Tcl_Obj *specObj);
+void curlExecJobFree(struct curlExecJob *jobPtr);
+void curlExecJobDeliver(struct curlExecJob *jobPtr,CURLcode result);
+int curlExecEventProc(Tcl_Event *evPtr,int flags);
+void curlExecPendingAdd(struct curlExecJob *jobPtr);
+void curlExecPendingRemove(struct curlExecJob *jobPtr);
+void curlExecThreadExit(ClientData clientData);
+
+Tcl_ThreadCreateType curlExecWorkerProc(ClientData clientData);
+void curlExecWorkerStart(struct curlExecWorker *workerPtr,struct curlExecJob *jobPtr);
+void curlExecWorkerFinish(struct curlExecWorker *workerPtr,CURL *easy,CURLcode result);
+size_t curlExecWrite(char *ptr,size_t size,size_t nmemb,void *userdata);
+
+#endif
+
+#ifdef  __cplusplus
+}
+#endif
@@ -0,0 +1,332 @@
+/*
+ * meminfo.c --
+ *
+ * Implementation of the part of the TclCurl extension that initializes
+ * libcurl, once for the whole process, and gives it Tcl's allocator,
+ * counting how much memory libcurl holds.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#include "meminfo.h"
+#include <limits.h>
+
+TCL_DECLARE_MUTEX(meminfoLock)
+
+static int                      curlGlobalInitialized=0;
+static struct curlMemCounters   memCounters;
+
+/*
+ * The allocation functions are called by every thread doing transfers,
+ * so the counters are updated with atomic operations where the compiler
+ * has them, with the mutex elsewhere.
+ */
+#if defined(__GNUC__)
+#define MEMINFO_ADD(counter,value) \
+        __atomic_add_fetch(&(counter),(value),__ATOMIC_RELAXED)
+#define MEMINFO_SET(counter,value) \
+        __atomic_store_n(&(counter),(value),__ATOMIC_RELAXED)
+
+static void
+curlMemPeak(Tcl_WideInt value) {
+    Tcl_WideInt             peak=__atomic_load_n(&memCounters.peak,__ATOMIC_RELAXED);
+
+    while ((value>peak)&&!__atomic_compare_exchange_n(&memCounters.peak,
+            &peak,value,1,__ATOMIC_RELAXED,__ATOMIC_RELAXED)) {
+    }
+}
+#else
+static Tcl_WideInt
+curlMemAdd(Tcl_WideInt *counterPtr,Tcl_WideInt value,int set) {
+    Tcl_WideInt             result;
+
+    Tcl_MutexLock(&meminfoLock);
+    result=set?(*counterPtr=value):(*counterPtr+=value);
+    Tcl_MutexUnlock(&meminfoLock);
+    return result;
+}
+#define MEMINFO_ADD(counter,value) curlMemAdd(&(counter),(value),0)
+#define MEMINFO_SET(counter,value) curlMemAdd(&(counter),(value),1)
+
+static void
+curlMemPeak(Tcl_WideInt value) {
+
+    Tcl_MutexLock(&meminfoLock);
+    if (value>memCounters.peak) {
+        memCounters.peak=value;
+    }
+    Tcl_MutexUnlock(&meminfoLock);
+}
+#endif
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Tclcurl_MeminfoInit --
+ *
+ *  This procedure initializes libcurl the first time any interpreter
+ *  loads the package and creates the 'curl::meminfo' command. It has to
+ *  be called before anything else in the package uses libcurl.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Tclcurl_MeminfoInit (Tcl_Interp *interp) {
+    CURLcode               exitCode=CURLE_OK;
+
+    Tcl_MutexLock(&meminfoLock);
+    if (!curlGlobalInitialized) {
+        exitCode=curl_global_init_mem(CURL_GLOBAL_ALL,curlMemMalloc,
+                curlMemFree,curlMemRealloc,curlMemStrdup,curlMemCalloc);
+        if (exitCode==CURLE_OK) {
+            curlGlobalInitialized=1;
+            Tcl_CreateExitHandler(curlGlobalExit,NULL);
+        }
+    }
+    Tcl_MutexUnlock(&meminfoLock);
+
+    if (exitCode!=CURLE_OK) {
+        Tcl_SetObjResult(interp,Tcl_ObjPrintf("Couldn't initialize libcurl: %s",
+                curl_easy_strerror(exitCode)));
+        return TCL_ERROR;
+    }
+
+    Tcl_CreateObjCommand (interp,"::curl::meminfo",curlMeminfoObjCmd,
+            (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlGlobalExit --
+ *
+ *  Exit handler, libcurl is cleaned up when the process exits.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlGlobalExit(ClientData clientData) {
+
+    Tcl_MutexLock(&meminfoLock);
+    if (curlGlobalInitialized) {
+        curl_global_cleanup();
+        curlGlobalInitialized=0;
+    }
+    Tcl_MutexUnlock(&meminfoLock);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMeminfoObjCmd --
+ *
+ *  This procedure is invoked to process the "curl::meminfo" Tcl command.
+ *  See the user documentation for details on what it does.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlMeminfoObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]) {
+
+    int                    tableIndex,i;
+    Tcl_Obj               *resultPtr,*callPtr;
+
+    if (objc!=2) {
+        Tcl_WrongNumArgs(interp,1,objv,"get|reset");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(interp, objv[1], meminfoCommandTable, "option",
+            TCL_EXACT,&tableIndex)==TCL_ERROR) {
+        return TCL_ERROR;
+    }
+
+    switch(tableIndex) {
+        case 0:
+            resultPtr=Tcl_NewDictObj();
+            Tcl_DictObjPut(NULL,resultPtr,Tcl_NewStringObj("inuse",-1),
+                    Tcl_NewWideIntObj(MEMINFO_ADD(memCounters.inUse,0)));
+            Tcl_DictObjPut(NULL,resultPtr,Tcl_NewStringObj("peak",-1),
+                    Tcl_NewWideIntObj(MEMINFO_ADD(memCounters.peak,0)));
+            Tcl_DictObjPut(NULL,resultPtr,Tcl_NewStringObj("blocks",-1),
+                    Tcl_NewWideIntObj(MEMINFO_ADD(memCounters.blocks,0)));
+            Tcl_DictObjPut(NULL,resultPtr,Tcl_NewStringObj("allocated",-1),
+                    Tcl_NewWideIntObj(MEMINFO_ADD(memCounters.allocated,0)));
+            for (i=0;i<MEMINFO_CALLS;i++) {
+                callPtr=Tcl_NewDictObj();
+                Tcl_DictObjPut(NULL,callPtr,Tcl_NewStringObj("calls",-1),
+                        Tcl_NewWideIntObj(MEMINFO_ADD(memCounters.calls[i],0)));
+                Tcl_DictObjPut(NULL,callPtr,Tcl_NewStringObj("bytes",-1),
+                        Tcl_NewWideIntObj(MEMINFO_ADD(memCounters.bytes[i],0)));
+                Tcl_DictObjPut(NULL,resultPtr,
+                        Tcl_NewStringObj(meminfoCallTable[i],-1),callPtr);
+            }
+            Tcl_SetObjResult(interp,resultPtr);
+            break;
+        case 1:
+            /* What libcurl holds right now can't be reset, the peak starts
+             * again from there. */
+            MEMINFO_SET(memCounters.peak,MEMINFO_ADD(memCounters.inUse,0));
+            MEMINFO_SET(memCounters.allocated,0);
+            for (i=0;i<MEMINFO_CALLS;i++) {
+                MEMINFO_SET(memCounters.calls[i],0);
+                MEMINFO_SET(memCounters.bytes[i],0);
+            }
+            break;
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMemCount --
+ *
+ *  Updates the counters after a block of 'size' bytes has been given
+ *  to libcurl or, with a negative size, taken back.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+curlMemCount(Tcl_WideInt size,Tcl_WideInt blocks) {
+    Tcl_WideInt             inUse;
+
+    inUse=MEMINFO_ADD(memCounters.inUse,size);
+    MEMINFO_ADD(memCounters.blocks,blocks);
+    if (size<=0) {
+        return;
+    }
+    MEMINFO_ADD(memCounters.allocated,size);
+    curlMemPeak(inUse);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMemMalloc, curlMemCalloc, curlMemRealloc, curlMemStrdup,
+ * curlMemFree --
+ *
+ *  The memory functions given to libcurl, they use Tcl's allocator,
+ *  which in threaded builds keeps a cache of blocks for every thread.
+ *  They return NULL if there is no memory, as libcurl expects, instead
+ *  of panicking like Tcl_Alloc.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void *
+curlMemMalloc(size_t size) {
+    char                   *block;
+
+    MEMINFO_ADD(memCounters.calls[MEMINFO_MALLOC],1);
+    MEMINFO_ADD(memCounters.bytes[MEMINFO_MALLOC],size);
+    if (size>UINT_MAX-MEMINFO_HEADER) {
+        return NULL;
+    }
+    block=Tcl_AttemptAlloc((unsigned int)(size+MEMINFO_HEADER));
+    if (block==NULL) {
+        return NULL;
+    }
+    *(size_t *)block=size;
+    curlMemCount(size,1);
+
+    return block+MEMINFO_HEADER;
+}
+
+void *
+curlMemCalloc(size_t nmemb,size_t size) {
+    char                   *block;
+    size_t                  total;
+
+    MEMINFO_ADD(memCounters.calls[MEMINFO_CALLOC],1);
+    if ((size!=0)&&(nmemb>(UINT_MAX-MEMINFO_HEADER)/size)) {
+        return NULL;
+    }
+    total=nmemb*size;
+    MEMINFO_ADD(memCounters.bytes[MEMINFO_CALLOC],total);
+    block=Tcl_AttemptAlloc((unsigned int)(total+MEMINFO_HEADER));
+    if (block==NULL) {
+        return NULL;
+    }
+    *(size_t *)block=total;
+    memset(block+MEMINFO_HEADER,0,total);
+    curlMemCount(total,1);
+
+    return block+MEMINFO_HEADER;
+}
+
+void *
+curlMemRealloc(void *ptr,size_t size) {
+    char                   *block;
+    size_t                  oldSize;
+
+    if (ptr==NULL) {
+        return curlMemMalloc(size);
+    }
+    MEMINFO_ADD(memCounters.calls[MEMINFO_REALLOC],1);
+    MEMINFO_ADD(memCounters.bytes[MEMINFO_REALLOC],size);
+    if (size>UINT_MAX-MEMINFO_HEADER) {
+        return NULL;
+    }
+    block=(char *)ptr-MEMINFO_HEADER;
+    oldSize=*(size_t *)block;
+    block=Tcl_AttemptRealloc(block,(unsigned int)(size+MEMINFO_HEADER));
+    if (block==NULL) {
+        return NULL;
+    }
+    *(size_t *)block=size;
+    curlMemCount((Tcl_WideInt)size-(Tcl_WideInt)oldSize,0);
+
+    return block+MEMINFO_HEADER;
+}
+
+char *
+curlMemStrdup(const char *str) {
+    char                   *block;
+    size_t                  size=strlen(str)+1;
+
+    MEMINFO_ADD(memCounters.calls[MEMINFO_STRDUP],1);
+    MEMINFO_ADD(memCounters.bytes[MEMINFO_STRDUP],size);
+    if (size>UINT_MAX-MEMINFO_HEADER) {
+        return NULL;
+    }
+    block=Tcl_AttemptAlloc((unsigned int)(size+MEMINFO_HEADER));
+    if (block==NULL) {
+        return NULL;
+    }
+    *(size_t *)block=size;
+    memcpy(block+MEMINFO_HEADER,str,size);
+    curlMemCount(size,1);
+
+    return block+MEMINFO_HEADER;
+}
+
+void
+curlMemFree(void *ptr) {
+    char                   *block;
+    size_t                  size;
+
+    if (ptr==NULL) {
+        return;
+    }
+    block=(char *)ptr-MEMINFO_HEADER;
+    size=*(size_t *)block;
+    MEMINFO_ADD(memCounters.calls[MEMINFO_FREE],1);
+    MEMINFO_ADD(memCounters.bytes[MEMINFO_FREE],size);
+    curlMemCount(-(Tcl_WideInt)size,-1);
+    Tcl_Free(block);
+}
@@ -0,0 +1,65 @@
+/*
+ * meminfo.h --
+ *
+ * Header file for the part of the TclCurl extension that initializes
+ * libcurl and counts the memory it uses.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#define meminfo_h
+#include "tclcurl.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Every block given to libcurl starts with a header that keeps its size,
+ * big enough not to spoil the alignment of the memory Tcl gives us.
+ */
+#define MEMINFO_HEADER      16
+
+#define MEMINFO_MALLOC      0
+#define MEMINFO_CALLOC      1
+#define MEMINFO_REALLOC     2
+#define MEMINFO_STRDUP      3
+#define MEMINFO_FREE        4
+#define MEMINFO_CALLS       5
+
+/*
+ * The counters, 'bytes' of every kind of call is what was asked for,
+ * for realloc that is the new size of the blocks.
+ */
+struct curlMemCounters {
+    Tcl_WideInt           inUse;
+    Tcl_WideInt           peak;
+    Tcl_WideInt           blocks;
+    Tcl_WideInt           allocated;
+    Tcl_WideInt           calls[MEMINFO_CALLS];
+    Tcl_WideInt           bytes[MEMINFO_CALLS];
+};
+
+const static char *meminfoCommandTable[] = {
+    "get", "reset", (char *)NULL
+};
+
+const static char *meminfoCallTable[] = {
+    "malloc", "calloc", "realloc", "strdup", "free", (char *)NULL
+};
+
+int curlMeminfoObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]);
+void curlGlobalExit(ClientData clientData);
+
+void *curlMemMalloc(size_t size);
+void *curlMemCalloc(size_t nmemb,size_t size);
+void *curlMemRealloc(void *ptr,size_t size);
+char *curlMemStrdup(const char *str);
+void curlMemFree(void *ptr);
+
+#ifdef  __cplusplus
+}
+#endif
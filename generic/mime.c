@@ -0,0 +1,763 @@
+/*
+ * mime.c --
+ *
+ * Implementation of the part of the TclCurl extension that deals with
+ * libcurl's mime API.
+ *
+ * A 'curl::mime' form only keeps references to the Tcl objects given for
+ * its parts, every easy handle using the form builds its own libcurl mime
+ * structure, which reads the data straight from those objects, so the same
+ * form can be used by any number of handles without copying the data.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#include "mime.h"
+
+#if CURL_AT_LEAST_VERSION(7, 56, 0)
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Tclcurl_MimeInit --
+ *
+ *  This procedure initializes the 'mime' part of the package.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Tclcurl_MimeInit (Tcl_Interp *interp) {
+
+    Tcl_CreateObjCommand (interp,"::curl::mime",curlMimeCreateObjCmd,
+            (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMimeCreateObjCmd --
+ *
+ *  This procedure is invoked to process the "curl::mime create" Tcl
+ *  command, it looks for the first free name (mimecurl1, mimecurl2,...)
+ *  and creates a command for the new form.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlMimeCreateObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]) {
+
+    struct curlMimeObjData  *mimeData;
+    char                     mimeName[32];
+    Tcl_CmdInfo              info;
+    int                      i;
+
+    if (objc!=2||strcmp(Tcl_GetString(objv[1]),"create")) {
+        Tcl_WrongNumArgs(interp,1,objv,"create");
+        return TCL_ERROR;
+    }
+
+    mimeData=(struct curlMimeObjData *)Tcl_Alloc(sizeof(struct curlMimeObjData));
+    memset(mimeData,0,sizeof(struct curlMimeObjData));
+    mimeData->interp=interp;
+    mimeData->refCount=1;
+
+    for (i=1;;i++) {
+        snprintf(mimeName,sizeof(mimeName),"mimecurl%d",i);
+        if (!Tcl_GetCommandInfo(interp,mimeName,&info)) {
+            mimeData->token=Tcl_CreateObjCommand(interp,mimeName,curlMimeObjCmd,
+                    (ClientData)mimeData,(Tcl_CmdDeleteProc *)curlMimeDeleteCmd);
+            break;
+        }
+    }
+    Tcl_SetObjResult(interp,Tcl_NewStringObj(mimeName,-1));
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMimeObjCmd --
+ *
+ *  This procedure is invoked to process the commands of a form.
+ *  See the user documentation for details on what it does.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlMimeObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]) {
+
+    struct curlMimeObjData  *mimeData=(struct curlMimeObjData *)clientData;
+    int                      tableIndex;
+
+    if (objc<2) {
+        Tcl_WrongNumArgs(interp,1,objv,"option ?arg ...?");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(interp, objv[1], mimeCommandTable, "option",
+            TCL_EXACT,&tableIndex)==TCL_ERROR) {
+        return TCL_ERROR;
+    }
+    switch(tableIndex) {
+        case 0:
+            return curlMimeAddPart(interp,mimeData,objc,objv);
+        case 1:
+            if (objc!=2) {
+                Tcl_WrongNumArgs(interp,2,objv,"");
+                return TCL_ERROR;
+            }
+            curlMimeClearParts(mimeData);
+            mimeData->generation++;
+            break;
+        case 2:
+            if (objc!=2) {
+                Tcl_WrongNumArgs(interp,2,objv,"");
+                return TCL_ERROR;
+            }
+            Tcl_DeleteCommandFromToken(interp,mimeData->token);
+            break;
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMimeAddPart --
+ *
+ *  Adds a part to a form, the options are checked here, so that errors
+ *  are found now rather than when the transfer is done.
+ *
+ * Results:
+ *  A standard Tcl result, the number of parts in the form is returned.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlMimeAddPart(Tcl_Interp *interp,struct curlMimeObjData *mimeData,
+        int objc,Tcl_Obj *const objv[]) {
+
+    struct curlMimePart     *partPtr;
+    Tcl_Obj                **slots[7];
+    Tcl_Obj                 *channelObj=NULL;
+    int                      tableIndex, i, count, mode, sources;
+    Tcl_Obj                **elements;
+    Tcl_WideInt              end;
+
+    if (objc%2) {
+        Tcl_WrongNumArgs(interp,2,objv,"?-option value ...?");
+        return TCL_ERROR;
+    }
+
+    partPtr=(struct curlMimePart *)Tcl_Alloc(sizeof(struct curlMimePart));
+    memset(partPtr,0,sizeof(struct curlMimePart));
+    partPtr->size=-1;
+
+    slots[0]=&partPtr->name;
+    slots[1]=&partPtr->data;
+    slots[2]=&partPtr->file;
+    slots[3]=&partPtr->fileName;
+    slots[4]=&partPtr->type;
+    slots[5]=&partPtr->encoder;
+    slots[6]=&partPtr->headers;
+
+    for (i=2;i<objc;i+=2) {
+        if (Tcl_GetIndexFromObj(interp,objv[i],mimePartTable,"option",
+                TCL_EXACT,&tableIndex)==TCL_ERROR) {
+            goto error;
+        }
+        switch(tableIndex) {
+            case 6:
+                if (Tcl_ListObjGetElements(interp,objv[i+1],&count,
+                        &elements)!=TCL_OK) {
+                    goto error;
+                }
+                break;
+            case 7:
+                channelObj=objv[i+1];
+                continue;
+            case 8:
+                if (partPtr->readProc!=NULL) {
+                    Tcl_DecrRefCount(partPtr->readProc);
+                }
+                partPtr->readProc=objv[i+1];
+                Tcl_IncrRefCount(partPtr->readProc);
+                continue;
+            case 9:
+                if (Tcl_GetWideIntFromObj(interp,objv[i+1],&partPtr->size)!=TCL_OK) {
+                    goto error;
+                }
+                continue;
+        }
+        if (*slots[tableIndex]!=NULL) {
+            Tcl_DecrRefCount(*slots[tableIndex]);
+        }
+        *slots[tableIndex]=objv[i+1];
+        Tcl_IncrRefCount(objv[i+1]);
+    }
+    sources=(partPtr->data!=NULL)+(partPtr->file!=NULL)
+            +(channelObj!=NULL)+(partPtr->readProc!=NULL);
+    if (sources>1) {
+        Tcl_SetObjResult(interp,Tcl_NewStringObj(
+                "a part can only have one of -data, -file, -channel and -readproc",-1));
+        goto error;
+    }
+    if (channelObj!=NULL) {
+        partPtr->channel=Tcl_GetChannel(interp,Tcl_GetString(channelObj),&mode);
+        if (partPtr->channel==NULL) {
+            goto error;
+        }
+        if (!(mode&TCL_READABLE)) {
+            Tcl_SetObjResult(interp,Tcl_ObjPrintf(
+                    "channel \"%s\" wasn't opened for reading",
+                    Tcl_GetString(channelObj)));
+            partPtr->channel=NULL;
+            goto error;
+        }
+        /* So that it isn't closed while the form needs it. */
+        Tcl_RegisterChannel((Tcl_Interp *)NULL,partPtr->channel);
+        partPtr->start=Tcl_Tell(partPtr->channel);
+        if (partPtr->size<0&&partPtr->start>=0) {
+            end=Tcl_Seek(partPtr->channel,0,SEEK_END);
+            Tcl_Seek(partPtr->channel,partPtr->start,SEEK_SET);
+            if (end>=partPtr->start) {
+                partPtr->size=end-partPtr->start;
+            }
+        }
+    }
+
+    if (mimeData->partLast==NULL) {
+        mimeData->partFirst=partPtr;
+    } else {
+        mimeData->partLast->next=partPtr;
+    }
+    mimeData->partLast=partPtr;
+    mimeData->partCount++;
+    if (partPtr->readProc!=NULL) {
+        mimeData->procCount++;
+    }
+    mimeData->generation++;
+
+    Tcl_SetObjResult(interp,Tcl_NewIntObj(mimeData->partCount));
+    return TCL_OK;
+
+error:
+    for (i=0;i<7;i++) {
+        if (*slots[i]!=NULL) {
+            Tcl_DecrRefCount(*slots[i]);
+        }
+    }
+    if (partPtr->readProc!=NULL) {
+        Tcl_DecrRefCount(partPtr->readProc);
+    }
+    Tcl_Free((char *)partPtr);
+    return TCL_ERROR;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMimeClearParts --
+ *
+ *  Removes all the parts from a form.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlMimeClearParts(struct curlMimeObjData *mimeData) {
+    struct curlMimePart     *partPtr;
+
+    while ((partPtr=mimeData->partFirst)!=NULL) {
+        mimeData->partFirst=partPtr->next;
+        if (partPtr->name)     Tcl_DecrRefCount(partPtr->name);
+        if (partPtr->data)     Tcl_DecrRefCount(partPtr->data);
+        if (partPtr->file)     Tcl_DecrRefCount(partPtr->file);
+        if (partPtr->fileName) Tcl_DecrRefCount(partPtr->fileName);
+        if (partPtr->type)     Tcl_DecrRefCount(partPtr->type);
+        if (partPtr->encoder)  Tcl_DecrRefCount(partPtr->encoder);
+        if (partPtr->headers)  Tcl_DecrRefCount(partPtr->headers);
+        if (partPtr->readProc) Tcl_DecrRefCount(partPtr->readProc);
+        if (partPtr->channel) {
+            Tcl_UnregisterChannel((Tcl_Interp *)NULL,partPtr->channel);
+        }
+        Tcl_Free((char *)partPtr);
+    }
+    mimeData->partLast=NULL;
+    mimeData->partCount=0;
+    mimeData->procCount=0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMimeDeleteCmd --
+ *
+ *  Invoked when the command of a form is deleted, the form itself
+ *  lives on while any easy handle is still using it.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlMimeDeleteCmd(ClientData clientData) {
+    struct curlMimeObjData  *mimeData=(struct curlMimeObjData *)clientData;
+
+    mimeData->token=NULL;
+    curlMimeRelease(mimeData);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMimeGet --
+ *
+ *  Given the name of a form, returns its data.
+ *
+ * Results:
+ *  The form, or NULL with an error in the interpreter if it doesn't
+ *  exist.
+ *
+ *----------------------------------------------------------------------
+ */
+
+struct curlMimeObjData *
+curlMimeGet(Tcl_Interp *interp,Tcl_Obj *nameObj) {
+    Tcl_CmdInfo     info;
+
+    if (!Tcl_GetCommandInfo(interp,Tcl_GetString(nameObj),&info)
+            ||info.objProc!=curlMimeObjCmd) {
+        Tcl_SetObjResult(interp,Tcl_ObjPrintf("\"%s\" is not a mime form",
+                Tcl_GetString(nameObj)));
+        return NULL;
+    }
+    return (struct curlMimeObjData *)info.objClientData;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMimeHold, curlMimeRelease --
+ *
+ *  Keep track of how many easy handles use a form, it is freed when
+ *  its command has been deleted and no handle uses it.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlMimeHold(struct curlMimeObjData *mimeData) {
+    mimeData->refCount++;
+}
+
+void
+curlMimeRelease(struct curlMimeObjData *mimeData) {
+    if (--mimeData->refCount>0) {
+        return;
+    }
+    curlMimeClearParts(mimeData);
+    Tcl_Free((char *)mimeData);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMimeSetPost --
+ *
+ *  Invoked before a transfer, if the handle uses a form and the libcurl
+ *  structure for it hasn't been built yet, or the form has changed, it
+ *  gets built and passed to libcurl.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlMimeSetPost(Tcl_Interp *interp,struct curlObjData *curlData) {
+
+    if (curlData->mimePost==NULL) {
+        return TCL_OK;
+    }
+    /* Parts read from a Tcl procedure can't be rewound, so the form gets
+     * built again for every transfer. */
+    if (curlData->mime!=NULL&&curlData->mimePost->procCount==0
+            &&curlData->mimeGeneration==curlData->mimePost->generation) {
+        return TCL_OK;
+    }
+    if (curlData->mime!=NULL) {
+        curl_easy_setopt(curlData->curl,CURLOPT_MIMEPOST,NULL);
+        curl_mime_free(curlData->mime);
+        curlData->mime=NULL;
+    }
+    curlData->mime=curlMimeBuild(interp,curlData->mimePost,curlData->curl);
+    if (curlData->mime==NULL) {
+        return TCL_ERROR;
+    }
+    curlData->mimeGeneration=curlData->mimePost->generation;
+    if (curl_easy_setopt(curlData->curl,CURLOPT_MIMEPOST,curlData->mime)) {
+        Tcl_SetObjResult(interp,Tcl_NewStringObj("Error setting the data to post",-1));
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMimeSetForm --
+ *
+ *  Makes an easy handle use a form, or no form at all if 'mimeData'
+ *  is NULL.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlMimeSetForm(struct curlObjData *curlData,struct curlMimeObjData *mimeData) {
+
+    if (mimeData!=NULL) {
+        curlMimeHold(mimeData);
+    }
+    curlMimeFree(curlData);
+    curlData->mimePost=mimeData;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMimeFree --
+ *
+ *  Frees the libcurl form of an easy handle and lets go of the form.
+ *  If the handle is still going to be used, CURLOPT_MIMEPOST has to be
+ *  reset before calling this.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlMimeFree(struct curlObjData *curlData) {
+
+    if (curlData->mime!=NULL) {
+        curl_mime_free(curlData->mime);
+        curlData->mime=NULL;
+    }
+    if (curlData->mimePost!=NULL) {
+        curlMimeRelease(curlData->mimePost);
+        curlData->mimePost=NULL;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMimeBuild --
+ *
+ *  Builds the libcurl form for an easy handle.
+ *
+ * Results:
+ *  The form, or NULL with an error in the interpreter.
+ *
+ *----------------------------------------------------------------------
+ */
+
+curl_mime *
+curlMimeBuild(Tcl_Interp *interp,struct curlMimeObjData *mimeData,
+        CURL *curlHandle) {
+
+    curl_mime               *mime;
+    curl_mimepart           *part;
+    struct curlMimePart     *partPtr;
+    struct curlMimeCursor   *cursorPtr;
+    struct curl_slist       *headerList;
+    Tcl_Obj                **elements;
+    int                      count, i, length, partNum=0;
+    Tcl_WideInt              size;
+    CURLcode                 exitCode=CURLE_OK;
+
+    mime=curl_mime_init(curlHandle);
+    if (mime==NULL) {
+        Tcl_SetObjResult(interp,Tcl_NewStringObj("Couldn't allocate memory",-1));
+        return NULL;
+    }
+    for (partPtr=mimeData->partFirst;partPtr!=NULL;partPtr=partPtr->next) {
+        partNum++;
+        if (partPtr->channel!=NULL&&partPtr->start<0) {
+            if (partPtr->taken) {
+                curl_mime_free(mime);
+                Tcl_SetObjResult(interp,Tcl_ObjPrintf(
+                        "mime part %d: its channel can't seek, it can only be sent once",
+                        partNum));
+                return NULL;
+            }
+            partPtr->taken=1;
+        }
+        part=curl_mime_addpart(mime);
+        if (part==NULL) {
+            exitCode=CURLE_OUT_OF_MEMORY;
+            break;
+        }
+        if (partPtr->name!=NULL) {
+            exitCode=curl_mime_name(part,Tcl_GetString(partPtr->name));
+            if (exitCode) break;
+        }
+        if (partPtr->data!=NULL||partPtr->channel!=NULL||partPtr->readProc!=NULL) {
+            cursorPtr=(struct curlMimeCursor *)Tcl_Alloc(sizeof(struct curlMimeCursor));
+            memset(cursorPtr,0,sizeof(struct curlMimeCursor));
+            cursorPtr->interp=mimeData->interp;
+            size=partPtr->size;
+            if (partPtr->data!=NULL) {
+                cursorPtr->dataObj=partPtr->data;
+                Tcl_IncrRefCount(cursorPtr->dataObj);
+                Tcl_GetByteArrayFromObj(partPtr->data,&length);
+                size=length;
+            } else if (partPtr->channel!=NULL) {
+                cursorPtr->channel=partPtr->channel;
+                Tcl_RegisterChannel((Tcl_Interp *)NULL,cursorPtr->channel);
+                cursorPtr->start=partPtr->start;
+            } else {
+                cursorPtr->readProc=partPtr->readProc;
+                Tcl_IncrRefCount(cursorPtr->readProc);
+            }
+            cursorPtr->size=size;
+            exitCode=curl_mime_data_cb(part,(curl_off_t)size,curlMimeReadData,
+                    curlMimeSeekData,curlMimeFreeData,cursorPtr);
+            if (exitCode) {
+                curlMimeFreeData(cursorPtr);
+                break;
+            }
+        }
+        if (partPtr->file!=NULL) {
+            exitCode=curl_mime_filedata(part,Tcl_GetString(partPtr->file));
+            if (exitCode) break;
+        }
+        if (partPtr->fileName!=NULL) {
+            exitCode=curl_mime_filename(part,Tcl_GetString(partPtr->fileName));
+            if (exitCode) break;
+        }
+        if (partPtr->type!=NULL) {
+            exitCode=curl_mime_type(part,Tcl_GetString(partPtr->type));
+            if (exitCode) break;
+        }
+        if (partPtr->encoder!=NULL) {
+            exitCode=curl_mime_encoder(part,Tcl_GetString(partPtr->encoder));
+            if (exitCode) break;
+        }
+        if (partPtr->headers!=NULL) {
+            Tcl_ListObjGetElements(NULL,partPtr->headers,&count,&elements);
+            headerList=NULL;
+            for (i=0;i<count;i++) {
+                headerList=curl_slist_append(headerList,Tcl_GetString(elements[i]));
+            }
+            exitCode=curl_mime_headers(part,headerList,1);
+            if (exitCode) {
+                curl_slist_free_all(headerList);
+                break;
+            }
+        }
+    }
+    if (exitCode) {
+        curl_mime_free(mime);
+        Tcl_SetObjResult(interp,Tcl_ObjPrintf("mime part %d: %s",partNum,
+                curl_easy_strerror(exitCode)));
+        return NULL;
+    }
+    return mime;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMimeReadData --
+ *
+ *  libcurl calls this function to read the data of a part.
+ *
+ * Results:
+ *  The number of bytes copied to the buffer, 0 at the end.
+ *
+ *----------------------------------------------------------------------
+ */
+
+size_t
+curlMimeReadData(char *buffer,size_t size,size_t nitems,void *arg) {
+    struct curlMimeCursor   *cursorPtr=(struct curlMimeCursor *)arg;
+    unsigned char           *bytes;
+    int                      length;
+    size_t                   toCopy;
+    Tcl_Obj                 *cmdObj;
+    Tcl_WideInt              position;
+
+    if (cursorPtr->channel!=NULL) {
+        toCopy=size*nitems;
+        if ((cursorPtr->size>=0)&&(cursorPtr->offset+(Tcl_WideInt)toCopy>cursorPtr->size)) {
+            toCopy=(size_t)(cursorPtr->size-cursorPtr->offset);
+        }
+        if (toCopy==0) {
+            return 0;
+        }
+        if (cursorPtr->start>=0) {
+            /* Other transfers may have read the channel since the last time. */
+            position=cursorPtr->start+cursorPtr->offset;
+            if ((Tcl_Tell(cursorPtr->channel)!=position)
+                    &&(Tcl_Seek(cursorPtr->channel,position,SEEK_SET)<0)) {
+                return CURL_READFUNC_ABORT;
+            }
+        }
+        length=Tcl_Read(cursorPtr->channel,buffer,(int)toCopy);
+        if (length<0) {
+            return CURL_READFUNC_ABORT;
+        }
+        cursorPtr->offset+=length;
+        return (size_t)length;
+    }
+    if (cursorPtr->readProc!=NULL) {
+        cmdObj=Tcl_DuplicateObj(cursorPtr->readProc);
+        Tcl_IncrRefCount(cmdObj);
+        if (Tcl_ListObjAppendElement(cursorPtr->interp,cmdObj,
+                Tcl_NewWideIntObj((Tcl_WideInt)(size*nitems)))!=TCL_OK
+                ||Tcl_EvalObjEx(cursorPtr->interp,cmdObj,TCL_EVAL_GLOBAL)!=TCL_OK) {
+            Tcl_DecrRefCount(cmdObj);
+            return CURL_READFUNC_ABORT;
+        }
+        Tcl_DecrRefCount(cmdObj);
+        bytes=Tcl_GetByteArrayFromObj(Tcl_GetObjResult(cursorPtr->interp),&length);
+        if ((size_t)length>size*nitems) {
+            return CURL_READFUNC_ABORT;
+        }
+        memcpy(buffer,bytes,length);
+        Tcl_ResetResult(cursorPtr->interp);
+        cursorPtr->offset+=length;
+        return (size_t)length;
+    }
+
+    bytes=Tcl_GetByteArrayFromObj(cursorPtr->dataObj,&length);
+    if (cursorPtr->offset>=length) {
+        return 0;
+    }
+    toCopy=(size_t)(length-cursorPtr->offset);
+    if (toCopy>size*nitems) {
+        toCopy=size*nitems;
+    }
+    memcpy(buffer,bytes+cursorPtr->offset,toCopy);
+    cursorPtr->offset+=toCopy;
+
+    return toCopy;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMimeSeekData --
+ *
+ *  libcurl calls this function to rewind the data of a part, before
+ *  sending it again.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlMimeSeekData(void *arg,curl_off_t offset,int origin) {
+    struct curlMimeCursor   *cursorPtr=(struct curlMimeCursor *)arg;
+    int                      length;
+
+    if (cursorPtr->dataObj==NULL) {
+        /* Channels that can seek go back to where they were when the
+         * part was added, the next read gets there, anything else can
+         * only 'seek' to where it is. */
+        if (origin==SEEK_SET&&offset==cursorPtr->offset) {
+            return CURL_SEEKFUNC_OK;
+        }
+        if (cursorPtr->channel==NULL||cursorPtr->start<0||origin!=SEEK_SET) {
+            return CURL_SEEKFUNC_CANTSEEK;
+        }
+        if (offset<0) {
+            return CURL_SEEKFUNC_FAIL;
+        }
+        cursorPtr->offset=offset;
+        return CURL_SEEKFUNC_OK;
+    }
+
+    Tcl_GetByteArrayFromObj(cursorPtr->dataObj,&length);
+    switch(origin) {
+        case SEEK_CUR:
+            offset+=cursorPtr->offset;
+            break;
+        case SEEK_END:
+            offset+=length;
+            break;
+    }
+    if (offset<0||offset>length) {
+        return CURL_SEEKFUNC_FAIL;
+    }
+    cursorPtr->offset=offset;
+
+    return CURL_SEEKFUNC_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMimeFreeData --
+ *
+ *  libcurl calls this function when the part is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlMimeFreeData(void *arg) {
+    struct curlMimeCursor   *cursorPtr=(struct curlMimeCursor *)arg;
+
+    if (cursorPtr->dataObj!=NULL) {
+        Tcl_DecrRefCount(cursorPtr->dataObj);
+    }
+    if (cursorPtr->readProc!=NULL) {
+        Tcl_DecrRefCount(cursorPtr->readProc);
+    }
+    if (cursorPtr->channel!=NULL) {
+        Tcl_UnregisterChannel((Tcl_Interp *)NULL,cursorPtr->channel);
+    }
+    Tcl_Free((char *)cursorPtr);
+}
+
+#else
+
+/*
+ * libcurl is too old for the mime API, there are no forms to use.
+ */
+
+int
+Tclcurl_MimeInit (Tcl_Interp *interp) {
+    return TCL_OK;
+}
+
+int
+curlMimeSetPost(Tcl_Interp *interp,struct curlObjData *curlData) {
+    return TCL_OK;
+}
+
+void
+curlMimeFree(struct curlObjData *curlData) {
+}
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * mime.h --
+ *
+ * Header file for the part of the TclCurl extension that deals with
+ * libcurl's mime API, used to build multipart forms.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#define mime_h
+#include "tclcurl.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#if CURL_AT_LEAST_VERSION(7, 56, 0)
+
+/*
+ * A part of a form, it just keeps the Tcl objects the user gave us, the
+ * libcurl parts are built from them for every easy handle using the form.
+ * The data of a channel starts at 'start', where the channel was when the
+ * part was added, or -1 if it can't seek, and then it can only be 'taken'
+ * by one transfer.
+ */
+struct curlMimePart {
+    Tcl_Obj                *name;
+    Tcl_Obj                *data;
+    Tcl_Obj                *file;
+    Tcl_Obj                *fileName;
+    Tcl_Obj                *type;
+    Tcl_Obj                *encoder;
+    Tcl_Obj                *headers;
+    Tcl_Channel             channel;
+    Tcl_WideInt             start;
+    int                     taken;
+    Tcl_Obj                *readProc;
+    Tcl_WideInt             size;
+    struct curlMimePart    *next;
+};
+
+/*
+ * A form, 'generation' changes every time the parts change, so the easy
+ * handles know they have to build their libcurl form again.
+ */
+struct curlMimeObjData {
+    Tcl_Command             token;
+    Tcl_Interp             *interp;
+    int                     refCount;
+    int                     generation;
+    int                     partCount;
+    int                     procCount;
+    struct curlMimePart    *partFirst;
+    struct curlMimePart    *partLast;
+};
+
+/*
+ * Used by the libcurl callbacks to read the data of a part, straight
+ * from its Tcl object, from a channel or from a Tcl procedure. 'offset'
+ * is how much of it this transfer has read, other handles may read the
+ * same channel in between.
+ */
+struct curlMimeCursor {
+    Tcl_Interp             *interp;
+    Tcl_Obj                *dataObj;
+    Tcl_Channel             channel;
+    Tcl_Obj                *readProc;
+    Tcl_WideInt             start;
+    Tcl_WideInt             size;
+    Tcl_WideInt             offset;
+};
+
+const static char *mimeCommandTable[] = {
+    "addpart", "clear", "cleanup", (char *)NULL
+};
+
+const static char *mimePartTable[] = {
+    "-name", "-data", "-file", "-filename", "-type", "-encoder",
+    "-headers", "-channel", "-readproc", "-size", (char *)NULL
+};
+
+int curlMimeCreateObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]);
+int curlMimeObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]);
+void curlMimeDeleteCmd(ClientData clientData);
+
+int curlMimeAddPart(Tcl_Interp *interp,struct curlMimeObjData *mimeData,
+        int objc,Tcl_Obj *const objv[]);
+void curlMimeClearParts(struct curlMimeObjData *mimeData);
+
+curl_mime *curlMimeBuild(Tcl_Interp *interp,struct curlMimeObjData *mimeData,
+        CURL *curlHandle);
+
+size_t curlMimeReadData(char *buffer,size_t size,size_t nitems,void *arg);
+int curlMimeSeekData(void *arg,curl_off_t offset,int origin);
+void curlMimeFreeData(void *arg);
+
+#endif
+
+#ifdef  __cplusplus
+}
+#endif
@@ -12,8 +12,13 @@
  */
 
 #include "multi.h"
-#ifndef _WIN32
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#include <sys/stat.h>
+#else
 #include <sys/time.h>
+#include <unistd.h>
 #endif
 
 /*
@@ -34,6 +39,14 @@ Tclcurl_MultiInit (Tcl_Interp *interp) {
 
     Tcl_CreateObjCommand (interp,"::curl::multiinit",curlInitMultiObjCmd,
             (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
+#if CURL_AT_LEAST_VERSION(7, 28, 0)
+    Tcl_CreateObjCommand (interp,"::curl::fetchall",curlFetchAllObjCmd,
+            (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
+#endif
+#if CURL_AT_LEAST_VERSION(7, 55, 0)
+    Tcl_CreateObjCommand (interp,"::curl::segmented",curlSegmentedObjCmd,
+            (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
+#endif
 
     return TCL_OK;
 }
@@ -167,17 +180,17 @@ curlMultiObjCmd (ClientData clientData, Tcl_Interp *interp,
     switch(tableIndex) {
         case 0:
 /*            fprintf(stdout,"Multi add handle\n"); */
-            errorCode=curlAddMultiHandle(interp,curlMultiData->mcurl,objv[2]);
+            errorCode=curlAddMultiHandle(interp,curlMultiData,objv[2]);
             return curlReturnCURLMcode(interp,errorCode);
             break;
         case 1:
 /*            fprintf(stdout,"Multi remove handle\n"); */
-            errorCode=curlRemoveMultiHandle(interp,curlMultiData->mcurl,objv[2]);
+            errorCode=curlRemoveMultiHandle(interp,curlMultiData,objv[2]);
             return curlReturnCURLMcode(interp,errorCode);
             break;
         case 2:
 /*            fprintf(stdout,"Multi perform\n"); */
-            errorCode=curlMultiPerform(interp,curlMultiData->mcurl);
+            errorCode=curlMultiPerform(interp,curlMultiData);
             return errorCode;
             break;
         case 3:
@@ -186,7 +199,7 @@ curlMultiObjCmd (ClientData clientData, Tcl_Interp *interp,
             break;
         case 4:
 /*            fprintf(stdout,"Multi getInfo\n"); */
-            curlMultiGetInfo(interp,curlMultiData->mcurl);
+            curlMultiGetInfo(interp,curlMultiData);
             break;
         case 5:
 /*            fprintf(stdout,"Multi activeTransfers\n"); */
@@ -198,8 +211,7 @@ curlMultiObjCmd (ClientData clientData, Tcl_Interp *interp,
             break;
         case 7:
 /*            fprintf(stdout,"Multi configure\n");*/
-            curlMultiConfigTransfer(interp,curlMultiData,objc,objv);
-            break;            
+            return curlMultiConfigTransfer(interp,curlMultiData,objc,objv);            
     }
     return TCL_OK;
 }
@@ -213,7 +225,7 @@ curlMultiObjCmd (ClientData clientData, Tcl_Interp *interp,
  *
  *  Parameter:
  *      interp: Pointer to the interpreter we are using.
- *      curlMultiHandle: The handle into which we will add the easy one.
+ *      curlMultiData: The handle into which we will add the easy one.
  *      objvPtr: The Tcl object with the name of the easy handle.
  *
  * Results:
@@ -222,11 +234,12 @@ curlMultiObjCmd (ClientData clientData, Tcl_Interp *interp,
  *----------------------------------------------------------------------
  */
 CURLMcode
-curlAddMultiHandle(Tcl_Interp *interp,CURLM *curlMultiHandlePtr
+curlAddMultiHandle(Tcl_Interp *interp,struct curlMultiObjData *curlMultiData
         ,Tcl_Obj *objvPtr) {
 
     struct curlObjData        *curlDataPtr;
     CURLMcode                  errorCode;
+    Tcl_DString                key;
 
 
     curlDataPtr=curlGetEasyHandle(interp,objvPtr);
@@ -238,9 +251,20 @@ curlAddMultiHandle(Tcl_Interp *interp,CURLM *curlMultiHandlePtr
         return TCL_ERROR;
     }
 
-    errorCode=curl_multi_add_handle(curlMultiHandlePtr,curlDataPtr->curl);
+    curlRetryStart(curlDataPtr);
+    if (curlMultiData->coalesce&&curlCoalesceKey(curlDataPtr,&key)) {
+        curlDigestPrepare(curlDataPtr);
+        errorCode=curlCoalesceAdd(curlMultiData,curlDataPtr,
+                Tcl_DStringValue(&key));
+        Tcl_DStringFree(&key);
+    } else {
+        curlRetryWatch(curlDataPtr);
+        curlResumePrepare(curlDataPtr);
+        curlDigestPrepare(curlDataPtr);
+        errorCode=curl_multi_add_handle(curlMultiData->mcurl,curlDataPtr->curl);
+    }
 
-    curlEasyHandleListAdd(curlMultiHandlePtr,curlDataPtr->curl
+    curlEasyHandleListAdd(curlMultiData,curlDataPtr->curl
             ,Tcl_GetString(objvPtr));
 
     return errorCode;
@@ -255,7 +279,7 @@ curlAddMultiHandle(Tcl_Interp *interp,CURLM *curlMultiHandlePtr
  *
  *  Parameter:
  *      interp: Pointer to the interpreter we are using.
- *      curlMultiHandle: The handle into which we will add the easy one.
+ *      curlMultiData: The handle from which we will remove the easy one.
  *      objvPtr: The Tcl object with the name of the easy handle.
  *
  * Results:
@@ -264,14 +288,28 @@ curlAddMultiHandle(Tcl_Interp *interp,CURLM *curlMultiHandlePtr
  *----------------------------------------------------------------------
  */
 CURLMcode
-curlRemoveMultiHandle(Tcl_Interp *interp,CURLM *curlMultiHandle
+curlRemoveMultiHandle(Tcl_Interp *interp,struct curlMultiObjData *curlMultiData
         ,Tcl_Obj *objvPtr) {
     struct curlObjData        *curlDataPtr;
     CURLMcode                  errorCode;
+    char                      *name;
 
     curlDataPtr=curlGetEasyHandle(interp,objvPtr);
-    errorCode=curl_multi_remove_handle(curlMultiHandle,curlDataPtr->curl);
-    curlEasyHandleListRemove(curlMultiHandle,curlDataPtr->curl);
+    errorCode=curl_multi_remove_handle(curlMultiData->mcurl,curlDataPtr->curl);
+    /* Like libcurl's, the messages of a removed handle are gone. */
+    if ((name=curlGetEasyName(curlMultiData,curlDataPtr->curl))!=NULL) {
+        curlMultiDropMsgs(curlMultiData,name);
+    }
+    if (curlMultiData->groups!=NULL) {
+        curlCoalesceRemove(curlMultiData,curlDataPtr);
+    }
+    if (curlMultiData->retries!=NULL) {
+        curlMultiRetryRemove(curlMultiData,curlDataPtr);
+    }
+    curlResumeStop(curlDataPtr);
+    curlDigestStop(curlDataPtr);
+    curlRetryUnwatch(curlDataPtr);
+    curlEasyHandleListRemove(curlMultiData,curlDataPtr->curl);
 
     curlCloseFiles(curlDataPtr);
     curlResetPostData(curlDataPtr);
@@ -293,22 +331,24 @@ curlRemoveMultiHandle(Tcl_Interp *interp,CURLM *curlMultiHandle
  *
  *  Parameter:
  *      interp: Pointer to the interpreter we are using.
- *      curlMultiHandle: The handle of the transfer to update.
- *      objvPtr: The Tcl object with the name of the easy handle.
+ *      curlMultiData: The handle of the transfer to update.
  *
  * Results:
         Usual Tcl result.
  *----------------------------------------------------------------------
  */
 int
-curlMultiPerform(Tcl_Interp *interp,CURLM *curlMultiHandlePtr) {
+curlMultiPerform(Tcl_Interp *interp,struct curlMultiObjData *curlMultiData) {
 
     CURLMcode        errorCode;
     int              runningTransfers;
 
+    curlMultiRetryStart(curlMultiData);
     for (errorCode=-1;errorCode<0;) {   
-        errorCode=curl_multi_perform(curlMultiHandlePtr,&runningTransfers);
+        errorCode=curl_multi_perform(curlMultiData->mcurl,&runningTransfers);
     }
+    curlMultiReadMessages(curlMultiData);
+    runningTransfers+=curlMultiData->retryCount;
 
     if (errorCode==0) {
         curlReturnCURLMcode(interp,runningTransfers);
@@ -343,7 +383,17 @@ curlMultiDeleteCmd(ClientData clientData) {
     CURLMcode                    errorCode;
     Tcl_Interp                  *interp=curlMultiData->interp;
     struct easyHandleList       *listPtr1,*listPtr2;
+    struct curlCoalesceGroup    *groupPtr;
+    struct curlMultiRetry       *retryPtr;
 
+    while ((groupPtr=curlMultiData->groups)!=NULL) {
+        curlMultiData->groups=groupPtr->next;
+        curlCoalesceFree(groupPtr);
+    }
+    while ((retryPtr=curlMultiData->retries)!=NULL) {
+        curlMultiData->retries=retryPtr->next;
+        Tcl_Free((char *)retryPtr);
+    }
     listPtr1=curlMultiData->handleListFirst;
     while (listPtr1!=NULL) {
         listPtr2=listPtr1->next;
@@ -352,7 +402,13 @@ curlMultiDeleteCmd(ClientData clientData) {
         listPtr1=listPtr2;
     }
     errorCode=curl_multi_cleanup(curlMultiHandle);
-    curlMultiFreeSpace(curlMultiData);
+    curlMultiData->mcurl=NULL;
+    if (curlMultiData->autoActive) {
+        Tcl_DeleteEventSource((Tcl_EventSetupProc *)curlEventSetup,
+                (Tcl_EventCheckProc *)curlEventCheck, (ClientData *)curlMultiData);
+    }
+    /* There may be events in the queue or a command running for us. */
+    Tcl_EventuallyFree((ClientData)curlMultiData,(Tcl_FreeProc *)curlMultiFreeSpace);
     return curlReturnCURLMcode(interp,errorCode);
 }
 
@@ -366,7 +422,7 @@ curlMultiDeleteCmd(ClientData clientData) {
  *
  * Parameter:
  *    interp: The Tcl interpreter we are using, mainly to report errors.
- *    curlMultiHandlePtr: Pointer to the multi handle of the transfer.
+ *    curlMultiData: Pointer to the multi handle of the transfer.
  *
  * Results:
  *    Standard Tcl codes. The Tcl command will return a list with the
@@ -374,30 +430,304 @@ curlMultiDeleteCmd(ClientData clientData) {
  *----------------------------------------------------------------------
  */
 int
-curlMultiGetInfo(Tcl_Interp *interp,CURLM *curlMultiHandlePtr) {
-    struct CURLMsg        *multiInfo;
-    int                    msgLeft;
+curlMultiGetInfo(Tcl_Interp *interp,struct curlMultiObjData *curlMultiData) {
+    struct curlMultiMsg   *msgPtr;
     Tcl_Obj               *resultPtr;
 
-    multiInfo=curl_multi_info_read(curlMultiHandlePtr, &msgLeft);
+    curlMultiReadMessages(curlMultiData);
+
+    msgPtr=curlMultiData->msgFirst;
     resultPtr=Tcl_NewListObj(0,(Tcl_Obj **)NULL); 
-    if (multiInfo==NULL) {
+    if (msgPtr==NULL) {
         Tcl_ListObjAppendElement(interp,resultPtr,Tcl_NewStringObj("",-1));
         Tcl_ListObjAppendElement(interp,resultPtr,Tcl_NewIntObj(0));
         Tcl_ListObjAppendElement(interp,resultPtr,Tcl_NewIntObj(0));
         Tcl_ListObjAppendElement(interp,resultPtr,Tcl_NewIntObj(0));
+        if (curlMultiData->captureCount) {
+            Tcl_ListObjAppendElement(interp,resultPtr,Tcl_NewDictObj());
+        }
     } else {
-        Tcl_ListObjAppendElement(interp,resultPtr,
-            Tcl_NewStringObj(curlGetEasyName(curlMultiHandlePtr,multiInfo->easy_handle),-1));
-        Tcl_ListObjAppendElement(interp,resultPtr,Tcl_NewIntObj(multiInfo->msg));
-        Tcl_ListObjAppendElement(interp,resultPtr,Tcl_NewIntObj(multiInfo->data.result));
-        Tcl_ListObjAppendElement(interp,resultPtr,Tcl_NewIntObj(msgLeft));
+        curlMultiData->msgFirst=msgPtr->next;
+        if (curlMultiData->msgFirst==NULL) {
+            curlMultiData->msgLast=NULL;
+        }
+        curlMultiData->msgCount--;
+
+        Tcl_ListObjAppendElement(interp,resultPtr,Tcl_NewStringObj(msgPtr->name,-1));
+        Tcl_ListObjAppendElement(interp,resultPtr,Tcl_NewIntObj(msgPtr->msg));
+        Tcl_ListObjAppendElement(interp,resultPtr,Tcl_NewIntObj(msgPtr->result));
+        Tcl_ListObjAppendElement(interp,resultPtr,Tcl_NewIntObj(curlMultiData->msgCount));
+        if (msgPtr->captured!=NULL) {
+            Tcl_ListObjAppendElement(interp,resultPtr,msgPtr->captured);
+            Tcl_DecrRefCount(msgPtr->captured);
+        } else if (curlMultiData->captureCount) {
+            Tcl_ListObjAppendElement(interp,resultPtr,Tcl_NewDictObj());
+        }
+        Tcl_Free(msgPtr->name);
+        Tcl_Free((char *)msgPtr);
     }
     Tcl_SetObjResult(interp,resultPtr); 
 
     return TCL_OK;            
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMultiReadMessages --
+ *    Reads all the messages libcurl has for a multi handle and queues
+ *    them for 'getinfo'. When a transfer is done, this is the moment to
+ *    add it to the statistics and to capture the information asked for
+ *    with '-capture', as after this the easy handle can be removed,
+ *    reset or added again.
+ *
+ * Parameter:
+ *    curlMultiData: Pointer to the multi handle of the transfers.
+ *----------------------------------------------------------------------
+ */
+void
+curlMultiReadMessages(struct curlMultiObjData *curlMultiData) {
+    struct CURLMsg        *multiInfo;
+    struct curlMultiMsg   *msgPtr;
+    struct curlObjData    *curlData;
+    int                    msgLeft;
+    char                  *name;
+
+    while ((multiInfo=curl_multi_info_read(curlMultiData->mcurl,&msgLeft))!=NULL) {
+        if (multiInfo->msg==CURLMSG_DONE) {
+            curlStatsRecord(multiInfo->easy_handle,multiInfo->data.result);
+            if (curlMultiRetryLater(curlMultiData,multiInfo->easy_handle,
+                    multiInfo->data.result)) {
+                continue;
+            }
+        }
+        msgPtr=(struct curlMultiMsg *)Tcl_Alloc(sizeof(struct curlMultiMsg));
+        name=curlGetEasyName(curlMultiData,multiInfo->easy_handle);
+        msgPtr->name=curlstrdup(name?name:"");
+        msgPtr->msg=multiInfo->msg;
+        msgPtr->result=multiInfo->data.result;
+        msgPtr->captured=NULL;
+        msgPtr->next=NULL;
+
+        if (multiInfo->msg==CURLMSG_DONE) {
+            if ((curl_easy_getinfo(multiInfo->easy_handle,CURLINFO_PRIVATE,
+                    (char **)&curlData)==CURLE_OK)&&(curlData!=NULL)) {
+                msgPtr->result=curlDigestFinish(curlData,msgPtr->result);
+                msgPtr->result=curlCommitFiles(curlData,msgPtr->result);
+            }
+            if (curlMultiData->captureCount) {
+                if (curlGetInfoDict(curlMultiData->interp,multiInfo->easy_handle,
+                        curlMultiData->captureCount,curlMultiData->captureIndices,
+                        &msgPtr->captured)==TCL_OK) {
+                    Tcl_IncrRefCount(msgPtr->captured);
+                } else {
+                    msgPtr->captured=NULL;
+                    Tcl_ResetResult(curlMultiData->interp);
+                }
+            }
+        }
+        curlMultiQueueMsg(curlMultiData,msgPtr);
+
+        if ((multiInfo->msg==CURLMSG_DONE)&&(curlMultiData->groups!=NULL)) {
+            curlCoalesceDone(curlMultiData,multiInfo->easy_handle,
+                    multiInfo->data.result,msgPtr->captured);
+        }
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMultiQueueMsg --
+ *    Puts a message at the end of the queue 'getinfo' reads.
+ *
+ * Parameter:
+ *    curlMultiData: Pointer to the multi handle of the transfers.
+ *    msgPtr: The message.
+ *----------------------------------------------------------------------
+ */
+void
+curlMultiQueueMsg(struct curlMultiObjData *curlMultiData,
+        struct curlMultiMsg *msgPtr) {
+
+    if (curlMultiData->msgLast==NULL) {
+        curlMultiData->msgFirst=msgPtr;
+    } else {
+        curlMultiData->msgLast->next=msgPtr;
+    }
+    msgPtr->consumed=0;
+    curlMultiData->msgLast=msgPtr;
+    curlMultiData->msgCount++;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMultiDropMsgs --
+ *    Takes messages 'getinfo' no longer has to report out of the queue.
+ *
+ * Parameter:
+ *    curlMultiData: Pointer to the multi handle of the transfers.
+ *    name: The easy handle whose messages go, if NULL the ones whose
+ *          '-command' has been invoked go.
+ *----------------------------------------------------------------------
+ */
+void
+curlMultiDropMsgs(struct curlMultiObjData *curlMultiData,const char *name) {
+    struct curlMultiMsg  **msgPtrPtr,*msgPtr;
+
+    curlMultiData->msgLast=NULL;
+    for (msgPtrPtr=&curlMultiData->msgFirst;(msgPtr=*msgPtrPtr)!=NULL;) {
+        if ((name!=NULL)?strcmp(msgPtr->name,name):!msgPtr->consumed) {
+            curlMultiData->msgLast=msgPtr;
+            msgPtrPtr=&msgPtr->next;
+            continue;
+        }
+        *msgPtrPtr=msgPtr->next;
+        curlMultiData->msgCount--;
+        if (msgPtr->captured!=NULL) {
+            Tcl_DecrRefCount(msgPtr->captured);
+        }
+        Tcl_Free(msgPtr->name);
+        Tcl_Free((char *)msgPtr);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMultiRetryLater --
+ *    Called when a transfer is done, if it has to be tried again the
+ *    handle leaves the multi handle until it is due and there is no
+ *    message for it.
+ *
+ * Parameter:
+ *    curlMultiData: Pointer to the multi handle of the transfers.
+ *    easyHandle: The libcurl handle whose transfer is done.
+ *    result: How it went.
+ *
+ * Results:
+ *    1 if it is going to be retried, 0 otherwise.
+ *----------------------------------------------------------------------
+ */
+int
+curlMultiRetryLater(struct curlMultiObjData *curlMultiData,CURL *easyHandle,
+        CURLcode result) {
+    struct curlObjData    *curlData;
+    struct curlMultiRetry *retryPtr,**retryPtrPtr;
+    long                   delay;
+
+    if ((curl_easy_getinfo(easyHandle,CURLINFO_PRIVATE,(char **)&curlData)!=CURLE_OK)
+            ||(curlData==NULL)) {
+        return 0;
+    }
+    if (curlResumeFinish(curlData,result)) {
+        /* The resource changed, the download starts over right away. */
+        delay=0;
+    } else if ((delay=curlRetryCheck(curlData,result))<0) {
+        return 0;
+    }
+    curl_multi_remove_handle(curlMultiData->mcurl,easyHandle);
+
+    retryPtr=(struct curlMultiRetry *)Tcl_Alloc(sizeof(struct curlMultiRetry));
+    retryPtr->curlData=curlData;
+    retryPtr->due=curlMultiNow()+delay;
+    retryPtr->next=NULL;
+    for (retryPtrPtr=&curlMultiData->retries;*retryPtrPtr!=NULL;
+            retryPtrPtr=&(*retryPtrPtr)->next) {
+    }
+    *retryPtrPtr=retryPtr;
+    curlMultiData->retryCount++;
+
+    return 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMultiRetryStart --
+ *    Adds back to the multi handle the handles whose next attempt is
+ *    due, if one leads a group of '-coalesce' the group starts over too.
+ *
+ * Parameter:
+ *    curlMultiData: Pointer to the multi handle of the transfers.
+ *----------------------------------------------------------------------
+ */
+void
+curlMultiRetryStart(struct curlMultiObjData *curlMultiData) {
+    struct curlMultiRetry     *retryPtr,**retryPtrPtr;
+    struct curlCoalesceGroup  *groupPtr;
+    Tcl_WideInt                now;
+
+    if (curlMultiData->retries==NULL) {
+        return;
+    }
+    now=curlMultiNow();
+    for (retryPtrPtr=&curlMultiData->retries;(retryPtr=*retryPtrPtr)!=NULL;) {
+        if (retryPtr->due>now) {
+            retryPtrPtr=&retryPtr->next;
+            continue;
+        }
+        *retryPtrPtr=retryPtr->next;
+        curlMultiData->retryCount--;
+
+        curlRetryWatch(retryPtr->curlData);
+        curlResumePrepare(retryPtr->curlData);
+        curlDigestPrepare(retryPtr->curlData);
+        for (groupPtr=curlMultiData->groups;groupPtr!=NULL;groupPtr=groupPtr->next) {
+            if (groupPtr->leader==retryPtr->curlData) {
+                curlCoalesceLead(groupPtr,retryPtr->curlData);
+                break;
+            }
+        }
+        curl_multi_add_handle(curlMultiData->mcurl,retryPtr->curlData->curl);
+        Tcl_Free((char *)retryPtr);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMultiRetryRemove --
+ *    Called when a handle is removed from a multi handle, if it was
+ *    waiting to be tried again it isn't anymore.
+ *
+ * Parameter:
+ *    curlMultiData: Pointer to the multi handle of the transfers.
+ *    curlData: The handle being removed.
+ *----------------------------------------------------------------------
+ */
+void
+curlMultiRetryRemove(struct curlMultiObjData *curlMultiData,
+        struct curlObjData *curlData) {
+    struct curlMultiRetry     *retryPtr,**retryPtrPtr;
+
+    for (retryPtrPtr=&curlMultiData->retries;(retryPtr=*retryPtrPtr)!=NULL;
+            retryPtrPtr=&retryPtr->next) {
+        if (retryPtr->curlData==curlData) {
+            *retryPtrPtr=retryPtr->next;
+            curlMultiData->retryCount--;
+            Tcl_Free((char *)retryPtr);
+            return;
+        }
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMultiNow --
+ *    The time in milliseconds, to know when a retry is due.
+ *----------------------------------------------------------------------
+ */
+Tcl_WideInt
+curlMultiNow(void) {
+    Tcl_Time        now;
+
+    Tcl_GetTime(&now);
+    return (Tcl_WideInt)now.sec*1000+now.usec/1000;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -522,9 +852,17 @@ curlGetEasyHandle(Tcl_Interp *interp,Tcl_Obj *nameObjPtr) {
  */
 void
 curlMultiFreeSpace(struct curlMultiObjData *curlMultiData) {
+    struct curlMultiMsg     *msgPtr;
 
-    curl_multi_cleanup(curlMultiData->mcurl);
-
+    while ((msgPtr=curlMultiData->msgFirst)!=NULL) {
+        curlMultiData->msgFirst=msgPtr->next;
+        if (msgPtr->captured!=NULL) {
+            Tcl_DecrRefCount(msgPtr->captured);
+        }
+        Tcl_Free(msgPtr->name);
+        Tcl_Free((char *)msgPtr);
+    }
+    Tcl_Free((char *)curlMultiData->captureIndices);
     Tcl_Free(curlMultiData->postCommand);
     Tcl_Free((char *)curlMultiData);
 }
@@ -676,20 +1014,31 @@ int
 curlMultiAutoTransfer(Tcl_Interp *interp, struct curlMultiObjData *curlMultiData,
         int objc,Tcl_Obj *const objv[]) {
 
+    struct curlMultiMsg   *lastMsg=curlMultiData->msgLast;
+
     if (objc==4) {
         Tcl_Free(curlMultiData->postCommand);
         curlMultiData->postCommand=curlstrdup(Tcl_GetString(objv[3]));
     }
 
-    Tcl_CreateEventSource((Tcl_EventSetupProc *)curlEventSetup, 
-            (Tcl_EventCheckProc *)curlEventCheck, (ClientData *)curlMultiData);
+    /* Calling 'auto' again, to add more handles, shouldn't add another
+       event source. */
+    if (!curlMultiData->autoActive) {
+        Tcl_CreateEventSource((Tcl_EventSetupProc *)curlEventSetup, 
+                (Tcl_EventCheckProc *)curlEventCheck, (ClientData *)curlMultiData);
+        curlMultiData->autoActive=1;
+    }
 
     /* We have to call perform once to boot the transfer, otherwise it seems nothing
        works *shrug* */
 
+    curlMultiRetryStart(curlMultiData);
     while(CURLM_CALL_MULTI_PERFORM ==
             curl_multi_perform(curlMultiData->mcurl,&(curlMultiData->runningTransfers))) {
     }
+    curlMultiReadMessages(curlMultiData);
+    curlMultiData->runningTransfers+=curlMultiData->retryCount;
+    curlMultiRunCommands(curlMultiData,lastMsg);
 
     return TCL_OK;
 }
@@ -769,10 +1118,54 @@ curlMultiSetOpts(Tcl_Interp *interp, struct curlMultiObjData *curlMultiData,
                 return TCL_ERROR;
             }
             break;
+        case 2:
+            if (curlMultiSetCapture(interp,curlMultiData,objv)) {
+                return TCL_ERROR;
+            }
+            break;
+        case 3:
+            if (Tcl_GetBooleanFromObj(interp,objv,&curlMultiData->coalesce)) {
+                return TCL_ERROR;
+            }
+            break;
     }
     return TCL_OK;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlMultiSetCapture --
+ *
+ *  Sets the list of 'getinfo' options whose values will be saved when
+ *  a transfer is done, an empty list means nothing will be saved.
+ *
+ *  Parameter:
+ *      interp: The interpreter we are working with.
+ *      curlMultiData: The multi handle.
+ *      tclObj: The list with the names of the options.
+ *
+ * Results:
+ *  0 if all went well.
+ *  1 in case of error.
+ *----------------------------------------------------------------------
+ */
+int
+curlMultiSetCapture(Tcl_Interp *interp,struct curlMultiObjData *curlMultiData,
+        Tcl_Obj *const tclObj) {
+    int             count;
+    int            *indices;
+
+    if (curlGetInfoIndices(interp,tclObj,&count,&indices)==TCL_ERROR) {
+        return 1;
+    }
+    Tcl_Free((char *)curlMultiData->captureIndices);
+    curlMultiData->captureIndices=indices;
+    curlMultiData->captureCount=count;
+
+    return 0;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -859,8 +1252,10 @@ curlEventCheck(ClientData clientData, int flags) {
     if (curlMultiData->runningTransfers==0) {
         Tcl_DeleteEventSource((Tcl_EventSetupProc *)curlEventSetup, 
                 (Tcl_EventCheckProc *)curlEventCheck, (ClientData *)curlMultiData);
+        curlMultiData->autoActive=0;
     } else {
         if (selectCode>=0) {
+            Tcl_Preserve((ClientData)curlMultiData);
             curlEventPtr=(struct curlEvent *)Tcl_Alloc(sizeof(struct curlEvent));
             curlEventPtr->proc=curlEventProc;
             curlEventPtr->curlMultiData=curlMultiData;
@@ -884,12 +1279,20 @@ int
 curlEventProc(Tcl_Event *evPtr,int flags) {
     struct curlMultiObjData   *curlMultiData
             =(struct curlMultiObjData *)((struct curlEvent *)evPtr)->curlMultiData;
-    CURLMcode                  errorCode;
+    struct curlMultiMsg       *lastMsg=curlMultiData->msgLast;
     Tcl_Obj                   *tclCommandObjPtr;
     char                       tclCommand[300];
 
-    errorCode=curl_multi_perform(curlMultiData->mcurl,&curlMultiData->runningTransfers);
-    if (curlMultiData->runningTransfers==0) {
+    if (curlMultiData->mcurl==NULL) {
+        Tcl_Release((ClientData)curlMultiData);
+        return 1;
+    }
+    curlMultiRetryStart(curlMultiData);
+    curl_multi_perform(curlMultiData->mcurl,&curlMultiData->runningTransfers);
+    curlMultiReadMessages(curlMultiData);
+    curlMultiData->runningTransfers+=curlMultiData->retryCount;
+    curlMultiRunCommands(curlMultiData,lastMsg);
+    if (curlMultiData->mcurl!=NULL&&curlMultiData->runningTransfers==0) {
         if (curlMultiData->postCommand!=NULL) {
             snprintf(tclCommand,299,"%s",curlMultiData->postCommand);
             tclCommandObjPtr=Tcl_NewStringObj(tclCommand,-1);
@@ -901,7 +1304,1119 @@ curlEventProc(Tcl_Event *evPtr,int flags) {
             }
         }
     }
+    Tcl_Release((ClientData)curlMultiData);
+    return 1;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * curlMultiRunCommands --
+ *
+ *  When the multi handle is driven by the event loop, invokes the
+ *  '-command' of the easy handles whose transfers have just finished.
+ *
+ * Parameters:
+ *  curlMultiData: The multi handle.
+ *  lastMsg: The last message in the queue before reading the new ones.
+ *----------------------------------------------------------------------
+ */
+
+void
+curlMultiRunCommands(struct curlMultiObjData *curlMultiData,
+        struct curlMultiMsg *lastMsg) {
+    Tcl_Interp            *interp=curlMultiData->interp;
+    struct curlMultiMsg   *msgPtr;
+    struct curlObjData    *curlData;
+    Tcl_Obj               *commandsObj, *nameObj, *commandObj;
+    int                    count, i;
+
+    msgPtr=(lastMsg==NULL)?curlMultiData->msgFirst:lastMsg->next;
+    if (msgPtr==NULL) {
+        return;
+    }
+
+    /* The commands may remove handles and read the messages, so we
+       collect them all before invoking any. */
+    commandsObj=Tcl_NewListObj(0,NULL);
+    Tcl_IncrRefCount(commandsObj);
+    for (;msgPtr!=NULL;msgPtr=msgPtr->next) {
+        if (msgPtr->msg!=CURLMSG_DONE) {
+            continue;
+        }
+        nameObj=Tcl_NewStringObj(msgPtr->name,-1);
+        Tcl_IncrRefCount(nameObj);
+        curlData=curlGetEasyHandle(interp,nameObj);
+        Tcl_DecrRefCount(nameObj);
+        if (curlData!=NULL&&curlData->callbacks!=NULL
+                &&curlData->callbacks->command!=NULL) {
+            Tcl_ListObjAppendElement(NULL,commandsObj,
+                    curlData->callbacks->command);
+            msgPtr->consumed=1;
+        }
+    }
+
+    Tcl_Preserve((ClientData)curlMultiData);
+    Tcl_ListObjLength(NULL,commandsObj,&count);
+    for (i=0;i<count&&curlMultiData->mcurl!=NULL;i++) {
+        Tcl_ListObjIndex(NULL,commandsObj,i,&commandObj);
+        if (Tcl_EvalObjEx(interp,commandObj,TCL_EVAL_GLOBAL)!=TCL_OK) {
+            Tcl_BackgroundError(interp);
+        }
+    }
+    /* Nobody is going to ask 'getinfo' for what the commands were told,
+       it would pile up in the queue. */
+    curlMultiDropMsgs(curlMultiData,NULL);
+    Tcl_Release((ClientData)curlMultiData);
+    Tcl_DecrRefCount(commandsObj);
+}
+
+/*----------------------------------------------------------------------
+ *
+ * curlCoalesceKey --
+ *
+ *  Puts together what tells the requests that can share a transfer
+ *  apart: the URL and the headers of a GET. Requests with credentials,
+ *  cookies or a client certificate of their own don't share.
+ *
+ * Results:
+ *  1 if the request can share a transfer and 'keyPtr' has the key, 0
+ *  if it can't.
+ *----------------------------------------------------------------------
+ */
+
+int
+curlCoalesceKey(struct curlObjData *curlData,Tcl_DString *keyPtr) {
+    struct curl_slist     *slistPtr;
+
+    if ((curlData->methodFlags!=0)||(curlData->identityFlags!=0)
+            ||(curlData->urlName==NULL)) {
+        return 0;
+    }
+    Tcl_DStringInit(keyPtr);
+    Tcl_DStringAppend(keyPtr,"GET ",4);
+    Tcl_DStringAppend(keyPtr,Tcl_GetString(curlData->urlName),-1);
+    for (slistPtr=curlData->headerList;slistPtr!=NULL;slistPtr=slistPtr->next) {
+        Tcl_DStringAppend(keyPtr,"\n",1);
+        Tcl_DStringAppend(keyPtr,slistPtr->data,-1);
+    }
     return 1;
 }
 
+/*----------------------------------------------------------------------
+ *
+ * curlCoalesceAdd --
+ *
+ *  Adds a handle to a multi handle with '-coalesce'. If there is a
+ *  transfer in flight for the same request, the handle follows it,
+ *  otherwise it starts one that others can follow.
+ *
+ * Parameters:
+ *  curlMultiData: The multi handle.
+ *  curlData: The easy handle.
+ *  key: What curlCoalesceKey put together for it.
+ *
+ * Results:
+ *  What curl_multi_add_handle returns.
+ *----------------------------------------------------------------------
+ */
+
+CURLMcode
+curlCoalesceAdd(struct curlMultiObjData *curlMultiData,
+        struct curlObjData *curlData,const char *key) {
+    struct curlCoalesceGroup      *groupPtr;
+    struct curlCoalesceFollower   *followerPtr,**followerPtrPtr;
+    CURLMcode                      errorCode;
+
+    for (groupPtr=curlMultiData->groups;groupPtr!=NULL;groupPtr=groupPtr->next) {
+        if (!strcmp(groupPtr->key,key)) {
+            break;
+        }
+    }
+    if ((groupPtr!=NULL)&&groupPtr->unbuffered) {
+        /* Too late to follow, it gets a transfer of its own. */
+        curlRetryWatch(curlData);
+        errorCode=curl_multi_add_handle(curlMultiData->mcurl,curlData->curl);
+        if (errorCode!=CURLM_OK) {
+            curlRetryUnwatch(curlData);
+        }
+        return errorCode;
+    }
+    if (groupPtr!=NULL) {
+        if (groupPtr->leader==curlData) {
+            return CURLM_BAD_EASY_HANDLE;
+        }
+        for (followerPtrPtr=&groupPtr->followers;*followerPtrPtr!=NULL;
+                followerPtrPtr=&(*followerPtrPtr)->next) {
+            if ((*followerPtrPtr)->curlData==curlData) {
+                return CURLM_BAD_EASY_HANDLE;
+            }
+        }
+        followerPtr=(struct curlCoalesceFollower *)
+                Tcl_Alloc(sizeof(struct curlCoalesceFollower));
+        followerPtr->curlData=curlData;
+        followerPtr->next=NULL;
+        *followerPtrPtr=followerPtr;
+        return CURLM_OK;
+    }
+
+    curlRetryWatch(curlData);
+    errorCode=curl_multi_add_handle(curlMultiData->mcurl,curlData->curl);
+    if (errorCode!=CURLM_OK) {
+        curlRetryUnwatch(curlData);
+        return errorCode;
+    }
+    groupPtr=(struct curlCoalesceGroup *)Tcl_Alloc(sizeof(struct curlCoalesceGroup));
+    memset(groupPtr,0,sizeof(struct curlCoalesceGroup));
+    groupPtr->key=curlstrdup((char *)key);
+    Tcl_DStringInit(&groupPtr->headers);
+    curlCoalesceLead(groupPtr,curlData);
+    groupPtr->next=curlMultiData->groups;
+    curlMultiData->groups=groupPtr;
+
+    return CURLM_OK;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * curlCoalesceLead --
+ *
+ *  Makes a handle the one doing the transfer of a group, what it gets
+ *  goes through the group on its way to the handle.
+ *----------------------------------------------------------------------
+ */
+
+void
+curlCoalesceLead(struct curlCoalesceGroup *groupPtr,struct curlObjData *curlData) {
+
+    groupPtr->leader=curlData;
+    Tcl_DStringSetLength(&groupPtr->headers,0);
+    groupPtr->size=0;
+    groupPtr->unbuffered=0;
+    curl_easy_setopt(curlData->curl,CURLOPT_WRITEFUNCTION,curlCoalesceWrite);
+    curl_easy_setopt(curlData->curl,CURLOPT_WRITEDATA,groupPtr);
+    curl_easy_setopt(curlData->curl,CURLOPT_HEADERFUNCTION,curlCoalesceHeader);
+    curl_easy_setopt(curlData->curl,CURLOPT_HEADERDATA,groupPtr);
+}
+
+/*----------------------------------------------------------------------
+ *
+ * curlCoalesceWrite, curlCoalesceHeader --
+ *
+ *  The write and header functions of the leader of a group, they keep
+ *  the body and the headers for the followers.
+ *----------------------------------------------------------------------
+ */
+
+size_t
+curlCoalesceWrite(char *ptr,size_t size,size_t nmemb,void *groupPtr) {
+    struct curlCoalesceGroup   *coalescePtr=(struct curlCoalesceGroup *)groupPtr;
+    size_t                      length=size*nmemb;
+
+    if (coalescePtr->followers==NULL) {
+        coalescePtr->unbuffered=1;
+        return curlWriteBody(coalescePtr->leader,ptr,length);
+    }
+    if (coalescePtr->size+length>coalescePtr->capacity) {
+        coalescePtr->capacity=(coalescePtr->size+length)*2;
+        coalescePtr->body=Tcl_Realloc(coalescePtr->body,coalescePtr->capacity);
+    }
+    memcpy(coalescePtr->body+coalescePtr->size,ptr,length);
+    coalescePtr->size+=length;
+
+    return curlWriteBody(coalescePtr->leader,ptr,length);
+}
+
+size_t
+curlCoalesceHeader(char *ptr,size_t size,size_t nmemb,void *groupPtr) {
+    struct curlCoalesceGroup   *coalescePtr=(struct curlCoalesceGroup *)groupPtr;
+    size_t                      length=size*nmemb;
+
+    Tcl_DStringAppend(&coalescePtr->headers,ptr,(int)length);
+
+    return curlWriteHeader(coalescePtr->leader,ptr,length);
+}
+
+/*----------------------------------------------------------------------
+ *
+ * curlCoalesceDone --
+ *
+ *  Called when a transfer is done, if it is the leader of a group the
+ *  followers get what it got and a message of their own, with the
+ *  same result and the same captured information.
+ *
+ * Parameters:
+ *  curlMultiData: The multi handle.
+ *  easyHandle: The libcurl handle whose transfer is done.
+ *  result: How it went.
+ *  captured: What was captured with '-capture' for it, or NULL.
+ *----------------------------------------------------------------------
+ */
 
+void
+curlCoalesceDone(struct curlMultiObjData *curlMultiData,CURL *easyHandle,
+        int result,Tcl_Obj *captured) {
+    struct curlCoalesceGroup     **groupPtrPtr,*groupPtr;
+    struct curlCoalesceFollower   *followerPtr;
+    struct curlMultiMsg           *msgPtr;
+    char                          *name;
+
+    for (groupPtrPtr=&curlMultiData->groups;*groupPtrPtr!=NULL;
+            groupPtrPtr=&(*groupPtrPtr)->next) {
+        if ((*groupPtrPtr)->leader->curl==easyHandle) {
+            break;
+        }
+    }
+    if ((groupPtr=*groupPtrPtr)==NULL) {
+        return;
+    }
+    *groupPtrPtr=groupPtr->next;
+
+    for (followerPtr=groupPtr->followers;followerPtr!=NULL;
+            followerPtr=followerPtr->next) {
+        msgPtr=(struct curlMultiMsg *)Tcl_Alloc(sizeof(struct curlMultiMsg));
+        name=curlGetEasyName(curlMultiData,followerPtr->curlData->curl);
+        msgPtr->name=curlstrdup(name?name:"");
+        msgPtr->msg=CURLMSG_DONE;
+        msgPtr->result=result;
+        if (curlWriteResponse(followerPtr->curlData,
+                Tcl_DStringValue(&groupPtr->headers),
+                Tcl_DStringLength(&groupPtr->headers),
+                groupPtr->body,groupPtr->size)&&(result==CURLE_OK)) {
+            msgPtr->result=CURLE_WRITE_ERROR;
+        }
+        msgPtr->result=curlDigestFinish(followerPtr->curlData,msgPtr->result);
+        msgPtr->result=curlCommitFiles(followerPtr->curlData,msgPtr->result);
+        msgPtr->captured=captured;
+        if (captured!=NULL) {
+            Tcl_IncrRefCount(captured);
+        }
+        msgPtr->next=NULL;
+        curlMultiQueueMsg(curlMultiData,msgPtr);
+    }
+    curlCoalesceFree(groupPtr);
+}
+
+/*----------------------------------------------------------------------
+ *
+ * curlCoalesceRemove --
+ *
+ *  Called when a handle is removed from a multi handle. A follower just
+ *  stops following, if the leader is removed in the middle of the
+ *  transfer the first follower starts it again.
+ *----------------------------------------------------------------------
+ */
+
+void
+curlCoalesceRemove(struct curlMultiObjData *curlMultiData,
+        struct curlObjData *curlData) {
+    struct curlCoalesceGroup     **groupPtrPtr,*groupPtr;
+    struct curlCoalesceFollower  **followerPtrPtr,*followerPtr;
+
+    for (groupPtrPtr=&curlMultiData->groups;*groupPtrPtr!=NULL;
+            groupPtrPtr=&(*groupPtrPtr)->next) {
+        groupPtr=*groupPtrPtr;
+        if (groupPtr->leader==curlData) {
+            if (groupPtr->followers==NULL) {
+                *groupPtrPtr=groupPtr->next;
+                curlCoalesceFree(groupPtr);
+                return;
+            }
+            curlSetWriter(curlData,curlData->writeFunction,curlData->writeData);
+            curlSetHeaderWriter(curlData,curlData->headerFunction,
+                    curlData->headerData);
+            followerPtr=groupPtr->followers;
+            groupPtr->followers=followerPtr->next;
+            curlRetryWatch(followerPtr->curlData);
+            curlCoalesceLead(groupPtr,followerPtr->curlData);
+            Tcl_Free((char *)followerPtr);
+            curl_multi_add_handle(curlMultiData->mcurl,groupPtr->leader->curl);
+            return;
+        }
+        for (followerPtrPtr=&groupPtr->followers;*followerPtrPtr!=NULL;
+                followerPtrPtr=&(*followerPtrPtr)->next) {
+            if ((*followerPtrPtr)->curlData==curlData) {
+                followerPtr=*followerPtrPtr;
+                *followerPtrPtr=followerPtr->next;
+                Tcl_Free((char *)followerPtr);
+                return;
+            }
+        }
+    }
+}
+
+/*----------------------------------------------------------------------
+ *
+ * curlCoalesceFree --
+ *
+ *  Gives the leader of a group its functions back and frees the group.
+ *----------------------------------------------------------------------
+ */
+
+void
+curlCoalesceFree(struct curlCoalesceGroup *groupPtr) {
+    struct curlObjData            *curlData=groupPtr->leader;
+    struct curlCoalesceFollower   *followerPtr;
+
+    curlSetWriter(curlData,curlData->writeFunction,curlData->writeData);
+    curlSetHeaderWriter(curlData,curlData->headerFunction,curlData->headerData);
+    while ((followerPtr=groupPtr->followers)!=NULL) {
+        groupPtr->followers=followerPtr->next;
+        Tcl_Free((char *)followerPtr);
+    }
+    Tcl_DStringFree(&groupPtr->headers);
+    if (groupPtr->body!=NULL) {
+        Tcl_Free(groupPtr->body);
+    }
+    Tcl_Free(groupPtr->key);
+    Tcl_Free((char *)groupPtr);
+}
+
+#if CURL_AT_LEAST_VERSION(7, 28, 0)
+
+/*----------------------------------------------------------------------
+ *
+ * curlFetchAllObjCmd --
+ *
+ *  This procedure is invoked to process the "curl::fetchall" Tcl command.
+ *  It fetches a list of URLs through its own multi handle, with at most
+ *  '-concurrency' transfers at the same time. Every handle gets a new URL
+ *  as soon as it is done with the last one.
+ *
+ * Results:
+ *  A standard Tcl result, without '-command' the result is a dict with
+ *  the result of every URL.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlFetchAllObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]) {
+
+    Tcl_Obj                *urlsObj=NULL, *commandObj=NULL, *resultObj=NULL;
+    Tcl_Obj                *entryObj, *cmdObj;
+    Tcl_Obj               **urls;
+    struct curlObjData     *templateData=NULL;
+    struct curlFetchSlot   *slots=NULL, *slotPtr;
+    CURLM                  *multiHandle;
+    CURLMsg                *multiInfo;
+    int                     concurrency=8, urlCount, nextUrl, active=0;
+    int                     tableIndex, i, msgLeft, running, code=TCL_OK;
+    CURLMcode               errorCode;
+
+    if (objc%2==0) {
+        Tcl_WrongNumArgs(interp,1,objv,"-urls list ?-option value ...?");
+        return TCL_ERROR;
+    }
+    for (i=1;i<objc;i+=2) {
+        if (Tcl_GetIndexFromObj(interp,objv[i],fetchAllOptionTable,"option",
+                TCL_EXACT,&tableIndex)==TCL_ERROR) {
+            return TCL_ERROR;
+        }
+        switch(tableIndex) {
+            case 0:
+                urlsObj=objv[i+1];
+                break;
+            case 1:
+                if (Tcl_GetIntFromObj(interp,objv[i+1],&concurrency)!=TCL_OK) {
+                    return TCL_ERROR;
+                }
+                if (concurrency<1) {
+                    Tcl_SetObjResult(interp,Tcl_NewStringObj(
+                            "the concurrency must be at least 1",-1));
+                    return TCL_ERROR;
+                }
+                break;
+            case 2:
+                commandObj=objv[i+1];
+                break;
+            case 3:
+                templateData=curlGetEasyHandle(interp,objv[i+1]);
+                if (templateData==NULL) {
+                    Tcl_SetObjResult(interp,Tcl_ObjPrintf(
+                            "\"%s\" is not a curl handle",Tcl_GetString(objv[i+1])));
+                    return TCL_ERROR;
+                }
+                break;
+        }
+    }
+    if (urlsObj==NULL) {
+        Tcl_SetObjResult(interp,Tcl_NewStringObj("the -urls option is required",-1));
+        return TCL_ERROR;
+    }
+    /* We may run scripts that change the list. */
+    urlsObj=Tcl_DuplicateObj(urlsObj);
+    Tcl_IncrRefCount(urlsObj);
+    if (Tcl_ListObjGetElements(interp,urlsObj,&urlCount,&urls)!=TCL_OK) {
+        Tcl_DecrRefCount(urlsObj);
+        return TCL_ERROR;
+    }
+    if (concurrency>urlCount) {
+        concurrency=urlCount;
+    }
+
+    multiHandle=curl_multi_init();
+    if (multiHandle==NULL) {
+        Tcl_DecrRefCount(urlsObj);
+        Tcl_SetObjResult(interp,Tcl_NewStringObj("Couldn't open curl multi handle",-1));
+        return TCL_ERROR;
+    }
+    if (commandObj==NULL) {
+        resultObj=Tcl_NewDictObj();
+        Tcl_IncrRefCount(resultObj);
+    }
+
+    if (concurrency>0) {
+        slots=(struct curlFetchSlot *)Tcl_Alloc(concurrency*sizeof(struct curlFetchSlot));
+        memset(slots,0,concurrency*sizeof(struct curlFetchSlot));
+    }
+    for (nextUrl=0;nextUrl<concurrency;nextUrl++) {
+        slotPtr=&slots[nextUrl];
+        if (templateData!=NULL) {
+            slotPtr->curl=curlDupEasyHandle(templateData);
+        } else {
+            slotPtr->curl=curl_easy_init();
+        }
+        if (slotPtr->curl==NULL) {
+            Tcl_SetObjResult(interp,Tcl_NewStringObj("Couldn't open curl handle",-1));
+            code=TCL_ERROR;
+            goto cleanup;
+        }
+        curl_easy_setopt(slotPtr->curl,CURLOPT_WRITEFUNCTION,curlFetchWrite);
+        curl_easy_setopt(slotPtr->curl,CURLOPT_WRITEDATA,slotPtr);
+        curl_easy_setopt(slotPtr->curl,CURLOPT_PRIVATE,slotPtr);
+        /* The template's callbacks would all get the template's data. */
+        curl_easy_setopt(slotPtr->curl,CURLOPT_HEADERFUNCTION,NULL);
+        curl_easy_setopt(slotPtr->curl,CURLOPT_HEADERDATA,NULL);
+        curl_easy_setopt(slotPtr->curl,CURLOPT_DEBUGFUNCTION,NULL);
+        curl_easy_setopt(slotPtr->curl,CURLOPT_DEBUGDATA,NULL);
+        curl_easy_setopt(slotPtr->curl,CURLOPT_NOPROGRESS,1L);
+        if (curlFetchStart(multiHandle,slotPtr,urls[nextUrl],nextUrl)) {
+            Tcl_SetObjResult(interp,Tcl_NewStringObj("Couldn't add the handle",-1));
+            code=TCL_ERROR;
+            goto cleanup;
+        }
+        active++;
+    }
+
+    while (active>0) {
+        errorCode=curl_multi_perform(multiHandle,&running);
+        if (errorCode!=CURLM_OK) {
+            curlReturnCURLMcode(interp,errorCode);
+            code=TCL_ERROR;
+            goto cleanup;
+        }
+        while ((multiInfo=curl_multi_info_read(multiHandle,&msgLeft))!=NULL) {
+            if (multiInfo->msg!=CURLMSG_DONE) {
+                continue;
+            }
+            curl_easy_getinfo(multiInfo->easy_handle,CURLINFO_PRIVATE,(char **)&slotPtr);
+            curlStatsRecord(slotPtr->curl,multiInfo->data.result);
+            entryObj=curlFetchResult(slotPtr,multiInfo->data.result);
+            curl_multi_remove_handle(multiHandle,slotPtr->curl);
+
+            if (commandObj==NULL) {
+                Tcl_DictObjPut(interp,resultObj,urls[slotPtr->urlIndex],entryObj);
+            } else {
+                cmdObj=Tcl_DuplicateObj(commandObj);
+                Tcl_IncrRefCount(cmdObj);
+                if (Tcl_ListObjAppendElement(interp,cmdObj,urls[slotPtr->urlIndex])!=TCL_OK
+                        ||Tcl_ListObjAppendElement(interp,cmdObj,entryObj)!=TCL_OK) {
+                    code=TCL_ERROR;
+                } else {
+                    code=Tcl_EvalObjEx(interp,cmdObj,TCL_EVAL_GLOBAL);
+                }
+                Tcl_DecrRefCount(cmdObj);
+                if (code==TCL_BREAK) {
+                    code=TCL_OK;
+                    Tcl_ResetResult(interp);
+                    goto cleanup;
+                }
+                if (code==TCL_ERROR) {
+                    goto cleanup;
+                }
+                code=TCL_OK;
+            }
+
+            if (nextUrl<urlCount) {
+                if (curlFetchStart(multiHandle,slotPtr,urls[nextUrl],nextUrl)) {
+                    Tcl_SetObjResult(interp,Tcl_NewStringObj("Couldn't add the handle",-1));
+                    code=TCL_ERROR;
+                    goto cleanup;
+                }
+                nextUrl++;
+            } else {
+                active--;
+            }
+        }
+        if (active>0) {
+            errorCode=curl_multi_wait(multiHandle,NULL,0,1000,NULL);
+            if (errorCode!=CURLM_OK) {
+                curlReturnCURLMcode(interp,errorCode);
+                code=TCL_ERROR;
+                goto cleanup;
+            }
+        }
+    }
+    if (commandObj==NULL) {
+        Tcl_SetObjResult(interp,resultObj);
+    } else {
+        Tcl_ResetResult(interp);
+    }
+
+cleanup:
+    for (i=0;i<concurrency;i++) {
+        if (slots[i].curl!=NULL) {
+            curl_multi_remove_handle(multiHandle,slots[i].curl);
+            curl_easy_cleanup(slots[i].curl);
+        }
+        Tcl_Free(slots[i].body);
+    }
+    Tcl_Free((char *)slots);
+    curl_multi_cleanup(multiHandle);
+    if (resultObj!=NULL) {
+        Tcl_DecrRefCount(resultObj);
+    }
+    Tcl_DecrRefCount(urlsObj);
+
+    return code;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * curlFetchStart --
+ *
+ *  Makes one of the handles of 'curl::fetchall' start on a new URL.
+ *
+ * Parameters:
+ *  multiHandle: The multi handle doing the transfers.
+ *  slotPtr: The handle.
+ *  urlObj: The URL to fetch.
+ *  urlIndex: Its position in the list.
+ *
+ * Results:
+ *  0 if all went well.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlFetchStart(CURLM *multiHandle,struct curlFetchSlot *slotPtr,
+        Tcl_Obj *urlObj,int urlIndex) {
+
+    slotPtr->urlIndex=urlIndex;
+    slotPtr->size=0;
+#if CURL_AT_LEAST_VERSION(7, 63, 0)
+    /* A parsed URL in the template would be used instead. */
+    curl_easy_setopt(slotPtr->curl,CURLOPT_CURLU,NULL);
+#endif
+    curl_easy_setopt(slotPtr->curl,CURLOPT_URL,Tcl_GetString(urlObj));
+
+    return curl_multi_add_handle(multiHandle,slotPtr->curl)!=CURLM_OK;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * curlFetchResult --
+ *
+ *  Builds the dict 'curl::fetchall' gives for a URL once it is done.
+ *
+ * Parameters:
+ *  slotPtr: The handle that fetched the URL.
+ *  result: The code of the transfer.
+ *
+ * Results:
+ *  A dict with the 'code', the 'responsecode', the 'body' and the total
+ *  'time' of the transfer.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Tcl_Obj *
+curlFetchResult(struct curlFetchSlot *slotPtr,CURLcode result) {
+    Tcl_Obj            *entryObj;
+    long                responseCode=0;
+    double              totalTime=0;
+
+    curl_easy_getinfo(slotPtr->curl,CURLINFO_RESPONSE_CODE,&responseCode);
+    curl_easy_getinfo(slotPtr->curl,CURLINFO_TOTAL_TIME,&totalTime);
+
+    entryObj=Tcl_NewDictObj();
+    Tcl_DictObjPut(NULL,entryObj,Tcl_NewStringObj("code",-1),
+            Tcl_NewIntObj(result));
+    Tcl_DictObjPut(NULL,entryObj,Tcl_NewStringObj("responsecode",-1),
+            Tcl_NewLongObj(responseCode));
+    Tcl_DictObjPut(NULL,entryObj,Tcl_NewStringObj("body",-1),
+            Tcl_NewByteArrayObj((unsigned char *)slotPtr->body,(int)slotPtr->size));
+    Tcl_DictObjPut(NULL,entryObj,Tcl_NewStringObj("time",-1),
+            Tcl_NewDoubleObj(totalTime));
+
+    return entryObj;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * curlFetchWrite --
+ *
+ *  libcurl calls this function with the body of the URLs 'curl::fetchall'
+ *  fetches.
+ *
+ * Results:
+ *  The number of bytes taken.
+ *
+ *----------------------------------------------------------------------
+ */
+
+size_t
+curlFetchWrite(char *ptr,size_t size,size_t nmemb,void *userdata) {
+    struct curlFetchSlot   *slotPtr=(struct curlFetchSlot *)userdata;
+    size_t                  realsize=size*nmemb;
+
+    if (slotPtr->size+realsize>slotPtr->capacity) {
+        slotPtr->capacity=2*slotPtr->capacity+realsize;
+        slotPtr->body=Tcl_Realloc(slotPtr->body,slotPtr->capacity);
+    }
+    memcpy(slotPtr->body+slotPtr->size,ptr,realsize);
+    slotPtr->size+=realsize;
+
+    return realsize;
+}
+
+#endif
+
+#if CURL_AT_LEAST_VERSION(7, 55, 0)
+
+/*----------------------------------------------------------------------
+ *
+ * curlSegmentedObjCmd --
+ *
+ *  This procedure is invoked to process the "curl::segmented" Tcl command.
+ *  It asks for the size of a resource with a HEAD request and downloads it
+ *  into a file with '-segments' range transfers at the same time, through
+ *  a multi handle of its own. Every transfer writes its part in its place
+ *  in the file, which is allocated beforehand.
+ *
+ *  If the size isn't known, or the server doesn't take ranges, there is a
+ *  single transfer for the whole resource.
+ *
+ * Results:
+ *  A standard Tcl result, a dict with the 'size' of the resource and the
+ *  number of 'segments'. If a transfer fails the rest are stopped, the
+ *  file is removed and, as with 'perform', the exit code is the error.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlSegmentedObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]) {
+
+    Tcl_Obj                *urlObj=NULL, *fileObj=NULL, *progressObj=NULL;
+    Tcl_Obj                *resultObj, *cmdObj;
+    struct curlObjData     *templateData=NULL;
+    struct curlSegment     *segments=NULL, *segmentPtr;
+    CURL                   *probe;
+    CURLM                  *multiHandle=NULL;
+    CURLMsg                *multiInfo;
+    CURLcode                exitCode;
+    CURLMcode               errorCode;
+    curl_off_t              length=-1;
+    Tcl_WideInt             size, chunk, done, reported=-1;
+    Tcl_DString             url;
+    char                   *effectiveUrl=NULL, range[64];
+    int                     count=SEGMENTS_DEFAULT, ranges=0, fd=-1;
+    int                     tableIndex, i, msgLeft, running, active=0;
+    int                     code=TCL_OK;
+
+    if (objc%2==0) {
+        Tcl_WrongNumArgs(interp,1,objv,"-url url -file fileName ?-option value ...?");
+        return TCL_ERROR;
+    }
+    for (i=1;i<objc;i+=2) {
+        if (Tcl_GetIndexFromObj(interp,objv[i],segmentedOptionTable,"option",
+                TCL_EXACT,&tableIndex)==TCL_ERROR) {
+            return TCL_ERROR;
+        }
+        switch(tableIndex) {
+            case 0:
+                urlObj=objv[i+1];
+                break;
+            case 1:
+                fileObj=objv[i+1];
+                break;
+            case 2:
+                if (Tcl_GetIntFromObj(interp,objv[i+1],&count)!=TCL_OK) {
+                    return TCL_ERROR;
+                }
+                if (count<1) {
+                    Tcl_SetObjResult(interp,Tcl_NewStringObj(
+                            "the number of segments must be at least 1",-1));
+                    return TCL_ERROR;
+                }
+                break;
+            case 3:
+                templateData=curlGetEasyHandle(interp,objv[i+1]);
+                if (templateData==NULL) {
+                    Tcl_SetObjResult(interp,Tcl_ObjPrintf(
+                            "\"%s\" is not a curl handle",Tcl_GetString(objv[i+1])));
+                    return TCL_ERROR;
+                }
+                break;
+            case 4:
+                progressObj=objv[i+1];
+                break;
+        }
+    }
+    if (urlObj==NULL) {
+        Tcl_SetObjResult(interp,Tcl_NewStringObj("the -url option is required",-1));
+        return TCL_ERROR;
+    }
+    if (fileObj==NULL) {
+        Tcl_SetObjResult(interp,Tcl_NewStringObj("the -file option is required",-1));
+        return TCL_ERROR;
+    }
+
+    probe=curlSegmentHandle(templateData,Tcl_GetString(urlObj));
+    if (probe==NULL) {
+        Tcl_SetObjResult(interp,Tcl_NewStringObj("Couldn't open curl handle",-1));
+        return TCL_ERROR;
+    }
+    curl_easy_setopt(probe,CURLOPT_NOBODY,1L);
+    curl_easy_setopt(probe,CURLOPT_HEADERFUNCTION,curlSegmentHeader);
+    curl_easy_setopt(probe,CURLOPT_HEADERDATA,&ranges);
+    exitCode=curl_easy_perform(probe);
+    curlStatsRecord(probe,exitCode);
+    /* The segments go straight to where the redirections, if any, led. */
+    Tcl_DStringInit(&url);
+    if (exitCode==CURLE_OK) {
+        curl_easy_getinfo(probe,CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,&length);
+        curl_easy_getinfo(probe,CURLINFO_EFFECTIVE_URL,&effectiveUrl);
+        Tcl_DStringAppend(&url,(effectiveUrl!=NULL)?effectiveUrl:Tcl_GetString(urlObj),-1);
+    }
+    curl_easy_cleanup(probe);
+    if (exitCode!=CURLE_OK) {
+        Tcl_DStringFree(&url);
+        Tcl_SetObjResult(interp,Tcl_NewIntObj(exitCode));
+        return TCL_ERROR;
+    }
+
+    size=(Tcl_WideInt)length;
+    if ((size<0)||!ranges) {
+        ranges=0;
+        count=1;
+    } else if (size<count) {
+        count=(int)size;
+    }
+    fd=curlSegmentOpen(Tcl_GetString(fileObj),(size>0)?size:0);
+    if (fd<0) {
+        Tcl_DStringFree(&url);
+        Tcl_SetObjResult(interp,Tcl_ObjPrintf("Couldn't open file %s",
+                Tcl_GetString(fileObj)));
+        return TCL_ERROR;
+    }
+
+    multiHandle=curl_multi_init();
+    if (multiHandle==NULL) {
+        Tcl_SetObjResult(interp,Tcl_NewStringObj("Couldn't open curl multi handle",-1));
+        code=TCL_ERROR;
+        goto cleanup;
+    }
+    if (count>0) {
+        segments=(struct curlSegment *)Tcl_Alloc(count*sizeof(struct curlSegment));
+        memset(segments,0,count*sizeof(struct curlSegment));
+    }
+    chunk=(count>0)?size/count:0;
+    for (i=0;i<count;i++) {
+        segmentPtr=&segments[i];
+        segmentPtr->fd=fd;
+        segmentPtr->curl=curlSegmentHandle(templateData,Tcl_DStringValue(&url));
+        if (segmentPtr->curl==NULL) {
+            Tcl_SetObjResult(interp,Tcl_NewStringObj("Couldn't open curl handle",-1));
+            code=TCL_ERROR;
+            goto cleanup;
+        }
+        if (ranges) {
+            segmentPtr->first=i*chunk;
+            segmentPtr->last=(i==count-1)?size-1:segmentPtr->first+chunk-1;
+            sprintf(range,"%" TCL_LL_MODIFIER "d-%" TCL_LL_MODIFIER "d",
+                    segmentPtr->first,segmentPtr->last);
+            curl_easy_setopt(segmentPtr->curl,CURLOPT_RANGE,range);
+        } else {
+            segmentPtr->first=0;
+            segmentPtr->last=-1;
+        }
+        segmentPtr->offset=segmentPtr->first;
+        curl_easy_setopt(segmentPtr->curl,CURLOPT_WRITEFUNCTION,curlSegmentWrite);
+        curl_easy_setopt(segmentPtr->curl,CURLOPT_WRITEDATA,segmentPtr);
+        curl_easy_setopt(segmentPtr->curl,CURLOPT_PRIVATE,segmentPtr);
+        if (curl_multi_add_handle(multiHandle,segmentPtr->curl)!=CURLM_OK) {
+            Tcl_SetObjResult(interp,Tcl_NewStringObj("Couldn't add the handle",-1));
+            code=TCL_ERROR;
+            goto cleanup;
+        }
+        active++;
+    }
+
+    while ((active>0)&&(exitCode==CURLE_OK)) {
+        errorCode=curl_multi_perform(multiHandle,&running);
+        if (errorCode!=CURLM_OK) {
+            curlReturnCURLMcode(interp,errorCode);
+            code=TCL_ERROR;
+            goto cleanup;
+        }
+        while ((multiInfo=curl_multi_info_read(multiHandle,&msgLeft))!=NULL) {
+            if (multiInfo->msg!=CURLMSG_DONE) {
+                continue;
+            }
+            curl_easy_getinfo(multiInfo->easy_handle,CURLINFO_PRIVATE,(char **)&segmentPtr);
+            curlStatsRecord(segmentPtr->curl,multiInfo->data.result);
+            curl_multi_remove_handle(multiHandle,segmentPtr->curl);
+            active--;
+            if (exitCode==CURLE_OK) {
+                exitCode=multiInfo->data.result;
+            }
+        }
+        if ((progressObj!=NULL)&&(exitCode==CURLE_OK)) {
+            for (done=0,i=0;i<count;i++) {
+                done+=segments[i].offset-segments[i].first;
+            }
+            if (done!=reported) {
+                reported=done;
+                cmdObj=Tcl_DuplicateObj(progressObj);
+                Tcl_IncrRefCount(cmdObj);
+                Tcl_ListObjAppendElement(interp,cmdObj,Tcl_NewWideIntObj((size>0)?size:0));
+                Tcl_ListObjAppendElement(interp,cmdObj,Tcl_NewWideIntObj(done));
+                Tcl_ListObjAppendElement(interp,cmdObj,Tcl_NewIntObj(0));
+                Tcl_ListObjAppendElement(interp,cmdObj,Tcl_NewIntObj(0));
+                code=Tcl_EvalObjEx(interp,cmdObj,TCL_EVAL_GLOBAL);
+                Tcl_DecrRefCount(cmdObj);
+                if (code!=TCL_OK) {
+                    code=TCL_ERROR;
+                    goto cleanup;
+                }
+            }
+        }
+        if ((active>0)&&(exitCode==CURLE_OK)) {
+            errorCode=curl_multi_wait(multiHandle,NULL,0,1000,NULL);
+            if (errorCode!=CURLM_OK) {
+                curlReturnCURLMcode(interp,errorCode);
+                code=TCL_ERROR;
+                goto cleanup;
+            }
+        }
+    }
+    if (exitCode!=CURLE_OK) {
+        Tcl_SetObjResult(interp,Tcl_NewIntObj(exitCode));
+        code=TCL_ERROR;
+        goto cleanup;
+    }
+
+    resultObj=Tcl_NewDictObj();
+    Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("size",-1),
+            Tcl_NewWideIntObj(ranges?size:segments[0].offset));
+    Tcl_DictObjPut(NULL,resultObj,Tcl_NewStringObj("segments",-1),
+            Tcl_NewIntObj(count));
+    Tcl_SetObjResult(interp,resultObj);
+
+cleanup:
+    for (i=0;(segments!=NULL)&&(i<count);i++) {
+        if (segments[i].curl!=NULL) {
+            curl_multi_remove_handle(multiHandle,segments[i].curl);
+            curl_easy_cleanup(segments[i].curl);
+        }
+    }
+    Tcl_Free((char *)segments);
+    if (multiHandle!=NULL) {
+        curl_multi_cleanup(multiHandle);
+    }
+    Tcl_DStringFree(&url);
+#ifdef _WIN32
+    if (_close(fd)) {
+#else
+    if (close(fd)) {
+#endif
+        if (code==TCL_OK) {
+            Tcl_SetObjResult(interp,Tcl_ObjPrintf("Couldn't write file %s",
+                    Tcl_GetString(fileObj)));
+            code=TCL_ERROR;
+        }
+    }
+    if (code==TCL_ERROR) {
+        Tcl_FSDeleteFile(fileObj);
+    }
+
+    return code;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * curlSegmentHandle --
+ *
+ *  Makes a handle for 'curl::segmented', from the template if there is
+ *  one. HTTP errors make the transfers fail, rather than have the error
+ *  page written to the file.
+ *
+ * Results:
+ *  The handle, NULL if it couldn't be made.
+ *
+ *----------------------------------------------------------------------
+ */
+
+CURL *
+curlSegmentHandle(struct curlObjData *templateData,const char *url) {
+    CURL                   *curlHandle;
+
+    if (templateData!=NULL) {
+        curlHandle=curlDupEasyHandle(templateData);
+    } else {
+        curlHandle=curl_easy_init();
+    }
+    if (curlHandle==NULL) {
+        return NULL;
+    }
+#if CURL_AT_LEAST_VERSION(7, 63, 0)
+    curl_easy_setopt(curlHandle,CURLOPT_CURLU,NULL);
+#endif
+    curl_easy_setopt(curlHandle,CURLOPT_URL,url);
+    curl_easy_setopt(curlHandle,CURLOPT_HTTPGET,1L);
+    curl_easy_setopt(curlHandle,CURLOPT_RANGE,NULL);
+    curl_easy_setopt(curlHandle,CURLOPT_FAILONERROR,1L);
+    curl_easy_setopt(curlHandle,CURLOPT_NOPROGRESS,1L);
+    /* The template's callbacks would all get the template's data. */
+    curl_easy_setopt(curlHandle,CURLOPT_HEADERFUNCTION,NULL);
+    curl_easy_setopt(curlHandle,CURLOPT_HEADERDATA,NULL);
+    curl_easy_setopt(curlHandle,CURLOPT_DEBUGFUNCTION,NULL);
+    curl_easy_setopt(curlHandle,CURLOPT_DEBUGDATA,NULL);
+
+    return curlHandle;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * curlSegmentOpen --
+ *
+ *  Creates the file of 'curl::segmented', or empties it, and allocates
+ *  the space for the whole resource, so the transfers can write their
+ *  parts in any order.
+ *
+ * Results:
+ *  The descriptor of the file, -1 if it couldn't be opened.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlSegmentOpen(const char *fileName,Tcl_WideInt size) {
+    int                     fd;
+
+#ifdef _WIN32
+    Tcl_DString             nativeString;
+    TCHAR                  *nativeFile=Tcl_WinUtfToTChar(fileName,-1,&nativeString);
+
+    fd=_topen(nativeFile,_O_WRONLY|_O_CREAT|_O_TRUNC|_O_BINARY,_S_IREAD|_S_IWRITE);
+    Tcl_DStringFree(&nativeString);
+    if ((fd>=0)&&(size>0)) {
+        _chsize_s(fd,size);
+    }
+#else
+    fd=open(fileName,O_WRONLY|O_CREAT|O_TRUNC,0666);
+    if ((fd>=0)&&(size>0)) {
+#if defined(_POSIX_ADVISORY_INFO) && (_POSIX_ADVISORY_INFO > 0)
+        if (!posix_fallocate(fd,0,(off_t)size)) {
+            return fd;
+        }
+#endif
+        /* Without the blocks, but with the right size. */
+        if (ftruncate(fd,(off_t)size)) {
+            /* Nothing else to do, the transfers write it all anyway. */
+        }
+    }
+#endif
+    return fd;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * curlSegmentWrite --
+ *
+ *  libcurl calls this function with the body of the transfers of
+ *  'curl::segmented', every one writes its part in its place.
+ *
+ * Results:
+ *  The number of bytes taken, 0 if they don't belong to the segment,
+ *  which stops the transfer.
+ *
+ *----------------------------------------------------------------------
+ */
+
+size_t
+curlSegmentWrite(char *ptr,size_t size,size_t nmemb,void *userdata) {
+    struct curlSegment     *segmentPtr=(struct curlSegment *)userdata;
+    size_t                  realsize=size*nmemb;
+    size_t                  written;
+    long                    responseCode=0,result;
+
+    if (segmentPtr->last>=0) {
+        if (!segmentPtr->checked) {
+            /* A server that ignores the range sends it all from the start. */
+            curl_easy_getinfo(segmentPtr->curl,CURLINFO_RESPONSE_CODE,&responseCode);
+            if (responseCode==200) {
+                return 0;
+            }
+            segmentPtr->checked=1;
+        }
+        if (segmentPtr->offset+(Tcl_WideInt)realsize>segmentPtr->last+1) {
+            return 0;
+        }
+    }
+    for (written=0;written<realsize;written+=result) {
+#ifdef _WIN32
+        if (_lseeki64(segmentPtr->fd,segmentPtr->offset+written,SEEK_SET)<0) {
+            return 0;
+        }
+        result=_write(segmentPtr->fd,ptr+written,(unsigned int)(realsize-written));
+#else
+        result=(long)pwrite(segmentPtr->fd,ptr+written,realsize-written,
+                (off_t)(segmentPtr->offset+written));
+#endif
+        if (result<=0) {
+            return 0;
+        }
+    }
+    segmentPtr->offset+=realsize;
+
+    return realsize;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * curlSegmentHeader --
+ *
+ *  The header function of the request 'curl::segmented' asks for the
+ *  size with, it tells whether the server takes ranges.
+ *
+ * Results:
+ *  The number of bytes taken.
+ *
+ *----------------------------------------------------------------------
+ */
+
+size_t
+curlSegmentHeader(char *ptr,size_t size,size_t nmemb,void *userdata) {
+    int                    *rangesPtr=(int *)userdata;
+    size_t                  length=size*nmemb;
+    Tcl_DString             value;
+
+    if ((length>5)&&(!strncmp(ptr,"HTTP/",5))) {
+        *rangesPtr=0;
+    } else if ((length>14)&&(!Tcl_UtfNcasecmp(ptr,"accept-ranges:",14))) {
+        Tcl_DStringInit(&value);
+        Tcl_DStringAppend(&value,ptr+14,(int)(length-14));
+        Tcl_UtfToLower(Tcl_DStringValue(&value));
+        *rangesPtr=(strstr(Tcl_DStringValue(&value),"bytes")!=NULL);
+        Tcl_DStringFree(&value);
+    }
+    return length;
+}
+
+#endif
@@ -25,6 +25,52 @@ struct easyHandleList {
     struct easyHandleList   *next;
 };
 
+/*
+ * A finished transfer, waiting for 'getinfo' to report it.
+ */
+struct curlMultiMsg {
+    char                  *name;
+    int                    msg;
+    int                    result;
+    Tcl_Obj               *captured;
+    int                    consumed;
+    struct curlMultiMsg   *next;
+};
+
+/*
+ * With '-coalesce', a transfer other handles asking for the same thing
+ * are waiting for. Only the leader is in the multi handle, what it gets
+ * is kept so the followers get it too when it is done. Until there are
+ * followers the body isn't kept, and once some of it went by unkept
+ * nobody else can follow.
+ */
+struct curlCoalesceFollower {
+    struct curlObjData           *curlData;
+    struct curlCoalesceFollower  *next;
+};
+
+struct curlCoalesceGroup {
+    char                         *key;
+    struct curlObjData           *leader;
+    struct curlCoalesceFollower  *followers;
+    Tcl_DString                   headers;
+    char                         *body;
+    size_t                        size;
+    size_t                        capacity;
+    int                           unbuffered;
+    struct curlCoalesceGroup     *next;
+};
+
+/*
+ * A handle whose transfer failed and is going to be tried again, it is
+ * out of the multi handle until it is due.
+ */
+struct curlMultiRetry {
+    struct curlObjData    *curlData;
+    Tcl_WideInt            due;
+    struct curlMultiRetry *next;
+};
+
 struct curlMultiObjData {
     CURLM                 *mcurl;
     Tcl_Command            token;
@@ -36,6 +82,16 @@ struct curlMultiObjData {
     fd_set                 fdexcep;
     int                    runningTransfers;
     char                  *postCommand;    
+    int                    captureCount;
+    int                   *captureIndices;
+    struct curlMultiMsg   *msgFirst;
+    struct curlMultiMsg   *msgLast;
+    int                    msgCount;
+    int                    autoActive;
+    int                    coalesce;
+    struct curlCoalesceGroup *groups;
+    struct curlMultiRetry *retries;
+    int                    retryCount;
 };
 
 struct curlEvent {
@@ -44,6 +100,45 @@ struct curlEvent {
     struct curlMultiObjData *curlMultiData;
 };
 
+/*
+ * One of the handles 'curl::fetchall' uses, with the body of the URL it
+ * is fetching.
+ */
+struct curlFetchSlot {
+    CURL                  *curl;
+    int                    urlIndex;
+    char                  *body;
+    size_t                 size;
+    size_t                 capacity;
+};
+
+const static char *fetchAllOptionTable[] = {
+    "-urls", "-concurrency", "-command", "-template",
+    (char *)NULL
+};
+
+/*
+ * One of the range transfers of 'curl::segmented', it writes its part of
+ * the resource from 'first' to 'last' into the file, 'offset' is where the
+ * next bytes go. 'last' is -1 when there is a single transfer for all of
+ * it, without a range.
+ */
+struct curlSegment {
+    CURL                  *curl;
+    int                    fd;
+    Tcl_WideInt            first;
+    Tcl_WideInt            last;
+    Tcl_WideInt            offset;
+    int                    checked;
+};
+
+const static char *segmentedOptionTable[] = {
+    "-url", "-file", "-segments", "-template", "-progressproc",
+    (char *)NULL
+};
+
+#define SEGMENTS_DEFAULT    4
+
 const static char *multiCommandTable[] = {
     "addhandle",
     "removehandle",
@@ -57,7 +152,7 @@ const static char *multiCommandTable[] = {
 };
 
 const static char *multiConfigTable[] = {
-    "-pipelining", "-maxconnects",
+    "-pipelining", "-maxconnects", "-capture", "-coalesce",
     (char *)NULL
 };
 
@@ -73,15 +168,18 @@ int curlInitMultiObjCmd (ClientData clientData, Tcl_Interp *interp,
 int curlMultiObjCmd (ClientData clientData, Tcl_Interp *interp,
     int objc,Tcl_Obj *const objv[]);
 
-CURLMcode curlAddMultiHandle(Tcl_Interp *interp,CURLM *curlMultiHandle
+CURLMcode curlAddMultiHandle(Tcl_Interp *interp,struct curlMultiObjData *curlMultiData
         ,Tcl_Obj *objvPtr);
 
-CURLMcode curlRemoveMultiHandle(Tcl_Interp *interp,CURLM *curlMultiHandle
+CURLMcode curlRemoveMultiHandle(Tcl_Interp *interp,struct curlMultiObjData *curlMultiData
         ,Tcl_Obj *objvPtr);
 
-int curlMultiPerform(Tcl_Interp *interp,CURLM *curlMultiHandle);
+int curlMultiPerform(Tcl_Interp *interp,struct curlMultiObjData *curlMultiData);
 
-int curlMultiGetInfo(Tcl_Interp *interp,CURLM *curlMultiHandlePtr);
+int curlMultiGetInfo(Tcl_Interp *interp,struct curlMultiObjData *curlMultiData);
+void curlMultiReadMessages(struct curlMultiObjData *curlMultiData);
+int curlMultiSetCapture(Tcl_Interp *interp,struct curlMultiObjData *curlMultiData,
+        Tcl_Obj *const objv);
 
 int curlMultiGetActiveTransfers( struct curlMultiObjData *curlMultiData);
 int curlMultiActiveTransfers(Tcl_Interp *interp, struct curlMultiObjData *curlMultiData);
@@ -109,6 +207,45 @@ void curlEventCheck(ClientData clientData, int flags);
 
 int curlEventProc(Tcl_Event *evPtr,int flags);
 
+int curlFetchAllObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]);
+int curlFetchStart(CURLM *multiHandle,struct curlFetchSlot *slotPtr,
+        Tcl_Obj *urlObj,int urlIndex);
+Tcl_Obj *curlFetchResult(struct curlFetchSlot *slotPtr,CURLcode result);
+size_t curlFetchWrite(char *ptr,size_t size,size_t nmemb,void *userdata);
+
+int curlSegmentedObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]);
+CURL *curlSegmentHandle(struct curlObjData *templateData,const char *url);
+int curlSegmentOpen(const char *fileName,Tcl_WideInt size);
+size_t curlSegmentWrite(char *ptr,size_t size,size_t nmemb,void *userdata);
+size_t curlSegmentHeader(char *ptr,size_t size,size_t nmemb,void *userdata);
+
+int curlCoalesceKey(struct curlObjData *curlData,Tcl_DString *keyPtr);
+CURLMcode curlCoalesceAdd(struct curlMultiObjData *curlMultiData,
+        struct curlObjData *curlData,const char *key);
+void curlCoalesceDone(struct curlMultiObjData *curlMultiData,CURL *easyHandle,
+        int result,Tcl_Obj *captured);
+void curlCoalesceRemove(struct curlMultiObjData *curlMultiData,
+        struct curlObjData *curlData);
+void curlCoalesceLead(struct curlCoalesceGroup *groupPtr,struct curlObjData *curlData);
+void curlCoalesceFree(struct curlCoalesceGroup *groupPtr);
+size_t curlCoalesceWrite(char *ptr,size_t size,size_t nmemb,void *groupPtr);
+size_t curlCoalesceHeader(char *ptr,size_t size,size_t nmemb,void *groupPtr);
+void curlMultiQueueMsg(struct curlMultiObjData *curlMultiData,
+        struct curlMultiMsg *msgPtr);
+void curlMultiDropMsgs(struct curlMultiObjData *curlMultiData,const char *name);
+
+int curlMultiRetryLater(struct curlMultiObjData *curlMultiData,CURL *easyHandle,
+        CURLcode result);
+void curlMultiRetryStart(struct curlMultiObjData *curlMultiData);
+void curlMultiRetryRemove(struct curlMultiObjData *curlMultiData,
+        struct curlObjData *curlData);
+Tcl_WideInt curlMultiNow(void);
+
+void curlMultiRunCommands(struct curlMultiObjData *curlMultiData,
+        struct curlMultiMsg *lastMsg);
+
 #ifdef  __cplusplus
 }
 
@@ -0,0 +1,464 @@
+/*
+ * resume.c --
+ *
+ * Implementation of the part of the TclCurl extension that carries on
+ * downloads to a file where they were left, '-resume auto'.
+ *
+ * The file in '-file' is opened to append to it and the transfer asks
+ * for what comes after the bytes already in it. The ETag, or the
+ * Last-Modified date, of the response is kept in a '.resume' file next to
+ * it and sent back in an 'If-Range' header, so if the resource changed in
+ * the meantime the server sends all of it and the download starts over.
+ * When a transfer fails and is retried, the next attempt carries on from
+ * what the last one wrote. The '.resume' file stays once the download is
+ * complete, so the next one can tell whether the file is still current;
+ * a file with nothing to tell that is downloaded again from the start.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#include "resume.h"
+#include <stdio.h>
+
+static struct curlResumeData *curlResumeAlloc(struct curlObjData *curlData);
+static Tcl_Obj *curlResumeRead(struct curlObjData *curlData);
+static void curlResumeCheckpoint(struct curlObjData *curlData);
+static void curlResumeRemove(struct curlObjData *curlData);
+static void curlResumeName(struct curlObjData *curlData,Tcl_DString *name);
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlResumeSet --
+ *
+ *  Sets '-resume', 'none' or 'auto'.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlResumeSet(Tcl_Interp *interp,struct curlObjData *curlData,Tcl_Obj *modeObj) {
+    int                     mode;
+
+    if (Tcl_GetIndexFromObj(interp,modeObj,resumeTable,"resume option",
+            TCL_EXACT,&mode)==TCL_ERROR) {
+        return TCL_ERROR;
+    }
+    if ((mode!=RESUME_NONE)||(curlData->resume!=NULL)) {
+        curlResumeAlloc(curlData)->mode=mode;
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlResumeAuto --
+ *
+ *  Tells whether the handle carries on its downloads, it needs both
+ *  '-resume auto' and a file in '-file', not written with '-atomic'.
+ *
+ * Results:
+ *  1 if it does, 0 if it doesn't.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlResumeAuto(struct curlObjData *curlData) {
+
+    return (curlData->resume!=NULL)&&(curlData->resume->mode==RESUME_AUTO)
+            &&(curlData->files!=NULL)&&curlData->files->outFlag
+            &&!(curlData->files->atomic&ATOMIC_RENAME);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlResumePrepare --
+ *
+ *  Called before every attempt, it asks for the part of the resource
+ *  that isn't in the file yet, if the file has some of it, and puts
+ *  curlResumeHeader between libcurl and the handle's header function.
+ *
+ *  It has to come after curlRetryWatch, it is undone first.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlResumePrepare(struct curlObjData *curlData) {
+    struct curlResumeData  *resumePtr=curlData->resume;
+    struct curlFileData    *filesPtr=curlData->files;
+    struct curl_slist      *slistPtr;
+    Tcl_StatBuf            *statPtr;
+    Tcl_DString             header;
+
+    if (!curlResumeAuto(curlData)||(filesPtr->outHandle==NULL)
+            ||resumePtr->active) {
+        return;
+    }
+
+    /* What is in the file is where the transfer goes on from. */
+    fflush(filesPtr->outHandle);
+    resumePtr->offset=0;
+    statPtr=Tcl_AllocStatBuf();
+    if (Tcl_FSStat(filesPtr->outFile,statPtr)==0) {
+        resumePtr->offset=(Tcl_WideInt)Tcl_GetSizeFromStat(statPtr);
+    }
+    Tcl_Free((char *)statPtr);
+
+    curlSetObj(&resumePtr->validator,curlResumeRead(curlData));
+    resumePtr->ifRange=0;
+    if ((resumePtr->offset>0)&&(resumePtr->validator==NULL)) {
+        /* A bare range would append to it whatever the resource is now. */
+        curlRetryTruncate(filesPtr->outHandle);
+        resumePtr->offset=0;
+    }
+    if (resumePtr->offset>0) {
+        curl_easy_setopt(curlData->curl,CURLOPT_RESUME_FROM_LARGE,
+                (curl_off_t)resumePtr->offset);
+        if (resumePtr->validator!=NULL) {
+            for (slistPtr=curlData->headerList;slistPtr!=NULL;slistPtr=slistPtr->next) {
+                resumePtr->headerList=curl_slist_append(resumePtr->headerList,
+                        slistPtr->data);
+            }
+            Tcl_DStringInit(&header);
+            Tcl_DStringAppend(&header,"If-Range: ",-1);
+            Tcl_DStringAppend(&header,Tcl_GetString(resumePtr->validator),-1);
+            resumePtr->headerList=curl_slist_append(resumePtr->headerList,
+                    Tcl_DStringValue(&header));
+            Tcl_DStringFree(&header);
+            curl_easy_setopt(curlData->curl,CURLOPT_HTTPHEADER,resumePtr->headerList);
+            resumePtr->ifRange=1;
+        }
+    }
+
+    resumePtr->active=1;
+    resumePtr->responseCode=0;
+    resumePtr->length=-1;
+    curlSetObj(&resumePtr->etag,NULL);
+    curlSetObj(&resumePtr->lastModified,NULL);
+    resumePtr->headerFunction=curlData->headerFunction;
+    resumePtr->headerData=curlData->headerData;
+    curlSetHeaderWriter(curlData,curlResumeHeader,curlData);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlResumeHeader --
+ *
+ *  The header function of downloads being resumed, it picks the code,
+ *  the validators and the length of the resource from the headers, and
+ *  keeps the validator in the '.resume' file before the body arrives.
+ *
+ * Results:
+ *  What the handle's header function returns.
+ *
+ *----------------------------------------------------------------------
+ */
+
+size_t
+curlResumeHeader(char *ptr,size_t size,size_t nmemb,void *curlDataPtr) {
+    struct curlObjData     *curlData=(struct curlObjData *)curlDataPtr;
+    struct curlResumeData  *resumePtr=curlData->resume;
+    size_t                  length=size*nmemb;
+    size_t                  nameLength,i;
+    Tcl_DString             value;
+    char                   *valuePtr,*slash;
+
+    if ((length>5)&&(!strncmp(ptr,"HTTP/",5))) {
+        /* A new response, after a redirection or a '100 Continue'. */
+        resumePtr->responseCode=0;
+        for (i=5;(i<length)&&(ptr[i]!=' ');i++) {
+        }
+        for (;(i<length)&&(ptr[i]==' ');i++) {
+        }
+        for (;(i<length)&&(ptr[i]>='0')&&(ptr[i]<='9');i++) {
+            resumePtr->responseCode=resumePtr->responseCode*10+(ptr[i]-'0');
+        }
+        resumePtr->length=-1;
+        curlSetObj(&resumePtr->etag,NULL);
+        curlSetObj(&resumePtr->lastModified,NULL);
+    } else if ((length<=2)&&((ptr[0]=='\r')||(ptr[0]=='\n'))) {
+        if ((resumePtr->responseCode==200)||(resumePtr->responseCode==206)) {
+            curlResumeCheckpoint(curlData);
+        }
+    }
+
+    for (nameLength=0;(nameLength<length)&&(ptr[nameLength]!=':');nameLength++) {
+    }
+    if (nameLength<length) {
+        Tcl_DStringInit(&value);
+        for (i=nameLength+1;(i<length)&&((ptr[i]==' ')||(ptr[i]=='\t'));i++) {
+        }
+        Tcl_DStringAppend(&value,ptr+i,(int)(length-i));
+        while ((Tcl_DStringLength(&value)>0)&&((Tcl_DStringValue(&value)
+                [Tcl_DStringLength(&value)-1]=='\n')||(Tcl_DStringValue(&value)
+                [Tcl_DStringLength(&value)-1]=='\r'))) {
+            Tcl_DStringSetLength(&value,Tcl_DStringLength(&value)-1);
+        }
+        valuePtr=Tcl_DStringValue(&value);
+
+        if ((nameLength==4)&&(!Tcl_UtfNcasecmp(ptr,"etag",4))) {
+            curlSetObj(&resumePtr->etag,Tcl_NewStringObj(valuePtr,-1));
+        } else if ((nameLength==13)&&(!Tcl_UtfNcasecmp(ptr,"last-modified",13))) {
+            curlSetObj(&resumePtr->lastModified,Tcl_NewStringObj(valuePtr,-1));
+        } else if ((nameLength==13)&&(!Tcl_UtfNcasecmp(ptr,"content-range",13))) {
+            /* 'bytes first-last/length' or 'bytes * /length'. */
+            if (((slash=strchr(valuePtr,'/'))!=NULL)&&(slash[1]>='0')
+                    &&(slash[1]<='9')) {
+                resumePtr->length=0;
+                for (slash++;(*slash>='0')&&(*slash<='9');slash++) {
+                    resumePtr->length=resumePtr->length*10+(*slash-'0');
+                }
+            }
+        }
+        Tcl_DStringFree(&value);
+    }
+
+    if (resumePtr->headerFunction!=NULL) {
+        return resumePtr->headerFunction(ptr,1,length,resumePtr->headerData);
+    }
+    return length;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlResumeFinish --
+ *
+ *  Called after every attempt. If the server sent the whole resource
+ *  when asked for the rest of it, because it changed, or said the file
+ *  doesn't fit what it has, the file is emptied to start over.
+ *
+ * Results:
+ *  1 if the download has to start over right away, 0 otherwise.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlResumeFinish(struct curlObjData *curlData,CURLcode exitCode) {
+    struct curlResumeData  *resumePtr=curlData->resume;
+
+    if ((resumePtr==NULL)||!resumePtr->active) {
+        return 0;
+    }
+    curlResumeStop(curlData);
+
+    if ((resumePtr->offset>0)
+            &&(((resumePtr->responseCode==200)
+                &&(resumePtr->ifRange||(exitCode==CURLE_RANGE_ERROR)))
+            ||((resumePtr->responseCode==416)
+                &&(resumePtr->length!=resumePtr->offset)))) {
+        curlRetryTruncate(curlData->files->outHandle);
+        curlResumeRemove(curlData);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlResumeStop --
+ *
+ *  Gives the handle back its header function, its headers and no offset
+ *  to start from.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlResumeStop(struct curlObjData *curlData) {
+    struct curlResumeData  *resumePtr=curlData->resume;
+
+    if ((resumePtr==NULL)||!resumePtr->active) {
+        return;
+    }
+    resumePtr->active=0;
+    curlSetHeaderWriter(curlData,resumePtr->headerFunction,resumePtr->headerData);
+    if (resumePtr->offset>0) {
+        curl_easy_setopt(curlData->curl,CURLOPT_RESUME_FROM_LARGE,(curl_off_t)0);
+    }
+    if (resumePtr->headerList!=NULL) {
+        curl_easy_setopt(curlData->curl,CURLOPT_HTTPHEADER,curlData->headerList);
+        curl_slist_free_all(resumePtr->headerList);
+        resumePtr->headerList=NULL;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlResumeOffset --
+ *
+ *  Returns how much of the file was there when the current attempt
+ *  started, 0 if it isn't carrying on a download.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Tcl_WideInt
+curlResumeOffset(struct curlObjData *curlData) {
+
+    if ((curlData->resume==NULL)||!curlData->resume->active) {
+        return 0;
+    }
+    return curlData->resume->offset;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlResumeCopy, curlResumeFree --
+ *
+ *  A duplicated handle resumes its downloads too.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlResumeCopy(struct curlObjData *curlDataOld,struct curlObjData *curlDataNew) {
+
+    curlDataNew->resume=NULL;
+    if (curlDataOld->resume!=NULL) {
+        curlResumeAlloc(curlDataNew)->mode=curlDataOld->resume->mode;
+    }
+}
+
+void
+curlResumeFree(struct curlObjData *curlData) {
+    struct curlResumeData  *resumePtr=curlData->resume;
+
+    if (resumePtr==NULL) {
+        return;
+    }
+    curl_slist_free_all(resumePtr->headerList);
+    curlSetObj(&resumePtr->validator,NULL);
+    curlSetObj(&resumePtr->etag,NULL);
+    curlSetObj(&resumePtr->lastModified,NULL);
+    Tcl_Free((char *)resumePtr);
+    curlData->resume=NULL;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlResumeAlloc --
+ *
+ *  Returns the resume block of a handle, allocating it the first time.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static struct curlResumeData *
+curlResumeAlloc(struct curlObjData *curlData) {
+
+    if (curlData->resume==NULL) {
+        curlData->resume=(struct curlResumeData *)Tcl_Alloc(sizeof(struct curlResumeData));
+        memset(curlData->resume,0,sizeof(struct curlResumeData));
+    }
+    return curlData->resume;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlResumeRead, curlResumeCheckpoint, curlResumeRemove --
+ *
+ *  Read, write and remove the '.resume' file of the download. A strong
+ *  ETag is the validator if there is one, weak ones can't go in an
+ *  'If-Range' header, the Last-Modified date otherwise.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tcl_Obj *
+curlResumeRead(struct curlObjData *curlData) {
+    Tcl_DString             name,contents;
+    Tcl_Obj                *validator=NULL;
+    FILE                   *resumeFile;
+    char                    buffer[1024];
+    size_t                  length;
+
+    curlResumeName(curlData,&name);
+    resumeFile=fopen(Tcl_DStringValue(&name),"rb");
+    Tcl_DStringFree(&name);
+    if (resumeFile==NULL) {
+        return NULL;
+    }
+    Tcl_DStringInit(&contents);
+    while ((length=fread(buffer,1,sizeof(buffer),resumeFile))>0) {
+        Tcl_DStringAppend(&contents,buffer,(int)length);
+    }
+    fclose(resumeFile);
+    if (Tcl_DStringLength(&contents)>0) {
+        validator=Tcl_NewStringObj(Tcl_DStringValue(&contents),
+                Tcl_DStringLength(&contents));
+    }
+    Tcl_DStringFree(&contents);
+
+    return validator;
+}
+
+static void
+curlResumeCheckpoint(struct curlObjData *curlData) {
+    struct curlResumeData  *resumePtr=curlData->resume;
+    Tcl_Obj                *validator=resumePtr->lastModified;
+    Tcl_DString             name;
+    FILE                   *resumeFile;
+    const char             *contents;
+    int                     length,failed;
+
+    if ((resumePtr->etag!=NULL)&&strncmp(Tcl_GetString(resumePtr->etag),"W/",2)) {
+        validator=resumePtr->etag;
+    }
+    if (validator==NULL) {
+        /* Nothing to tell whether the resource changed. */
+        curlResumeRemove(curlData);
+        curlSetObj(&resumePtr->validator,NULL);
+        return;
+    }
+    if ((resumePtr->validator!=NULL)
+            &&!strcmp(Tcl_GetString(resumePtr->validator),Tcl_GetString(validator))) {
+        return;
+    }
+
+    curlResumeName(curlData,&name);
+    resumeFile=fopen(Tcl_DStringValue(&name),"wb");
+    if (resumeFile!=NULL) {
+        contents=Tcl_GetStringFromObj(validator,&length);
+        failed=(fwrite(contents,1,length,resumeFile)!=(size_t)length);
+        failed|=fclose(resumeFile);
+        if (failed) {
+            remove(Tcl_DStringValue(&name));
+        }
+    }
+    Tcl_DStringFree(&name);
+    curlSetObj(&resumePtr->validator,validator);
+}
+
+static void
+curlResumeRemove(struct curlObjData *curlData) {
+    Tcl_DString             name;
+
+    curlResumeName(curlData,&name);
+    remove(Tcl_DStringValue(&name));
+    Tcl_DStringFree(&name);
+}
+
+static void
+curlResumeName(struct curlObjData *curlData,Tcl_DString *name) {
+
+    Tcl_DStringInit(name);
+    Tcl_DStringAppend(name,Tcl_GetString(curlData->files->outFile),-1);
+    Tcl_DStringAppend(name,RESUME_SUFFIX,-1);
+}
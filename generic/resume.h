@@ -0,0 +1,58 @@
+/*
+ * resume.h --
+ *
+ * Header file for the part of the TclCurl extension that carries on
+ * downloads to a file where they were left, '-resume'.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#define resume_h
+#include "tclcurl.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define RESUME_NONE         0
+#define RESUME_AUTO         1
+
+const static char *resumeTable[] = {
+    "none", "auto", (char *)NULL
+};
+
+/*
+ * The file next to the download with the validator of what is in it.
+ */
+#define RESUME_SUFFIX       ".resume"
+
+/*
+ * How a handle resumes its downloads. The fields after 'mode' only mean
+ * something during a transfer: 'offset' is how much of the file was there
+ * when it started, 'validator' is the one for it in the '.resume' file,
+ * 'ifRange' tells whether it was sent in an 'If-Range' header, and the
+ * rest is picked from the headers of the response by curlResumeHeader.
+ */
+struct curlResumeData {
+    int                     mode;
+
+    int                     active;
+    Tcl_WideInt             offset;
+    Tcl_Obj                *validator;
+    int                     ifRange;
+    struct curl_slist      *headerList;
+    curl_write_callback     headerFunction;
+    void                   *headerData;
+    long                    responseCode;
+    Tcl_Obj                *etag;
+    Tcl_Obj                *lastModified;
+    Tcl_WideInt             length;
+};
+
+size_t curlResumeHeader(char *ptr,size_t size,size_t nmemb,void *curlDataPtr);
+
+#ifdef  __cplusplus
+}
+#endif
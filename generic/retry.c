@@ -0,0 +1,535 @@
+/*
+ * retry.c --
+ *
+ * Implementation of the part of the TclCurl extension that tries the
+ * transfers again when they fail, '-retry', '-retrybackoff' and
+ * '-retryon'.
+ *
+ * A transfer is retried when it fails with one of the exit codes in
+ * '-retryon', or when the response has one of the HTTP codes in it. Such
+ * a response never reaches the handle: its headers are swallowed and the
+ * transfer is stopped as soon as they are all in. Between attempts the
+ * handle waits, twice as long every time with some jitter, or what the
+ * 'Retry-After' header asks for.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#include "retry.h"
+#include <stdlib.h>
+#include <time.h>
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+static struct curlRetryData *curlRetryAlloc(struct curlObjData *curlData);
+static int curlRetryOn(struct curlRetryData *retryPtr,long code);
+static long curlRetryRandom(struct curlRetryData *retryPtr,long range);
+static void curlRetryRewind(struct curlObjData *curlData);
+
+/*
+ * What is retried when '-retryon' isn't set: the exit codes for failed
+ * connections, timeouts and broken transfers, and the HTTP codes that
+ * mean trying later may work.
+ */
+static const int retryDefaultCodes[]={
+    CURLE_COULDNT_CONNECT, CURLE_HTTP2, CURLE_PARTIAL_FILE,
+    CURLE_OPERATION_TIMEDOUT, CURLE_GOT_NOTHING, CURLE_SEND_ERROR,
+    CURLE_RECV_ERROR, 408, 429, 500, 502, 503, 504
+};
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlRetrySetCount, curlRetrySetBackoff, curlRetrySetCodes --
+ *
+ *  Set '-retry', the number of times a transfer may be retried,
+ *  '-retrybackoff', the first and the longest wait between attempts in
+ *  milliseconds, and '-retryon', the exit and HTTP codes to retry on.
+ *
+ * Results:
+ *  0 if all went well, 1 if the value is not valid.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlRetrySetCount(Tcl_Interp *interp,struct curlObjData *curlData,Tcl_Obj *countObj) {
+    int                     count;
+
+    if ((Tcl_GetIntFromObj(interp,countObj,&count)!=TCL_OK)||(count<0)) {
+        return 1;
+    }
+    curlRetryAlloc(curlData)->retries=count;
+
+    return 0;
+}
+
+int
+curlRetrySetBackoff(Tcl_Interp *interp,struct curlObjData *curlData,
+        Tcl_Obj *backoffObj) {
+    Tcl_Obj               **elements;
+    int                     count;
+    long                    base,max;
+
+    if ((Tcl_ListObjGetElements(interp,backoffObj,&count,&elements)!=TCL_OK)
+            ||(count<1)||(count>2)
+            ||(Tcl_GetLongFromObj(interp,elements[0],&base)!=TCL_OK)) {
+        return 1;
+    }
+    max=(base>RETRY_MAX)?base:RETRY_MAX;
+    if ((count==2)&&(Tcl_GetLongFromObj(interp,elements[1],&max)!=TCL_OK)) {
+        return 1;
+    }
+    if ((base<0)||(max<base)) {
+        return 1;
+    }
+    curlRetryAlloc(curlData)->base=base;
+    curlData->retry->max=max;
+
+    return 0;
+}
+
+int
+curlRetrySetCodes(Tcl_Interp *interp,struct curlObjData *curlData,
+        Tcl_Obj *codesObj) {
+    struct curlRetryData   *retryPtr;
+    Tcl_Obj               **elements;
+    int                     count,i,*codes;
+
+    if (Tcl_ListObjGetElements(interp,codesObj,&count,&elements)!=TCL_OK) {
+        return 1;
+    }
+    codes=(int *)Tcl_Alloc((count+1)*sizeof(int));
+    for (i=0;i<count;i++) {
+        if ((Tcl_GetIntFromObj(interp,elements[i],&codes[i])!=TCL_OK)
+                ||(codes[i]<=0)) {
+            Tcl_Free((char *)codes);
+            return 1;
+        }
+    }
+    retryPtr=curlRetryAlloc(curlData);
+    Tcl_Free((char *)retryPtr->codes);
+    retryPtr->codes=codes;
+    retryPtr->codeCount=count;
+
+    return 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlRetryStart --
+ *
+ *  Called when a transfer starts, before its first attempt.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlRetryStart(struct curlObjData *curlData) {
+
+    if (curlData->retry!=NULL) {
+        curlData->retry->attempts=1;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlRetryWatch, curlRetryUnwatch --
+ *
+ *  Put curlRetryHeader between libcurl and the handle's header function
+ *  for an attempt that may be retried, and take it away again.
+ *
+ *  Whatever stands in between later, a cache or coalescing, gives the
+ *  headers to the handle's function, so this has to be done before.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlRetryWatch(struct curlObjData *curlData) {
+    struct curlRetryData   *retryPtr=curlData->retry;
+
+    if ((retryPtr==NULL)||retryPtr->watching
+            ||(retryPtr->attempts>retryPtr->retries)) {
+        return;
+    }
+    retryPtr->headerFunction=curlData->headerFunction;
+    retryPtr->headerData=curlData->headerData;
+    retryPtr->swallow=0;
+    retryPtr->retryAfter=-1;
+    retryPtr->watching=1;
+    curlSetHeaderWriter(curlData,curlRetryHeader,curlData);
+}
+
+void
+curlRetryUnwatch(struct curlObjData *curlData) {
+    struct curlRetryData   *retryPtr=curlData->retry;
+
+    if ((retryPtr==NULL)||!retryPtr->watching) {
+        return;
+    }
+    retryPtr->watching=0;
+    curlSetHeaderWriter(curlData,retryPtr->headerFunction,retryPtr->headerData);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlRetryHeader --
+ *
+ *  The header function while watching. If the status line has one of
+ *  the HTTP codes to retry on, the response is swallowed, keeping the
+ *  'Retry-After' header, and the transfer is stopped at the end of the
+ *  headers. Everything else goes on to the handle.
+ *
+ * Results:
+ *  The number of bytes taken, 0 stops the transfer.
+ *
+ *----------------------------------------------------------------------
+ */
+
+size_t
+curlRetryHeader(char *ptr,size_t size,size_t nmemb,void *curlDataPtr) {
+    struct curlObjData     *curlData=(struct curlObjData *)curlDataPtr;
+    struct curlRetryData   *retryPtr=curlData->retry;
+    size_t                  length=size*nmemb;
+    size_t                  i;
+    long                    code=0;
+    Tcl_WideInt             seconds;
+    Tcl_DString             value;
+
+    if ((length>5)&&(!strncmp(ptr,"HTTP/",5))) {
+        for (i=5;(i<length)&&(ptr[i]!=' ');i++) {
+        }
+        for (;(i<length)&&(ptr[i]==' ');i++) {
+        }
+        for (;(i<length)&&(ptr[i]>='0')&&(ptr[i]<='9');i++) {
+            code=code*10+(ptr[i]-'0');
+        }
+        retryPtr->swallow=curlRetryOn(retryPtr,code);
+        retryPtr->retryAfter=-1;
+    }
+    if (!retryPtr->swallow) {
+        if (retryPtr->headerFunction!=NULL) {
+            return retryPtr->headerFunction(ptr,1,length,retryPtr->headerData);
+        }
+        return length;
+    }
+
+    if ((length<=2)&&((ptr[0]=='\r')||(ptr[0]=='\n'))) {
+        return 0;
+    }
+    if ((length>12)&&(!Tcl_UtfNcasecmp(ptr,"retry-after:",12))) {
+        for (i=12;(i<length)&&((ptr[i]==' ')||(ptr[i]=='\t'));i++) {
+        }
+        Tcl_DStringInit(&value);
+        Tcl_DStringAppend(&value,ptr+i,(int)(length-i));
+        if ((ptr[i]>='0')&&(ptr[i]<='9')) {
+            seconds=strtol(Tcl_DStringValue(&value),NULL,10);
+        } else {
+            seconds=(Tcl_WideInt)curl_getdate(Tcl_DStringValue(&value),NULL);
+            seconds=(seconds<0)?-1:seconds-(Tcl_WideInt)time(NULL);
+        }
+        Tcl_DStringFree(&value);
+        if (seconds>=0) {
+            retryPtr->retryAfter=(long)seconds*1000;
+        }
+    }
+    return length;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlRetryCheck --
+ *
+ *  Called after every attempt, it decides whether the transfer has to
+ *  be tried again. If so the files the handle writes to are emptied,
+ *  as is the body of '-bodyvar', and the one it uploads is rewound.
+ *
+ * Results:
+ *  How many milliseconds to wait before the next attempt, -1 if there
+ *  isn't going to be one.
+ *
+ *----------------------------------------------------------------------
+ */
+
+long
+curlRetryCheck(struct curlObjData *curlData,CURLcode exitCode) {
+    struct curlRetryData   *retryPtr=curlData->retry;
+    int                     swallowed,i;
+    long                    delay;
+
+    if (retryPtr==NULL) {
+        return -1;
+    }
+    swallowed=retryPtr->watching&&retryPtr->swallow;
+    curlRetryUnwatch(curlData);
+
+    if ((retryPtr->attempts>retryPtr->retries)||(exitCode==CURLE_OK)) {
+        return -1;
+    }
+    if (!(swallowed&&(exitCode==CURLE_WRITE_ERROR))
+            &&!curlRetryOn(retryPtr,exitCode)) {
+        return -1;
+    }
+
+    delay=retryPtr->base;
+    for (i=1;(i<retryPtr->attempts)&&(delay<retryPtr->max);i++) {
+        delay*=2;
+    }
+    if (delay>retryPtr->max) {
+        delay=retryPtr->max;
+    }
+    /* Half of it, and a random part of the other half, so many handles
+       failing at once don't come back at once. */
+    delay=delay/2+curlRetryRandom(retryPtr,delay-delay/2+1);
+    if (swallowed&&(retryPtr->retryAfter>delay)) {
+        delay=(retryPtr->retryAfter<retryPtr->max)?retryPtr->retryAfter:retryPtr->max;
+    }
+
+    retryPtr->attempts++;
+    curlRetryRewind(curlData);
+
+    return delay;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlRetryWait --
+ *
+ *  Waits before the next attempt of 'perform', with '-eventloop' the
+ *  event loop goes on in the meantime.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlRetryWait(long delay,int eventLoop) {
+    int                     done=0;
+
+    if (!eventLoop) {
+        Tcl_Sleep((int)delay);
+        return;
+    }
+    Tcl_CreateTimerHandler((int)delay,curlRetryWake,(ClientData)&done);
+    while (!done) {
+        Tcl_DoOneEvent(TCL_ALL_EVENTS);
+    }
+}
+
+void
+curlRetryWake(ClientData clientData) {
+    *(int *)clientData=1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlRetryAttempts --
+ *
+ *  Returns what 'getinfo attempts' returns, how many times the last
+ *  transfer was tried.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlRetryAttempts(struct curlObjData *curlData) {
+
+    if ((curlData==NULL)||(curlData->retry==NULL)) {
+        return 1;
+    }
+    return curlData->retry->attempts;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlRetryCopy, curlRetryFree --
+ *
+ *  A duplicated handle retries the same way.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlRetryCopy(struct curlObjData *curlDataOld,struct curlObjData *curlDataNew) {
+    struct curlRetryData   *retryPtr;
+
+    curlDataNew->retry=NULL;
+    if (curlDataOld->retry==NULL) {
+        return;
+    }
+    retryPtr=curlRetryAlloc(curlDataNew);
+    retryPtr->retries=curlDataOld->retry->retries;
+    retryPtr->base=curlDataOld->retry->base;
+    retryPtr->max=curlDataOld->retry->max;
+    if (curlDataOld->retry->codes!=NULL) {
+        retryPtr->codeCount=curlDataOld->retry->codeCount;
+        retryPtr->codes=(int *)Tcl_Alloc((retryPtr->codeCount+1)*sizeof(int));
+        memcpy(retryPtr->codes,curlDataOld->retry->codes,
+                retryPtr->codeCount*sizeof(int));
+    }
+}
+
+void
+curlRetryFree(struct curlObjData *curlData) {
+    struct curlRetryData   *retryPtr=curlData->retry;
+
+    if (retryPtr==NULL) {
+        return;
+    }
+    Tcl_Free((char *)retryPtr->codes);
+    Tcl_Free((char *)retryPtr);
+    curlData->retry=NULL;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlRetryAlloc --
+ *
+ *  Returns the retry block of a handle, allocating it the first time
+ *  one of the options needs it.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static struct curlRetryData *
+curlRetryAlloc(struct curlObjData *curlData) {
+
+    if (curlData->retry==NULL) {
+        curlData->retry=(struct curlRetryData *)Tcl_Alloc(sizeof(struct curlRetryData));
+        memset(curlData->retry,0,sizeof(struct curlRetryData));
+        curlData->retry->base=RETRY_BASE;
+        curlData->retry->max=RETRY_MAX;
+    }
+    return curlData->retry;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlRetryRandom --
+ *
+ *  A xorshift generator of its own for every handle, seeded with the
+ *  time, the process and the handle, so that processes started at the
+ *  same time don't wait the same, and threads don't share a state.
+ *
+ * Results:
+ *  A number from 0 to range-1.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static long
+curlRetryRandom(struct curlRetryData *retryPtr,long range) {
+    Tcl_Time                now;
+    unsigned int            x=retryPtr->random;
+
+    if (x==0) {
+        Tcl_GetTime(&now);
+        x=(unsigned int)now.sec^((unsigned int)now.usec<<12)
+                ^((unsigned int)getpid()<<20)
+                ^(unsigned int)(((size_t)retryPtr)>>4);
+        if (x==0) {
+            x=0x9e3779b9;
+        }
+    }
+    x^=x<<13;
+    x^=x>>17;
+    x^=x<<5;
+    retryPtr->random=x;
+
+    return (long)(x%(unsigned long)range);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlRetryOn --
+ *
+ *  Tells whether an exit code, or an HTTP code, is one to retry on.
+ *  Exit codes are below 100, HTTP codes aren't.
+ *
+ * Results:
+ *  1 if it is, 0 if it isn't.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+curlRetryOn(struct curlRetryData *retryPtr,long code) {
+    const int              *codes=retryPtr->codes;
+    int                     count=retryPtr->codeCount,i;
+
+    if (retryPtr->attempts>retryPtr->retries) {
+        return 0;
+    }
+    if (codes==NULL) {
+        codes=retryDefaultCodes;
+        count=sizeof(retryDefaultCodes)/sizeof(retryDefaultCodes[0]);
+    }
+    for (i=0;i<count;i++) {
+        if (codes[i]==code) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlRetryRewind, curlRetryTruncate --
+ *
+ *  Get the handle ready for another attempt: what the last one wrote
+ *  is thrown away, but for a download being resumed, and the upload
+ *  starts from the beginning again.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+curlRetryRewind(struct curlObjData *curlData) {
+    struct curlFileData    *filesPtr=curlData->files;
+
+    curlData->bodyVar.size=0;
+    if (filesPtr!=NULL) {
+        if (!curlResumeAuto(curlData)) {
+            /* Otherwise the next attempt carries on from there. */
+            curlRetryTruncate(filesPtr->outHandle);
+        }
+        curlRetryTruncate(filesPtr->headerHandle);
+        if (filesPtr->inHandle!=NULL) {
+            rewind(filesPtr->inHandle);
+        }
+    }
+}
+
+void
+curlRetryTruncate(FILE *filePtr) {
+
+    if (filePtr==NULL) {
+        return;
+    }
+    fflush(filePtr);
+    rewind(filePtr);
+#ifdef _WIN32
+    _chsize(_fileno(filePtr),0);
+#else
+    if (ftruncate(fileno(filePtr),0)) {
+        /* Nothing else to do, the next attempt writes over it. */
+    }
+#endif
+}
@@ -0,0 +1,50 @@
+/*
+ * retry.h --
+ *
+ * Header file for the part of the TclCurl extension that tries the
+ * transfers again when they fail, '-retry'.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#define retry_h
+#include "tclcurl.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define RETRY_BASE          1000
+#define RETRY_MAX           30000
+
+/*
+ * How a handle retries its transfers, 'random' is the state for the
+ * jitter of the waits. The fields after it only mean something during a
+ * transfer: while watching, the headers go through curlRetryHeader,
+ * which swallows a response that will be retried instead of giving it
+ * to the handle.
+ */
+struct curlRetryData {
+    int                     retries;
+    long                    base;
+    long                    max;
+    int                    *codes;
+    int                     codeCount;
+    int                     attempts;
+    unsigned int            random;
+
+    int                     watching;
+    curl_write_callback     headerFunction;
+    void                   *headerData;
+    int                     swallow;
+    long                    retryAfter;
+};
+
+size_t curlRetryHeader(char *ptr,size_t size,size_t nmemb,void *curlDataPtr);
+void curlRetryWake(ClientData clientData);
+
+#ifdef  __cplusplus
+}
+#endif
@@ -0,0 +1,426 @@
+/*
+ * stats.c --
+ *
+ * Implementation of the part of the TclCurl extension that keeps per host
+ * statistics of the transfers: a histogram for every phase of a transfer
+ * and byte counts, shared by all the threads and interpreters.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#include "stats.h"
+#include <ctype.h>
+
+TCL_DECLARE_MUTEX(statsLock)
+
+static Tcl_HashTable    statsHosts;
+static int              statsInitialized=0;
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Tclcurl_StatsInit --
+ *
+ *  This procedure initializes the 'stats' part of the package.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Tclcurl_StatsInit (Tcl_Interp *interp) {
+
+    Tcl_MutexLock(&statsLock);
+    if (!statsInitialized) {
+        Tcl_InitHashTable(&statsHosts,TCL_STRING_KEYS);
+        statsInitialized=1;
+    }
+    Tcl_MutexUnlock(&statsLock);
+
+    Tcl_CreateObjCommand (interp,"::curl::stats",curlStatsObjCmd,
+            (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlStatsObjCmd --
+ *
+ *  This procedure is invoked to process the "curl::stats" Tcl command.
+ *  See the user documentation for details on what it does.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlStatsObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]) {
+
+    int                    tableIndex;
+    Tcl_HashEntry         *entryPtr;
+    Tcl_HashSearch         search;
+    Tcl_Obj               *resultPtr;
+
+    if ((objc<2)||(objc>3)) {
+        Tcl_WrongNumArgs(interp,1,objv,"get|reset ?host?");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(interp, objv[1], statsCommandTable, "option",
+            TCL_EXACT,&tableIndex)==TCL_ERROR) {
+        return TCL_ERROR;
+    }
+
+    Tcl_MutexLock(&statsLock);
+    switch(tableIndex) {
+        case 0:
+            if (objc==3) {
+                entryPtr=Tcl_FindHashEntry(&statsHosts,Tcl_GetString(objv[2]));
+                if (entryPtr==NULL) {
+                    resultPtr=Tcl_NewDictObj();
+                } else {
+                    resultPtr=curlStatsHostObj(
+                            (struct curlStatsHost *)Tcl_GetHashValue(entryPtr));
+                }
+            } else {
+                resultPtr=Tcl_NewDictObj();
+                for (entryPtr=Tcl_FirstHashEntry(&statsHosts,&search);
+                        entryPtr!=NULL;entryPtr=Tcl_NextHashEntry(&search)) {
+                    Tcl_DictObjPut(NULL,resultPtr,
+                            Tcl_NewStringObj(Tcl_GetHashKey(&statsHosts,entryPtr),-1),
+                            curlStatsHostObj(
+                                (struct curlStatsHost *)Tcl_GetHashValue(entryPtr)));
+                }
+            }
+            Tcl_SetObjResult(interp,resultPtr);
+            break;
+        case 1:
+            if (objc==3) {
+                entryPtr=Tcl_FindHashEntry(&statsHosts,Tcl_GetString(objv[2]));
+                if (entryPtr!=NULL) {
+                    Tcl_Free((char *)Tcl_GetHashValue(entryPtr));
+                    Tcl_DeleteHashEntry(entryPtr);
+                }
+            } else {
+                for (entryPtr=Tcl_FirstHashEntry(&statsHosts,&search);
+                        entryPtr!=NULL;entryPtr=Tcl_NextHashEntry(&search)) {
+                    Tcl_Free((char *)Tcl_GetHashValue(entryPtr));
+                }
+                Tcl_DeleteHashTable(&statsHosts);
+                Tcl_InitHashTable(&statsHosts,TCL_STRING_KEYS);
+            }
+            break;
+    }
+    Tcl_MutexUnlock(&statsLock);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlStatsRecord --
+ *
+ *  Adds the timings and byte counts of a finished transfer to the
+ *  statistics of its host. It is invoked after 'curl_easy_perform' and
+ *  when the multi interface reports a transfer as done.
+ *
+ *  Parameter:
+ *      curlHandle: The easy handle of the transfer.
+ *      result: What the transfer returned.
+ *
+ *  The dns and connect phases are only recorded when the transfer had
+ *  to open a new connection, and tls when there was a handshake.
+ *----------------------------------------------------------------------
+ */
+
+void
+curlStatsRecord(CURL *curlHandle,CURLcode result) {
+#if CURL_AT_LEAST_VERSION(7, 61, 0)
+    char                   *url=NULL;
+    char                    host[256];
+    curl_off_t              namelookup=0, connect=0, appconnect=0;
+    curl_off_t              pretransfer=0, starttransfer=0, total=0;
+    curl_off_t              bytesDown=0, bytesUp=0;
+    long                    connects=0;
+    Tcl_HashEntry          *entryPtr;
+    struct curlStatsHost   *hostPtr;
+    int                     newEntry;
+
+    if (curl_easy_getinfo(curlHandle,CURLINFO_EFFECTIVE_URL,&url)||(url==NULL)) {
+        return;
+    }
+    if (curlStatsHostFromUrl(url,host,sizeof(host))) {
+        return;
+    }
+    curl_easy_getinfo(curlHandle,CURLINFO_NAMELOOKUP_TIME_T,&namelookup);
+    curl_easy_getinfo(curlHandle,CURLINFO_CONNECT_TIME_T,&connect);
+    curl_easy_getinfo(curlHandle,CURLINFO_APPCONNECT_TIME_T,&appconnect);
+    curl_easy_getinfo(curlHandle,CURLINFO_PRETRANSFER_TIME_T,&pretransfer);
+    curl_easy_getinfo(curlHandle,CURLINFO_STARTTRANSFER_TIME_T,&starttransfer);
+    curl_easy_getinfo(curlHandle,CURLINFO_TOTAL_TIME_T,&total);
+    curl_easy_getinfo(curlHandle,CURLINFO_SIZE_DOWNLOAD_T,&bytesDown);
+    curl_easy_getinfo(curlHandle,CURLINFO_SIZE_UPLOAD_T,&bytesUp);
+    curl_easy_getinfo(curlHandle,CURLINFO_NUM_CONNECTS,&connects);
+
+    Tcl_MutexLock(&statsLock);
+    entryPtr=Tcl_CreateHashEntry(&statsHosts,host,&newEntry);
+    if (newEntry) {
+        hostPtr=(struct curlStatsHost *)Tcl_Alloc(sizeof(struct curlStatsHost));
+        memset(hostPtr,0,sizeof(struct curlStatsHost));
+        Tcl_SetHashValue(entryPtr,hostPtr);
+    } else {
+        hostPtr=(struct curlStatsHost *)Tcl_GetHashValue(entryPtr);
+    }
+    hostPtr->transfers++;
+    if (result!=CURLE_OK) {
+        hostPtr->errors++;
+    }
+    hostPtr->bytesDown+=bytesDown;
+    hostPtr->bytesUp+=bytesUp;
+
+    if (connects>0) {
+        curlStatsHistogramAdd(&hostPtr->phases[STATS_PHASE_DNS],namelookup);
+        if (connect>=namelookup) {
+            curlStatsHistogramAdd(&hostPtr->phases[STATS_PHASE_CONNECT],
+                    connect-namelookup);
+        }
+    }
+    if (appconnect>=connect&&appconnect>0) {
+        curlStatsHistogramAdd(&hostPtr->phases[STATS_PHASE_TLS],appconnect-connect);
+    }
+    if (starttransfer>=pretransfer&&starttransfer>0) {
+        curlStatsHistogramAdd(&hostPtr->phases[STATS_PHASE_TTFB],
+                starttransfer-pretransfer);
+    }
+    curlStatsHistogramAdd(&hostPtr->phases[STATS_PHASE_TOTAL],total);
+    Tcl_MutexUnlock(&statsLock);
+#endif
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlStatsHostFromUrl --
+ *
+ *  Gets the host part of a URL, in lower case and without user info,
+ *  port or the brackets of an IPv6 address. URLs without a host, like
+ *  'file:///tmp/file', count as 'localhost'.
+ *
+ *  Parameter:
+ *      url: The URL.
+ *      host: Where to store the host.
+ *      size: The size of 'host'.
+ *
+ * Results:
+ *  0 if all went well, 1 if the URL is too weird.
+ *----------------------------------------------------------------------
+ */
+
+int
+curlStatsHostFromUrl(const char *url,char *host,int size) {
+    const char     *start, *stop, *charPtr;
+    int             i, length;
+
+    start=strstr(url,"://");
+    if (start==NULL) {
+        return 1;
+    }
+    start+=3;
+    stop=start+strcspn(start,"/?#");
+    for (charPtr=start;charPtr<stop;charPtr++) {
+        if (*charPtr=='@') {
+            start=charPtr+1;
+        }
+    }
+    if (*start=='[') {
+        start++;
+        for (charPtr=start;charPtr<stop&&*charPtr!=']';charPtr++);
+        stop=charPtr;
+    } else {
+        for (charPtr=start;charPtr<stop&&*charPtr!=':';charPtr++);
+        stop=charPtr;
+    }
+    length=(int)(stop-start);
+    if (length==0) {
+        start="localhost";
+        length=9;
+    }
+    if (length>=size) {
+        return 1;
+    }
+    for (i=0;i<length;i++) {
+        host[i]=(char)tolower((unsigned char)start[i]);
+    }
+    host[length]='\0';
+
+    return 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlStatsHistogramAdd --
+ *
+ *  Adds a value, in microseconds, to a histogram.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlStatsHistogramAdd(struct curlStatsHistogram *histPtr,Tcl_WideInt value) {
+    Tcl_WideUInt    v;
+    int             exp, index;
+
+    if (value<0) {
+        value=0;
+    }
+    v=(Tcl_WideUInt)value;
+    if (v<STATS_SUB_BUCKETS) {
+        index=(int)v;
+    } else {
+        for (exp=STATS_SUB_BITS;(v>>(exp+1))!=0;exp++);
+        index=(exp-STATS_SUB_BITS+1)*STATS_SUB_BUCKETS
+                +(int)((v>>(exp-STATS_SUB_BITS))-STATS_SUB_BUCKETS);
+        if (index>=STATS_BUCKETS) {
+            index=STATS_BUCKETS-1;
+        }
+    }
+    histPtr->buckets[index]++;
+
+    if (histPtr->count==0||value<histPtr->min) {
+        histPtr->min=value;
+    }
+    if (value>histPtr->max) {
+        histPtr->max=value;
+    }
+    histPtr->count++;
+    histPtr->sum+=value;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlStatsPercentile --
+ *
+ *  Estimates a percentile from a histogram.
+ *
+ *  Parameter:
+ *      histPtr: The histogram.
+ *      fraction: Which percentile, 0.5 for the median.
+ *
+ * Results:
+ *  The middle of the bucket the percentile falls in, it never goes
+ *  beyond the minimum and maximum values seen.
+ *----------------------------------------------------------------------
+ */
+
+Tcl_WideInt
+curlStatsPercentile(struct curlStatsHistogram *histPtr,double fraction) {
+    Tcl_WideInt     target, seen=0;
+    Tcl_WideInt     low, width, value;
+    int             index, exp;
+
+    if (histPtr->count==0) {
+        return 0;
+    }
+    target=(Tcl_WideInt)(fraction*histPtr->count+0.999999);
+    if (target<1) {
+        target=1;
+    }
+    for (index=0;index<STATS_BUCKETS;index++) {
+        seen+=histPtr->buckets[index];
+        if (seen>=target) {
+            break;
+        }
+    }
+    if (index<STATS_SUB_BUCKETS) {
+        value=index;
+    } else {
+        exp=index/STATS_SUB_BUCKETS+STATS_SUB_BITS-1;
+        width=(Tcl_WideInt)1<<(exp-STATS_SUB_BITS);
+        low=(Tcl_WideInt)(STATS_SUB_BUCKETS+index%STATS_SUB_BUCKETS)*width;
+        value=low+width/2;
+    }
+    if (value<histPtr->min) {
+        value=histPtr->min;
+    }
+    if (value>histPtr->max) {
+        value=histPtr->max;
+    }
+    return value;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlStatsHistogramObj --
+ *
+ *  Returns a dict with the summary of a histogram, all the values
+ *  are in microseconds.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Tcl_Obj *
+curlStatsHistogramObj(struct curlStatsHistogram *histPtr) {
+    Tcl_Obj        *dictPtr=Tcl_NewDictObj();
+
+    Tcl_DictObjPut(NULL,dictPtr,Tcl_NewStringObj("count",-1),
+            Tcl_NewWideIntObj(histPtr->count));
+    Tcl_DictObjPut(NULL,dictPtr,Tcl_NewStringObj("min",-1),
+            Tcl_NewWideIntObj(histPtr->min));
+    Tcl_DictObjPut(NULL,dictPtr,Tcl_NewStringObj("max",-1),
+            Tcl_NewWideIntObj(histPtr->max));
+    Tcl_DictObjPut(NULL,dictPtr,Tcl_NewStringObj("mean",-1),
+            Tcl_NewWideIntObj(histPtr->count?histPtr->sum/histPtr->count:0));
+    Tcl_DictObjPut(NULL,dictPtr,Tcl_NewStringObj("p50",-1),
+            Tcl_NewWideIntObj(curlStatsPercentile(histPtr,0.50)));
+    Tcl_DictObjPut(NULL,dictPtr,Tcl_NewStringObj("p90",-1),
+            Tcl_NewWideIntObj(curlStatsPercentile(histPtr,0.90)));
+    Tcl_DictObjPut(NULL,dictPtr,Tcl_NewStringObj("p99",-1),
+            Tcl_NewWideIntObj(curlStatsPercentile(histPtr,0.99)));
+    Tcl_DictObjPut(NULL,dictPtr,Tcl_NewStringObj("p999",-1),
+            Tcl_NewWideIntObj(curlStatsPercentile(histPtr,0.999)));
+
+    return dictPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlStatsHostObj --
+ *
+ *  Returns a dict with the statistics of a host.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Tcl_Obj *
+curlStatsHostObj(struct curlStatsHost *hostPtr) {
+    Tcl_Obj        *dictPtr=Tcl_NewDictObj();
+    int             i;
+
+    Tcl_DictObjPut(NULL,dictPtr,Tcl_NewStringObj("transfers",-1),
+            Tcl_NewWideIntObj(hostPtr->transfers));
+    Tcl_DictObjPut(NULL,dictPtr,Tcl_NewStringObj("errors",-1),
+            Tcl_NewWideIntObj(hostPtr->errors));
+    Tcl_DictObjPut(NULL,dictPtr,Tcl_NewStringObj("bytesdown",-1),
+            Tcl_NewWideIntObj(hostPtr->bytesDown));
+    Tcl_DictObjPut(NULL,dictPtr,Tcl_NewStringObj("bytesup",-1),
+            Tcl_NewWideIntObj(hostPtr->bytesUp));
+    for (i=0;i<STATS_PHASES;i++) {
+        Tcl_DictObjPut(NULL,dictPtr,Tcl_NewStringObj(statsPhaseTable[i],-1),
+                curlStatsHistogramObj(&hostPtr->phases[i]));
+    }
+
+    return dictPtr;
+}
@@ -0,0 +1,76 @@
+/*
+ * stats.h --
+ *
+ * Header file for the part of the TclCurl extension that keeps per host
+ * statistics of the transfers.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#define stats_h
+#include "tclcurl.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The histograms are log-linear: values under STATS_SUB_BUCKETS
+ * microseconds get a bucket each, after that every power of two is
+ * split in STATS_SUB_BUCKETS buckets, which keeps the error under
+ * 1/STATS_SUB_BUCKETS. Anything over 2^STATS_MAX_EXP microseconds
+ * (about 12 days) goes into the last bucket.
+ */
+
+#define STATS_SUB_BUCKETS   16
+#define STATS_SUB_BITS      4
+#define STATS_MAX_EXP       40
+#define STATS_BUCKETS       ((STATS_MAX_EXP-STATS_SUB_BITS+1)*STATS_SUB_BUCKETS)
+
+#define STATS_PHASE_DNS     0
+#define STATS_PHASE_CONNECT 1
+#define STATS_PHASE_TLS     2
+#define STATS_PHASE_TTFB    3
+#define STATS_PHASE_TOTAL   4
+#define STATS_PHASES        5
+
+struct curlStatsHistogram {
+    Tcl_WideInt           count;
+    Tcl_WideInt           sum;
+    Tcl_WideInt           min;
+    Tcl_WideInt           max;
+    unsigned int          buckets[STATS_BUCKETS];
+};
+
+struct curlStatsHost {
+    Tcl_WideInt                transfers;
+    Tcl_WideInt                errors;
+    Tcl_WideInt                bytesDown;
+    Tcl_WideInt                bytesUp;
+    struct curlStatsHistogram  phases[STATS_PHASES];
+};
+
+const static char *statsCommandTable[] = {
+    "get", "reset", (char *)NULL
+};
+
+const static char *statsPhaseTable[] = {
+    "dns", "connect", "tls", "ttfb", "total", (char *)NULL
+};
+
+int curlStatsObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]);
+
+int curlStatsHostFromUrl(const char *url,char *host,int size);
+
+Tcl_Obj *curlStatsHostObj(struct curlStatsHost *hostPtr);
+Tcl_Obj *curlStatsHistogramObj(struct curlStatsHistogram *histPtr);
+
+void curlStatsHistogramAdd(struct curlStatsHistogram *histPtr,Tcl_WideInt value);
+Tcl_WideInt curlStatsPercentile(struct curlStatsHistogram *histPtr,double fraction);
+
+#ifdef  __cplusplus
+}
+#endif
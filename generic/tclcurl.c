@@ -22,8 +22,18 @@
 #include <sys/types.h>
 #ifndef _WIN32
 #include <unistd.h>
+#else
+#include <io.h>
+#include <process.h>
 #endif
 
+/*
+ * The named share handles of the process, keyed by name.
+ */
+TCL_DECLARE_MUTEX(shareLock)
+static Tcl_HashTable    sharesByName;
+static int              sharesInitialized=0;
+
 /*
  *----------------------------------------------------------------------
  *
@@ -50,14 +60,14 @@ Tclcurl_Init (Tcl_Interp *interp) {
     }
 #endif
 
+    if (Tclcurl_MeminfoInit(interp)!=TCL_OK) {
+        return TCL_ERROR;
+    }
+
     Tcl_CreateObjCommand (interp,"::curl::init",curlInitObjCmd,
             (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
     Tcl_CreateObjCommand (interp,"::curl::version",curlVersion,
             (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
-    Tcl_CreateObjCommand (interp,"::curl::escape",curlEscape,
-            (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
-    Tcl_CreateObjCommand (interp,"::curl::unescape",curlUnescape,
-            (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
     Tcl_CreateObjCommand (interp,"::curl::versioninfo",curlVersionInfo,
             (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
     Tcl_CreateObjCommand (interp,"::curl::shareinit",curlShareInitObjCmd,
@@ -70,6 +80,12 @@ Tclcurl_Init (Tcl_Interp *interp) {
             (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
 
     Tclcurl_MultiInit(interp);
+    Tclcurl_StatsInit(interp);
+    Tclcurl_MimeInit(interp);
+    Tclcurl_ExecutorInit(interp);
+    Tclcurl_EscapeInit(interp);
+    Tclcurl_UrlInit(interp);
+    Tclcurl_CacheInit(interp);
 
     Tcl_PkgProvide(interp,"TclCurl",PACKAGE_VERSION);
 
@@ -161,6 +177,7 @@ curlInitObjCmd (ClientData clientData, Tcl_Interp *interp,
     handleObj=curlCreateObjCmd(interp,curlData);
 
     curlData->curl=curlHandle;
+    curl_easy_setopt(curlHandle,CURLOPT_PRIVATE,curlData);
 
     Tcl_SetObjResult(interp,handleObj);
 
@@ -200,6 +217,13 @@ curlObjCmd (ClientData clientData, Tcl_Interp *interp,
         return TCL_ERROR;
     }
 
+    /* Scripts run by 'perform -eventloop' can't touch the handle. */
+    if (curlData->performing&&tableIndex!=2&&tableIndex!=7&&tableIndex!=8) {
+        Tcl_SetObjResult(interp,Tcl_NewStringObj(
+                "the handle is busy with a transfer",-1));
+        return TCL_ERROR;
+    }
+
     switch(tableIndex) {
         case 0:
             if (objc != 4) {
@@ -211,25 +235,33 @@ curlObjCmd (ClientData clientData, Tcl_Interp *interp,
             }
             break;
         case 1:
-            if (objc != 2) {
-                Tcl_WrongNumArgs(interp,2,objv,"");
+            if (objc!=2&&objc!=3) {
+                Tcl_WrongNumArgs(interp,2,objv,"?-eventloop?");
+                return TCL_ERROR;
+            }
+            if (objc==3&&Tcl_GetIndexFromObj(interp,objv[2],performTable,
+                    "option",TCL_EXACT,&tableIndex)==TCL_ERROR) {
                 return TCL_ERROR;
             }
-            if (curlPerform(interp,curlHandle,curlData)) {
-                if (curlData->errorBuffer!=NULL) {
-                    if (curlData->errorBufferKey==NULL) {
-                        Tcl_SetVar(interp,curlData->errorBufferName,
-                                curlData->errorBuffer,0);
-                    } else {
-                        Tcl_SetVar2(interp,curlData->errorBufferName,
-                                curlData->errorBufferKey,
-                                curlData->errorBuffer,0);
-                    }
+            /* A script run by the transfer may delete the handle. */
+            Tcl_Preserve((ClientData)curlData);
+            if (curlPerform(interp,curlHandle,curlData,objc==3)) {
+                if ((!curlData->deleted)&&(curlData->errorBuffer!=NULL)) {
+                    Tcl_ObjSetVar2(interp,curlData->errorBufferName,NULL,
+                            Tcl_NewStringObj(curlData->errorBuffer,-1),0);
                 }
+                Tcl_Release((ClientData)curlData);
                 return TCL_ERROR;
             }
+            Tcl_Release((ClientData)curlData);
             break;
         case 2:
+            if ((objc==3||objc==4)&&(*Tcl_GetString(objv[2])=='-')) {
+                if (curlGetInfoDictCmd(interp,curlHandle,objc,objv)) {
+                    return TCL_ERROR;
+                }
+                break;
+            }
             if (objc != 3) {
                 Tcl_WrongNumArgs(interp,2,objv,"option");
                 return TCL_ERROR;
@@ -309,21 +341,41 @@ curlObjCmd (ClientData clientData, Tcl_Interp *interp,
  *  A standard Tcl result.
  *
  * Side effects:
- *  Cleans the curl handle and frees the memory.
+ *  Cleans the curl handle and frees the memory, once a transfer
+ *  going on has let go of it.
  *
  *----------------------------------------------------------------------
  */
 int
 curlDeleteCmd(ClientData clientData) {
     struct curlObjData     *curlData=(struct curlObjData *)clientData;
-    CURL                   *curlHandle=curlData->curl;
 
-    curl_easy_cleanup(curlHandle);
+    curlData->deleted=1;
+    Tcl_EventuallyFree((ClientData)curlData,(Tcl_FreeProc *)curlFreeHandle);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlFreeHandle --
+ *
+ *  Cleans the curl handle of a deleted command and frees its memory.
+ *
+ * Parameter:
+ *  dataPtr: The TclCurl data of the handle.
+ *
+ *----------------------------------------------------------------------
+ */
+void
+curlFreeHandle(char *dataPtr) {
+    struct curlObjData     *curlData=(struct curlObjData *)dataPtr;
+
+    curl_easy_cleanup(curlData->curl);
     curlFreeSpace(curlData);
 
     Tcl_Free((char *)curlData);
-
-    return TCL_OK;
 }
 
 /*
@@ -331,12 +383,15 @@ curlDeleteCmd(ClientData clientData) {
  *
  * curlPerform --
  *
- *  Invokes the libcurl function 'curl_easy_perform'
+ *  Invokes the libcurl function 'curl_easy_perform', or does the
+ *  transfer while servicing Tcl's event loop, as many times as '-retry'
+ *  allows if it fails.
  *
  * Parameter:
  *  interp: Pointer to the interpreter we are using.
  *  curlHandle: the curl handle for which the option is set.
- *  objc and objv: The usual in Tcl.
+ *  curlData: The TclCurl data of the handle.
+ *  eventLoop: Whether to keep the event loop going.
  *
  * Results:
  *  Standard Tcl return codes.
@@ -344,8 +399,9 @@ curlDeleteCmd(ClientData clientData) {
  */
 int
 curlPerform(Tcl_Interp *interp,CURL *curlHandle,
-            struct curlObjData *curlData) {
+            struct curlObjData *curlData,int eventLoop) {
     int         exitCode;
+    long        delay;
     Tcl_Obj     *resultPtr;
 
     if (curlOpenFiles(interp,curlData)) {
@@ -354,20 +410,273 @@ curlPerform(Tcl_Interp *interp,CURL *curlHandle,
     if (curlSetPostData(interp,curlData)) {
         return TCL_ERROR;
     }
-    exitCode=curl_easy_perform(curlHandle);
+    curlRetryStart(curlData);
+    for (;;) {
+        curlRetryWatch(curlData);
+        curlResumePrepare(curlData);
+        curlDigestPrepare(curlData);
+        if ((curlData->cache!=NULL)&&curlCachePrepare(interp,curlData)) {
+            /* A fresh copy in the cache, there is no transfer at all. */
+            curlCacheServe(curlData);
+            exitCode=CURLE_OK;
+        } else {
+            if (eventLoop) {
+                curlData->performing=1;
+                exitCode=curlPerformEventLoop(curlData);
+                curlData->performing=0;
+            } else {
+                exitCode=curl_easy_perform(curlHandle);
+            }
+            curlStatsRecord(curlHandle,exitCode);
+            if (curlData->cache!=NULL) {
+                curlCacheFinish(curlData,exitCode);
+            }
+        }
+        if (curlResumeFinish(curlData,exitCode)) {
+            /* The resource changed, the download starts over. */
+            continue;
+        }
+        if (curlData->deleted||((delay=curlRetryCheck(curlData,exitCode))<0)) {
+            break;
+        }
+        curlRetryWait(delay,eventLoop);
+        if (curlData->deleted) {
+            break;
+        }
+    }
+    exitCode=curlDigestFinish(curlData,exitCode);
+    exitCode=curlCommitFiles(curlData,exitCode);
     resultPtr=Tcl_NewIntObj(exitCode);
     Tcl_SetObjResult(interp,resultPtr);
     curlCloseFiles(curlData);
     curlResetPostData(curlData);
+    if (curlData->deleted) {
+        Tcl_SetObjResult(interp,Tcl_NewStringObj(
+                "the handle was deleted during the transfer",-1));
+        return TCL_ERROR;
+    }
     if (curlData->bodyVarName) {
         curlSetBodyVarName(interp,curlData);
     }
-    if (curlData->command) {
-        Tcl_GlobalEval(interp,curlData->command);
+    if ((curlData->callbacks!=NULL)&&(curlData->callbacks->command!=NULL)) {
+        Tcl_GlobalEval(interp,Tcl_GetString(curlData->callbacks->command));
     }
     return exitCode;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlPerformEventLoop --
+ *
+ *  Does a transfer through a multi handle of its own, handing its
+ *  sockets and timeouts to Tcl so the event loop can go on while it
+ *  waits for them.
+ *
+ * Parameter:
+ *  curlData: The TclCurl data of the handle, if a script deletes
+ *  it the transfer is aborted.
+ *
+ * Results:
+ *  The code of the transfer.
+ *----------------------------------------------------------------------
+ */
+CURLcode
+curlPerformEventLoop(struct curlObjData *curlData) {
+    CURL                    *curlHandle=curlData->curl;
+    struct curlEventLoop     loop;
+#ifndef _WIN32
+    struct curlEventSocket  *socketPtr;
+#endif
+
+    memset(&loop,0,sizeof(struct curlEventLoop));
+    loop.multi=curl_multi_init();
+    if (loop.multi==NULL) {
+        return CURLE_OUT_OF_MEMORY;
+    }
+#ifndef _WIN32
+    curl_multi_setopt(loop.multi,CURLMOPT_SOCKETFUNCTION,curlEventLoopSocket);
+    curl_multi_setopt(loop.multi,CURLMOPT_SOCKETDATA,&loop);
+#endif
+    curl_multi_setopt(loop.multi,CURLMOPT_TIMERFUNCTION,curlEventLoopTimer);
+    curl_multi_setopt(loop.multi,CURLMOPT_TIMERDATA,&loop);
+
+    if (curl_multi_add_handle(loop.multi,curlHandle)!=CURLM_OK) {
+        curl_multi_cleanup(loop.multi);
+        return CURLE_FAILED_INIT;
+    }
+    while ((!loop.done)&&(!curlData->deleted)) {
+        Tcl_DoOneEvent(TCL_ALL_EVENTS);
+    }
+    if (!loop.done) {
+        loop.result=CURLE_ABORTED_BY_CALLBACK;
+    }
+    curl_multi_remove_handle(loop.multi,curlHandle);
+    curl_multi_cleanup(loop.multi);
+    if (loop.timer!=NULL) {
+        Tcl_DeleteTimerHandler(loop.timer);
+    }
+#ifndef _WIN32
+    while ((socketPtr=loop.sockets)!=NULL) {
+        loop.sockets=socketPtr->next;
+        Tcl_DeleteFileHandler((int)socketPtr->fd);
+        Tcl_Free((char *)socketPtr);
+    }
+#endif
+
+    return loop.result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlEventLoopSocket --
+ *
+ *  libcurl tells us with this function which sockets to watch.
+ *
+ * Results:
+ *  Always 0.
+ *----------------------------------------------------------------------
+ */
+int
+curlEventLoopSocket(CURL *easy,curl_socket_t s,int what,void *userp,void *socketp) {
+#ifndef _WIN32
+    struct curlEventLoop     *loopPtr=(struct curlEventLoop *)userp;
+    struct curlEventSocket   *socketPtr=(struct curlEventSocket *)socketp;
+    struct curlEventSocket  **prevPtr;
+    int                       mask=0;
+
+    if (what==CURL_POLL_REMOVE) {
+        Tcl_DeleteFileHandler((int)s);
+        for (prevPtr=&loopPtr->sockets;*prevPtr!=NULL;prevPtr=&(*prevPtr)->next) {
+            if (*prevPtr==socketPtr) {
+                *prevPtr=socketPtr->next;
+                Tcl_Free((char *)socketPtr);
+                break;
+            }
+        }
+        return 0;
+    }
+    if (socketPtr==NULL) {
+        socketPtr=(struct curlEventSocket *)Tcl_Alloc(sizeof(struct curlEventSocket));
+        socketPtr->loopPtr=loopPtr;
+        socketPtr->fd=s;
+        socketPtr->next=loopPtr->sockets;
+        loopPtr->sockets=socketPtr;
+        curl_multi_assign(loopPtr->multi,s,socketPtr);
+    }
+    if (what&CURL_POLL_IN) {
+        mask|=TCL_READABLE;
+    }
+    if (what&CURL_POLL_OUT) {
+        mask|=TCL_WRITABLE;
+    }
+    Tcl_CreateFileHandler((int)s,mask,curlEventLoopReady,(ClientData)socketPtr);
+#endif
+    return 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlEventLoopTimer --
+ *
+ *  libcurl tells us with this function when it wants to be called even
+ *  if none of its sockets is ready. Where we can't watch the sockets,
+ *  we just check them every few milliseconds.
+ *
+ * Results:
+ *  Always 0.
+ *----------------------------------------------------------------------
+ */
+int
+curlEventLoopTimer(CURLM *multi,long timeoutMs,void *userp) {
+    struct curlEventLoop   *loopPtr=(struct curlEventLoop *)userp;
+
+    if (loopPtr->timer!=NULL) {
+        Tcl_DeleteTimerHandler(loopPtr->timer);
+        loopPtr->timer=NULL;
+    }
+#ifdef _WIN32
+    if (timeoutMs<0||timeoutMs>10) {
+        timeoutMs=10;
+    }
+#endif
+    if (timeoutMs>=0) {
+        loopPtr->timer=Tcl_CreateTimerHandler((int)timeoutMs,
+                curlEventLoopTimeout,(ClientData)loopPtr);
+    }
+    return 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlEventLoopTimeout --
+ *
+ *  Invoked by Tcl when the time libcurl asked for is up.
+ *----------------------------------------------------------------------
+ */
+void
+curlEventLoopTimeout(ClientData clientData) {
+    struct curlEventLoop   *loopPtr=(struct curlEventLoop *)clientData;
+
+    loopPtr->timer=NULL;
+    curlEventLoopAction(loopPtr,CURL_SOCKET_TIMEOUT,0);
+#ifdef _WIN32
+    if (!loopPtr->done&&loopPtr->timer==NULL) {
+        loopPtr->timer=Tcl_CreateTimerHandler(10,curlEventLoopTimeout,clientData);
+    }
+#endif
+}
+
+#ifndef _WIN32
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlEventLoopReady --
+ *
+ *  Invoked by Tcl when one of the sockets of the transfer is ready.
+ *----------------------------------------------------------------------
+ */
+void
+curlEventLoopReady(ClientData clientData,int mask) {
+    struct curlEventSocket *socketPtr=(struct curlEventSocket *)clientData;
+    int                     events=0;
+
+    if (mask&TCL_READABLE) {
+        events|=CURL_CSELECT_IN;
+    }
+    if (mask&TCL_WRITABLE) {
+        events|=CURL_CSELECT_OUT;
+    }
+    curlEventLoopAction(socketPtr->loopPtr,socketPtr->fd,events);
+}
+#endif
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlEventLoopAction --
+ *
+ *  Lets libcurl do what it can with a socket, or with all of them, and
+ *  checks if the transfer is done.
+ *----------------------------------------------------------------------
+ */
+void
+curlEventLoopAction(struct curlEventLoop *loopPtr,curl_socket_t s,int mask) {
+    CURLMsg     *multiInfo;
+    int          running, msgLeft;
+
+    curl_multi_socket_action(loopPtr->multi,s,mask,&running);
+    while ((multiInfo=curl_multi_info_read(loopPtr->multi,&msgLeft))!=NULL) {
+        if (multiInfo->msg==CURLMSG_DONE) {
+            loopPtr->result=multiInfo->data.result;
+            loopPtr->done=1;
+        }
+    }
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -463,18 +772,20 @@ int
 curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
         Tcl_Obj *const objv,int tableIndex) {
 
-    int            exitCode;
     CURL           *curlHandle=curlData->curl;
+#if CURL_AT_LEAST_VERSION(7, 56, 0)
+    struct curlMimeObjData *mimeDataPtr;
+#endif
+#if CURL_AT_LEAST_VERSION(7, 63, 0)
+    struct curlUrlData       *urlDataPtr;
+#endif
+    struct curlFileData      *filesPtr;
+    struct curlCallbackData  *callbacksPtr;
     int            i,j,k;
 
     Tcl_Obj        *resultObjPtr;
     Tcl_Obj        *tmpObjPtr;
 
-    Tcl_RegExp      regExp;
-    const char     *startPtr;
-    const char     *endPtr;
-
-    int             charLength;
     long            longNumber=0;
     int             intNumber;
     char           *tmpStr;
@@ -492,44 +803,63 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
 
     switch(tableIndex) {
         case 0:
+            curlSetObj(&curlData->urlName,objv);
+#if CURL_AT_LEAST_VERSION(7, 63, 0)
+            /* A URL 'curl::url' returned is already parsed. */
+            urlDataPtr=curlUrlGet(objv);
+            if (urlDataPtr!=NULL) {
+                curlUrlHold(urlDataPtr);
+                curl_easy_setopt(curlHandle,CURLOPT_CURLU,urlDataPtr->handle);
+            } else {
+                /* Clearing the parsed URL clears the string one too. */
+                curl_easy_setopt(curlHandle,CURLOPT_CURLU,NULL);
+                if (SetoptChar(interp,curlHandle,CURLOPT_URL,
+                        tableIndex,objv)) {
+                    return TCL_ERROR;
+                }
+            }
+            if (curlData->url!=NULL) {
+                curlUrlRelease(curlData->url);
+            }
+            curlData->url=urlDataPtr;
+#else
             if (SetoptChar(interp,curlHandle,CURLOPT_URL,
                     tableIndex,objv)) {
                 return TCL_ERROR;
             }
+#endif
             break;
         case 1:
-            Tcl_Free(curlData->outFile);
-            curlData->outFile=curlstrdup(Tcl_GetString(objv));
-            if (curlData->outFlag) {
-                if (curlData->outHandle!=NULL) {
-                    fclose(curlData->outHandle);
-                    curlData->outHandle=NULL;
-                }
-            }
-            if ((strcmp(curlData->outFile,""))&&(strcmp(curlData->outFile,"stdout"))) {
-                curlData->outFlag=1;
+            filesPtr=curlGetFiles(curlData);
+            if (filesPtr->outHandle!=NULL) {
+                fclose(filesPtr->outHandle);
+                filesPtr->outHandle=NULL;
+            }
+            tmpStr=Tcl_GetString(objv);
+            if ((strcmp(tmpStr,""))&&(strcmp(tmpStr,"stdout"))) {
+                curlSetObj(&filesPtr->outFile,objv);
+                filesPtr->outFlag=1;
+                curlSetWriter(curlData,NULL,NULL);
             } else {
-                curlData->outFlag=0;
-                curl_easy_setopt(curlHandle,CURLOPT_WRITEDATA,stdout);
-                curlData->outFile=NULL;
+                curlSetObj(&filesPtr->outFile,NULL);
+                filesPtr->outFlag=0;
+                curlSetWriter(curlData,NULL,stdout);
             }
-            curl_easy_setopt(curlHandle,CURLOPT_WRITEFUNCTION,NULL);
             break;
         case 2:
-            Tcl_Free(curlData->inFile);
-            curlData->inFile=curlstrdup(Tcl_GetString(objv));
-            if (curlData->inFlag) {
-                if (curlData->inHandle!=NULL) {
-                    fclose(curlData->inHandle);
-                    curlData->inHandle=NULL;
-                }
-            }
-            if ((strcmp(curlData->inFile,""))&&(strcmp(curlData->inFile,"stdin"))) {
-                curlData->inFlag=1;
+            filesPtr=curlGetFiles(curlData);
+            if (filesPtr->inHandle!=NULL) {
+                fclose(filesPtr->inHandle);
+                filesPtr->inHandle=NULL;
+            }
+            tmpStr=Tcl_GetString(objv);
+            if ((strcmp(tmpStr,""))&&(strcmp(tmpStr,"stdin"))) {
+                curlSetObj(&filesPtr->inFile,objv);
+                filesPtr->inFlag=1;
             } else {
+                curlSetObj(&filesPtr->inFile,NULL);
+                filesPtr->inFlag=0;
                 curl_easy_setopt(curlHandle,CURLOPT_READDATA,stdin);
-                curlData->inFlag=0;
-                curlData->inFile=NULL;
             }
             curl_easy_setopt(curlHandle,CURLOPT_READFUNCTION,NULL);
             break;
@@ -678,46 +1008,22 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
             }
             break;
         case 28:
-            tmpStr=curlstrdup(Tcl_GetString(objv));
-            regExp=Tcl_RegExpCompile(interp,"(.*)(?:\\()(.*)(?:\\))");
-            exitCode=Tcl_RegExpExec(interp,regExp,tmpStr,tmpStr);
-            switch(exitCode) {
-                case -1:
-                    Tcl_Free((char *)tmpStr);
-                    return TCL_ERROR;
-                    break;
-                case 0:
-                    if (*tmpStr!=0) {
-                        curlData->errorBufferName=curlstrdup(tmpStr);
-                    } else {
-                        curlData->errorBuffer=NULL;
-                    }
-                    curlData->errorBufferKey=NULL;
-                    break;
-                case 1:
-                    Tcl_RegExpRange(regExp,1,&startPtr,&endPtr);
-                    charLength=endPtr-startPtr;
-                    curlData->errorBufferName=Tcl_Alloc(charLength+1);
-                    strncpy(curlData->errorBufferName,startPtr,charLength);
-                    curlData->errorBufferName[charLength]=0;
-                    Tcl_RegExpRange(regExp,2,&startPtr,&endPtr);
-                    charLength=endPtr-startPtr;
-                    curlData->errorBufferKey=Tcl_Alloc(charLength+1);
-                    strncpy(curlData->errorBufferKey,startPtr,charLength);
-                    curlData->errorBufferKey[charLength]=0;
-                    break;
-            }
-            Tcl_Free((char *)tmpStr);
-            if (curlData->errorBufferName!=NULL) {
-                curlData->errorBuffer=Tcl_Alloc(CURL_ERROR_SIZE);
+            /* Tcl takes care of names like 'array(key)' when setting it. */
+            if (*Tcl_GetString(objv)!=0) {
+                curlSetObj(&curlData->errorBufferName,objv);
+                if (curlData->errorBuffer==NULL) {
+                    curlData->errorBuffer=Tcl_Alloc(CURL_ERROR_SIZE);
+                    curlData->errorBuffer[0]=0;
+                }
                 if (curl_easy_setopt(curlHandle,CURLOPT_ERRORBUFFER,
                         curlData->errorBuffer)) {
-                    Tcl_Free((char *)curlData->errorBuffer);
-                    curlData->errorBuffer=NULL;
                     return TCL_ERROR;
                 }
             } else {
+                curl_easy_setopt(curlHandle,CURLOPT_ERRORBUFFER,NULL);
+                curlSetObj(&curlData->errorBufferName,NULL);
                 Tcl_Free(curlData->errorBuffer);
+                curlData->errorBuffer=NULL;
             }
             break;
         case 29:
@@ -953,51 +1259,54 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
             }
             break;
         case 42:
-            if(SetoptsList(interp,&curlData->quote,objv)) {
+            if(SetoptsList(interp,&curlGetLists(curlData)->quote,objv)) {
                 curlErrorSetOpt(interp,configTable,tableIndex,"quote list invalid");
                 return TCL_ERROR;
             }
-            if (curl_easy_setopt(curlHandle,CURLOPT_QUOTE,curlData->quote)) {
-                curl_slist_free_all(curlData->quote);
-                curlData->quote=NULL;
+            if (curl_easy_setopt(curlHandle,CURLOPT_QUOTE,curlData->lists->quote)) {
+                curl_slist_free_all(curlData->lists->quote);
+                curlData->lists->quote=NULL;
                 return TCL_ERROR;
             }
             return TCL_OK;
             break;
         case 43:
-            if(SetoptsList(interp,&curlData->postquote,objv)) {
+            if(SetoptsList(interp,&curlGetLists(curlData)->postquote,objv)) {
                 curlErrorSetOpt(interp,configTable,tableIndex,"postquote invalid");
                 return TCL_ERROR;
             }
-            if (curl_easy_setopt(curlHandle,CURLOPT_POSTQUOTE,curlData->postquote)) {
+            if (curl_easy_setopt(curlHandle,CURLOPT_POSTQUOTE,curlData->lists->postquote)) {
                 curlErrorSetOpt(interp,configTable,tableIndex,"postquote invalid");
-                curl_slist_free_all(curlData->postquote);
-                curlData->postquote=NULL;
+                curl_slist_free_all(curlData->lists->postquote);
+                curlData->lists->postquote=NULL;
                 return TCL_ERROR;
             }
             return TCL_OK;
             break;
         case 44:
-            Tcl_Free(curlData->headerFile);
-            curlData->headerFile=curlstrdup(Tcl_GetString(objv));
-            if (curlData->headerFlag) {
-                if (curlData->headerHandle!=NULL) {
-                    fclose(curlData->headerHandle);
-                    curlData->headerHandle=NULL;
+            filesPtr=curlGetFiles(curlData);
+            if (filesPtr->headerFlag) {
+                if (filesPtr->headerHandle!=NULL) {
+                    fclose(filesPtr->headerHandle);
+                    filesPtr->headerHandle=NULL;
                 }
-                curl_easy_setopt(curlHandle,CURLOPT_HEADERDATA,NULL);
             }
-            if ((strcmp(curlData->headerFile,""))&&(strcmp(curlData->headerFile,"stdout"))
-                    &&(strcmp(curlData->headerFile,"stderr"))) {
-                curlData->headerFlag=1;
+            /* Without a header function of its own, libcurl would give
+             * the headers, with the file as data, to the write function. */
+            tmpStr=Tcl_GetString(objv);
+            if ((strcmp(tmpStr,""))&&(strcmp(tmpStr,"stdout"))
+                    &&(strcmp(tmpStr,"stderr"))) {
+                curlSetObj(&filesPtr->headerFile,objv);
+                filesPtr->headerFlag=1;
+                curlSetHeaderWriter(curlData,curlHeaderFileWriter,NULL);
             } else {
-                if ((strcmp(curlData->headerFile,"stdout"))) {
-                    curl_easy_setopt(curlHandle,CURLOPT_HEADERDATA,stderr);
+                if ((strcmp(tmpStr,"stdout"))) {
+                    curlSetHeaderWriter(curlData,curlHeaderFileWriter,stderr);
                 } else {
-                    curl_easy_setopt(curlHandle,CURLOPT_HEADERDATA,stdout);
+                    curlSetHeaderWriter(curlData,curlHeaderFileWriter,stdout);
                 }
-                curlData->headerFlag=0;
-                curlData->headerFile=NULL;
+                curlSetObj(&filesPtr->headerFile,NULL);
+                filesPtr->headerFlag=0;
             }
             break;
         case 45:
@@ -1026,19 +1335,20 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
             }
             break;
         case 48:
-            Tcl_Free(curlData->stderrFile);
-            curlData->stderrFile=curlstrdup(Tcl_GetString(objv));
-            if ((strcmp(curlData->stderrFile,""))&&(strcmp(curlData->stderrFile,"stdout"))
-                    &&(strcmp(curlData->stderrFile,"stderr"))) {
-                curlData->stderrFlag=1;
+            filesPtr=curlGetFiles(curlData);
+            tmpStr=Tcl_GetString(objv);
+            if ((strcmp(tmpStr,""))&&(strcmp(tmpStr,"stdout"))
+                    &&(strcmp(tmpStr,"stderr"))) {
+                curlSetObj(&filesPtr->stderrFile,objv);
+                filesPtr->stderrFlag=1;
             } else {
-                curlData->stderrFlag=0;
-                if (strcmp(curlData->stderrFile,"stdout")) {
+                filesPtr->stderrFlag=0;
+                if (strcmp(tmpStr,"stdout")) {
                     curl_easy_setopt(curlHandle,CURLOPT_STDERR,stderr);
                 } else {
                     curl_easy_setopt(curlHandle,CURLOPT_STDERR,stdout);
                 }
-                curlData->stderrFile=NULL;
+                curlSetObj(&filesPtr->stderrFile,NULL);
             }
             break;
         case 49:
@@ -1108,48 +1418,33 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
             }
             break;
         case 61:
-            if (curlData->headerFlag) {
-                if (curlData->headerHandle!=NULL) {
-                    fclose(curlData->headerHandle);
-                    curlData->headerHandle=NULL;
+            filesPtr=curlData->files;
+            if ((filesPtr!=NULL)&&(filesPtr->headerFlag)) {
+                if (filesPtr->headerHandle!=NULL) {
+                    fclose(filesPtr->headerHandle);
+                    filesPtr->headerHandle=NULL;
                 }
-                curl_easy_setopt(curlHandle,CURLOPT_HEADERDATA,NULL);
-                curlData->headerFlag=0;
-            }
-            if (curl_easy_setopt(curlHandle,CURLOPT_HEADERFUNCTION,
-                    curlHeaderReader)) {
-                return TCL_ERROR;
-            }
-            Tcl_Free(curlData->headerVar);
-            curlData->headerVar=curlstrdup(Tcl_GetString(objv));
-            if (curl_easy_setopt(curlHandle,CURLOPT_HEADERDATA,
-                    (FILE *)curlData)) {
-                return TCL_ERROR;
+                filesPtr->headerFlag=0;
             }
+            curlSetObj(&curlData->headerVar,objv);
+            curlSetHeaderWriter(curlData,(curl_write_callback)curlHeaderReader,
+                    curlData);
             break;
         case 62:
-            Tcl_Free(curlData->bodyVarName);
-            curlData->bodyVarName=curlstrdup(Tcl_GetString(objv));
-            if (curlData->outFlag) {
-                if (curlData->outHandle!=NULL) {
-                    fclose(curlData->outHandle);
-                    curlData->outHandle=NULL;
+            curlSetObj(&curlData->bodyVarName,objv);
+            filesPtr=curlData->files;
+            if ((filesPtr!=NULL)&&(filesPtr->outFlag)) {
+                if (filesPtr->outHandle!=NULL) {
+                    fclose(filesPtr->outHandle);
+                    filesPtr->outHandle=NULL;
                 }
-                curl_easy_setopt(curlHandle,CURLOPT_WRITEDATA,NULL);
-            }
-            curlData->outFlag=0;
-            if (curl_easy_setopt(curlHandle,CURLOPT_WRITEFUNCTION,
-                    curlBodyReader)) {
-                return TCL_ERROR;
-            }
-            if (curl_easy_setopt(curlHandle,CURLOPT_WRITEDATA,curlData)) {
-                return TCL_ERROR;
+                filesPtr->outFlag=0;
             }
+            curlSetWriter(curlData,(curl_write_callback)curlBodyReader,curlData);
             break;
         case 63:
-            Tcl_Free(curlData->progressProc);
-            curlData->progressProc=curlstrdup(Tcl_GetString(objv));
-            if (strcmp(curlData->progressProc,"")) {
+            curlSetObj(&curlGetCallbacks(curlData)->progressProc,objv);
+            if (strcmp(Tcl_GetString(objv),"")) {
                 if (curl_easy_setopt(curlHandle,CURLOPT_PROGRESSFUNCTION,
                         curlProgressCallback)) {
                     return TCL_ERROR;
@@ -1165,45 +1460,40 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
             }
             break;
         case 64:
-            if (curlData->cancelTransVarName) {
-                Tcl_UnlinkVar(curlData->interp,curlData->cancelTransVarName);
-                Tcl_Free(curlData->cancelTransVarName);
+            callbacksPtr=curlGetCallbacks(curlData);
+            if (callbacksPtr->cancelTransVarName) {
+                Tcl_UnlinkVar(curlData->interp,
+                        Tcl_GetString(callbacksPtr->cancelTransVarName));
             }
-            curlData->cancelTransVarName=curlstrdup(Tcl_GetString(objv));
-            Tcl_LinkVar(interp,curlData->cancelTransVarName,
-                    (char *)&(curlData->cancelTrans),TCL_LINK_INT);
+            curlSetObj(&callbacksPtr->cancelTransVarName,objv);
+            Tcl_LinkVar(interp,Tcl_GetString(callbacksPtr->cancelTransVarName),
+                    (char *)&(callbacksPtr->cancelTrans),TCL_LINK_INT);
             break;
         case 65:
-            curlData->writeProc=curlstrdup(Tcl_GetString(objv));
-            if (curlData->outFlag) {
-                if (curlData->outHandle!=NULL) {
-                    fclose(curlData->outHandle);
-                    curlData->outHandle=NULL;
+            curlSetObj(&curlGetCallbacks(curlData)->writeProc,objv);
+            filesPtr=curlData->files;
+            if ((filesPtr!=NULL)&&(filesPtr->outFlag)) {
+                if (filesPtr->outHandle!=NULL) {
+                    fclose(filesPtr->outHandle);
+                    filesPtr->outHandle=NULL;
                 }
-                curl_easy_setopt(curlHandle,CURLOPT_WRITEDATA,NULL);
-	    }
-            curlData->outFlag=0;
-            if (curl_easy_setopt(curlHandle,CURLOPT_WRITEFUNCTION,
-                    curlWriteProcInvoke)) {
-                curl_easy_setopt(curlHandle,CURLOPT_WRITEFUNCTION,NULL);
-                return TCL_ERROR;
-            }
-            if (curl_easy_setopt(curlHandle,CURLOPT_WRITEDATA,curlData)) {
-                curl_easy_setopt(curlHandle,CURLOPT_WRITEFUNCTION,NULL);
-                return TCL_ERROR;
+                filesPtr->outFlag=0;
             }
+            curlSetWriter(curlData,(curl_write_callback)curlWriteProcInvoke,
+                    curlData);
             break;
         case 66:
-            curlData->readProc=curlstrdup(Tcl_GetString(objv));
-            if (curlData->inFlag) {
-                if (curlData->inHandle!=NULL) {
-                    fclose(curlData->inHandle);
-                    curlData->inHandle=NULL;
+            curlSetObj(&curlGetCallbacks(curlData)->readProc,objv);
+            filesPtr=curlData->files;
+            if ((filesPtr!=NULL)&&(filesPtr->inFlag)) {
+                if (filesPtr->inHandle!=NULL) {
+                    fclose(filesPtr->inHandle);
+                    filesPtr->inHandle=NULL;
                 }
                 curl_easy_setopt(curlHandle,CURLOPT_READDATA,NULL);
+                filesPtr->inFlag=0;
             }
-            curlData->inFlag=0;
-            if (strcmp(curlData->readProc,"")) {
+            if (strcmp(Tcl_GetString(objv),"")) {
                 if (curl_easy_setopt(curlHandle,CURLOPT_READFUNCTION,
                         curlReadProcInvoke)) {
                     return TCL_ERROR;
@@ -1283,20 +1573,20 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
             }
             break;
         case 78:
-            if(SetoptsList(interp,&curlData->prequote,objv)) {
+            if(SetoptsList(interp,&curlGetLists(curlData)->prequote,objv)) {
                 curlErrorSetOpt(interp,configTable,tableIndex,"prequote invalid");
                 return TCL_ERROR;
             }
-            if (curl_easy_setopt(curlHandle,CURLOPT_PREQUOTE,curlData->prequote)) {
+            if (curl_easy_setopt(curlHandle,CURLOPT_PREQUOTE,curlData->lists->prequote)) {
                 curlErrorSetOpt(interp,configTable,tableIndex,"prequote invalid");
-                curl_slist_free_all(curlData->prequote);
-                curlData->prequote=NULL;
+                curl_slist_free_all(curlData->lists->prequote);
+                curlData->lists->prequote=NULL;
                 return TCL_ERROR;
             }
             return TCL_OK;
             break;
         case 79:
-            curlData->debugProc=curlstrdup(Tcl_GetString(objv));
+            curlSetObj(&curlGetCallbacks(curlData)->debugProc,objv);
             if (curl_easy_setopt(curlHandle,CURLOPT_DEBUGFUNCTION,
                     curlDebugProcInvoke)) {    
                 return TCL_ERROR;
@@ -1389,14 +1679,14 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
             }
             break;
         case 88:
-            if(SetoptsList(interp,&curlData->http200aliases,objv)) {
+            if(SetoptsList(interp,&curlGetLists(curlData)->http200aliases,objv)) {
                 curlErrorSetOpt(interp,configTable,tableIndex,"http200aliases invalid");
                 return TCL_ERROR;
             }
-            if (curl_easy_setopt(curlHandle,CURLOPT_HTTP200ALIASES,curlData->http200aliases)) {
+            if (curl_easy_setopt(curlHandle,CURLOPT_HTTP200ALIASES,curlData->lists->http200aliases)) {
                 curlErrorSetOpt(interp,configTable,tableIndex,"http200aliases invalid");
-                curl_slist_free_all(curlData->http200aliases);
-                curlData->http200aliases=NULL;
+                curl_slist_free_all(curlData->lists->http200aliases);
+                curlData->lists->http200aliases=NULL;
                 return TCL_ERROR;
             }
             return TCL_OK;
@@ -1414,8 +1704,7 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
             }
             break;
         case 91:
-            Tcl_Free(curlData->command);
-            curlData->command=curlstrdup(Tcl_GetString(objv));
+            curlSetObj(&curlGetCallbacks(curlData)->command,objv);
             break;
         case 92:
             if (Tcl_GetIndexFromObj(interp, objv, httpAuthMethods,
@@ -1572,7 +1861,7 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
             Tcl_DecrRefCount(tmpObjPtr);
             break;
         case 100:
-            if (SetoptSHandle(interp,curlHandle,CURLOPT_SHARE,
+            if (SetoptSHandle(interp,curlData,CURLOPT_SHARE,
                     tableIndex,objv)) {
                 return TCL_ERROR;
             }
@@ -2084,7 +2373,7 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
             if (curl_easy_setopt(curlHandle,CURLOPT_SSH_KEYDATA,curlData)) {
                 return TCL_ERROR;
             }
-            curlData->sshkeycallProc=curlstrdup(Tcl_GetString(objv));
+            curlSetObj(&curlGetCallbacks(curlData)->sshkeycallProc,objv);
             break;
         case 159:
             if (SetoptChar(interp,curlHandle,CURLOPT_MAIL_FROM,
@@ -2093,14 +2382,14 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
             }
             break;
         case 160:
-            if (SetoptsList(interp,&curlData->mailrcpt,objv)) {
+            if (SetoptsList(interp,&curlGetLists(curlData)->mailrcpt,objv)) {
                 curlErrorSetOpt(interp,configTable,tableIndex,"mailrcpt invalid");
                 return TCL_ERROR;
             }
-            if (curl_easy_setopt(curlHandle,CURLOPT_MAIL_RCPT,curlData->mailrcpt)) {
+            if (curl_easy_setopt(curlHandle,CURLOPT_MAIL_RCPT,curlData->lists->mailrcpt)) {
                 curlErrorSetOpt(interp,configTable,tableIndex,"mailrcpt invalid");
-                curl_slist_free_all(curlData->mailrcpt);
-                curlData->mailrcpt=NULL;
+                curl_slist_free_all(curlData->lists->mailrcpt);
+                curlData->lists->mailrcpt=NULL;
                 return TCL_ERROR;
             }
             return TCL_OK;
@@ -2118,8 +2407,8 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
             }
             break;
         case 163:
-            curlData->chunkBgnProc=curlstrdup(Tcl_GetString(objv));
-            if (strcmp(curlData->chunkBgnProc,"")) {
+            curlSetObj(&curlGetWildcard(curlData)->chunkBgnProc,objv);
+            if (strcmp(Tcl_GetString(objv),"")) {
                 if (curl_easy_setopt(curlHandle,CURLOPT_CHUNK_BGN_FUNCTION,
                         curlChunkBgnProcInvoke)) {
                     return TCL_ERROR;
@@ -2133,15 +2422,15 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
             }
             break;
         case 164:
-            curlData->chunkBgnVar=curlstrdup(Tcl_GetString(objv));
-            if (!strcmp(curlData->chunkBgnVar,"")) {
+            if (!strcmp(Tcl_GetString(objv),"")) {
                 curlErrorSetOpt(interp,configTable,tableIndex,"invalid var name");
                 return TCL_ERROR;
             }
+            curlSetObj(&curlGetWildcard(curlData)->chunkBgnVar,objv);
             break;
         case 165:
-            curlData->chunkEndProc=curlstrdup(Tcl_GetString(objv));
-            if (strcmp(curlData->chunkEndProc,"")) {
+            curlSetObj(&curlGetWildcard(curlData)->chunkEndProc,objv);
+            if (strcmp(Tcl_GetString(objv),"")) {
                 if (curl_easy_setopt(curlHandle,CURLOPT_CHUNK_END_FUNCTION,
                         curlChunkEndProcInvoke)) {
                     return TCL_ERROR;
@@ -2152,8 +2441,8 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
             }
             break;
         case 166:
-            curlData->fnmatchProc=curlstrdup(Tcl_GetString(objv));
-            if (strcmp(curlData->fnmatchProc,"")) {
+            curlSetObj(&curlGetWildcard(curlData)->fnmatchProc,objv);
+            if (strcmp(Tcl_GetString(objv),"")) {
                 if (curl_easy_setopt(curlHandle,CURLOPT_FNMATCH_FUNCTION,
                         curlfnmatchProcInvoke)) {
                     return TCL_ERROR;
@@ -2167,14 +2456,14 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
             }
             break;
         case 167:
-            if (SetoptsList(interp,&curlData->resolve,objv)) {
+            if (SetoptsList(interp,&curlGetLists(curlData)->resolve,objv)) {
                 curlErrorSetOpt(interp,configTable,tableIndex,"invalid list");
                 return TCL_ERROR;
             }
-            if (curl_easy_setopt(curlHandle,CURLOPT_RESOLVE,curlData->resolve)) {
+            if (curl_easy_setopt(curlHandle,CURLOPT_RESOLVE,curlData->lists->resolve)) {
                 curlErrorSetOpt(interp,configTable,tableIndex,"resolve list invalid");
-                curl_slist_free_all(curlData->resolve);
-                curlData->resolve=NULL;
+                curl_slist_free_all(curlData->lists->resolve);
+                curlData->lists->resolve=NULL;
                 return TCL_ERROR;
             }
             return TCL_OK;
@@ -2246,14 +2535,14 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
             }
             break;
         case 174:
-            if (SetoptsList(interp,&curlData->telnetoptions,objv)) {
+            if (SetoptsList(interp,&curlGetLists(curlData)->telnetoptions,objv)) {
                 curlErrorSetOpt(interp,configTable,tableIndex,"invalid list");
                 return TCL_ERROR;
             }
-            if (curl_easy_setopt(curlHandle,CURLOPT_TELNETOPTIONS,curlData->telnetoptions)) {
+            if (curl_easy_setopt(curlHandle,CURLOPT_TELNETOPTIONS,curlData->lists->telnetoptions)) {
                 curlErrorSetOpt(interp,configTable,tableIndex,"telnetoptions list invalid");
-                curl_slist_free_all(curlData->telnetoptions);
-                curlData->telnetoptions=NULL;
+                curl_slist_free_all(curlData->lists->telnetoptions);
+                curlData->lists->telnetoptions=NULL;
                 return TCL_ERROR;
             }
             return TCL_OK;
@@ -2268,41 +2557,216 @@ curlSetOpts(Tcl_Interp *interp, struct curlObjData *curlData,
 #else
             return TCL_ERROR;
 #endif
+        case 176:
+#if CURL_AT_LEAST_VERSION(7, 56, 0)
+            if (*Tcl_GetString(objv)=='\0') {
+                mimeDataPtr=NULL;
+            } else {
+                mimeDataPtr=curlMimeGet(interp,objv);
+                if (mimeDataPtr==NULL) {
+                    return TCL_ERROR;
+                }
+            }
+            curl_easy_setopt(curlHandle,CURLOPT_MIMEPOST,NULL);
+            curlMimeSetForm(curlData,mimeDataPtr);
+            break;
+#else
+            return TCL_ERROR;
+#endif
+        case 177:
+            if (curlCacheSetDir(interp,curlData,objv)) {
+                return TCL_ERROR;
+            }
+            break;
+        case 178:
+            if (curlCacheSetMem(interp,curlData,objv)) {
+                return TCL_ERROR;
+            }
+            break;
+        case 179:
+            if (curlRetrySetCount(interp,curlData,objv)) {
+                curlErrorSetOpt(interp,configTable,tableIndex,Tcl_GetString(objv));
+                return TCL_ERROR;
+            }
+            break;
+        case 180:
+            if (curlRetrySetBackoff(interp,curlData,objv)) {
+                curlErrorSetOpt(interp,configTable,tableIndex,Tcl_GetString(objv));
+                return TCL_ERROR;
+            }
+            break;
+        case 181:
+            if (curlRetrySetCodes(interp,curlData,objv)) {
+                curlErrorSetOpt(interp,configTable,tableIndex,Tcl_GetString(objv));
+                return TCL_ERROR;
+            }
+            break;
+        case 182:
+            if (curlResumeSet(interp,curlData,objv)) {
+                return TCL_ERROR;
+            }
+            break;
+        case 183:
+            if (curlDigestSetAlgorithms(interp,curlData,objv)) {
+                return TCL_ERROR;
+            }
+            break;
+        case 184:
+            curlDigestSetVar(interp,curlData,objv);
+            break;
+        case 185:
+            if (curlDigestSetExpected(interp,curlData,objv)) {
+                return TCL_ERROR;
+            }
+            break;
+        case 186:
+        case 187:
+        case 188:
+            if (Tcl_GetBooleanFromObj(interp,objv,&intNumber)!=TCL_OK) {
+                return TCL_ERROR;
+            }
+            i=(tableIndex==186)?ATOMIC_RENAME:(tableIndex==187)?ATOMIC_SYNC:ATOMIC_2XX;
+            if (intNumber) {
+                curlGetFiles(curlData)->atomic|=i;
+            } else if (curlData->files!=NULL) {
+                curlData->files->atomic&=~i;
+            }
+            break;
     }
+    curlSetMethodFlags(curlData,tableIndex,objv);
+    curlSetIdentityFlags(curlData,tableIndex,objv);
     return TCL_OK;
 }
 
 /*
  *----------------------------------------------------------------------
  *
- * SetoptInt --
- *
- *   Sets the curl options that require an int
- *
- * Parameters:
- *   interp: The interpreter we are working with.
- *   curlHandle: and the curl handle
- *   opt: the option to set
- *   tclObj: The Tcl with the value for the option.
+ * curlSetMethodFlags --
  *
- * Results:
- *  0 if all went well.
- *  1 in case of error.
+ *  Keeps track of the options that change the request method, or ask
+ *  for part of the resource, once they have been set.
  *
  *----------------------------------------------------------------------
  */
-int
-SetoptInt(Tcl_Interp *interp,CURL *curlHandle,CURLoption opt,
-        int tableIndex,Tcl_Obj *tclObj) {
-    int        intNumber;
+void
+curlSetMethodFlags(struct curlObjData *curlData,int tableIndex,Tcl_Obj *objv) {
+    int            flag,set=0;
 
-    if (Tcl_GetIntFromObj(interp,tclObj,&intNumber)) {
-        curlErrorSetOpt(interp,configTable,tableIndex,Tcl_GetString(tclObj));
-        return 1;
+    switch(tableIndex) {
+        case 7:   flag=METHOD_NOBODY;     break;
+        case 17:  flag=METHOD_UPLOAD;     break;
+        case 23:  flag=METHOD_PUT;        break;
+        case 30:  flag=METHOD_POST;       break;
+        case 31:  flag=METHOD_POSTFIELDS; break;
+        case 37:  flag=METHOD_HTTPPOST;   break;
+        case 47:  flag=METHOD_CUSTOM;     break;
+        case 176: flag=METHOD_MIMEPOST;   break;
+        case 15:
+        case 27:
+        case 182: flag=METHOD_RANGE;      break;
+        case 29:
+            if ((Tcl_GetBooleanFromObj(NULL,objv,&set)==TCL_OK)&&set) {
+                curlData->methodFlags&=(METHOD_CUSTOM|METHOD_RANGE);
+            }
+            return;
+        default:
+            return;
     }
-    if (curl_easy_setopt(curlHandle,opt,intNumber)) {
-        curlErrorSetOpt(interp,configTable,tableIndex,Tcl_GetString(tclObj));
-        return 1;
+    switch(tableIndex) {
+        case 7:
+        case 17:
+        case 23:
+        case 30:
+            if (Tcl_GetBooleanFromObj(NULL,objv,&set)!=TCL_OK) {
+                set=1;
+            }
+            break;
+        case 47:
+            set=(*Tcl_GetString(objv)!='\0')&&strcmp(Tcl_GetString(objv),"GET");
+            break;
+        case 15:
+            set=(*Tcl_GetString(objv)!='\0')&&strcmp(Tcl_GetString(objv),"0");
+            break;
+        case 182:
+            set=!strcmp(Tcl_GetString(objv),"auto");
+            break;
+        default:
+            set=(*Tcl_GetString(objv)!='\0');
+            break;
+    }
+    if (set) {
+        curlData->methodFlags|=flag;
+    } else {
+        curlData->methodFlags&=~flag;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlSetIdentityFlags --
+ *
+ *  Keeps track of the options with the credentials, cookies or client
+ *  certificate of the request, once they have been set.
+ *
+ *----------------------------------------------------------------------
+ */
+void
+curlSetIdentityFlags(struct curlObjData *curlData,int tableIndex,Tcl_Obj *objv) {
+    static const int  identityOptions[]={IDENTITY_OPTIONS};
+    int               i,set;
+
+    for (i=0;i<(int)(sizeof(identityOptions)/sizeof(int));i++) {
+        if (identityOptions[i]==tableIndex) {
+            break;
+        }
+    }
+    if (i==(int)(sizeof(identityOptions)/sizeof(int))) {
+        return;
+    }
+    if (tableIndex==20) {
+        set=(*Tcl_GetString(objv)!='\0')&&strcmp(Tcl_GetString(objv),"ignored");
+    } else {
+        set=(*Tcl_GetString(objv)!='\0');
+    }
+    if (set) {
+        curlData->identityFlags|=(1<<i);
+    } else {
+        curlData->identityFlags&=~(1<<i);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetoptInt --
+ *
+ *   Sets the curl options that require an int
+ *
+ * Parameters:
+ *   interp: The interpreter we are working with.
+ *   curlHandle: and the curl handle
+ *   opt: the option to set
+ *   tclObj: The Tcl with the value for the option.
+ *
+ * Results:
+ *  0 if all went well.
+ *  1 in case of error.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+SetoptInt(Tcl_Interp *interp,CURL *curlHandle,CURLoption opt,
+        int tableIndex,Tcl_Obj *tclObj) {
+    int        intNumber;
+
+    if (Tcl_GetIntFromObj(interp,tclObj,&intNumber)) {
+        curlErrorSetOpt(interp,configTable,tableIndex,Tcl_GetString(tclObj));
+        return 1;
+    }
+    if (curl_easy_setopt(curlHandle,opt,intNumber)) {
+        curlErrorSetOpt(interp,configTable,tableIndex,Tcl_GetString(tclObj));
+        return 1;
     }
     return 0;
 }
@@ -2457,11 +2921,12 @@ SetoptBlob(Tcl_Interp *interp,CURL *curlHandle,
  * SetoptSHandle --
  *
  *  Set the curl options that require a share handle (there is only
- *  one but you never know.
+ *  one but you never know. The share can be given by the name of its
+ *  command or, for named shares, by the name given to 'curl::shareinit'.
  *
  * Parameters:
  *  interp: The interpreter we are working with.
- *  curlHandle: the curl handle
+ *  curlData: the TclCurl handle, it keeps a reference to the share.
  *  opt: the option to set
  *  tclObj: The Tcl with the value for the option.
  *
@@ -2472,23 +2937,24 @@ SetoptBlob(Tcl_Interp *interp,CURL *curlHandle,
  *----------------------------------------------------------------------
  */
 int
-SetoptSHandle(Tcl_Interp *interp,CURL *curlHandle,
+SetoptSHandle(Tcl_Interp *interp,struct curlObjData *curlData,
         CURLoption opt,int tableIndex,Tcl_Obj *tclObj) {
 
-    char                    *shandleName;
-    Tcl_CmdInfo             *infoPtr=(Tcl_CmdInfo *)Tcl_Alloc(sizeof(Tcl_CmdInfo));
     struct shcurlObjData    *shandleDataPtr;
 
-    shandleName=Tcl_GetString(tclObj);
-    if (0==Tcl_GetCommandInfo(interp,shandleName,infoPtr)) {
+    shandleDataPtr=curlShareGet(interp,tclObj);
+    if (shandleDataPtr==NULL) {
         return 1;
     }
-    shandleDataPtr=(struct shcurlObjData *)(infoPtr->objClientData);
-    Tcl_Free((char *)infoPtr);
-    if (curl_easy_setopt(curlHandle,opt,shandleDataPtr->shandle)) {
-        curlErrorSetOpt(interp,configTable,tableIndex,shandleName);
+    if (curl_easy_setopt(curlData->curl,opt,shandleDataPtr->shandle)) {
+        curlShareRelease(shandleDataPtr);
+        curlErrorSetOpt(interp,configTable,tableIndex,Tcl_GetString(tclObj));
         return 1;
     }
+    if (curlData->share!=NULL) {
+        curlShareRelease(curlData->share);
+    }
+    curlData->share=shandleDataPtr;
     return 0;
 }
 
@@ -2559,6 +3025,136 @@ curlErrorSetOpt(Tcl_Interp *interp,const char **configTable, int option,
     Tcl_SetObjResult(interp,resultPtr);
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlSetWriter, curlSetHeaderWriter --
+ *
+ *  Set the function and the data libcurl gives the body, or the
+ *  headers, of a transfer to, and keep them in the handle.
+ *
+ *----------------------------------------------------------------------
+ */
+void
+curlSetWriter(struct curlObjData *curlData,curl_write_callback writeFunction,
+        void *writeData) {
+
+    curlData->writeFunction=writeFunction;
+    curlData->writeData=writeData;
+    curl_easy_setopt(curlData->curl,CURLOPT_WRITEFUNCTION,writeFunction);
+    curl_easy_setopt(curlData->curl,CURLOPT_WRITEDATA,writeData);
+}
+
+void
+curlSetHeaderWriter(struct curlObjData *curlData,
+        curl_write_callback headerFunction,void *headerData) {
+
+    curlData->headerFunction=headerFunction;
+    curlData->headerData=headerData;
+    curl_easy_setopt(curlData->curl,CURLOPT_HEADERFUNCTION,headerFunction);
+    curl_easy_setopt(curlData->curl,CURLOPT_HEADERDATA,headerData);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlWriteBody, curlWriteHeader --
+ *
+ *  Give data to the function set for the body, or the headers, as
+ *  libcurl would, for when something else stands in between.
+ *
+ * Results:
+ *  What the function returns.
+ *
+ *----------------------------------------------------------------------
+ */
+size_t
+curlWriteBody(struct curlObjData *curlData,char *ptr,size_t length) {
+
+    if (curlData->writeFunction!=NULL) {
+        return curlData->writeFunction(ptr,1,length,curlData->writeData);
+    }
+    return fwrite(ptr,1,length,
+            (curlData->writeData!=NULL)?(FILE *)curlData->writeData:stdout);
+}
+
+size_t
+curlWriteHeader(struct curlObjData *curlData,char *ptr,size_t length) {
+
+    if (curlData->headerFunction!=NULL) {
+        return curlData->headerFunction(ptr,1,length,curlData->headerData);
+    }
+    return length;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlWriteResponse --
+ *
+ *  Gives the handle the headers, line by line, and the body of a
+ *  response that didn't come from a transfer of its own.
+ *
+ * Results:
+ *  0 if the handle took it all.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+curlWriteResponse(struct curlObjData *curlData,char *headers,
+        size_t headersLength,char *body,size_t bodyLength) {
+    char                   *end,*lineEnd;
+    size_t                  length;
+    Tcl_DString             line;
+
+    /*
+     * Like libcurl we hand over one line at a time and NUL terminated,
+     * the header reader relies on it.
+     */
+    Tcl_DStringInit(&line);
+    for (end=headers+headersLength;headers<end;headers=lineEnd) {
+        lineEnd=memchr(headers,'\n',end-headers);
+        lineEnd=(lineEnd==NULL)?end:lineEnd+1;
+        Tcl_DStringSetLength(&line,0);
+        Tcl_DStringAppend(&line,headers,lineEnd-headers);
+        if (curlWriteHeader(curlData,Tcl_DStringValue(&line),lineEnd-headers)
+                !=(size_t)(lineEnd-headers)) {
+            Tcl_DStringFree(&line);
+            return 1;
+        }
+    }
+    Tcl_DStringFree(&line);
+    for (;bodyLength>0;body+=length,bodyLength-=length) {
+        length=(bodyLength>CURL_MAX_WRITE_SIZE)?CURL_MAX_WRITE_SIZE:bodyLength;
+        if (curlWriteBody(curlData,body,length)!=length) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlHeaderFileWriter --
+ *
+ *  Writes the headers of a transfer to the file given with
+ *  '-writeheader'.
+ *
+ * Results:
+ *  The number of bytes actually written.
+ *
+ *----------------------------------------------------------------------
+ */
+size_t
+curlHeaderFileWriter(char *ptr,size_t size,size_t nmemb,void *stream) {
+
+    if (stream==NULL) {
+        return size*nmemb;
+    }
+    return fwrite(ptr,size,nmemb,(FILE *)stream);
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -2612,11 +3208,11 @@ curlHeaderReader(void *ptr,size_t size,size_t nmemb,FILE *curlDataPtr) {
         headerContent[charLength]=0;
         /* There may be multiple 'Set-Cookie' headers, so we use a list */
         if (Tcl_StringCaseMatch(headerName,"Set-Cookie",1)) {
-            Tcl_SetVar2(curlData->interp,curlData->headerVar,headerName,
-                    headerContent,TCL_LIST_ELEMENT|TCL_APPEND_VALUE);
+            Tcl_SetVar2(curlData->interp,Tcl_GetString(curlData->headerVar),
+                    headerName,headerContent,TCL_LIST_ELEMENT|TCL_APPEND_VALUE);
         } else {
-            Tcl_SetVar2(curlData->interp,curlData->headerVar,headerName,
-                    headerContent,0);
+            Tcl_SetVar2(curlData->interp,Tcl_GetString(curlData->headerVar),
+                    headerName,headerContent,0);
         }
         Tcl_Free(headerContent);
         Tcl_Free(headerName);
@@ -2630,7 +3226,7 @@ curlHeaderReader(void *ptr,size_t size,size_t nmemb,FILE *curlDataPtr) {
         strncpy(httpStatus,startPtr,charLength);
         httpStatus[charLength]=0;
 
-        Tcl_SetVar2(curlData->interp,curlData->headerVar,"http",
+        Tcl_SetVar2(curlData->interp,Tcl_GetString(curlData->headerVar),"http",
                 httpStatus,0);
         Tcl_Free(httpStatus);
     }
@@ -2703,15 +3299,13 @@ curlProgressCallback(void *clientData,double dltotal,double dlnow,
     struct curlObjData    *curlData=(struct curlObjData *)clientData;
     Tcl_Obj               *tclProcPtr;
 
-    if (curlData->cancelTransVarName) {
-        if (curlData->cancelTrans) {
-            curlData->cancelTrans=0;
-            return -1;
-        }
+    if (curlData->callbacks->cancelTrans) {
+        curlData->callbacks->cancelTrans=0;
+        return -1;
     }
 
     tclProcPtr = Tcl_NewListObj(0, 0);
-    Tcl_ListObjAppendElement(curlData->interp, tclProcPtr, Tcl_NewStringObj(curlData->progressProc, -1));
+    Tcl_ListObjAppendElement(curlData->interp, tclProcPtr, curlData->callbacks->progressProc);
     Tcl_ListObjAppendElement(curlData->interp, tclProcPtr, Tcl_NewDoubleObj(dltotal));
     Tcl_ListObjAppendElement(curlData->interp, tclProcPtr, Tcl_NewDoubleObj(dlnow));
     Tcl_ListObjAppendElement(curlData->interp, tclProcPtr, Tcl_NewDoubleObj(ultotal));
@@ -2760,15 +3354,14 @@ curlWriteProcInvoke(void *ptr,size_t size,size_t nmemb,FILE *curlDataPtr) {
     Tcl_Obj**           objList;
     int                 i;
 
-    if (curlData->cancelTransVarName) {
-        if (curlData->cancelTrans) {
-            curlData->cancelTrans = 0;
-            return -1;
-        }
+    if (curlData->callbacks->cancelTrans) {
+        curlData->callbacks->cancelTrans=0;
+        return -1;
     }
 
     curl_retcode = realsize;
-    if (Tcl_SplitList(curlData->interp,curlData->writeProc,&argcPtr,&argvPtr) != TCL_OK) {
+    if (Tcl_SplitList(curlData->interp,Tcl_GetString(curlData->callbacks->writeProc),
+            &argcPtr,&argvPtr) != TCL_OK) {
         return -1;
     }
 
@@ -2821,13 +3414,12 @@ curlReadProcInvoke(void *ptr,size_t size,size_t nmemb,FILE *curlDataPtr) {
     unsigned char       *readBytes;
     int                  sizeRead;
 
-    if (curlData->cancelTransVarName) {
-        if (curlData->cancelTrans) {
-            curlData->cancelTrans=0;
-            return CURL_READFUNC_ABORT;
-        }
+    if (curlData->callbacks->cancelTrans) {
+        curlData->callbacks->cancelTrans=0;
+        return CURL_READFUNC_ABORT;
     }
-    tclProcPtr=Tcl_ObjPrintf("%s %d",curlData->readProc,realsize);
+    tclProcPtr=Tcl_ObjPrintf("%s %d",Tcl_GetString(curlData->callbacks->readProc),
+            realsize);
     Tcl_IncrRefCount(tclProcPtr);
     if (Tcl_EvalObjEx(curlData->interp,tclProcPtr,TCL_EVAL_GLOBAL)!=TCL_OK) {
         Tcl_DecrRefCount(tclProcPtr);
@@ -2860,74 +3452,78 @@ curlReadProcInvoke(void *ptr,size_t size,size_t nmemb,FILE *curlDataPtr) {
 long
 curlChunkBgnProcInvoke (const void *transfer_info, void *curlDataPtr, int remains) {
     struct curlObjData             *curlData=(struct curlObjData *)curlDataPtr;
+    struct curlWildcardData        *wildcardPtr=curlData->wildcard;
     Tcl_Obj                        *tclProcPtr;
+    char                           *varName;
     int                             i;
     const struct curl_fileinfo     *fileinfoPtr=(const struct curl_fileinfo *)transfer_info;
 
-    if (curlData->chunkBgnVar==NULL) {
-        curlData->chunkBgnVar=curlstrdup("fileData");
+    if (wildcardPtr->chunkBgnVar==NULL) {
+        curlSetObj(&wildcardPtr->chunkBgnVar,Tcl_NewStringObj("fileData",-1));
     }
+    varName=Tcl_GetString(wildcardPtr->chunkBgnVar);
 
-    Tcl_SetVar2(curlData->interp,curlData->chunkBgnVar,"filename",
+    Tcl_SetVar2(curlData->interp,varName,"filename",
             fileinfoPtr->filename,0);
 
     switch(fileinfoPtr->filetype) {
         case 0:
-            Tcl_SetVar2(curlData->interp,curlData->chunkBgnVar,"filetype",
+            Tcl_SetVar2(curlData->interp,varName,"filetype",
                     "file",0);
             break;
         case 1:
-            Tcl_SetVar2(curlData->interp,curlData->chunkBgnVar,"filetype",
+            Tcl_SetVar2(curlData->interp,varName,"filetype",
                     "directory",0);
             break;
         case 2:
-            Tcl_SetVar2(curlData->interp,curlData->chunkBgnVar,"filetype",
+            Tcl_SetVar2(curlData->interp,varName,"filetype",
                     "symlink",0);
             break;
         case 3:
-            Tcl_SetVar2(curlData->interp,curlData->chunkBgnVar,"filetype",
+            Tcl_SetVar2(curlData->interp,varName,"filetype",
                     "device block",0);
             break;
         case 4:
-            Tcl_SetVar2(curlData->interp,curlData->chunkBgnVar,"filetype",
+            Tcl_SetVar2(curlData->interp,varName,"filetype",
                     "device char",0);
             break;
         case 5:
-            Tcl_SetVar2(curlData->interp,curlData->chunkBgnVar,"filetype",
+            Tcl_SetVar2(curlData->interp,varName,"filetype",
                     "named pipe",0);
             break;
         case 6:
-            Tcl_SetVar2(curlData->interp,curlData->chunkBgnVar,"filetype",
+            Tcl_SetVar2(curlData->interp,varName,"filetype",
                     "socket",0);
             break;
         case 7:
-            Tcl_SetVar2(curlData->interp,curlData->chunkBgnVar,"filetype",
+            Tcl_SetVar2(curlData->interp,varName,"filetype",
                     "door",0);
             break;
         case 8:
-            Tcl_SetVar2(curlData->interp,curlData->chunkBgnVar,"filetype",
+            Tcl_SetVar2(curlData->interp,varName,"filetype",
                     "error",0);
             break;
     }
 
-    Tcl_SetVar2Ex(curlData->interp,curlData->chunkBgnVar,"time",
+    Tcl_SetVar2Ex(curlData->interp,varName,"time",
             Tcl_NewLongObj(fileinfoPtr->time),0);
 
-    Tcl_SetVar2Ex(curlData->interp,curlData->chunkBgnVar,"perm",
+    Tcl_SetVar2Ex(curlData->interp,varName,"perm",
             Tcl_NewIntObj(fileinfoPtr->perm),0);
 
-    Tcl_SetVar2Ex(curlData->interp,curlData->chunkBgnVar,"uid",
+    Tcl_SetVar2Ex(curlData->interp,varName,"uid",
             Tcl_NewIntObj(fileinfoPtr->uid),0);
-    Tcl_SetVar2Ex(curlData->interp,curlData->chunkBgnVar,"gid",
+    Tcl_SetVar2Ex(curlData->interp,varName,"gid",
             Tcl_NewIntObj(fileinfoPtr->gid),0);
-    Tcl_SetVar2Ex(curlData->interp,curlData->chunkBgnVar,"size",
+    Tcl_SetVar2Ex(curlData->interp,varName,"size",
             Tcl_NewLongObj(fileinfoPtr->size),0);
-    Tcl_SetVar2Ex(curlData->interp,curlData->chunkBgnVar,"hardlinks",
+    Tcl_SetVar2Ex(curlData->interp,varName,"hardlinks",
             Tcl_NewIntObj(fileinfoPtr->hardlinks),0);
-    Tcl_SetVar2Ex(curlData->interp,curlData->chunkBgnVar,"flags",
+    Tcl_SetVar2Ex(curlData->interp,varName,"flags",
             Tcl_NewIntObj(fileinfoPtr->flags),0);
 
-    tclProcPtr=Tcl_ObjPrintf("%s %d",curlData->chunkBgnProc,remains);
+    tclProcPtr=Tcl_ObjPrintf("%s %d",Tcl_GetString(wildcardPtr->chunkBgnProc),
+            remains);
     Tcl_IncrRefCount(tclProcPtr);
     if (Tcl_EvalObjEx(curlData->interp,tclProcPtr,TCL_EVAL_GLOBAL)!=TCL_OK) {
         Tcl_DecrRefCount(tclProcPtr);
@@ -2970,7 +3566,7 @@ curlChunkEndProcInvoke (void *curlDataPtr) {
     Tcl_Obj                 *tclProcPtr;
     int                      i;
 
-    tclProcPtr=Tcl_NewStringObj(curlData->chunkEndProc,-1);
+    tclProcPtr=curlData->wildcard->chunkEndProc;
     Tcl_IncrRefCount(tclProcPtr);
     if (Tcl_EvalObjEx(curlData->interp,tclProcPtr,TCL_EVAL_GLOBAL)!=TCL_OK) {
         Tcl_DecrRefCount(tclProcPtr);
@@ -3010,7 +3606,8 @@ curlfnmatchProcInvoke(void *curlDataPtr, const char *pattern, const char *filena
     Tcl_Obj                 *tclProcPtr;
     int                      i;
 
-    tclProcPtr=Tcl_ObjPrintf("%s %s %s",curlData->fnmatchProc,pattern,filename);
+    tclProcPtr=Tcl_ObjPrintf("%s %s %s",
+            Tcl_GetString(curlData->wildcard->fnmatchProc),pattern,filename);
     Tcl_IncrRefCount(tclProcPtr);
     if (Tcl_EvalObjEx(curlData->interp,tclProcPtr,TCL_EVAL_GLOBAL)!=TCL_OK) {
         Tcl_DecrRefCount(tclProcPtr);
@@ -3110,7 +3707,7 @@ curlsshkeycallback(CURL *curl ,const struct curl_khkey *knownkey,
 
     interp=tclcurlDataPtr->interp;
 
-    objv[0]=Tcl_NewStringObj(tclcurlDataPtr->sshkeycallProc,-1);
+    objv[0]=tclcurlDataPtr->callbacks->sshkeycallProc;
     objv[1]=curlsshkeyextract(interp,knownkey);
     objv[2]=curlsshkeyextract(interp,foundkey);
 
@@ -3178,14 +3775,12 @@ curlDebugProcInvoke(CURL *curlHandle, curl_infotype infoType,
     Tcl_Obj             *objv[3];
     int                  i;
 
-    if (curlData->cancelTransVarName) {
-        if (curlData->cancelTrans) {
-            curlData->cancelTrans=0;
-            return -1;
-        }
+    if (curlData->callbacks->cancelTrans) {
+        curlData->callbacks->cancelTrans=0;
+        return -1;
     }
 
-    objv[0]=Tcl_NewStringObj(curlData->debugProc,-1);
+    objv[0]=curlData->callbacks->debugProc;
     objv[1]=Tcl_NewIntObj(infoType);
     objv[2]=Tcl_NewByteArrayObj((const unsigned char *)dataPtr,size);
     for (i=0;i<3;i++) Tcl_IncrRefCount(objv[i]);
@@ -3562,192 +4157,507 @@ curlGetInfo(Tcl_Interp *interp,CURL *curlHandle,int tableIndex) {
             resultObjPtr=Tcl_NewLongObj(longNumber);
             Tcl_SetObjResult(interp,resultObjPtr);
             break;
+        case 37:
+            exitCode=curl_easy_getinfo(curlHandle,CURLINFO_PRIVATE,&charPtr);
+            if (exitCode) {
+                return exitCode;
+            }
+            Tcl_SetObjResult(interp,curlCacheInfo((struct curlObjData *)charPtr));
+            break;
+        case 38:
+            exitCode=curl_easy_getinfo(curlHandle,CURLINFO_PRIVATE,&charPtr);
+            if (exitCode) {
+                return exitCode;
+            }
+            resultObjPtr=Tcl_NewIntObj(curlRetryAttempts((struct curlObjData *)charPtr));
+            Tcl_SetObjResult(interp,resultObjPtr);
+            break;
     }
     return 0;
 }
 
+/*
+ * The info every 'getInfoTable' entry maps to when building a dict, times
+ * and sizes use the 'curl_off_t' variants so we get microseconds and
+ * bytes without going through a double. GETINFO_BUILT means the entry
+ * doesn't map to a single value, and 'curlGetInfo' has to build it,
+ * GETINFO_ASKED that it also isn't in 'getinfo -all', only given when
+ * asked for by name.
+ */
+
+#define GETINFO_BUILT       ((CURLINFO)0)
+#define GETINFO_ASKED       ((CURLINFO)1)
+
+#if CURL_AT_LEAST_VERSION(7, 61, 0)
+#define CURLINFO_TIME(info)  info##_T
+#else
+#define CURLINFO_TIME(info)  info
+#endif
+
+#if CURL_AT_LEAST_VERSION(7, 55, 0)
+#define CURLINFO_SIZE(info)  info##_T
+#else
+#define CURLINFO_SIZE(info)  info
+#endif
+
+static const CURLINFO getInfoDictMap[]={
+    CURLINFO_EFFECTIVE_URL,
+    CURLINFO_RESPONSE_CODE,
+    CURLINFO_RESPONSE_CODE,
+#if CURL_AT_LEAST_VERSION(7, 59, 0)
+    CURLINFO_FILETIME_T,
+#else
+    CURLINFO_FILETIME,
+#endif
+    CURLINFO_TIME(CURLINFO_TOTAL_TIME),
+    CURLINFO_TIME(CURLINFO_NAMELOOKUP_TIME),
+    CURLINFO_TIME(CURLINFO_CONNECT_TIME),
+    CURLINFO_TIME(CURLINFO_PRETRANSFER_TIME),
+    CURLINFO_SIZE(CURLINFO_SIZE_UPLOAD),
+    CURLINFO_SIZE(CURLINFO_SIZE_DOWNLOAD),
+    CURLINFO_SIZE(CURLINFO_SPEED_DOWNLOAD),
+    CURLINFO_SIZE(CURLINFO_SPEED_UPLOAD),
+    CURLINFO_HEADER_SIZE,
+    CURLINFO_REQUEST_SIZE,
+    CURLINFO_SSL_VERIFYRESULT,
+    CURLINFO_SIZE(CURLINFO_CONTENT_LENGTH_DOWNLOAD),
+    CURLINFO_SIZE(CURLINFO_CONTENT_LENGTH_UPLOAD),
+    CURLINFO_TIME(CURLINFO_STARTTRANSFER_TIME),
+    CURLINFO_CONTENT_TYPE,
+    CURLINFO_TIME(CURLINFO_REDIRECT_TIME),
+    CURLINFO_REDIRECT_COUNT,
+    GETINFO_BUILT,              /* httpauthavail  */
+    GETINFO_BUILT,              /* proxyauthavail */
+    CURLINFO_OS_ERRNO,
+    CURLINFO_NUM_CONNECTS,
+    GETINFO_ASKED,              /* sslengines     */
+    CURLINFO_HTTP_CONNECTCODE,
+    GETINFO_ASKED,              /* cookielist     */
+    CURLINFO_FTP_ENTRY_PATH,
+    CURLINFO_REDIRECT_URL,
+    CURLINFO_PRIMARY_IP,
+    CURLINFO_TIME(CURLINFO_APPCONNECT_TIME),
+    GETINFO_ASKED,              /* certinfo       */
+    CURLINFO_CONDITION_UNMET,
+    CURLINFO_PRIMARY_PORT,
+    CURLINFO_LOCAL_IP,
+    CURLINFO_LOCAL_PORT,
+    GETINFO_BUILT,              /* cache          */
+    GETINFO_BUILT               /* attempts       */
+};
+
 /*
  *----------------------------------------------------------------------
  *
- * curlFreeSpace --
- *
- *    Frees the space taken by a curlObjData struct either because we are
- *    deleting the handle or reseting it.
+ * curlGetInfoDictCmd --
  *
- *  Parameter:
- *    interp: Pointer to the interpreter we are using.
- *    curlHandle: the curl handle for which the option is set.
- *    objc and objv: The usual in Tcl.
+ *  Takes care of the 'getinfo -all' and 'getinfo -list names' forms of
+ *  the 'getinfo' command.
  *
  * Results:
- *	A standard Tcl result.
+ *  A standard Tcl result, the dict is left in the interpreter.
  *
  *----------------------------------------------------------------------
  */
-void
-curlFreeSpace(struct curlObjData *curlData) {
+int
+curlGetInfoDictCmd(Tcl_Interp *interp,CURL *curlHandle,int objc,
+        Tcl_Obj *const objv[]) {
 
-    curl_slist_free_all(curlData->headerList);
-    curl_slist_free_all(curlData->quote);
-    curl_slist_free_all(curlData->prequote);
-    curl_slist_free_all(curlData->postquote);
+    int                 modeIndex;
+    int                 count=-1;
+    int                *indices=NULL;
+    Tcl_Obj            *dictPtr;
+    int                 result;
 
-    Tcl_Free(curlData->outFile);
-    Tcl_Free(curlData->inFile);
-    Tcl_Free(curlData->proxy);
-    Tcl_Free(curlData->errorBuffer);
-    Tcl_Free(curlData->errorBufferName);
-    Tcl_Free(curlData->errorBufferKey);
-    Tcl_Free(curlData->stderrFile);
-    Tcl_Free(curlData->randomFile);
-    Tcl_Free(curlData->headerVar);
-    Tcl_Free(curlData->bodyVarName);
-    if (curlData->bodyVar.memory) {
-        Tcl_Free(curlData->bodyVar.memory);
+    if (Tcl_GetIndexFromObj(interp,objv[2],getInfoDictTable,"getinfo option",
+            TCL_EXACT,&modeIndex)==TCL_ERROR) {
+        return TCL_ERROR;
+    }
+    if ((modeIndex==0&&objc!=3)||(modeIndex==1&&objc!=4)) {
+        Tcl_WrongNumArgs(interp,2,objv,modeIndex?"-list names":"-all");
+        return TCL_ERROR;
+    }
+    if (modeIndex==1) {
+        if (curlGetInfoIndices(interp,objv[3],&count,&indices)==TCL_ERROR) {
+            return TCL_ERROR;
+        }
     }
-    Tcl_Free(curlData->progressProc);
-    if (curlData->cancelTransVarName) {
-        Tcl_UnlinkVar(curlData->interp,curlData->cancelTransVarName);
-        Tcl_Free(curlData->cancelTransVarName);
-    }
-    Tcl_Free(curlData->writeProc);
-    Tcl_Free(curlData->readProc);
-    Tcl_Free(curlData->debugProc);
-    curl_slist_free_all(curlData->http200aliases);
-    Tcl_Free(curlData->sshkeycallProc);
-    curl_slist_free_all(curlData->mailrcpt);
-    Tcl_Free(curlData->chunkBgnProc);
-    Tcl_Free(curlData->chunkBgnVar);
-    Tcl_Free(curlData->chunkEndProc);
-    Tcl_Free(curlData->fnmatchProc);
-    curl_slist_free_all(curlData->resolve);
-    curl_slist_free_all(curlData->telnetoptions);
-
-    Tcl_Free(curlData->command);
+    result=curlGetInfoDict(interp,curlHandle,count,indices,&dictPtr);
+    if (indices!=NULL) {
+        Tcl_Free((char *)indices);
+    }
+    if (result==TCL_OK) {
+        Tcl_SetObjResult(interp,dictPtr);
+    }
+    return result;
 }
 
 /*
  *----------------------------------------------------------------------
  *
- * curlDupHandle --
+ * curlGetInfoIndices --
  *
- *  This function is invoked by the 'duphandle' command, it will 
- *  create a duplicate of the given handle.
+ *  Turns a list of 'getinfo' option names into their indices in
+ *  'getInfoTable'.
  *
- * Parameters:
- *  The stantard parameters for Tcl commands
+ * Parameter:
+ *  interp: The interpreter, used to report errors.
+ *  listObj: The list with the names.
+ *  countPtr: Where to store how many names there are.
+ *  indicesPtr: Where to store the indices, they have to be freed with
+ *              Tcl_Free, it is NULL for an empty list.
  *
  * Results:
  *  A standard Tcl result.
  *
- * Side effects:
- *  See the user documentation.
- *
  *----------------------------------------------------------------------
  */
 int
-curlDupHandle(Tcl_Interp *interp, struct curlObjData *curlData,
-        int objc, Tcl_Obj *const objv[]) {
+curlGetInfoIndices(Tcl_Interp *interp,Tcl_Obj *listObj,int *countPtr,
+        int **indicesPtr) {
 
-    CURL                *newCurlHandle;
-    Tcl_Obj             *result;
-    struct curlObjData  *newCurlData;
-    Tcl_Obj             *handleObj;
+    Tcl_Obj           **nameObjs;
+    int                 count, i;
+    int                *indices=NULL;
 
-    newCurlHandle=curl_easy_duphandle(curlData->curl);
-    if (newCurlHandle==NULL) {
-        result=Tcl_NewStringObj("Couldn't create new handle.",-1);
-        Tcl_SetObjResult(interp,result);
+    if (Tcl_ListObjGetElements(interp,listObj,&count,&nameObjs)!=TCL_OK) {
         return TCL_ERROR;
     }
-
-    newCurlData=(struct curlObjData *)Tcl_Alloc(sizeof(struct curlObjData));
-
-    curlCopyCurlData(curlData,newCurlData);
-
-    handleObj=curlCreateObjCmd(interp,newCurlData);
-
-    newCurlData->curl=newCurlHandle;
-
-    Tcl_SetObjResult(interp,handleObj);
-
+    if (count) {
+        indices=(int *)Tcl_Alloc(sizeof(int)*count);
+        for (i=0;i<count;i++) {
+            if (Tcl_GetIndexFromObj(interp,nameObjs[i],getInfoTable,
+                    "getinfo option",TCL_EXACT,&indices[i])==TCL_ERROR) {
+                Tcl_Free((char *)indices);
+                return TCL_ERROR;
+            }
+        }
+    }
+    *countPtr=count;
+    *indicesPtr=indices;
     return TCL_OK;
 }
 
-
 /*
  *----------------------------------------------------------------------
  *
- * curlResetHandle --
+ * curlGetInfoDict --
  *
- *  This function is invoked by the 'reset' command, it reset all the
- *  options in the handle to the state it had when 'init' was invoked.
+ *  Builds a dict with several 'getinfo' values in one go, the keys are
+ *  the names in 'getInfoTable'. Times are returned in microseconds and
+ *  sizes and speeds as integers.
  *
- * Parameters:
- *  The stantard parameters for Tcl commands
+ * Parameter:
+ *  interp: The interpreter, used to report errors.
+ *  curlHandle: The easy handle to query.
+ *  count: How many entries there are in 'indices', if it is negative we
+ *         want every value, except for the lists that take a while to
+ *         build: 'sslengines', 'cookielist' and 'certinfo'.
+ *  indices: The 'getInfoTable' indices to put in the dict.
+ *  dictPtrPtr: Where to store the new dict, with a zero reference count.
  *
  * Results:
- *  A standard Tcl result.
- *
- * Side effects:
- *	See the user documentation.
+ *  A standard Tcl result. Values libcurl doesn't know about are left out
+ *  when getting everything, but they are an error when asked for.
  *
  *----------------------------------------------------------------------
  */
 int
-curlResetHandle(Tcl_Interp *interp, struct curlObjData *curlData)  {
-    struct curlObjData   *tmpPtr=
-                    (struct curlObjData *)Tcl_Alloc(sizeof(struct curlObjData));
-
-    tmpPtr->curl       = curlData->curl;
-    tmpPtr->token      = curlData->token;
-    tmpPtr->shareToken = curlData->shareToken;
-    tmpPtr->interp     = curlData->interp;
-
-    curlFreeSpace(curlData);
-    memset(curlData, 0, sizeof(struct curlObjData));
-
-    curlData->curl       = tmpPtr->curl;
-    curlData->token      = tmpPtr->token;
-    curlData->shareToken = tmpPtr->shareToken;
-    curlData->interp     = tmpPtr->interp;
-
-    curl_easy_reset(curlData->curl);
-
-    Tcl_Free((char *)tmpPtr);
-
+curlGetInfoDict(Tcl_Interp *interp,CURL *curlHandle,int count,
+        const int *indices,Tcl_Obj **dictPtrPtr) {
+
+    Tcl_Obj            *dictPtr;
+    Tcl_Obj            *valuePtr;
+    CURLINFO            info;
+    CURLcode            exitCode;
+    char               *charPtr;
+    long                longNumber;
+    double              doubleNumber;
+    curl_off_t          offNumber;
+    int                 all=(count<0);
+    int                 i, tableIndex;
+
+    if (all) {
+        count=sizeof(getInfoDictMap)/sizeof(getInfoDictMap[0]);
+    }
+    dictPtr=Tcl_NewDictObj();
+    for (i=0;i<count;i++) {
+        tableIndex=all?i:indices[i];
+        info=getInfoDictMap[tableIndex];
+        valuePtr=NULL;
+        switch(info&CURLINFO_TYPEMASK) {
+            case CURLINFO_STRING:
+                exitCode=curl_easy_getinfo(curlHandle,info,&charPtr);
+                if (!exitCode) {
+                    valuePtr=Tcl_NewStringObj(charPtr?charPtr:"",-1);
+                }
+                break;
+            case CURLINFO_LONG:
+                exitCode=curl_easy_getinfo(curlHandle,info,&longNumber);
+                if (!exitCode) {
+                    valuePtr=Tcl_NewLongObj(longNumber);
+                }
+                break;
+            case CURLINFO_DOUBLE:
+                exitCode=curl_easy_getinfo(curlHandle,info,&doubleNumber);
+                if (!exitCode) {
+                    valuePtr=Tcl_NewDoubleObj(doubleNumber);
+                }
+                break;
+            case CURLINFO_OFF_T:
+                exitCode=curl_easy_getinfo(curlHandle,info,&offNumber);
+                if (!exitCode) {
+                    valuePtr=Tcl_NewWideIntObj((Tcl_WideInt)offNumber);
+                }
+                break;
+            default:
+                if (all&&(info==GETINFO_ASKED)) {
+                    continue;
+                }
+                exitCode=curlGetInfo(interp,curlHandle,tableIndex);
+                if (!exitCode) {
+                    valuePtr=Tcl_GetObjResult(interp);
+                    Tcl_IncrRefCount(valuePtr);
+                    Tcl_ResetResult(interp);
+                    Tcl_DictObjPut(interp,dictPtr,
+                            Tcl_NewStringObj(getInfoTable[tableIndex],-1),valuePtr);
+                    Tcl_DecrRefCount(valuePtr);
+                    continue;
+                }
+                break;
+        }
+        if (exitCode) {
+            if (all) {
+                continue;
+            }
+            Tcl_DecrRefCount(dictPtr);
+            Tcl_SetObjResult(interp,Tcl_ObjPrintf("getinfo %s: %s",
+                    getInfoTable[tableIndex],curl_easy_strerror(exitCode)));
+            return TCL_ERROR;
+        }
+        Tcl_DictObjPut(interp,dictPtr,
+                Tcl_NewStringObj(getInfoTable[tableIndex],-1),valuePtr);
+    }
+    *dictPtrPtr=dictPtr;
     return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlFreeSpace --
+ *
+ *    Frees the space taken by a curlObjData struct either because we are
+ *    deleting the handle or reseting it.
+ *
+ *  Parameter:
+ *    interp: Pointer to the interpreter we are using.
+ *    curlHandle: the curl handle for which the option is set.
+ *    objc and objv: The usual in Tcl.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+void
+curlFreeSpace(struct curlObjData *curlData) {
+    struct curlFileData        *filesPtr=curlData->files;
+    struct curlCallbackData    *callbacksPtr=curlData->callbacks;
+    struct curlWildcardData    *wildcardPtr=curlData->wildcard;
+    struct curlListData        *listsPtr=curlData->lists;
+
+    curl_slist_free_all(curlData->headerList);
 
+    Tcl_Free(curlData->errorBuffer);
+    curlSetObj(&curlData->errorBufferName,NULL);
+    curlSetObj(&curlData->headerVar,NULL);
+    curlSetObj(&curlData->bodyVarName,NULL);
+    if (curlData->bodyVar.memory) {
+        Tcl_Free(curlData->bodyVar.memory);
+    }
+    curlMimeFree(curlData);
+    if (curlData->share!=NULL) {
+        curlShareRelease(curlData->share);
+    }
+    curlSetObj(&curlData->urlName,NULL);
+    curlCacheFree(curlData);
+    curlRetryFree(curlData);
+    curlResumeFree(curlData);
+    curlDigestFree(curlData);
+#if CURL_AT_LEAST_VERSION(7, 63, 0)
+    if (curlData->url!=NULL) {
+        curlUrlRelease(curlData->url);
+    }
+#endif
+
+    if (filesPtr!=NULL) {
+        curlSetObj(&filesPtr->outFile,NULL);
+        curlSetObj(&filesPtr->inFile,NULL);
+        curlSetObj(&filesPtr->headerFile,NULL);
+        curlSetObj(&filesPtr->stderrFile,NULL);
+        curlSetObj(&filesPtr->atomicFile,NULL);
+        Tcl_Free((char *)filesPtr);
+    }
+    if (callbacksPtr!=NULL) {
+        if (callbacksPtr->cancelTransVarName) {
+            Tcl_UnlinkVar(curlData->interp,
+                    Tcl_GetString(callbacksPtr->cancelTransVarName));
+            curlSetObj(&callbacksPtr->cancelTransVarName,NULL);
+        }
+        curlSetObj(&callbacksPtr->progressProc,NULL);
+        curlSetObj(&callbacksPtr->writeProc,NULL);
+        curlSetObj(&callbacksPtr->readProc,NULL);
+        curlSetObj(&callbacksPtr->debugProc,NULL);
+        curlSetObj(&callbacksPtr->command,NULL);
+        curlSetObj(&callbacksPtr->sshkeycallProc,NULL);
+        Tcl_Free((char *)callbacksPtr);
+    }
+    if (wildcardPtr!=NULL) {
+        curlSetObj(&wildcardPtr->chunkBgnProc,NULL);
+        curlSetObj(&wildcardPtr->chunkBgnVar,NULL);
+        curlSetObj(&wildcardPtr->chunkEndProc,NULL);
+        curlSetObj(&wildcardPtr->fnmatchProc,NULL);
+        Tcl_Free((char *)wildcardPtr);
+    }
+    if (listsPtr!=NULL) {
+        curl_slist_free_all(listsPtr->quote);
+        curl_slist_free_all(listsPtr->prequote);
+        curl_slist_free_all(listsPtr->postquote);
+        curl_slist_free_all(listsPtr->http200aliases);
+        curl_slist_free_all(listsPtr->mailrcpt);
+        curl_slist_free_all(listsPtr->resolve);
+        curl_slist_free_all(listsPtr->telnetoptions);
+        Tcl_Free((char *)listsPtr);
+    }
 }
 
 /*
  *----------------------------------------------------------------------
  *
- * curlVersion --
+ * curlGetFiles, curlGetCallbacks, curlGetWildcard, curlGetLists --
  *
- *	This procedure is invoked to process the "curl::init" Tcl command.
- *	See the user documentation for details on what it does.
+ *  Return a block of the handle, allocating it the first time an
+ *  option needs it.
+ *
+ *----------------------------------------------------------------------
+ */
+
+struct curlFileData *
+curlGetFiles(struct curlObjData *curlData) {
+    if (curlData->files==NULL) {
+        curlData->files=(struct curlFileData *)Tcl_Alloc(sizeof(struct curlFileData));
+        memset(curlData->files,0,sizeof(struct curlFileData));
+    }
+    return curlData->files;
+}
+
+struct curlCallbackData *
+curlGetCallbacks(struct curlObjData *curlData) {
+    if (curlData->callbacks==NULL) {
+        curlData->callbacks=(struct curlCallbackData *)
+                Tcl_Alloc(sizeof(struct curlCallbackData));
+        memset(curlData->callbacks,0,sizeof(struct curlCallbackData));
+    }
+    return curlData->callbacks;
+}
+
+struct curlWildcardData *
+curlGetWildcard(struct curlObjData *curlData) {
+    if (curlData->wildcard==NULL) {
+        curlData->wildcard=(struct curlWildcardData *)
+                Tcl_Alloc(sizeof(struct curlWildcardData));
+        memset(curlData->wildcard,0,sizeof(struct curlWildcardData));
+    }
+    return curlData->wildcard;
+}
+
+struct curlListData *
+curlGetLists(struct curlObjData *curlData) {
+    if (curlData->lists==NULL) {
+        curlData->lists=(struct curlListData *)Tcl_Alloc(sizeof(struct curlListData));
+        memset(curlData->lists,0,sizeof(struct curlListData));
+    }
+    return curlData->lists;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlSetObj --
+ *
+ *  Keeps 'objPtr', which may be NULL, in '*objPtrPtr' letting go of
+ *  the object that was there.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlSetObj(Tcl_Obj **objPtrPtr,Tcl_Obj *objPtr) {
+    if (objPtr!=NULL) {
+        Tcl_IncrRefCount(objPtr);
+    }
+    if (*objPtrPtr!=NULL) {
+        Tcl_DecrRefCount(*objPtrPtr);
+    }
+    *objPtrPtr=objPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlDupHandle --
+ *
+ *  This function is invoked by the 'duphandle' command, it will 
+ *  create a duplicate of the given handle.
  *
  * Parameters:
  *  The stantard parameters for Tcl commands
  *
  * Results:
- *	A standard Tcl result.
+ *  A standard Tcl result.
  *
  * Side effects:
- *	See the user documentation.
+ *  See the user documentation.
  *
  *----------------------------------------------------------------------
  */
 int
-curlVersion (ClientData clientData, Tcl_Interp *interp,
-    int objc,Tcl_Obj *const objv[]) {
+curlDupHandle(Tcl_Interp *interp, struct curlObjData *curlData,
+        int objc, Tcl_Obj *const objv[]) {
 
-    Tcl_Obj     *versionPtr;
+    CURL                *newCurlHandle;
+    Tcl_Obj             *result;
+    struct curlObjData  *newCurlData;
+    Tcl_Obj             *handleObj;
 
-    versionPtr=Tcl_ObjPrintf("TclCurl Version %s (%s)",TclCurlVersion,
-                                                 curl_version());
-    Tcl_SetObjResult(interp,versionPtr);
+    newCurlHandle=curlDupEasyHandle(curlData);
+    if (newCurlHandle==NULL) {
+        result=Tcl_NewStringObj("Couldn't create new handle.",-1);
+        Tcl_SetObjResult(interp,result);
+        return TCL_ERROR;
+    }
+
+    newCurlData=(struct curlObjData *)Tcl_Alloc(sizeof(struct curlObjData));
+
+    curlCopyCurlData(curlData,newCurlData);
+
+    handleObj=curlCreateObjCmd(interp,newCurlData);
+
+    newCurlData->curl=newCurlHandle;
+    curl_easy_setopt(newCurlHandle,CURLOPT_PRIVATE,newCurlData);
+    if (newCurlData->errorBuffer!=NULL) {
+        curl_easy_setopt(newCurlHandle,CURLOPT_ERRORBUFFER,newCurlData->errorBuffer);
+    }
+    /* The copy has to get its own body and headers. */
+    if (newCurlData->writeData==(void *)curlData) {
+        curlSetWriter(newCurlData,newCurlData->writeFunction,newCurlData);
+    }
+    if (newCurlData->headerData==(void *)curlData) {
+        curlSetHeaderWriter(newCurlData,newCurlData->headerFunction,newCurlData);
+    }
+
+    Tcl_SetObjResult(interp,handleObj);
 
     return TCL_OK;
 }
@@ -3755,11 +4665,46 @@ curlVersion (ClientData clientData, Tcl_Interp *interp,
 /*
  *----------------------------------------------------------------------
  *
- * curlEscape --
+ * curlDupEasyHandle --
  *
- *  This function is invoked to process the "curl::escape" Tcl command.
- *  See the user documentation for details on what it does.
+ *  Duplicates the libcurl handle of a TclCurl handle.
+ *
+ * Parameter:
+ *  curlData: The TclCurl handle.
+ *
+ * Results:
+ *  The new libcurl handle, NULL if it couldn't be created.
+ *
+ *----------------------------------------------------------------------
+ */
+
+CURL *
+curlDupEasyHandle(struct curlObjData *curlData) {
+    CURL                *newCurlHandle;
+
+#if CURL_AT_LEAST_VERSION(7, 56, 0)
+    /* libcurl would copy our form, callback data included, and free
+     * that data twice, the new handle builds its own form. */
+    if (curlData->mime!=NULL) {
+        curl_easy_setopt(curlData->curl,CURLOPT_MIMEPOST,NULL);
+    }
+#endif
+    newCurlHandle=curl_easy_duphandle(curlData->curl);
+#if CURL_AT_LEAST_VERSION(7, 56, 0)
+    if (curlData->mime!=NULL) {
+        curl_easy_setopt(curlData->curl,CURLOPT_MIMEPOST,curlData->mime);
+    }
+#endif
+    return newCurlHandle;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlResetHandle --
  *
+ *  This function is invoked by the 'reset' command, it reset all the
+ *  options in the handle to the state it had when 'init' was invoked.
  *
  * Parameters:
  *  The stantard parameters for Tcl commands
@@ -3768,67 +4713,64 @@ curlVersion (ClientData clientData, Tcl_Interp *interp,
  *  A standard Tcl result.
  *
  * Side effects:
- *  See the user documentation.
+ *	See the user documentation.
  *
  *----------------------------------------------------------------------
  */
 int
-curlEscape(ClientData clientData, Tcl_Interp *interp,
-    int objc,Tcl_Obj *const objv[]) {
+curlResetHandle(Tcl_Interp *interp, struct curlObjData *curlData)  {
+    struct curlObjData   *tmpPtr=
+                    (struct curlObjData *)Tcl_Alloc(sizeof(struct curlObjData));
 
-    Tcl_Obj        *resultObj;
-    char           *escapedStr;
+    tmpPtr->curl       = curlData->curl;
+    tmpPtr->token      = curlData->token;
+    tmpPtr->interp     = curlData->interp;
 
-    escapedStr=curl_easy_escape(NULL,Tcl_GetString(objv[1]),0);
+    /* The handle has to let go of its share before we do. */
+    curl_easy_reset(curlData->curl);
 
-    if (!escapedStr) {
-        resultObj=Tcl_NewStringObj("curl::escape bad parameter",-1);
-        Tcl_SetObjResult(interp,resultObj);
-        return TCL_ERROR;
-    }
-    resultObj=Tcl_NewStringObj(escapedStr,-1);
-    Tcl_SetObjResult(interp,resultObj);
-    curl_free(escapedStr);
+    curlFreeSpace(curlData);
+    memset(curlData, 0, sizeof(struct curlObjData));
+
+    curlData->curl       = tmpPtr->curl;
+    curlData->token      = tmpPtr->token;
+    curlData->interp     = tmpPtr->interp;
+    curl_easy_setopt(curlData->curl,CURLOPT_PRIVATE,curlData);
+
+    Tcl_Free((char *)tmpPtr);
 
     return TCL_OK;
+
 }
 
 /*
  *----------------------------------------------------------------------
  *
- * curlUnescape --
- *
- *  This function is invoked to process the "curl::Unescape" Tcl command.
- *  See the user documentation for details on what it does.
+ * curlVersion --
  *
+ *	This procedure is invoked to process the "curl::init" Tcl command.
+ *	See the user documentation for details on what it does.
  *
  * Parameters:
  *  The stantard parameters for Tcl commands
  *
  * Results:
- *  A standard Tcl result.
+ *	A standard Tcl result.
  *
  * Side effects:
- *  See the user documentation.
+ *	See the user documentation.
  *
  *----------------------------------------------------------------------
  */
 int
-curlUnescape(ClientData clientData, Tcl_Interp *interp,
+curlVersion (ClientData clientData, Tcl_Interp *interp,
     int objc,Tcl_Obj *const objv[]) {
 
-    Tcl_Obj        *resultObj;
-    char           *unescapedStr;
+    Tcl_Obj     *versionPtr;
 
-    unescapedStr=curl_easy_unescape(NULL,Tcl_GetString(objv[1]),0,NULL);
-    if (!unescapedStr) {
-        resultObj=Tcl_NewStringObj("curl::unescape bad parameter",-1);
-        Tcl_SetObjResult(interp,resultObj);
-        return TCL_ERROR;
-    }
-    resultObj=Tcl_NewStringObj(unescapedStr,-1);
-    Tcl_SetObjResult(interp,resultObj);
-    curl_free(unescapedStr);
+    versionPtr=Tcl_ObjPrintf("TclCurl Version %s (%s)",TclCurlVersion,
+                                                 curl_version());
+    Tcl_SetObjResult(interp,versionPtr);
 
     return TCL_OK;
 }
@@ -3987,6 +4929,8 @@ curlVersionInfo (ClientData clientData, Tcl_Interp *interp,
 int
 curlCopyCurlData (struct curlObjData *curlDataOld,
                       struct curlObjData *curlDataNew) {
+    struct curlCallbackData    *callbacksPtr;
+    struct curlWildcardData    *wildcardPtr;
 
     /* This takes care of the int and long values */
     memcpy(curlDataNew, curlDataOld, sizeof(struct curlObjData));
@@ -3994,55 +4938,90 @@ curlCopyCurlData (struct curlObjData *curlDataOld,
     /* Some of the data doesn't get copied */
 
     curlDataNew->headerList=NULL;
-    curlDataNew->quote=NULL;
-    curlDataNew->prequote=NULL;
-    curlDataNew->postquote=NULL;
     curlDataNew->formArray=NULL;
     curlDataNew->postListFirst=NULL;
     curlDataNew->postListLast=NULL;
-    curlDataNew->formArray=NULL;
-    curlDataNew->outHandle=NULL;
-    curlDataNew->outFlag=0;
-    curlDataNew->inHandle=NULL;
-    curlDataNew->inFlag=0;
-    curlDataNew->headerHandle=NULL;
-    curlDataNew->headerFlag=0;
-    curlDataNew->stderrHandle=NULL;
-    curlDataNew->stderrFlag=0;
-    curlDataNew->http200aliases=NULL;
-    curlDataNew->mailrcpt=NULL;
-    curlDataNew->resolve=NULL;
-    curlDataNew->telnetoptions=NULL;
-
-    /* The strings need a special treatment. */
-
-    curlDataNew->outFile=curlstrdup(curlDataOld->outFile);
-    curlDataNew->inFile=curlstrdup(curlDataOld->inFile);
-    curlDataNew->proxy=curlstrdup(curlDataOld->proxy);
-    curlDataNew->errorBuffer=curlstrdup(curlDataOld->errorBuffer);
-    curlDataNew->errorBufferName=curlstrdup(curlDataOld->errorBufferName);
-    curlDataNew->errorBufferKey=curlstrdup(curlDataOld->errorBufferKey);
-    curlDataNew->headerFile=curlstrdup(curlDataOld->headerFile);
-    curlDataNew->stderrFile=curlstrdup(curlDataOld->stderrFile);
-    curlDataNew->randomFile=curlstrdup(curlDataOld->randomFile);
-    curlDataNew->headerVar=curlstrdup(curlDataOld->headerVar);
-    curlDataNew->bodyVarName=curlstrdup(curlDataOld->bodyVarName);
-    curlDataNew->progressProc=curlstrdup(curlDataOld->progressProc);
-    curlDataNew->cancelTransVarName=curlstrdup(curlDataOld->cancelTransVarName);
-    curlDataNew->writeProc=curlstrdup(curlDataOld->writeProc);
-    curlDataNew->readProc=curlstrdup(curlDataOld->readProc);
-    curlDataNew->debugProc=curlstrdup(curlDataOld->debugProc);
-    curlDataNew->command=curlstrdup(curlDataOld->command);
-    curlDataNew->sshkeycallProc=curlstrdup(curlDataOld->sshkeycallProc);
-    curlDataNew->chunkBgnProc=curlstrdup(curlDataOld->chunkBgnProc);
-    curlDataNew->chunkBgnVar=curlstrdup(curlDataOld->chunkBgnVar);
-    curlDataNew->chunkEndProc=curlstrdup(curlDataOld->chunkEndProc);
-    curlDataNew->fnmatchProc=curlstrdup(curlDataOld->fnmatchProc);
-
-    curlDataNew->bodyVar.memory=(char *)Tcl_Alloc(curlDataOld->bodyVar.size);
-    memcpy(curlDataNew->bodyVar.memory,curlDataOld->bodyVar.memory
-            ,curlDataOld->bodyVar.size);
-    curlDataNew->bodyVar.size=curlDataOld->bodyVar.size;
+    curlDataNew->lists=NULL;
+#if CURL_AT_LEAST_VERSION(7, 56, 0)
+    curlDataNew->mime=NULL;
+    if (curlDataNew->mimePost!=NULL) {
+        curlMimeHold(curlDataNew->mimePost);
+    }
+#endif
+    if (curlDataNew->share!=NULL) {
+        curlShareHold(curlDataNew->share);
+    }
+#if CURL_AT_LEAST_VERSION(7, 63, 0)
+    if (curlDataNew->url!=NULL) {
+        curlUrlHold(curlDataNew->url);
+    }
+#endif
+
+    /* The names are shared, the blocks with them are not. */
+
+    if (curlDataOld->errorBuffer!=NULL) {
+        curlDataNew->errorBuffer=Tcl_Alloc(CURL_ERROR_SIZE);
+        curlDataNew->errorBuffer[0]=0;
+        Tcl_IncrRefCount(curlDataNew->errorBufferName);
+    }
+    if (curlDataNew->headerVar!=NULL) {
+        Tcl_IncrRefCount(curlDataNew->headerVar);
+    }
+    if (curlDataNew->bodyVarName!=NULL) {
+        Tcl_IncrRefCount(curlDataNew->bodyVarName);
+    }
+    if (curlDataNew->urlName!=NULL) {
+        Tcl_IncrRefCount(curlDataNew->urlName);
+    }
+    curlCacheCopy(curlDataOld,curlDataNew);
+    curlRetryCopy(curlDataOld,curlDataNew);
+    curlResumeCopy(curlDataOld,curlDataNew);
+    curlDigestCopy(curlDataOld,curlDataNew);
+    if (curlDataOld->files!=NULL) {
+        curlDataNew->files=NULL;
+        curlGetFiles(curlDataNew);
+        curlSetObj(&curlDataNew->files->outFile,curlDataOld->files->outFile);
+        curlSetObj(&curlDataNew->files->inFile,curlDataOld->files->inFile);
+        curlSetObj(&curlDataNew->files->headerFile,curlDataOld->files->headerFile);
+        curlSetObj(&curlDataNew->files->stderrFile,curlDataOld->files->stderrFile);
+        curlDataNew->files->outFlag=curlDataOld->files->outFlag;
+        curlDataNew->files->inFlag=curlDataOld->files->inFlag;
+        curlDataNew->files->headerFlag=curlDataOld->files->headerFlag;
+        curlDataNew->files->stderrFlag=curlDataOld->files->stderrFlag;
+        curlDataNew->files->atomic=curlDataOld->files->atomic;
+    }
+    if (curlDataOld->callbacks!=NULL) {
+        callbacksPtr=curlDataOld->callbacks;
+        curlDataNew->callbacks=NULL;
+        curlGetCallbacks(curlDataNew);
+        memcpy(curlDataNew->callbacks,callbacksPtr,sizeof(struct curlCallbackData));
+        curlDataNew->callbacks->cancelTrans=0;
+        callbacksPtr=curlDataNew->callbacks;
+        if (callbacksPtr->progressProc) Tcl_IncrRefCount(callbacksPtr->progressProc);
+        if (callbacksPtr->cancelTransVarName) Tcl_IncrRefCount(callbacksPtr->cancelTransVarName);
+        if (callbacksPtr->writeProc) Tcl_IncrRefCount(callbacksPtr->writeProc);
+        if (callbacksPtr->readProc) Tcl_IncrRefCount(callbacksPtr->readProc);
+        if (callbacksPtr->debugProc) Tcl_IncrRefCount(callbacksPtr->debugProc);
+        if (callbacksPtr->command) Tcl_IncrRefCount(callbacksPtr->command);
+        if (callbacksPtr->sshkeycallProc) Tcl_IncrRefCount(callbacksPtr->sshkeycallProc);
+    }
+    if (curlDataOld->wildcard!=NULL) {
+        curlDataNew->wildcard=NULL;
+        wildcardPtr=curlGetWildcard(curlDataNew);
+        curlSetObj(&wildcardPtr->chunkBgnProc,curlDataOld->wildcard->chunkBgnProc);
+        curlSetObj(&wildcardPtr->chunkBgnVar,curlDataOld->wildcard->chunkBgnVar);
+        curlSetObj(&wildcardPtr->chunkEndProc,curlDataOld->wildcard->chunkEndProc);
+        curlSetObj(&wildcardPtr->fnmatchProc,curlDataOld->wildcard->fnmatchProc);
+    }
+
+    curlDataNew->bodyVar.memory=NULL;
+    curlDataNew->bodyVar.size=0;
+    if (curlDataOld->bodyVar.memory!=NULL) {
+        curlDataNew->bodyVar.memory=(char *)Tcl_Alloc(curlDataOld->bodyVar.size);
+        memcpy(curlDataNew->bodyVar.memory,curlDataOld->bodyVar.memory
+                ,curlDataOld->bodyVar.size);
+        curlDataNew->bodyVar.size=curlDataOld->bodyVar.size;
+    }
 
     return TCL_OK;
 }
@@ -4066,36 +5045,59 @@ curlCopyCurlData (struct curlObjData *curlDataOld,
  */
 int
 curlOpenFiles(Tcl_Interp *interp,struct curlObjData *curlData) {
+    struct curlFileData        *filesPtr=curlData->files;
+    Tcl_Time                    now;
+    char                        suffix[96];
 
-    if (curlData->outFlag) {
-        if (curlOpenFile(interp,curlData->outFile,&(curlData->outHandle),1,
+    if (filesPtr==NULL) {
+        return 0;
+    }
+    if (filesPtr->outFlag&&(filesPtr->atomic&ATOMIC_RENAME)) {
+        /* The file is only replaced by curlCommitFiles, other handles
+         * may be writing to the same one at the same time. */
+        Tcl_GetTime(&now);
+        sprintf(suffix,".%d.%p.%ld%06ld.part",(int)getpid(),(void *)curlData,
+                (long)now.sec,(long)now.usec);
+        curlSetObj(&filesPtr->atomicFile,Tcl_ObjPrintf("%s%s",
+                Tcl_GetString(filesPtr->outFile),suffix));
+        if (curlOpenFile(interp,Tcl_GetString(filesPtr->atomicFile),
+                &(filesPtr->outHandle),1,curlData->transferText)) {
+            curlSetObj(&filesPtr->atomicFile,NULL);
+            return 1;
+        }
+        curlSetWriter(curlData,NULL,filesPtr->outHandle);
+    } else if (filesPtr->outFlag) {
+        if (curlOpenFile(interp,Tcl_GetString(filesPtr->outFile),
+                &(filesPtr->outHandle),curlResumeAuto(curlData)?2:1,
                 curlData->transferText)) {
             return 1;
         }
-        curl_easy_setopt(curlData->curl,CURLOPT_WRITEDATA,curlData->outHandle);
+        curlSetWriter(curlData,NULL,filesPtr->outHandle);
     }
-    if (curlData->inFlag) {
-        if (curlOpenFile(interp,curlData->inFile,&(curlData->inHandle),0,
-                curlData->transferText)) {
+    if (filesPtr->inFlag) {
+        if (curlOpenFile(interp,Tcl_GetString(filesPtr->inFile),
+                &(filesPtr->inHandle),0,curlData->transferText)) {
             return 1;
         }
-        curl_easy_setopt(curlData->curl,CURLOPT_READDATA,curlData->inHandle);
+        curl_easy_setopt(curlData->curl,CURLOPT_READDATA,filesPtr->inHandle);
         if (curlData->anyAuthFlag) {
             curl_easy_setopt(curlData->curl, CURLOPT_SEEKFUNCTION, (curl_seek_callback)curlseek);
-            curl_easy_setopt(curlData->curl, CURLOPT_SEEKDATA, curlData->inHandle);
+            curl_easy_setopt(curlData->curl, CURLOPT_SEEKDATA, filesPtr->inHandle);
         }
     }
-    if (curlData->headerFlag) {
-        if (curlOpenFile(interp,curlData->headerFile,&(curlData->headerHandle),1,1)) {
+    if (filesPtr->headerFlag) {
+        if (curlOpenFile(interp,Tcl_GetString(filesPtr->headerFile),
+                &(filesPtr->headerHandle),1,1)) {
             return 1;
         }
-        curl_easy_setopt(curlData->curl,CURLOPT_HEADERDATA,curlData->headerHandle);
+        curlSetHeaderWriter(curlData,curlHeaderFileWriter,filesPtr->headerHandle);
     }
-    if (curlData->stderrFlag) {
-        if (curlOpenFile(interp,curlData->stderrFile,&(curlData->stderrHandle),1,1)) {
+    if (filesPtr->stderrFlag) {
+        if (curlOpenFile(interp,Tcl_GetString(filesPtr->stderrFile),
+                &(filesPtr->stderrHandle),1,1)) {
             return 1;
         }
-        curl_easy_setopt(curlData->curl,CURLOPT_STDERR,curlData->stderrHandle);
+        curl_easy_setopt(curlData->curl,CURLOPT_STDERR,filesPtr->stderrHandle);
     }
     return 0;
 }
@@ -4113,22 +5115,99 @@ curlOpenFiles(Tcl_Interp *interp,struct curlObjData *curlData) {
  */
 void
 curlCloseFiles(struct curlObjData *curlData) {
-    if (curlData->outHandle!=NULL) {
-        fclose(curlData->outHandle);
-        curlData->outHandle=NULL;
+    struct curlFileData        *filesPtr=curlData->files;
+
+    if (filesPtr==NULL) {
+        return;
+    }
+    if (filesPtr->outHandle!=NULL) {
+        fclose(filesPtr->outHandle);
+        filesPtr->outHandle=NULL;
+    }
+    if (filesPtr->inHandle!=NULL) {
+        fclose(filesPtr->inHandle);
+        filesPtr->inHandle=NULL;
+    }
+    if (filesPtr->headerHandle!=NULL) {
+        fclose(filesPtr->headerHandle);
+        filesPtr->headerHandle=NULL;
+    }
+    if (filesPtr->stderrHandle!=NULL) {
+        fclose(filesPtr->stderrHandle);
+        filesPtr->stderrHandle=NULL;
+    }
+    if (filesPtr->atomicFile!=NULL) {
+        /* The transfer never got to curlCommitFiles. */
+        Tcl_FSDeleteFile(filesPtr->atomicFile);
+        curlSetObj(&filesPtr->atomicFile,NULL);
+    }
+}
+
+/*----------------------------------------------------------------------
+ *
+ * curlCommitFiles --
+ *
+ *  Called when a transfer with '-atomic' is done, after the last
+ *  attempt. If it went well, and with '-atomic2xx' got a 2xx response,
+ *  the file it was written to is renamed to the one of '-file', once
+ *  flushed to the disk with '-atomicsync'. Otherwise it is removed and
+ *  the file of '-file' is left as it was.
+ *
+ * Parameters:
+ *	curlData: The pointer to the struct with the transfer data.
+ *	exitCode: The exit code of the transfer.
+ *
+ * Results:
+ *  The exit code of the transfer, CURLE_WRITE_ERROR if the file could
+ *  not be written or renamed.
+ *
+ *----------------------------------------------------------------------
+ */
+CURLcode
+curlCommitFiles(struct curlObjData *curlData,CURLcode exitCode) {
+    struct curlFileData        *filesPtr=curlData->files;
+    long                        responseCode=0;
+    int                         replace;
+
+    if ((filesPtr==NULL)||(filesPtr->atomicFile==NULL)) {
+        return exitCode;
     }
-    if (curlData->inHandle!=NULL) {
-        fclose(curlData->inHandle);
-        curlData->inHandle=NULL;
+    replace=(exitCode==CURLE_OK);
+    if (replace&&(filesPtr->atomic&ATOMIC_2XX)) {
+        curl_easy_getinfo(curlData->curl,CURLINFO_RESPONSE_CODE,&responseCode);
+        /* Only HTTP has response codes to go by. */
+        replace=(responseCode==0)||((responseCode>=200)&&(responseCode<300));
+    }
+    if (filesPtr->outHandle!=NULL) {
+        if (replace&&(fflush(filesPtr->outHandle)!=0)) {
+            exitCode=CURLE_WRITE_ERROR;
+            replace=0;
+        }
+        if (replace&&(filesPtr->atomic&ATOMIC_SYNC)) {
+#ifdef _WIN32
+            if (_commit(_fileno(filesPtr->outHandle))!=0) {
+#else
+            if (fsync(fileno(filesPtr->outHandle))!=0) {
+#endif
+                exitCode=CURLE_WRITE_ERROR;
+                replace=0;
+            }
+        }
+        if ((fclose(filesPtr->outHandle)!=0)&&replace) {
+            exitCode=CURLE_WRITE_ERROR;
+            replace=0;
+        }
+        filesPtr->outHandle=NULL;
     }
-    if (curlData->headerHandle!=NULL) {
-        fclose(curlData->headerHandle);
-        curlData->headerHandle=NULL;
+    if (replace&&(Tcl_FSRenameFile(filesPtr->atomicFile,filesPtr->outFile)!=TCL_OK)) {
+        exitCode=CURLE_WRITE_ERROR;
+        replace=0;
     }
-    if (curlData->stderrHandle!=NULL) {
-        fclose(curlData->stderrHandle);
-        curlData->stderrHandle=NULL;
+    if (!replace) {
+        Tcl_FSDeleteFile(filesPtr->atomicFile);
     }
+    curlSetObj(&filesPtr->atomicFile,NULL);
+    return exitCode;
 }
 
 /*----------------------------------------------------------------------
@@ -4140,7 +5219,7 @@ curlCloseFiles(struct curlObjData *curlData) {
  * Parameter:
  *  fileName: name of the file.
  *  handle: the handle for the file
- *  writing: '0' if reading, '1' if writing.
+ *  writing: '0' if reading, '1' if writing, '2' if appending.
  *  text:    '0' if binary, '1' if text.
  *
  * Results:
@@ -4164,6 +5243,12 @@ curlOpenFile(Tcl_Interp *interp,char *fileName, FILE **handle, int writing, int
         *handle=_tfopen(nativeFile, text==1 ? _T("w") : _T("wb"));
 #else
         *handle=fopen(fileName, text==1 ? "w" : "wb");
+#endif
+    } else if (writing==2) {
+#ifdef _WIN32
+        *handle=_tfopen(nativeFile, text==1 ? _T("a") : _T("ab"));
+#else
+        *handle=fopen(fileName, text==1 ? "a" : "ab");
 #endif
     } else {
 #ifdef _WIN32
@@ -4222,6 +5307,10 @@ int
 curlSetPostData(Tcl_Interp *interp,struct curlObjData *curlDataPtr) {
     Tcl_Obj        *errorMsgObjPtr;
 
+    if (curlMimeSetPost(interp,curlDataPtr)) {
+        return TCL_ERROR;
+    }
+
     if (curlDataPtr->postListFirst!=NULL) {
         if (curl_easy_setopt(curlDataPtr->curl,CURLOPT_HTTPPOST,curlDataPtr->postListFirst)) {
             curl_formfree(curlDataPtr->postListFirst);
@@ -4316,7 +5405,7 @@ void
 curlSetBodyVarName(Tcl_Interp *interp,struct curlObjData *curlDataPtr) {
     Tcl_Obj    *bodyVarNameObjPtr, *bodyVarObjPtr;
 
-    bodyVarNameObjPtr=Tcl_NewStringObj(curlDataPtr->bodyVarName,-1);
+    bodyVarNameObjPtr=curlDataPtr->bodyVarName;
     bodyVarObjPtr=Tcl_NewByteArrayObj((unsigned char *)curlDataPtr->bodyVar.memory,
             curlDataPtr->bodyVar.size);
 
@@ -4359,7 +5448,8 @@ char
  * curlCreateShareObjCmd --
  *
  *  Looks for the first free share handle (scurl1, scurl2,...) and
- *  creates a Tcl command for it.
+ *  creates a Tcl command for it, the command holds a reference to
+ *  the share.
  *
  * Results:
  *  A string with the name of the handle, don't forget to free it.
@@ -4374,19 +5464,17 @@ curlCreateShareObjCmd (Tcl_Interp *interp,struct shcurlObjData  *shcurlData) {
     char                shandleName[32];
     int                 i;
     Tcl_CmdInfo         info;
-    Tcl_Command         cmdToken;
 
     /* We try with scurl1, if it already exists with scurl2...*/
     for (i=1;;i++) {
         snprintf(shandleName,sizeof(shandleName),"scurl%d",i);
         if (!Tcl_GetCommandInfo(interp,shandleName,&info)) {
-            cmdToken=Tcl_CreateObjCommand(interp,shandleName,curlShareObjCmd,
+            Tcl_CreateObjCommand(interp,shandleName,curlShareObjCmd,
                                 (ClientData)shcurlData,
                                 (Tcl_CmdDeleteProc *)curlCleanUpShareCmd);
             break;
         }
     }
-    shcurlData->token=cmdToken;
 
     return Tcl_NewStringObj(shandleName,-1);
 }
@@ -4416,35 +5504,171 @@ curlShareInitObjCmd (ClientData clientData, Tcl_Interp *interp,
     CURL                  *shcurlHandle;
     struct shcurlObjData  *shcurlData;
     Tcl_Obj               *shandleObj;
+    Tcl_HashEntry         *entryPtr=NULL;
+    char                  *name=NULL;
+    int                    tableIndex,newEntry;
 
-    shcurlData=(struct shcurlObjData *)Tcl_Alloc(sizeof(struct shcurlObjData));
-    if (shcurlData==NULL) {
-        resultPtr=Tcl_NewStringObj("Couldn't allocate memory",-1);
-        Tcl_SetObjResult(interp,resultPtr);
+    if ((objc!=1)&&(objc!=3)) {
+        Tcl_WrongNumArgs(interp,1,objv,"?-name name?");
         return TCL_ERROR;
     }
+    if (objc==3) {
+        if (Tcl_GetIndexFromObj(interp,objv[1],shareInitTable,"option",
+                TCL_EXACT,&tableIndex)==TCL_ERROR) {
+            return TCL_ERROR;
+        }
+        name=Tcl_GetString(objv[2]);
+    }
 
+    /* The mutex is kept while the share is created, so two threads
+     * asking for the same name get the same share. */
+    if (name!=NULL) {
+        Tcl_MutexLock(&shareLock);
+        if (!sharesInitialized) {
+            Tcl_InitHashTable(&sharesByName,TCL_STRING_KEYS);
+            sharesInitialized=1;
+        }
+        entryPtr=Tcl_CreateHashEntry(&sharesByName,name,&newEntry);
+        if (!newEntry) {
+            shcurlData=(struct shcurlObjData *)Tcl_GetHashValue(entryPtr);
+            shcurlData->refCount++;
+            Tcl_MutexUnlock(&shareLock);
+            Tcl_SetObjResult(interp,curlCreateShareObjCmd(interp,shcurlData));
+            return TCL_OK;
+        }
+    }
+
+    shcurlData=(struct shcurlObjData *)Tcl_Alloc(sizeof(struct shcurlObjData));
     memset(shcurlData, 0, sizeof(struct shcurlObjData));
 
     shcurlHandle=curl_share_init();
     if (shcurlHandle==NULL) {
+        if (entryPtr!=NULL) {
+            Tcl_DeleteHashEntry(entryPtr);
+            Tcl_MutexUnlock(&shareLock);
+        }
+        Tcl_Free((char *)shcurlData);
         resultPtr=Tcl_NewStringObj("Couldn't create share handle",-1);
         Tcl_SetObjResult(interp,resultPtr);
         return TCL_ERROR;
     }
 
-    shandleObj=curlCreateShareObjCmd(interp,shcurlData);
-
     shcurlData->shandle=shcurlHandle;
+    shcurlData->refCount=1;
+
+#ifdef TCL_THREADS
+    curl_share_setopt(shcurlHandle, CURLSHOPT_LOCKFUNC,   curlShareLockFunc);
+    curl_share_setopt(shcurlHandle, CURLSHOPT_UNLOCKFUNC, curlShareUnLockFunc);
+    curl_share_setopt(shcurlHandle, CURLSHOPT_USERDATA,   shcurlData);
+#endif
 
+    if (entryPtr!=NULL) {
+        shcurlData->name=curlstrdup(name);
+        Tcl_SetHashValue(entryPtr,shcurlData);
+        Tcl_MutexUnlock(&shareLock);
+    }
+
+    shandleObj=curlCreateShareObjCmd(interp,shcurlData);
     Tcl_SetObjResult(interp,shandleObj);
 
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlShareGet --
+ *
+ *  Finds a share handle from the name of its command in 'interp' or,
+ *  failing that, from the name it was given in 'curl::shareinit'.
+ *
+ * Results:
+ *  The share, with a reference the caller has to let go of with
+ *  curlShareRelease, NULL if there is no such share, with an error
+ *  message in the interpreter.
+ *
+ *----------------------------------------------------------------------
+ */
+
+struct shcurlObjData *
+curlShareGet(Tcl_Interp *interp,Tcl_Obj *nameObj) {
+    Tcl_CmdInfo              info;
+    Tcl_HashEntry           *entryPtr;
+    struct shcurlObjData    *shcurlData=NULL;
+    char                    *name=Tcl_GetString(nameObj);
+
+    if (Tcl_GetCommandInfo(interp,name,&info)
+            &&(info.objProc==curlShareObjCmd)) {
+        shcurlData=(struct shcurlObjData *)info.objClientData;
+        curlShareHold(shcurlData);
+        return shcurlData;
+    }
+
+    Tcl_MutexLock(&shareLock);
+    if (sharesInitialized) {
+        entryPtr=Tcl_FindHashEntry(&sharesByName,name);
+        if (entryPtr!=NULL) {
+            shcurlData=(struct shcurlObjData *)Tcl_GetHashValue(entryPtr);
+            shcurlData->refCount++;
+        }
+    }
+    Tcl_MutexUnlock(&shareLock);
+
+    if (shcurlData==NULL) {
+        Tcl_SetObjResult(interp,Tcl_ObjPrintf(
+                "\"%s\" is not a share handle",name));
+    }
+    return shcurlData;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlShareHold, curlShareRelease --
+ *
+ *  Keep track of the commands and easy handles using a share, it is
+ *  cleaned up when the last of them lets go. The easy handle has to
+ *  stop using the share before letting go.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlShareHold(struct shcurlObjData *shcurlData) {
+    Tcl_MutexLock(&shareLock);
+    shcurlData->refCount++;
+    Tcl_MutexUnlock(&shareLock);
+}
+
+void
+curlShareRelease(struct shcurlObjData *shcurlData) {
+    Tcl_HashEntry            *entryPtr;
 #ifdef TCL_THREADS
-    curl_share_setopt(shcurlHandle, CURLSHOPT_LOCKFUNC, curlShareLockFunc);
-    curl_share_setopt(shcurlHandle, CURLSHOPT_LOCKFUNC, curlShareUnLockFunc);
+    int                       i;
 #endif
 
-    return TCL_OK;
+    Tcl_MutexLock(&shareLock);
+    if (--shcurlData->refCount>0) {
+        Tcl_MutexUnlock(&shareLock);
+        return;
+    }
+    if (shcurlData->name!=NULL) {
+        entryPtr=Tcl_FindHashEntry(&sharesByName,shcurlData->name);
+        if (entryPtr!=NULL) {
+            Tcl_DeleteHashEntry(entryPtr);
+        }
+    }
+    Tcl_MutexUnlock(&shareLock);
+
+    curl_share_cleanup(shcurlData->shandle);
+#ifdef TCL_THREADS
+    for (i=0;i<CURL_LOCK_DATA_LAST;i++) {
+        Tcl_ConditionFinalize(&shcurlData->locks[i].cond);
+        Tcl_MutexFinalize(&shcurlData->locks[i].mutex);
+    }
+#endif
+    Tcl_Free(shcurlData->name);
+    Tcl_Free((char *)shcurlData);
 }
 
 #ifdef TCL_THREADS
@@ -4454,7 +5678,9 @@ curlShareInitObjCmd (ClientData clientData, Tcl_Interp *interp,
  * curlShareLockFunc --
  *
  *  This will be the function invoked by libcurl when it wants to lock
- *  some data for the share interface.
+ *  some data for the share interface. Every share handle has its own
+ *  reader/writer lock for each kind of data, so transfers using
+ *  different share handles, or different data, never block each other.
  *
  * Side effects:
  *  See the user documentation.
@@ -4466,23 +5692,31 @@ void
 curlShareLockFunc (CURL *handle, curl_lock_data data, curl_lock_access access
         , void *userptr) {
 
-    switch(data) {
-        case CURL_LOCK_DATA_COOKIE:
-            Tcl_MutexLock(&cookieLock);
-            break;
-        case CURL_LOCK_DATA_DNS:
-            Tcl_MutexLock(&dnsLock);
-            break;
-        case CURL_LOCK_DATA_SSL_SESSION:
-            Tcl_MutexLock(&sslLock);
-            break;
-        case CURL_LOCK_DATA_CONNECT:
-            Tcl_MutexLock(&connectLock);
-            break;
-        default:
-            /* Prevent useless compile warnings */
-            break;
+    struct shcurlObjData     *shcurlData=(struct shcurlObjData *)userptr;
+    struct shcurlLock        *lockPtr;
+
+    if ((shcurlData==NULL)||(data<0)||(data>=CURL_LOCK_DATA_LAST)) {
+        return;
     }
+    lockPtr=&shcurlData->locks[data];
+
+    Tcl_MutexLock(&lockPtr->mutex);
+    if (access==CURL_LOCK_ACCESS_SHARED) {
+        /* Readers only have to wait for a writer, but they let waiting
+         * writers go first so those don't starve. */
+        while (lockPtr->writer||lockPtr->writersWaiting) {
+            Tcl_ConditionWait(&lockPtr->cond,&lockPtr->mutex,NULL);
+        }
+        lockPtr->readers++;
+    } else {
+        lockPtr->writersWaiting++;
+        while (lockPtr->writer||lockPtr->readers) {
+            Tcl_ConditionWait(&lockPtr->cond,&lockPtr->mutex,NULL);
+        }
+        lockPtr->writersWaiting--;
+        lockPtr->writer=1;
+    }
+    Tcl_MutexUnlock(&lockPtr->mutex);
 }
 
 /*
@@ -4501,22 +5735,23 @@ curlShareLockFunc (CURL *handle, curl_lock_data data, curl_lock_access access
 void
 curlShareUnLockFunc(CURL *handle, curl_lock_data data, void *userptr) {
 
-    switch(data) {
-        case CURL_LOCK_DATA_COOKIE:
-            Tcl_MutexUnlock(&cookieLock);
-            break;
-        case CURL_LOCK_DATA_DNS:
-            Tcl_MutexUnlock(&dnsLock);
-            break;
-        case CURL_LOCK_DATA_SSL_SESSION:
-            Tcl_MutexUnlock(&sslLock);
-            break;
-        case CURL_LOCK_DATA_CONNECT:
-            Tcl_MutexUnlock(&connectLock);
-            break;
-        default:
-            break;
+    struct shcurlObjData     *shcurlData=(struct shcurlObjData *)userptr;
+    struct shcurlLock        *lockPtr;
+
+    if ((shcurlData==NULL)||(data<0)||(data>=CURL_LOCK_DATA_LAST)) {
+        return;
     }
+    lockPtr=&shcurlData->locks[data];
+
+    Tcl_MutexLock(&lockPtr->mutex);
+    if (lockPtr->writer) {
+        lockPtr->writer=0;
+    } else if (lockPtr->readers>0) {
+        lockPtr->readers--;
+    }
+    /* Wakes up every waiting thread, they recheck their own condition. */
+    Tcl_ConditionNotify(&lockPtr->cond);
+    Tcl_MutexUnlock(&lockPtr->mutex);
 }
 
 #endif
@@ -4545,6 +5780,7 @@ curlShareObjCmd (ClientData clientData, Tcl_Interp *interp,
     CURLSH                   *shcurlHandle=shcurlData->shandle;
     int                       tableIndex, dataIndex;
     int                       dataToLock=0;
+    CURLSHcode                shErrorCode;
 
     if (objc<2) {
         Tcl_WrongNumArgs(interp,1,objv,"option arg ?arg?");
@@ -4573,11 +5809,38 @@ curlShareObjCmd (ClientData clientData, Tcl_Interp *interp,
                 case 1:
                     dataToLock=CURL_LOCK_DATA_DNS;
                     break;
+                case 2:
+                    dataToLock=CURL_LOCK_DATA_SSL_SESSION;
+                    break;
+                case 3:
+#if CURL_AT_LEAST_VERSION(7, 57, 0)
+                    dataToLock=CURL_LOCK_DATA_CONNECT;
+                    break;
+#else
+                    Tcl_SetObjResult(interp,Tcl_NewStringObj(
+                            "sharing connect needs libcurl 7.57.0",-1));
+                    return TCL_ERROR;
+#endif
+                case 4:
+#if CURL_AT_LEAST_VERSION(7, 61, 0)
+                    dataToLock=CURL_LOCK_DATA_PSL;
+                    break;
+#else
+                    Tcl_SetObjResult(interp,Tcl_NewStringObj(
+                            "sharing psl needs libcurl 7.61.0",-1));
+                    return TCL_ERROR;
+#endif
             }
             if (tableIndex==0) {
-                curl_share_setopt(shcurlHandle, CURLSHOPT_SHARE,   dataToLock);
+                shErrorCode=curl_share_setopt(shcurlHandle, CURLSHOPT_SHARE,   dataToLock);
             } else {
-                curl_share_setopt(shcurlHandle, CURLSHOPT_UNSHARE, dataToLock);
+                shErrorCode=curl_share_setopt(shcurlHandle, CURLSHOPT_UNSHARE, dataToLock);
+            }
+            if (shErrorCode!=CURLSHE_OK) {
+                Tcl_SetObjResult(interp,Tcl_ObjPrintf("%s %s: %s",
+                        shareCmd[tableIndex],lockData[dataIndex],
+                        curl_share_strerror(shErrorCode)));
+                return TCL_ERROR;
             }
             break;
         case 2:
@@ -4585,7 +5848,8 @@ curlShareObjCmd (ClientData clientData, Tcl_Interp *interp,
                 Tcl_WrongNumArgs(interp,2,objv,"");
                 return TCL_ERROR;
             }
-            Tcl_DeleteCommandFromToken(interp,shcurlData->token);
+            Tcl_DeleteCommandFromToken(interp,
+                    Tcl_GetCommandFromObj(interp,objv[0]));
             break;
     }
     return TCL_OK;
@@ -4602,17 +5866,15 @@ curlShareObjCmd (ClientData clientData, Tcl_Interp *interp,
  *   A standard Tcl result.
  *
  * Side effects:
- *   Cleans the curl share handle and frees the memory.
+ *   Lets go of the share, it is cleaned up if nothing else uses it.
  *
  *----------------------------------------------------------------------
  */
 int
 curlCleanUpShareCmd(ClientData clientData) {
     struct shcurlObjData     *shcurlData=(struct shcurlObjData *)clientData;
-    CURLSH                   *shcurlHandle=shcurlData->shandle;
 
-    curl_share_cleanup(shcurlHandle);
-    Tcl_Free((char *)shcurlData);
+    curlShareRelease(shcurlData);
 
     return TCL_OK;
 }
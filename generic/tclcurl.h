@@ -65,64 +65,216 @@ struct formArrayStruct {
     struct formArrayStruct  *next;
 };
 
-struct curlObjData {
-    CURL                   *curl;
-    Tcl_Command             token;
-    Tcl_Command             shareToken;
-    Tcl_Interp             *interp;
-    struct curl_slist      *headerList;
-    struct curl_slist      *quote;
-    struct curl_slist      *prequote;
-    struct curl_slist      *postquote;
-    struct curl_httppost   *postListFirst;
-    struct curl_httppost   *postListLast;
-    struct formArrayStruct *formArray;
-    char                   *outFile;
+/*
+ * The files a handle reads from or writes to, allocated the first time
+ * one of the options for them is used.
+ */
+struct curlFileData {
+    Tcl_Obj                *outFile;
     FILE                   *outHandle;
     int                     outFlag;
-    char                   *inFile;
+    Tcl_Obj                *inFile;
     FILE                   *inHandle;
     int                     inFlag;
-    char                   *proxy;
-    int                     transferText;
-    char                   *errorBuffer;
-    char                   *errorBufferName;
-    char                   *errorBufferKey;
-    char                   *headerFile;
+    Tcl_Obj                *headerFile;
     FILE                   *headerHandle;
     int                     headerFlag;
-    char                   *stderrFile;
+    Tcl_Obj                *stderrFile;
     FILE                   *stderrHandle;
     int                     stderrFlag;
-    char                   *randomFile;
-    char                   *headerVar;
-    char                   *bodyVarName;
-    struct MemoryStruct     bodyVar;
-    char                   *progressProc;
-    char                   *cancelTransVarName;
+    int                     atomic;
+    Tcl_Obj                *atomicFile;
+};
+
+/*
+ * With '-atomic' the body goes to 'atomicFile', next to '-file', which is
+ * renamed over it when the transfer is done, '-atomicsync' and
+ * '-atomic2xx' add to it.
+ */
+#define ATOMIC_RENAME       (1<<0)
+#define ATOMIC_SYNC         (1<<1)
+#define ATOMIC_2XX          (1<<2)
+
+/*
+ * The Tcl procedures invoked during a transfer, and the variable to
+ * cancel it.
+ */
+struct curlCallbackData {
+    Tcl_Obj                *progressProc;
+    Tcl_Obj                *cancelTransVarName;
     int                     cancelTrans;
-    char                   *writeProc;
-    char                   *readProc;
-    char                   *debugProc;
+    Tcl_Obj                *writeProc;
+    Tcl_Obj                *readProc;
+    Tcl_Obj                *debugProc;
+    Tcl_Obj                *command;
+    Tcl_Obj                *sshkeycallProc;
+};
+
+/*
+ * For FTP wildcard downloads.
+ */
+struct curlWildcardData {
+    Tcl_Obj                *chunkBgnProc;
+    Tcl_Obj                *chunkBgnVar;
+    Tcl_Obj                *chunkEndProc;
+    Tcl_Obj                *fnmatchProc;
+};
+
+/*
+ * The lists only some protocols use.
+ */
+struct curlListData {
+    struct curl_slist      *quote;
+    struct curl_slist      *prequote;
+    struct curl_slist      *postquote;
     struct curl_slist      *http200aliases;
-    char                   *command;
-    int                     anyAuthFlag;
-    char                   *sshkeycallProc;
     struct curl_slist      *mailrcpt;
-    char                   *chunkBgnProc;
-    char                   *chunkBgnVar;
-    char                   *chunkEndProc;
-    char                   *fnmatchProc;
     struct curl_slist      *resolve;
     struct curl_slist      *telnetoptions;
 };
 
+#if CURL_AT_LEAST_VERSION(7, 63, 0)
+/*
+ * A parsed URL, the internal representation of the objects 'curl::url'
+ * returns, easy handles using it for '-url' keep a reference too.
+ */
+struct curlUrlData {
+    CURLU                  *handle;
+    int                     refCount;
+};
+#endif
+
+/*
+ * The options that make a request something other than a GET of the
+ * whole resource, the caches and coalescing only deal with those.
+ */
+#define METHOD_NOBODY       (1<<0)
+#define METHOD_UPLOAD       (1<<1)
+#define METHOD_PUT          (1<<2)
+#define METHOD_POST         (1<<3)
+#define METHOD_POSTFIELDS   (1<<4)
+#define METHOD_HTTPPOST     (1<<5)
+#define METHOD_CUSTOM       (1<<6)
+#define METHOD_MIMEPOST     (1<<7)
+#define METHOD_RANGE        (1<<8)
+
+/*
+ * The options that tell who is asking, in 'identityFlags' every one set
+ * has the bit of its place in 'identityOptions'. Coalescing leaves
+ * handles with any of them alone, the caches those with anything but
+ * the user agent, which comes first.
+ */
+#define IDENTITY_OPTIONS    3,20,25,26,34,35,38,68,73,98,116,147,148,149,150,168,169
+#define IDENTITY_USERAGENT  (1<<0)
+
+struct curlCacheData;
+struct curlRetryData;
+struct curlResumeData;
+struct curlDigestData;
+
+/*
+ * A TclCurl handle, what most handles need is here, the rest is in
+ * blocks that are only allocated when an option needs them.
+ *
+ * The functions and data the body and the headers are given to are kept
+ * here too, so a transfer can be run through a cache, which passes them
+ * on after having a look at them.
+ */
+struct curlObjData {
+    CURL                     *curl;
+    Tcl_Command               token;
+    struct shcurlObjData     *share;
+    Tcl_Interp               *interp;
+    struct curl_slist        *headerList;
+    struct curl_httppost     *postListFirst;
+    struct curl_httppost     *postListLast;
+    struct formArrayStruct   *formArray;
+    int                       transferText;
+    int                       anyAuthFlag;
+    int                       performing;
+    int                       deleted;
+    char                     *errorBuffer;
+    Tcl_Obj                  *errorBufferName;
+    Tcl_Obj                  *headerVar;
+    Tcl_Obj                  *bodyVarName;
+    struct MemoryStruct       bodyVar;
+    struct curlFileData      *files;
+    struct curlCallbackData  *callbacks;
+    struct curlWildcardData  *wildcard;
+    struct curlListData      *lists;
+    Tcl_Obj                  *urlName;
+    int                       methodFlags;
+    int                       identityFlags;
+    curl_write_callback       writeFunction;
+    void                     *writeData;
+    curl_write_callback       headerFunction;
+    void                     *headerData;
+    struct curlCacheData     *cache;
+    struct curlRetryData     *retry;
+    struct curlResumeData    *resume;
+    struct curlDigestData    *digest;
+#if CURL_AT_LEAST_VERSION(7, 63, 0)
+    struct curlUrlData       *url;
+#endif
+#if CURL_AT_LEAST_VERSION(7, 56, 0)
+    struct curlMimeObjData   *mimePost;
+    curl_mime                *mime;
+    int                       mimeGeneration;
+#endif
+};
+
+
+/*
+ * A transfer done by 'perform -eventloop', through a multi handle whose
+ * sockets and timeouts are watched by Tcl's event loop.
+ */
+struct curlEventLoop {
+    CURLM                  *multi;
+    Tcl_TimerToken          timer;
+    struct curlEventSocket *sockets;
+    int                     done;
+    CURLcode                result;
+};
+
+struct curlEventSocket {
+    struct curlEventLoop   *loopPtr;
+    curl_socket_t           fd;
+    struct curlEventSocket *next;
+};
+
+#ifdef TCL_THREADS
+/*
+ * Reader/writer lock protecting one kind of data (cookies, dns, ...)
+ * in a share handle, libcurl asks for shared access when it only
+ * needs to read the data.
+ */
+struct shcurlLock {
+    Tcl_Mutex             mutex;
+    Tcl_Condition         cond;
+    int                   readers;
+    int                   writer;
+    int                   writersWaiting;
+};
+#endif
+
+/*
+ * A share handle, it belongs to the process: the commands for it in any
+ * interpreter and the easy handles using it hold a reference. Named ones
+ * are also in a table, so any thread can find them by their name.
+ */
 struct shcurlObjData {
-    Tcl_Command           token;
     CURLSH               *shandle;
+    char                 *name;
+    int                   refCount;
+#ifdef TCL_THREADS
+    struct shcurlLock     locks[CURL_LOCK_DATA_LAST];
+#endif
 };
 
-#ifndef multi_h
+#if !defined(multi_h) && !defined(stats_h) && !defined(mime_h) && !defined(executor_h) \
+        && !defined(meminfo_h) && !defined(escape_h) \
+        && !defined(url_h) && !defined(cache_h) && !defined(retry_h) \
+        && !defined(resume_h) && !defined(digest_h)
 
 const static char *commandTable[] = {
     "setopt",
@@ -137,6 +289,10 @@ const static char *commandTable[] = {
     (char *) NULL
 };
 
+const static char *performTable[] = {
+    "-eventloop", (char *) NULL
+};
+
 const static char *optionTable[] = {
     "CURLOPT_URL",           "CURLOPT_FILE",            "CURLOPT_READDATA",
     "CURLOPT_USERAGENT",     "CURLOPT_REFERER",         "CURLOPT_VERBOSE",
@@ -267,7 +423,11 @@ const static char *configTable[] = {
     "-fnmatchproc",       "-resolve",            "-tlsauthusername",
     "-tlsauthpassword",   "-tlsauthtype",        "-transferencoding",
     "-gssapidelegation",  "-noproxy",            "-telnetoptions",
-    "-cainfoblob",
+    "-cainfoblob",        "-mimepost",           "-cachedir",
+    "-memcache",          "-retry",              "-retrybackoff",
+    "-retryon",           "-resume",             "-digest",
+    "-digestvar",         "-expectdigest",       "-atomic",
+    "-atomicsync",        "-atomic2xx",
     (char *) NULL
 };
 
@@ -290,9 +450,14 @@ const static char    *getInfoTable[]={
     "ftpentrypath",   "redirecturl",    "primaryip",
     "appconnecttime", "certinfo",       "conditionunmet",
     "primaryport",    "localip",        "localport",
+    "cache",          "attempts",
     (char *)NULL
 };
 
+const static char    *getInfoDictTable[]={
+    "-all", "-list", (char *)NULL
+};
+
 const static char   *curlFormTable[]={
     "name",  "contents", "file", "contenttype", "contentheader", "filename",
     "bufferName", "buffer", "filecontent", (char *)NULL
@@ -342,8 +507,12 @@ const static char *shareCmd[] = {
     "share", "unshare", "cleanup", (char *)NULL
 };
 
+const static char *shareInitTable[] = {
+    "-name", (char *)NULL
+};
+
 const static char *lockData[] = {
-    "cookies", "dns", (char *)NULL
+    "cookies", "dns", "ssl", "connect", "psl", (char *)NULL
 };
 
 const static char *ftpsslauth[] = {
@@ -400,8 +569,18 @@ int curlInitObjCmd(ClientData clientData, Tcl_Interp *interp, int objc,
 int curlObjCmd(ClientData clientData, Tcl_Interp *interp, int objc,
         Tcl_Obj *const objv[]);
 int curlDeleteCmd(ClientData clientData);
-
-int curlPerform(Tcl_Interp *interp,CURL *curlHandle,struct curlObjData *curlData);
+void curlFreeHandle(char *dataPtr);
+
+int curlPerform(Tcl_Interp *interp,CURL *curlHandle,struct curlObjData *curlData,
+        int eventLoop);
+CURLcode curlPerformEventLoop(struct curlObjData *curlData);
+int curlEventLoopSocket(CURL *easy,curl_socket_t s,int what,void *userp,void *socketp);
+int curlEventLoopTimer(CURLM *multi,long timeoutMs,void *userp);
+void curlEventLoopTimeout(ClientData clientData);
+void curlEventLoopAction(struct curlEventLoop *loopPtr,curl_socket_t s,int mask);
+#ifndef _WIN32
+void curlEventLoopReady(ClientData clientData,int mask);
+#endif
 
 int curlSetOptsTransfer(Tcl_Interp *interp, struct curlObjData *curlData,int objc,
         Tcl_Obj *const objv[]);
@@ -428,17 +607,34 @@ int SetoptChar(Tcl_Interp *interp,CURL *curlHandle,CURLoption opt,
             int tableIndex,Tcl_Obj *tclObj);
 int SetoptBlob(Tcl_Interp *interp,CURL *curlHandle,CURLoption opt,
             int tableIndex,Tcl_Obj *tclObj);
-int SetoptSHandle(Tcl_Interp *interp,CURL *curlHandle,CURLoption opt,
-        int tableIndex,Tcl_Obj *tclObj);
+int SetoptSHandle(Tcl_Interp *interp,struct curlObjData *curlData,
+        CURLoption opt,int tableIndex,Tcl_Obj *tclObj);
 int SetoptsList(Tcl_Interp *interp,struct curl_slist **slistPtr,Tcl_Obj *const objv);
 
 CURLcode curlGetInfo(Tcl_Interp *interp,CURL *curlHandle,int tableIndex);
+int curlGetInfoDictCmd(Tcl_Interp *interp,CURL *curlHandle,int objc,
+        Tcl_Obj *const objv[]);
+int curlGetInfoIndices(Tcl_Interp *interp,Tcl_Obj *listObj,int *countPtr,
+        int **indicesPtr);
+int curlGetInfoDict(Tcl_Interp *interp,CURL *curlHandle,int count,
+        const int *indices,Tcl_Obj **dictPtrPtr);
 
 void curlFreeSpace(struct curlObjData *curlData);
 
 void curlErrorSetOpt(Tcl_Interp *interp,const char **configTable, int option,const char *parPtr);
 
 size_t curlHeaderReader(void *ptr,size_t size,size_t nmemb,FILE *stream);
+size_t curlHeaderFileWriter(char *ptr,size_t size,size_t nmemb,void *stream);
+void curlSetWriter(struct curlObjData *curlData,curl_write_callback writeFunction,
+        void *writeData);
+void curlSetHeaderWriter(struct curlObjData *curlData,
+        curl_write_callback headerFunction,void *headerData);
+size_t curlWriteBody(struct curlObjData *curlData,char *ptr,size_t length);
+size_t curlWriteHeader(struct curlObjData *curlData,char *ptr,size_t length);
+int curlWriteResponse(struct curlObjData *curlData,char *headers,
+        size_t headersLength,char *body,size_t bodyLength);
+void curlSetMethodFlags(struct curlObjData *curlData,int tableIndex,Tcl_Obj *objv);
+void curlSetIdentityFlags(struct curlObjData *curlData,int tableIndex,Tcl_Obj *objv);
 
 size_t curlBodyReader(void *ptr,size_t size,size_t nmemb,FILE *curlDataPtr);
 
@@ -469,22 +665,24 @@ int curlDebugProcInvoke(CURL *curlHandle, curl_infotype infoType,
 int curlVersion (ClientData clientData, Tcl_Interp *interp,
     int objc,Tcl_Obj *const objv[]);
 
-int curlEscape(ClientData clientData, Tcl_Interp *interp,
-    int objc,Tcl_Obj *const objv[]);
-
-int curlUnescape(ClientData clientData, Tcl_Interp *interp,
-    int objc,Tcl_Obj *const objv[]);
-
 int curlVersionInfo (ClientData clientData, Tcl_Interp *interp,
     int objc,Tcl_Obj *const objv[]);
 
 int curlCopyCurlData (struct curlObjData *curlDataOld,
                       struct curlObjData *curlDataNew);
+CURL *curlDupEasyHandle(struct curlObjData *curlData);
 
 int curlOpenFile(Tcl_Interp *interp,char *fileName, FILE **handle, int writing, int text);
 
 int  curlOpenFiles (Tcl_Interp *interp,struct curlObjData *curlData);
 void curlCloseFiles(struct curlObjData *curlData);
+CURLcode curlCommitFiles(struct curlObjData *curlData,CURLcode exitCode);
+
+struct curlFileData *curlGetFiles(struct curlObjData *curlData);
+struct curlCallbackData *curlGetCallbacks(struct curlObjData *curlData);
+struct curlWildcardData *curlGetWildcard(struct curlObjData *curlData);
+struct curlListData *curlGetLists(struct curlObjData *curlData);
+void curlSetObj(Tcl_Obj **objPtrPtr,Tcl_Obj *objPtr);
 
 int curlSetPostData(Tcl_Interp *interp,struct curlObjData *curlData);
 void curlResetPostData(struct curlObjData *curlDataPtr);
@@ -501,20 +699,83 @@ int curlShareInitObjCmd (ClientData clientData, Tcl_Interp *interp,
 int curlShareObjCmd (ClientData clientData, Tcl_Interp *interp,
         int objc,Tcl_Obj *const objv[]);
 int curlCleanUpShareCmd(ClientData clientData);
+struct shcurlObjData *curlShareGet(Tcl_Interp *interp,Tcl_Obj *nameObj);
+void curlShareHold(struct shcurlObjData *shcurlData);
+void curlShareRelease(struct shcurlObjData *shcurlData);
 
-#ifndef multi_h
 #ifdef TCL_THREADS
-    TCL_DECLARE_MUTEX(cookieLock)
-    TCL_DECLARE_MUTEX(dnsLock)
-    TCL_DECLARE_MUTEX(sslLock)
-    TCL_DECLARE_MUTEX(connectLock)
-
     void curlShareLockFunc (CURL *handle, curl_lock_data data
             , curl_lock_access access, void *userptr);
     void curlShareUnLockFunc(CURL *handle, curl_lock_data data, void *userptr);
 #endif
+
+int Tclcurl_MimeInit (Tcl_Interp *interp);
+int curlMimeSetPost(Tcl_Interp *interp,struct curlObjData *curlData);
+void curlMimeFree(struct curlObjData *curlData);
+#if CURL_AT_LEAST_VERSION(7, 56, 0)
+struct curlMimeObjData *curlMimeGet(Tcl_Interp *interp,Tcl_Obj *nameObj);
+void curlMimeSetForm(struct curlObjData *curlData,struct curlMimeObjData *mimeData);
+void curlMimeHold(struct curlMimeObjData *mimeData);
+void curlMimeRelease(struct curlMimeObjData *mimeData);
+#endif
+#if CURL_AT_LEAST_VERSION(7, 63, 0)
+struct curlUrlData *curlUrlGet(Tcl_Obj *objPtr);
+void curlUrlHold(struct curlUrlData *urlData);
+void curlUrlRelease(struct curlUrlData *urlData);
 #endif
 
+int Tclcurl_StatsInit (Tcl_Interp *interp);
+int Tclcurl_ExecutorInit (Tcl_Interp *interp);
+int Tclcurl_MeminfoInit (Tcl_Interp *interp);
+int Tclcurl_EscapeInit (Tcl_Interp *interp);
+int Tclcurl_UrlInit (Tcl_Interp *interp);
+
+int Tclcurl_CacheInit (Tcl_Interp *interp);
+int curlCacheSetDir(Tcl_Interp *interp,struct curlObjData *curlData,Tcl_Obj *dirObj);
+int curlCacheSetMem(Tcl_Interp *interp,struct curlObjData *curlData,Tcl_Obj *nameObj);
+int curlCachePrepare(Tcl_Interp *interp,struct curlObjData *curlData);
+void curlCacheServe(struct curlObjData *curlData);
+void curlCacheFinish(struct curlObjData *curlData,CURLcode exitCode);
+void curlCacheCopy(struct curlObjData *curlDataOld,struct curlObjData *curlDataNew);
+void curlCacheFree(struct curlObjData *curlData);
+Tcl_Obj *curlCacheInfo(struct curlObjData *curlData);
+
+int curlRetrySetCount(Tcl_Interp *interp,struct curlObjData *curlData,Tcl_Obj *countObj);
+int curlRetrySetBackoff(Tcl_Interp *interp,struct curlObjData *curlData,
+        Tcl_Obj *backoffObj);
+int curlRetrySetCodes(Tcl_Interp *interp,struct curlObjData *curlData,
+        Tcl_Obj *codesObj);
+void curlRetryStart(struct curlObjData *curlData);
+void curlRetryWatch(struct curlObjData *curlData);
+void curlRetryUnwatch(struct curlObjData *curlData);
+long curlRetryCheck(struct curlObjData *curlData,CURLcode exitCode);
+void curlRetryWait(long delay,int eventLoop);
+int curlRetryAttempts(struct curlObjData *curlData);
+void curlRetryCopy(struct curlObjData *curlDataOld,struct curlObjData *curlDataNew);
+void curlRetryFree(struct curlObjData *curlData);
+void curlRetryTruncate(FILE *filePtr);
+
+int curlResumeSet(Tcl_Interp *interp,struct curlObjData *curlData,Tcl_Obj *modeObj);
+int curlResumeAuto(struct curlObjData *curlData);
+void curlResumePrepare(struct curlObjData *curlData);
+int curlResumeFinish(struct curlObjData *curlData,CURLcode exitCode);
+void curlResumeStop(struct curlObjData *curlData);
+void curlResumeCopy(struct curlObjData *curlDataOld,struct curlObjData *curlDataNew);
+void curlResumeFree(struct curlObjData *curlData);
+Tcl_WideInt curlResumeOffset(struct curlObjData *curlData);
+
+int curlDigestSetAlgorithms(Tcl_Interp *interp,struct curlObjData *curlData,
+        Tcl_Obj *algorithmsObj);
+int curlDigestSetVar(Tcl_Interp *interp,struct curlObjData *curlData,Tcl_Obj *varNameObj);
+int curlDigestSetExpected(Tcl_Interp *interp,struct curlObjData *curlData,
+        Tcl_Obj *expectedObj);
+void curlDigestPrepare(struct curlObjData *curlData);
+CURLcode curlDigestFinish(struct curlObjData *curlData,CURLcode exitCode);
+void curlDigestStop(struct curlObjData *curlData);
+void curlDigestCopy(struct curlObjData *curlDataOld,struct curlObjData *curlDataNew);
+void curlDigestFree(struct curlObjData *curlData);
+void curlStatsRecord(CURL *curlHandle,CURLcode result);
+
 int curlErrorStrings (Tcl_Interp *interp, Tcl_Obj *const objv,int type);
 int curlEasyStringError (ClientData clientData, Tcl_Interp *interp,
         int objc,Tcl_Obj *const objv[]);
@@ -53,17 +53,31 @@ proc ::curl::curlConfig {option} {
 #    The transfer command is used for simple transfers in which you don't
 #    want to request more than one file.
 #
+#    Blocking transfers reuse a cached handle, which is reset between
+#    transfers, so consecutive transfers to the same server can reuse the
+#    connection. Non blocking ones get an idle handle and are added to a
+#    multi handle shared by all of them. The handles and the multi handle
+#    belong to the interpreter, so every thread gets its own.
+#
 # Parameters:
 #    Use the same parameters you would use in the 'configure' command to
 #    configure the download and the same as in 'getinfo' with a 'info'
-#    prefix to get info about the transfer.
+#    prefix to get info about the transfer, '-infoall' gets the dict
+#    'getinfo -all' returns.
+#    With '-block 0', '-command' is invoked with the code of the transfer
+#    appended once it is done.
 ################################################################################
+variable transferHandle  ""
+variable transferIdle    {}
+variable transferIdleMax 4
+variable transferMulti   ""
+
 proc ::curl::transfer {args} {
     variable getInfo
-    variable curlBodyVar
 
-    set i 0
     set newArgs ""
+    set command ""
+    set block   1
     catch {unset getInfo}
 
     if {[llength $args]==0} {
@@ -71,30 +85,41 @@ proc ::curl::transfer {args} {
         return
     }
 
+    foreach {option value} $args {
+        if {$option eq "-block"} {
+            set block $value
+        }
+    }
+
     foreach {option value} $args {
         set noPassOption 0
-        set block        1
         switch -regexp -- $option {
             -info.* {
                 set noPassOption 1
                 regsub -- {-info} $option {} option
+                if {$option eq "all"} {
+                    set option -all
+                }
                 set getInfo($option) $value
             }
             -block {
                 set noPassOption 1
-                set block $value
             }
-            -bodyvar {
-                upvar $value curlBodyVar
-                set    value curlBodyVar
+            -command {
+                if {!$block} {
+                    set noPassOption 1
+                    set command $value
+                }
             }
-            -headervar {
-                upvar $value curlHeaderVar
-                set    value curlHeaderVar
-            }
-            -errorbuffer {
-                upvar $value curlErrorVar
-                set    value curlErrorVar
+            -bodyvar - -headervar - -errorbuffer {
+                # Non blocking transfers end when this proc is long gone,
+                # so their variables live in the caller's namespace.
+                if {!$block} {
+                    set value [TransferVarName $value]
+                } else {
+                    upvar $value curlVar$option
+                    set value curlVar$option
+                }
             }
         }
         if {$noPassOption==0} {
@@ -102,19 +127,17 @@ proc ::curl::transfer {args} {
         }
     }
 
-    if {[catch {::curl::init} curlHandle]} {
-        error "Could not init a curl session: $curlHandle"
-    }
+    set curlHandle [TransferHandle $block]
 
     if {[catch {eval $curlHandle configure $newArgs} result]} {
-        $curlHandle  cleanup
+        TransferRelease $curlHandle $block
         error $result
     }
 
     if {$block==1} {
         if {[catch {$curlHandle perform} result]} {
-           $curlHandle cleanup
-           error $result
+            TransferRelease $curlHandle $block
+            error $result
         }
         if {[info exists getInfo]} {
             foreach {option var} [array get getInfo] {
@@ -122,22 +145,220 @@ proc ::curl::transfer {args} {
                 set info [eval $curlHandle getinfo $option]
             }
         }
-        if {[catch {$curlHandle cleanup} result]} {
-            error $result
-        }
+        TransferRelease $curlHandle $block
     } else {
-        # We create a multiHandle
-        set multiHandle [curl::multiinit]
+        variable transferMulti
+        variable transferJobs
 
-        # We add the easy handle to the multi handle.
-        $multiHandle addhandle $curlHandle
+        set infoVars {}
+        if {[info exists getInfo]} {
+            foreach {option var} [array get getInfo] {
+                lappend infoVars $option [TransferVarName $var]
+            }
+        }
+        set transferJobs($curlHandle) [list $command $infoVars]
+        $curlHandle configure -command [list ::curl::TransferDone $curlHandle]
 
-        # So now we create the event source passing the multiHandle as a parameter.
-        curl::createEventSource $multiHandle
+        if {$transferMulti eq "" || [info commands $transferMulti] eq ""} {
+            set transferMulti [curl::multiinit]
+        }
+        $transferMulti addhandle $curlHandle
 
-        # And we return, it is non blocking after all.
+        # The transfer starts from the event loop, so the command is never
+        # invoked before we return.
+        after cancel [list $transferMulti auto]
+        after idle [list $transferMulti auto]
     }
     return 0
 }
 
+################################################################################
+# TransferVarName
+#    Returns the fully qualified name of a variable given to a non blocking
+#    transfer, relative to the namespace of the caller of 'transfer'.
+################################################################################
+proc ::curl::TransferVarName {name} {
+    if {[string match ::* $name]} {
+        return $name
+    }
+    set ns [uplevel 2 {namespace current}]
+    if {$ns eq "::"} {
+        return ::$name
+    }
+    return ${ns}::$name
+}
+
+################################################################################
+# TransferHandle
+#    Returns an easy handle for 'transfer', reset and ready to be configured.
+#    Blocking transfers use the cached one, unless it is being used already,
+#    non blocking ones take an idle handle.
+################################################################################
+proc ::curl::TransferHandle {block} {
+    variable transferHandle
+    variable transferIdle
+
+    if {$block && $transferHandle ne ""} {
+        set curlHandle $transferHandle
+        set transferHandle ""
+    } elseif {!$block && [llength $transferIdle]} {
+        set transferIdle [lassign $transferIdle curlHandle]
+    } else {
+        if {[catch {::curl::init} curlHandle]} {
+            error "Could not init a curl session: $curlHandle"
+        }
+        return $curlHandle
+    }
+    $curlHandle reset
+    return $curlHandle
+}
+
+################################################################################
+# TransferRelease
+#    Puts back a handle 'transfer' has finished with.
+################################################################################
+proc ::curl::TransferRelease {curlHandle block} {
+    variable transferHandle
+    variable transferIdle
+    variable transferIdleMax
+
+    if {$block && $transferHandle eq ""} {
+        set transferHandle $curlHandle
+    } elseif {!$block && [llength $transferIdle] < $transferIdleMax} {
+        lappend transferIdle $curlHandle
+    } else {
+        $curlHandle cleanup
+    }
+}
+
+################################################################################
+# TransferDone
+#    Invoked when a non blocking transfer is done, it sets the info
+#    variables and invokes the command of the transfer.
+################################################################################
+proc ::curl::TransferDone {curlHandle} {
+    variable transferMulti
+    variable transferJobs
+    variable transferCodes
+
+    while {1} {
+        lassign [$transferMulti getinfo] name msg code remaining
+        if {$name eq ""} {
+            break
+        }
+        set transferCodes($name) $code
+        if {$remaining==0} {
+            break
+        }
+    }
+    set code 0
+    if {[info exists transferCodes($curlHandle)]} {
+        set code $transferCodes($curlHandle)
+        unset transferCodes($curlHandle)
+    }
+
+    lassign $transferJobs($curlHandle) command infoVars
+    unset transferJobs($curlHandle)
+    set values {}
+    foreach {option var} $infoVars {
+        lappend values $var [$curlHandle getinfo $option]
+    }
+    $transferMulti removehandle $curlHandle
+    TransferRelease $curlHandle 0
+
+    foreach {var value} $values {
+        set $var $value
+    }
+
+    if {$command ne ""} {
+        uplevel #0 $command [list $code]
+    }
+}
+
+################################################################################
+# fetch
+#    Does a transfer and returns a dict with its 'body', 'headers' and
+#    'info', the dict 'getinfo -all' returns. Inside a coroutine the
+#    transfer is non blocking and the coroutine yields until it is done,
+#    otherwise it just blocks.
+#
+# Parameters:
+#    The same options 'transfer' takes.
+################################################################################
+variable fetchId 0
+
+proc ::curl::fetch {args} {
+    variable fetchId
+    variable fetchCode
+
+    set id [incr fetchId]
+    set bodyVar   [namespace current]::fetchBody$id
+    set headerVar [namespace current]::fetchHeaders$id
+    set infoVar   [namespace current]::fetchInfo$id
+    set options [list -bodyvar $bodyVar -headervar $headerVar -infoall $infoVar]
+
+    if {[info coroutine] eq ""} {
+        if {[catch {transfer {*}$args {*}$options -block 1} result]} {
+            FetchCleanup $id
+            if {![string is integer -strict $result]} {
+                error $result
+            }
+            set code $result
+        } else {
+            set code 0
+        }
+    } else {
+        if {[catch {transfer {*}$args {*}$options -block 0 \
+                -command [list ::curl::FetchResume [info coroutine] $id]} result]} {
+            FetchCleanup $id
+            error $result
+        }
+        while {![info exists fetchCode($id)]} {
+            yield
+        }
+        set code $fetchCode($id)
+        unset fetchCode($id)
+    }
+    if {$code} {
+        FetchCleanup $id
+        return -code error -errorcode [list CURL $code] [curl::easystrerror $code]
+    }
+
+    set result [dict create body "" headers {} info {}]
+    if {[info exists $bodyVar]} {
+        dict set result body [set $bodyVar]
+    }
+    if {[array exists $headerVar]} {
+        dict set result headers [array get $headerVar]
+    }
+    if {[info exists $infoVar]} {
+        dict set result info [set $infoVar]
+    }
+    FetchCleanup $id
+    return $result
+}
+
+################################################################################
+# FetchResume
+#    The '-command' of the transfers 'fetch' does inside coroutines.
+################################################################################
+proc ::curl::FetchResume {coroutine id code} {
+    variable fetchCode
+
+    set fetchCode($id) $code
+    if {[info commands $coroutine] ne ""} {
+        $coroutine
+    }
+}
+
+################################################################################
+# FetchCleanup
+#    Forgets the variables of a 'fetch'.
+################################################################################
+proc ::curl::FetchCleanup {id} {
+    foreach var {fetchBody fetchHeaders fetchInfo} {
+        unset -nocomplain [namespace current]::$var$id
+    }
+}
+
 }
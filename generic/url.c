@@ -0,0 +1,501 @@
+/*
+ * url.c --
+ *
+ * Implementation of the part of the TclCurl extension that parses and
+ * builds URLs with libcurl's URL API.
+ *
+ * The URLs 'curl::url' returns keep the parsed URL as their internal
+ * representation, so giving one of them to '-url' doesn't parse it again.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#include "url.h"
+
+#if CURL_AT_LEAST_VERSION(7, 63, 0)
+
+static Tcl_ObjType curlUrlObjType = {
+    "curlurl",
+    curlUrlFreeIntRep,
+    curlUrlDupIntRep,
+    curlUrlUpdateString,
+    NULL
+};
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Tclcurl_UrlInit --
+ *
+ *  This procedure creates the 'curl::url' command.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Tclcurl_UrlInit (Tcl_Interp *interp) {
+
+    Tcl_CreateObjCommand (interp,"::curl::url",curlUrlObjCmd,
+            (ClientData)NULL,(Tcl_CmdDeleteProc *)NULL);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlUrlObjCmd --
+ *
+ *  This procedure is invoked to process the "curl::url" Tcl command.
+ *  See the user documentation for details on what it does.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlUrlObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]) {
+
+    Tcl_Obj               *keys[URL_ALWAYS_PARTS+4];
+    Tcl_Obj               *resultObj,*elemObj,**elemv;
+    CURLU                 *urlHandle,*baseHandle;
+    CURLUcode              code;
+    int                    tableIndex,optionIndex,list,elemc,i,result=TCL_OK;
+    unsigned int           flags=CURLU_NON_SUPPORT_SCHEME;
+
+    if (objc<3) {
+        Tcl_WrongNumArgs(interp,1,objv,"subcommand ?-list? ?arg ...?");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(interp, objv[1], urlCommandTable, "subcommand",
+            TCL_EXACT,&tableIndex)==TCL_ERROR) {
+        return TCL_ERROR;
+    }
+    list=(objc>3)&&(Tcl_GetString(objv[2])[0]=='-');
+    if (list) {
+        if (Tcl_GetIndexFromObj(interp, objv[2], urlOptionTable, "option",
+                TCL_EXACT,&optionIndex)==TCL_ERROR) {
+            return TCL_ERROR;
+        }
+        objc--;
+        objv++;
+    }
+
+    switch(tableIndex) {
+        case 0:
+        case 1:
+        case 3:
+            if (objc!=3) {
+                Tcl_WrongNumArgs(interp,2,objv,(tableIndex==1)?"?-list? parts":"?-list? url");
+                return TCL_ERROR;
+            }
+            if (list) {
+                if (Tcl_ListObjGetElements(interp,objv[2],&elemc,&elemv)==TCL_ERROR) {
+                    return TCL_ERROR;
+                }
+            } else {
+                elemc=1;
+                elemv=(Tcl_Obj **)&objv[2];
+            }
+            break;
+        case 2:
+            if (objc!=4) {
+                Tcl_WrongNumArgs(interp,2,objv,"?-list? base relative");
+                return TCL_ERROR;
+            }
+            if (list) {
+                if (Tcl_ListObjGetElements(interp,objv[3],&elemc,&elemv)==TCL_ERROR) {
+                    return TCL_ERROR;
+                }
+            } else {
+                elemc=1;
+                elemv=(Tcl_Obj **)&objv[3];
+            }
+            break;
+    }
+
+    resultObj=Tcl_NewListObj(0,NULL);
+    Tcl_IncrRefCount(resultObj);
+    switch(tableIndex) {
+        case 0:
+            /* One handle and one set of keys do for the whole list. */
+            for (i=0;i<URL_ALWAYS_PARTS+4;i++) {
+                keys[i]=Tcl_NewStringObj(urlPartTable[i],-1);
+                Tcl_IncrRefCount(keys[i]);
+            }
+            urlHandle=curl_url();
+            for (i=0;i<elemc;i++) {
+                curl_url_set(urlHandle,CURLUPART_URL,NULL,0);
+                result=curlUrlParse(interp,urlHandle,elemv[i],keys,&elemObj);
+                if (result!=TCL_OK) {
+                    break;
+                }
+                Tcl_ListObjAppendElement(NULL,resultObj,elemObj);
+            }
+            curl_url_cleanup(urlHandle);
+            for (i=0;i<URL_ALWAYS_PARTS+4;i++) {
+                Tcl_DecrRefCount(keys[i]);
+            }
+            break;
+        case 1:
+            for (i=0;i<elemc;i++) {
+                result=curlUrlBuild(interp,elemv[i],&elemObj);
+                if (result!=TCL_OK) {
+                    break;
+                }
+                Tcl_ListObjAppendElement(NULL,resultObj,elemObj);
+            }
+            break;
+        case 2:
+            baseHandle=curl_url();
+            code=curl_url_set(baseHandle,CURLUPART_URL,Tcl_GetString(objv[2]),flags);
+            if (code!=CURLUE_OK) {
+                result=curlUrlError(interp,Tcl_GetString(objv[2]),code);
+            }
+            for (i=0;(result==TCL_OK)&&(i<elemc);i++) {
+                urlHandle=curl_url_dup(baseHandle);
+                code=curl_url_set(urlHandle,CURLUPART_URL,Tcl_GetString(elemv[i]),flags);
+                if (code!=CURLUE_OK) {
+                    result=curlUrlError(interp,Tcl_GetString(elemv[i]),code);
+                    curl_url_cleanup(urlHandle);
+                    break;
+                }
+                elemObj=curlUrlNewObj(interp,urlHandle);
+                if (elemObj==NULL) {
+                    result=TCL_ERROR;
+                    break;
+                }
+                Tcl_ListObjAppendElement(NULL,resultObj,elemObj);
+            }
+            curl_url_cleanup(baseHandle);
+            break;
+        case 3:
+            /* The same rules libcurl follows for '-url'. */
+            flags|=CURLU_GUESS_SCHEME;
+            for (i=0;i<elemc;i++) {
+                urlHandle=curl_url();
+                code=curl_url_set(urlHandle,CURLUPART_URL,Tcl_GetString(elemv[i]),flags);
+                if (code!=CURLUE_OK) {
+                    result=curlUrlError(interp,Tcl_GetString(elemv[i]),code);
+                    curl_url_cleanup(urlHandle);
+                    break;
+                }
+                elemObj=curlUrlNewObj(interp,urlHandle);
+                if (elemObj==NULL) {
+                    result=TCL_ERROR;
+                    break;
+                }
+                Tcl_ListObjAppendElement(NULL,resultObj,elemObj);
+            }
+            break;
+    }
+
+    if (result==TCL_OK) {
+        if (list) {
+            Tcl_SetObjResult(interp,resultObj);
+        } else {
+            Tcl_ListObjIndex(NULL,resultObj,0,&elemObj);
+            Tcl_SetObjResult(interp,elemObj);
+        }
+    }
+    Tcl_DecrRefCount(resultObj);
+
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlUrlParse --
+ *
+ *  Parses a URL into a dictionary with its parts.
+ *
+ * Parameter:
+ *  urlHandle: An empty URL handle to use.
+ *  urlObj: The URL.
+ *  keys: The names of the parts, in the order of 'urlPartTable'.
+ *  resultPtr: Where to put the dictionary.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlUrlParse(Tcl_Interp *interp,CURLU *urlHandle,Tcl_Obj *urlObj,
+        Tcl_Obj **keys,Tcl_Obj **resultPtr) {
+
+    Tcl_Obj               *dictObj;
+    CURLUcode              code;
+    char                  *part;
+    int                    i;
+
+    code=curl_url_set(urlHandle,CURLUPART_URL,Tcl_GetString(urlObj),
+            CURLU_NON_SUPPORT_SCHEME);
+    if (code!=CURLUE_OK) {
+        return curlUrlError(interp,Tcl_GetString(urlObj),code);
+    }
+
+    dictObj=Tcl_NewDictObj();
+    for (i=0;urlPartTable[i]!=NULL;i++) {
+        code=curl_url_get(urlHandle,urlParts[i],&part,
+                (urlParts[i]==CURLUPART_PORT)?CURLU_DEFAULT_PORT:0);
+        if (code==CURLUE_OK) {
+            Tcl_DictObjPut(NULL,dictObj,keys[i],Tcl_NewStringObj(part,-1));
+            curl_free(part);
+        } else if (i<URL_ALWAYS_PARTS) {
+            Tcl_DictObjPut(NULL,dictObj,keys[i],Tcl_NewObj());
+        }
+    }
+    *resultPtr=dictObj;
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlUrlBuild --
+ *
+ *  Builds a URL out of a dictionary with its parts.
+ *
+ * Parameter:
+ *  dictObj: The dictionary, the same 'curl::url parse' returns.
+ *  resultPtr: Where to put the URL.
+ *
+ * Results:
+ *  A standard Tcl result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlUrlBuild(Tcl_Interp *interp,Tcl_Obj *dictObj,Tcl_Obj **resultPtr) {
+
+    Tcl_DictSearch         search;
+    Tcl_Obj               *keyObj,*valueObj;
+    CURLU                 *urlHandle;
+    CURLUcode              code;
+    char                  *value;
+    int                    done,partIndex;
+
+    if (Tcl_DictObjFirst(interp,dictObj,&search,&keyObj,&valueObj,&done)
+            ==TCL_ERROR) {
+        return TCL_ERROR;
+    }
+    urlHandle=curl_url();
+    for (;!done;Tcl_DictObjNext(&search,&keyObj,&valueObj,&done)) {
+        if (Tcl_GetIndexFromObj(interp,keyObj,urlPartTable,"part",
+                TCL_EXACT,&partIndex)==TCL_ERROR) {
+            Tcl_DictObjDone(&search);
+            curl_url_cleanup(urlHandle);
+            return TCL_ERROR;
+        }
+        value=Tcl_GetString(valueObj);
+        if (*value==0) {
+            continue;
+        }
+        code=curl_url_set(urlHandle,urlParts[partIndex],value,
+                CURLU_NON_SUPPORT_SCHEME);
+        if (code!=CURLUE_OK) {
+            Tcl_DictObjDone(&search);
+            curl_url_cleanup(urlHandle);
+            return curlUrlError(interp,value,code);
+        }
+    }
+    Tcl_DictObjDone(&search);
+
+    *resultPtr=curlUrlNewObj(interp,urlHandle);
+    if (*resultPtr==NULL) {
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlUrlError --
+ *
+ *  Leaves in the interpreter the error of the URL API.
+ *
+ * Results:
+ *  TCL_ERROR, always.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+curlUrlError(Tcl_Interp *interp,const char *url,CURLUcode code) {
+
+#if CURL_AT_LEAST_VERSION(7, 80, 0)
+    Tcl_SetObjResult(interp,Tcl_ObjPrintf("bad URL \"%s\": %s",url,
+            curl_url_strerror(code)));
+#else
+    Tcl_SetObjResult(interp,Tcl_ObjPrintf("bad URL \"%s\": error %d",url,
+            (int)code));
+#endif
+    Tcl_SetErrorCode(interp,"TCLCURL","URL",NULL);
+    return TCL_ERROR;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlUrlNewObj --
+ *
+ *  Makes a Tcl object out of a URL handle, its string is the whole URL
+ *  and the handle, which now belongs to the object, its internal
+ *  representation.
+ *
+ * Results:
+ *  The new object, NULL if the handle doesn't have a complete URL, the
+ *  error is left in the interpreter.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Tcl_Obj *
+curlUrlNewObj(Tcl_Interp *interp,CURLU *urlHandle) {
+
+    struct curlUrlData    *urlData;
+    Tcl_Obj               *objPtr;
+    CURLUcode              code;
+    char                  *url;
+
+    code=curl_url_get(urlHandle,CURLUPART_URL,&url,0);
+    if (code!=CURLUE_OK) {
+        curlUrlError(interp,"",code);
+        curl_url_cleanup(urlHandle);
+        return NULL;
+    }
+    objPtr=Tcl_NewStringObj(url,-1);
+    curl_free(url);
+
+    urlData=(struct curlUrlData *)Tcl_Alloc(sizeof(struct curlUrlData));
+    urlData->handle=urlHandle;
+    urlData->refCount=1;
+    objPtr->internalRep.twoPtrValue.ptr1=urlData;
+    objPtr->typePtr=&curlUrlObjType;
+
+    return objPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlUrlGet --
+ *
+ *  Gets the parsed URL of an object 'curl::url' returned.
+ *
+ * Results:
+ *  The parsed URL, NULL if the object doesn't have one, the caller has
+ *  to hold it if it keeps it.
+ *
+ *----------------------------------------------------------------------
+ */
+
+struct curlUrlData *
+curlUrlGet(Tcl_Obj *objPtr) {
+
+    if (objPtr->typePtr!=&curlUrlObjType) {
+        return NULL;
+    }
+    return (struct curlUrlData *)objPtr->internalRep.twoPtrValue.ptr1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlUrlHold, curlUrlRelease --
+ *
+ *  Keep track of the objects and easy handles using a parsed URL, it
+ *  is freed when the last of them lets it go.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlUrlHold(struct curlUrlData *urlData) {
+    urlData->refCount++;
+}
+
+void
+curlUrlRelease(struct curlUrlData *urlData) {
+
+    if (--urlData->refCount>0) {
+        return;
+    }
+    curl_url_cleanup(urlData->handle);
+    Tcl_Free((char *)urlData);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * curlUrlFreeIntRep, curlUrlDupIntRep, curlUrlUpdateString --
+ *
+ *  The procedures of the 'curlurl' object type.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+curlUrlFreeIntRep(Tcl_Obj *objPtr) {
+
+    curlUrlRelease((struct curlUrlData *)objPtr->internalRep.twoPtrValue.ptr1);
+    objPtr->typePtr=NULL;
+}
+
+void
+curlUrlDupIntRep(Tcl_Obj *srcPtr,Tcl_Obj *dupPtr) {
+    struct curlUrlData    *urlData;
+
+    urlData=(struct curlUrlData *)srcPtr->internalRep.twoPtrValue.ptr1;
+    curlUrlHold(urlData);
+    dupPtr->internalRep.twoPtrValue.ptr1=urlData;
+    dupPtr->typePtr=&curlUrlObjType;
+}
+
+void
+curlUrlUpdateString(Tcl_Obj *objPtr) {
+    struct curlUrlData    *urlData;
+    char                  *url;
+    size_t                 length=0;
+
+    urlData=(struct curlUrlData *)objPtr->internalRep.twoPtrValue.ptr1;
+    if (curl_url_get(urlData->handle,CURLUPART_URL,&url,0)!=CURLUE_OK) {
+        url=NULL;
+    } else {
+        length=strlen(url);
+    }
+    objPtr->bytes=Tcl_Alloc((unsigned int)length+1);
+    if (url!=NULL) {
+        memcpy(objPtr->bytes,url,length);
+        curl_free(url);
+    }
+    objPtr->bytes[length]=0;
+    objPtr->length=(int)length;
+}
+
+#else
+
+/*
+ * libcurl is too old for the URL API.
+ */
+
+int
+Tclcurl_UrlInit (Tcl_Interp *interp) {
+    return TCL_OK;
+}
+
+#endif
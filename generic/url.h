@@ -0,0 +1,64 @@
+/*
+ * url.h --
+ *
+ * Header file for the part of the TclCurl extension that parses and
+ * builds URLs with libcurl's URL API.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#define url_h
+#include "tclcurl.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#if CURL_AT_LEAST_VERSION(7, 63, 0)
+
+const static char *urlCommandTable[] = {
+    "parse", "build", "resolve", "create", (char *)NULL
+};
+
+const static char *urlOptionTable[] = {
+    "-list", (char *)NULL
+};
+
+/*
+ * The parts of a URL, the first six are always in the dictionaries
+ * 'curl::url parse' returns, the rest only when the URL has them.
+ */
+#define URL_ALWAYS_PARTS    6
+
+const static char *urlPartTable[] = {
+    "scheme", "host", "port", "path", "query", "fragment",
+    "user", "password", "options", "zoneid", (char *)NULL
+};
+
+const static CURLUPart urlParts[] = {
+    CURLUPART_SCHEME, CURLUPART_HOST,     CURLUPART_PORT,
+    CURLUPART_PATH,   CURLUPART_QUERY,    CURLUPART_FRAGMENT,
+    CURLUPART_USER,   CURLUPART_PASSWORD, CURLUPART_OPTIONS,
+    CURLUPART_ZONEID
+};
+
+int curlUrlObjCmd (ClientData clientData, Tcl_Interp *interp,
+        int objc,Tcl_Obj *const objv[]);
+
+int curlUrlParse(Tcl_Interp *interp,CURLU *urlHandle,Tcl_Obj *urlObj,
+        Tcl_Obj **keys,Tcl_Obj **resultPtr);
+int curlUrlBuild(Tcl_Interp *interp,Tcl_Obj *dictObj,Tcl_Obj **resultPtr);
+int curlUrlError(Tcl_Interp *interp,const char *url,CURLUcode code);
+Tcl_Obj *curlUrlNewObj(Tcl_Interp *interp,CURLU *urlHandle);
+
+void curlUrlFreeIntRep(Tcl_Obj *objPtr);
+void curlUrlDupIntRep(Tcl_Obj *srcPtr,Tcl_Obj *dupPtr);
+void curlUrlUpdateString(Tcl_Obj *objPtr);
+
+#endif
+
+#ifdef  __cplusplus
+}
+#endif
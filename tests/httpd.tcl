@@ -0,0 +1,164 @@
+# A very small HTTP server for the tests, it runs in its own thread so
+# blocking transfers can talk to it. Every response closes the connection.
+#
+#   httpd::start                          Starts the server, returns the port.
+#   httpd::route path ?code? ?headers? ?body?
+#                                         What to answer for a path, 'headers'
+#                                         is a dict. A code, headers or a body
+#                                         starting with '!' is a script run for
+#                                         every request, '$requests' has them
+#                                         all. An 'X-Truncate' header isn't
+#                                         sent, only that many bytes of the
+#                                         body are. 'Range: bytes=N-M' requests
+#                                         get a 206, or a 416, unless their
+#                                         'If-Range' doesn't match.
+#   httpd::requests                       The requests received, a list of
+#                                         dicts: method path headers body.
+#   httpd::clear                          Forgets the requests.
+#   httpd::stop                           Stops the server.
+
+package require Thread
+
+namespace eval httpd {
+    variable tid ""
+    variable port 0
+}
+
+proc httpd::start {} {
+    variable tid
+    variable port
+
+    set tid [thread::create {
+        set requests {}
+        array set routes {}
+
+        proc accept {chan addr port} {
+            fconfigure $chan -translation binary -blocking 1
+            fileevent $chan readable [list handle $chan]
+        }
+
+        proc handle {chan} {
+            fileevent $chan readable {}
+            if {[catch {serve $chan} msg]} {
+                catch {close $chan}
+            }
+        }
+
+        proc serve {chan} {
+            global requests routes
+
+            set line [string trimright [gets $chan] "\r"]
+            lassign $line method path
+            set headers {}
+            while {[gets $chan line] > 0} {
+                set line [string trimright $line "\r"]
+                if {$line eq ""} {
+                    break
+                }
+                set colon [string first : $line]
+                dict set headers [string tolower [string range $line 0 $colon-1]] \
+                        [string trim [string range $line $colon+1 end]]
+            }
+            set body ""
+            if {[dict exists $headers content-length]} {
+                set body [read $chan [dict get $headers content-length]]
+            } elseif {[dict exists $headers transfer-encoding]} {
+                while {1} {
+                    set size [scan [string trimright [gets $chan] "\r"] %x]
+                    if {$size == 0} {
+                        gets $chan
+                        break
+                    }
+                    append body [read $chan $size]
+                    gets $chan
+                }
+            }
+            lappend requests [dict create method $method path $path \
+                    headers $headers body $body]
+
+            if {[info exists routes($path)]} {
+                lassign $routes($path) code responseHeaders responseBody
+            } else {
+                lassign {404 {} {Not found}} code responseHeaders responseBody
+            }
+            if {[string index $code 0] eq "!"} {
+                set code [uplevel #0 [string range $code 1 end]]
+            }
+            if {[string index $responseHeaders 0] eq "!"} {
+                set responseHeaders [uplevel #0 [string range $responseHeaders 1 end]]
+            }
+            if {[string index $responseBody 0] eq "!"} {
+                set responseBody [uplevel #0 [string range $responseBody 1 end]]
+            }
+            set truncate -1
+            if {[dict exists $responseHeaders X-Truncate]} {
+                set truncate [dict get $responseHeaders X-Truncate]
+                dict unset responseHeaders X-Truncate
+            }
+            if {$code == 200 && [dict exists $headers range]
+                    && [regexp {^bytes=(\d+)-(\d*)$} [dict get $headers range] -> first last]} {
+                set validators {}
+                foreach name {ETag Last-Modified} {
+                    if {[dict exists $responseHeaders $name]} {
+                        lappend validators [dict get $responseHeaders $name]
+                    }
+                }
+                if {![dict exists $headers if-range]
+                        || [dict get $headers if-range] in $validators} {
+                    set size [string length $responseBody]
+                    if {$last eq "" || $last >= $size} {
+                        set last [expr {$size-1}]
+                    }
+                    if {$first < $size} {
+                        set code 206
+                        dict set responseHeaders Content-Range "bytes $first-$last/$size"
+                        set responseBody [string range $responseBody $first $last]
+                    } else {
+                        set code 416
+                        dict set responseHeaders Content-Range "bytes */$size"
+                        set responseBody ""
+                    }
+                }
+            }
+            puts -nonewline $chan "HTTP/1.1 $code Whatever\r\n"
+            dict for {name value} $responseHeaders {
+                puts -nonewline $chan "$name: $value\r\n"
+            }
+            puts -nonewline $chan "Content-Length: [string length $responseBody]\r\n"
+            puts -nonewline $chan "Connection: close\r\n\r\n"
+            if {$method ne "HEAD"} {
+                if {$truncate >= 0} {
+                    set responseBody [string range $responseBody 0 $truncate-1]
+                }
+                puts -nonewline $chan $responseBody
+            }
+            close $chan
+        }
+
+        set server [socket -server accept -myaddr 127.0.0.1 0]
+        thread::wait
+    }]
+    set port [lindex [thread::send $tid {fconfigure $server -sockname}] 2]
+    return $port
+}
+
+proc httpd::route {path {code 200} {headers {}} {body {}}} {
+    variable tid
+    thread::send $tid [list set routes($path) [list $code $headers $body]]
+}
+
+proc httpd::requests {} {
+    variable tid
+    thread::send $tid {set requests}
+}
+
+proc httpd::clear {} {
+    variable tid
+    thread::send $tid {set requests {}}
+}
+
+proc httpd::stop {} {
+    variable tid
+    thread::release $tid
+    set tid ""
+}
@@ -0,0 +1,73 @@
+# Small benchmark for the share handle locking, all the threads use one
+# named share for cookies, dns and TLS sessions and do a number of
+# transfers against the given URL. Readers of the shared data don't block
+# each other, so the threads shouldn't slow each other down much.
+#
+# Usage: tclsh shareThreads.tcl ?url? ?threads? ?transfers?
+
+package require Thread
+package require TclCurl
+
+set url       [lindex [concat $argv http://127.0.0.1/] 0]
+set threads   [expr {[llength $argv] > 1 ? [lindex $argv 1] : 8}]
+set transfers [expr {[llength $argv] > 2 ? [lindex $argv 2] : 200}]
+
+# The share has to be set up before any handle uses it.
+set sHandle [curl::shareinit -name global]
+$sHandle share cookies
+$sHandle share dns
+$sHandle share ssl
+
+set worker {
+    package require TclCurl
+
+    proc run {url transfers} {
+        set curlHandle [curl::init]
+        $curlHandle configure -url $url -share global -cookiefile "" \
+                -bodyvar body -nosignal 1
+
+        set errors 0
+        for {set i 0} {$i < $transfers} {incr i} {
+            if {[catch {$curlHandle perform}]} {
+                incr errors
+            }
+        }
+        $curlHandle cleanup
+
+        return $errors
+    }
+    thread::wait
+}
+
+proc runThreads {count} {
+    global url transfers worker results
+
+    set ids {}
+    for {set i 0} {$i < $count} {incr i} {
+        lappend ids [thread::create $worker]
+    }
+    array unset results
+    set start [clock microseconds]
+    foreach id $ids {
+        thread::send -async $id [list run $url $transfers] results($id)
+    }
+    foreach id $ids {
+        if {![info exists results($id)]} {
+            vwait results($id)
+        }
+    }
+    set elapsed [expr {([clock microseconds] - $start) / 1000000.0}]
+    set errors 0
+    foreach id $ids {
+        incr errors $results($id)
+        thread::release $id
+    }
+    set total [expr {$count * $transfers}]
+    puts [format "%3d threads: %6d transfers in %7.3fs, %9.1f transfers/s, %d errors" \
+            $count $total $elapsed [expr {$total / $elapsed}] $errors]
+}
+
+runThreads 1
+runThreads $threads
+
+$sHandle cleanup